@@ -27,29 +27,41 @@
 #include "common/cloudConfig.h"
 #include "common/deviceIdentity.h"
 #include "common/secretEncryption.h"
+#include "common/controllerConfig.h"
+#include "common/runtimeConfigImage.h"
+#include "common/macIndex.h"
+#include "common/directoryIndex.h"
 #include "common/oled.h"
 #include "common/frontPanel.h"
 #include "common/inputs.h"
 #include "common/temperature.h"
 #include "common/outputs.h"
 #include "common/eventLog.h"
+#include "common/syslogSink.h"
 #include "common/authorizationToken.h"
 #include "common/otaConfig.h"
 #include "common/cloudDeviceAuth.h"
 #include <ArduinoJson.h>
 #include "common/psramAllocator.h"
+#include "common/jsonStreamWriter.h"
 #include "AsyncJson.h"
 #include <StreamUtils.h>
-#include <NTPClient.h>
-#include <WiFiUdp.h>
+#include "common/sntpClock.h"
 #include "common/extendedPubSubClient.h"
+#include "common/mqttTransport.h"
+#include "common/mqttConnector.h"
 #include "common/provisioningMode.h"
+#include "common/networkWorker.h"
+#include "common/cloudHttpPool.h"
+#include "common/httpEtag.h"
+#include "common/deltaOta.h"
 #include <HTTPClient.h>
 #include <mbedtls/hkdf.h>
 #include <mbedtls/md.h>
 #include <mbedtls/sha256.h>
 #include <mbedtls/ecdsa.h>
 #include <mbedtls/base64.h>
+#include <mbedtls/x509_crt.h>
 #include <esp_http_client.h>
 #include <WiFiClientSecure.h>
 #include <esp_crt_bundle.h>
@@ -68,6 +80,13 @@ bool _mqttWasConnected = false; /* Tracks prior MQTT connected state to detect d
 AsyncWebServer httpServer(80);
 managerDeviceIdentity deviceIdentity; /* Device identity instance */
 SecretEncryption secretEncryption; /* File encryption instance */
+ControllerConfigCache controllerConfig; /* Decrypted copy of this controller's own config file */
+RuntimeConfigImage runtimeConfig; /* Compiled form of this controller's config, read by boot-time setup */
+MacIndex clientMacIndex; /* MAC address to UUID index over /clients */
+MacIndex controllerMacIndex; /* MAC address to UUID index over /controllers */
+DirectoryIndex controllerDirectory; /* Names, sizes and mtimes of the files in /controllers */
+DirectoryIndex clientDirectory; /* Names, sizes and mtimes of the files in /clients */
+DirectoryIndex certDirectory; /* Names, sizes and mtimes of the files in /certs */
 managerOled oled; /* OLED instance */
 managerFrontPanel frontPanel; /* Front panel instance */
 managerInputs inputs; /* Inputs collection */
@@ -75,32 +94,45 @@ nsOutputs::managerOutputs outputs; /* Outputs collection */
 managerTemperatureSensors temperatureSensors; /* Temperature sensors */
 authorizationToken authToken;
 managerProvisioningMode provisioningMode;
+NetworkWorker networkWorker; /* Runs cloud backup requests and OTA manifest checks off the loop and async_tcp tasks */
 
-#if ETHERNET_MODEL == ENUM_ETHERNET_MODEL_W5500 || WIFI_MODEL == ENUM_WIFI_MODEL_ESP32
-  WiFiClient ethClient;
-#endif
+#define NETWORK_JOB_CLOUD_BACKUP 0 /* Upload of /backup.json, scheduled or from POST /api/cloud-backup */
+#define NETWORK_JOB_OTA_CHECK 1 /* Scheduled OTA manifest check */
+#define NETWORK_JOB_CLOUD_RESTORE 2 /* Download of the cloud backup to /backup.json, from GET /api/cloud-backup */
+#define NETWORK_JOB_CLOUD_DELETE 3 /* Deletion of the cloud backup, from DELETE /api/cloud-backup */
 
-exPubSubClient mqttClient(ethClient);
+CloudHttpPool cloudHttp; /* Kept-alive HTTPS clients for FIREFLY_CLOUD_API_ROOT */
 
-#if ETHERNET_MODEL == ENUM_ETHERNET_MODEL_W5500 || WIFI_MODEL == ENUM_WIFI_MODEL_ESP32
-  WiFiUDP wifiNtpUdp;
-  NTPClient timeClient(wifiNtpUdp); /* WiFi NTP client for handling time requests */
-#endif
+MqttTransport mqttTransport; /* Broker connection for mqttClient, plain or TLS */
+exPubSubClient mqttClient(mqttTransport);
+MqttConnector mqttConnector; /* Opens the broker connection for mqttClient without blocking loop() */
+
+SntpClock timeClient; /* Wall-clock time, kept in the background by the SNTP service */
 
 EventLog eventLog(&timeClient); /* Event Log instance */
-uint64_t ntpSleepUntil = 0;
+SyslogSink syslogSink; /* Remote UDP log sink, enabled by the syslog object in the controller config */
 
 void updateNTPTime(bool force = false);
 void refreshCertBundle();
+void _refreshCertBundle();
 void mqtt_publishClientCertState();
 void mqtt_publishControllerCertState();
 bool cloudBackup_performUpload(int &httpCode, String &errorMsg);
+bool cloudBackup_performRestore(int &httpCode, String &errorMsg);
+bool cloudBackup_performDelete(int &httpCode, String &errorMsg);
 void cloudBackup_scheduleHandler();
 void writeBackupEtag();
+void backupEtag(char* etag, size_t length);
+void setBackupEtag(const char* etagHex);
+void clearBackupEtag();
 void http_handleCloudBackup(AsyncWebServerRequest *request);
 void http_handleCloudBackup_POST(AsyncWebServerRequest *request);
 void http_handleCloudBackup_GET(AsyncWebServerRequest *request);
 void http_handleCloudBackup_DELETE(AsyncWebServerRequest *request);
+void http_handleCloudBackupStaged(AsyncWebServerRequest *request);
+void http_handleCloudBackupStaged_GET(AsyncWebServerRequest *request);
+void http_handleCloudBackupStaged_POST(AsyncWebServerRequest *request);
+void http_handleCloudBackupStaged_DELETE(AsyncWebServerRequest *request);
 
 esp32OTA otaFirmware;
 WiFiClientSecure _otaHttpsClient;       /* TLS client used when the manifest URL is https:// */
@@ -114,12 +146,22 @@ bool _otaUpdateInProcess = false;
 bool _otaPendingRequest = false;
 bool _otaCheckFailed = false;           /* Set by onError during checkForUpdate(); reset before each check */
 int _otaCheckErrorCode = 0;             /* Error code captured by onError during checkForUpdate() */
+volatile bool _otaCheckRunning = false; /* Set while the network worker runs checkForUpdate(); callbacks then only record */
 JsonDocument _otaPendingDoc;
 static char _otaCurrentPartition[8] = "";
 static char _otaLatestVersion[32] = "";
 static char _otaReleaseUrl[256] = "";
 static int _otaLastPublishedPercentage = -1;
-uint64_t _otaLastCheckedTime = 0;
+const esp_partition_t* _otaDeltaPartition = nullptr; /* App partition rebuilt from a delta patch; booted once the rest of the update succeeds */
+uint64_t _otaNextCheckTime = 0;         /* esp_timer time of the next scheduled manifest check; 0 until the first is scheduled */
+
+/* Validators of the manifest as of the last successful check, and what that check found.  Only the network worker reads or writes it. */
+struct {
+  bool valid = false;
+  bool updateAvailable = false;
+  char etag[96] = "";
+  char lastModified[40] = "";
+} _otaManifestCache;
 
 fs::LittleFSFS uiFS;
 fs::LittleFSFS configFS;
@@ -131,10 +173,13 @@ char _uiCommit[16] = {0};
 
 char* _certBundle = nullptr;            /* PSRAM-backed concatenated PEM bundle for OTA TLS */
 size_t _certBundleSize = 0;             /* Byte length of _certBundle, excluding null terminator */
+SemaphoreHandle_t _certBundleLock = nullptr; /* Held by refreshCertBundle(), and by other tasks while they copy _certBundle */
 
 #define CONFIGFS_PATH_CERTS "/certs"
 #define CONFIGFS_PATH_CONTROLLERS "/controllers"
 #define CONFIGFS_PATH_CLIENTS "/clients"
+#define CONFIGFS_PATH_CONTROLLERS_INDEX "/controllers.index"
+#define CONFIGFS_PATH_CLIENTS_INDEX "/clients.index"
 
 
 enum outputAction{
@@ -198,6 +243,16 @@ void reportMemoryUsage(const char* tag) {
           tag,
           (unsigned long)ESP.getFreeHeap(),
           (unsigned long)heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+
+  CloudHttpPool::stats httpStats;
+  cloudHttp.getStats(httpStats);
+  log_d("Cloud HTTP: %lu requests, %lu reused, %lu handshakes (%lu resumable), handshake avg %lu ms, max %lu ms",
+          (unsigned long)httpStats.requests,
+          (unsigned long)httpStats.reused,
+          (unsigned long)httpStats.handshakes,
+          (unsigned long)httpStats.resumable,
+          (unsigned long)(httpStats.handshakes ? httpStats.handshakeMillisTotal / httpStats.handshakes : 0),
+          (unsigned long)httpStats.handshakeMillisMax);
 }
 
 
@@ -333,7 +388,6 @@ void setup() {
     if(ESP32_W5500_isConnected()){
 
       timeClient.begin();
-      updateNTPTime(true);
 
       #if CORE_DEBUG_LEVEL > 0
         telnetLog.begin();
@@ -438,6 +492,14 @@ void setup() {
       };
     }
 
+    controllerDirectory.begin(configFS, CONFIGFS_PATH_CONTROLLERS);
+    clientDirectory.begin(configFS, CONFIGFS_PATH_CLIENTS);
+    certDirectory.begin(configFS, CONFIGFS_PATH_CERTS);
+
+    if(!controllerDirectory.build() || !clientDirectory.build() || !certDirectory.build()){
+      log_w("configFS directory index incomplete; list endpoints will read the file system");
+    }
+
   }
   else{
     eventLog.createEvent("configFS mount fail", EventLog::LOG_LEVEL_ERROR);
@@ -448,6 +510,34 @@ void setup() {
     configFS.remove("/backup.json.upload_in_progress");
   }
 
+  if(configFS.exists("/backup.json.restore_in_progress")){
+    configFS.remove("/backup.json.restore_in_progress");
+  }
+
+  if(configFS.exists("/backup.cloud.json")){
+    configFS.remove("/backup.cloud.json");
+  }
+
+  if(configFS.exists(SECRET_ENCRYPTION_TEMP_PATH)){
+    configFS.remove(SECRET_ENCRYPTION_TEMP_PATH);
+  }
+
+  if(deviceIdentity.enabled){
+    controllerConfig.begin(configFS, secretEncryption, CONFIGFS_PATH_CONTROLLERS + (String)"/" + deviceIdentity.data.uuid);
+  }
+
+  if(deviceIdentity.enabled && configFS_isMounted){
+    clientMacIndex.begin(configFS, secretEncryption, CONFIGFS_PATH_CLIENTS, CONFIGFS_PATH_CLIENTS_INDEX);
+    controllerMacIndex.begin(configFS, secretEncryption, CONFIGFS_PATH_CONTROLLERS, CONFIGFS_PATH_CONTROLLERS_INDEX);
+    clientMacIndex.reconcile();
+    controllerMacIndex.reconcile();
+  }
+
+  if(configFS_isMounted){
+    certTypes_backfillMetadata();
+  }
+
+  _certBundleLock = xSemaphoreCreateRecursiveMutex();
   refreshCertBundle();
 
   /* If configFS is mounted and this device has no controller config, scan for a provisioning AP
@@ -573,12 +663,12 @@ void setup() {
                   clientRoot.close();
                 }
               }
+              controllerDirectory.build();
+              clientDirectory.build();
               if(configFS.exists("/backup.json")){
                 configFS.remove("/backup.json");
               }
-              if(configFS.exists("/backup.etag")){
-                configFS.remove("/backup.etag");
-              }
+              clearBackupEtag();
 
               int expected_controllers = 0;
               int actual_controllers = 0;
@@ -605,6 +695,7 @@ void setup() {
                       String ctlrPayload = httpProvisioning.getString();
                       httpProvisioning.end();
                       if(secretEncryption.encryptToFile(configFS, CONFIGFS_PATH_CONTROLLERS + (String)"/" + uuid, ctlrPayload)){
+                        controllerDirectory.put(uuid.c_str());
                         actual_controllers++;
                       } else {
                         log_e("Prov: failed to write controller %s", uuid.c_str());
@@ -617,6 +708,8 @@ void setup() {
                 } else {
                   log_e("Prov: failed to parse controller list: %s", ctlrListErr.c_str());
                 }
+                controllerConfig.invalidate();
+                controllerMacIndex.reconcile();
               } else {
                 log_e("Prov: GET /api/controllers returned %d", controllersListCode);
                 httpProvisioning.end();
@@ -647,6 +740,7 @@ void setup() {
                       String clientPayload = httpProvisioning.getString();
                       httpProvisioning.end();
                       if(secretEncryption.encryptToFile(configFS, CONFIGFS_PATH_CLIENTS + (String)"/" + clientUuid, clientPayload)){
+                        clientDirectory.put(clientUuid.c_str());
                         actual_clients++;
                       } else {
                         log_e("Prov: failed to write client %s", clientUuid.c_str());
@@ -659,6 +753,7 @@ void setup() {
                 } else {
                   log_e("Prov: failed to parse client list: %s", clientListErr.c_str());
                 }
+                clientMacIndex.reconcile();
               } else {
                 log_e("Prov: GET /api/clients returned %d", clientsListCode);
                 httpProvisioning.end();
@@ -772,6 +867,7 @@ void setup() {
   httpServer.on("/api/reboot", http_handleReboot_POST);
   httpServer.on("/api/events", http_handleEventLog);
   httpServer.on("/api/errors", http_handleErrorLog);
+  httpServer.on("^/api/jobs/([0-9]+)$", http_handleJob);
   httpServer.on("/auth", http_handleAuth);
   httpServer.on("/files", http_handleFileList_GET);
 
@@ -800,6 +896,7 @@ void setup() {
     httpServer.on("^/certs$", HTTP_ANY, http_handleCerts, http_handleCerts_Upload);
     httpServer.on("/api/ota", HTTP_OPTIONS, http_options);
     httpServer.addHandler(new AsyncCallbackJsonWebHandler("/api/ota", http_handleOTA_POST));
+    httpServer.on("/api/cloud-backup/staged", http_handleCloudBackupStaged);
     httpServer.on("/api/cloud-backup", http_handleCloudBackup);
     setup_OtaFirmware();
   }else{
@@ -831,6 +928,8 @@ void setup() {
 
   setupMQTT();
 
+  setupSyslog();
+
   #if CORE_DEBUG_LEVEL >= 4
     reportMemoryUsage("MQTT Started.  Setting up IO.");
   #endif /* CORE_DEBUG_LEVEL >= 4 */
@@ -845,6 +944,10 @@ void setup() {
   otaFirmware.setCurrentVersion(VERSION);
   otaFirmware.setBlockedPartitions({"config"});
 
+  if(!networkWorker.begin(networkWorker_run)){
+    eventLog.createEvent("Net worker failed", EventLog::LOG_LEVEL_ERROR);
+  }
+
   #if CORE_DEBUG_LEVEL >= 4
     reportMemoryUsage("Setup complete.");
   #endif /* CORE_DEBUG_LEVEL >= 4 */
@@ -868,90 +971,25 @@ void loop() {
     }
   }
 
-  if(!_otaManifestUrl.isEmpty() && esp_timer_get_time() > 60ULL * 1000000ULL){ //Wait 60 seconds after booting before checking the firmware
-    if((_otaLastCheckedTime == 0) || (esp_timer_get_time() - _otaLastCheckedTime >= (uint64_t)FIRMWARE_CHECK_SECONDS * 1000000ULL)){
-      if(!_otaUpdateInProcess){
-        #if CORE_DEBUG_LEVEL >= 4
-          reportMemoryUsage("Starting firmware check.");
-        #endif /* CORE_DEBUG_LEVEL >= 4 */
-
-        _otaCheckFailed = false;
-        _otaCheckErrorCode = 0;
-        bool updateAvailable = otaFirmware.checkForUpdate();
-
-        if(_otaCheckFailed){
-          eventLog.createEvent("OTA check failed");
-          /* onError already published "offline" to availability topic; do not overwrite with "online" */
-          if(deviceIdentity.enabled && mqttClient.connected()){
-            const char* notifyMessage;
-            switch(_otaCheckErrorCode){
-              case -1:
-                notifyMessage = "Could not reach the OTA server. Please verify network connectivity.";
-                break;
-              case 404:
-                notifyMessage = "No firmware was found for this device. The OTA URL may be incorrect.";
-                break;
-              case 409:
-                notifyMessage = "This device is running a revoked firmware version and cannot update automatically. Manual intervention is required.";
-                break;
-              case 500:
-                notifyMessage = "The OTA server returned an error. This is likely transient; the device will retry.";
-                break;
-              case ESP_ERR_INVALID_ARG:
-                notifyMessage = "The firmware manifest could not be parsed. The server may have returned an unexpected response.";
-                break;
-              case ESP_ERR_INVALID_STATE:
-                notifyMessage = "OTA is not properly configured on this device.";
-                break;
-              case ESP_ERR_NOT_FOUND:
-                notifyMessage = "This device was not found in the firmware manifest. The OTA URL may be incorrect.";
-                break;
-              default:
-                notifyMessage = "The firmware update check failed. Please verify network connectivity and OTA configuration.";
-                break;
-            }
-            JsonDocument notifyDoc;
-            notifyDoc["title"] = "⚠️ FireFly Controller OTA Check Failed";
-            notifyDoc["message"] = notifyMessage;
-            char notificationId[64];
-            snprintf(notificationId, sizeof(notificationId), "firefly_ota_error_%s", deviceIdentity.data.uuid);
-            notifyDoc["notification_id"] = notificationId;
-            mqttClient.beginPublish("homeassistant/persistent_notification/create", measureJson(notifyDoc), false);
-            BufferingPrint bufferedNotify(mqttClient, 32);
-            serializeJson(notifyDoc, bufferedNotify);
-            bufferedNotify.flush();
-            mqttClient.endPublish();
-          }
-        } else if(!updateAvailable){
-          /* Service reachable, no update — publish online + current version */
-          if(deviceIdentity.enabled && mqttClient.connected()){
-            char availability_topic[MQTT_TOPIC_UPDATE_AVAILABILITY_LENGTH+1];
-            snprintf(availability_topic, sizeof(availability_topic), MQTT_TOPIC_UPDATE_AVAILABILITY_PATTERN, deviceIdentity.data.uuid);
-            mqttClient.publish(availability_topic, "online", true);
-
-            JsonDocument mqttDoc;
-            mqttDoc["installed_version"] = VERSION;
-            mqttDoc["latest_version"] = VERSION;
-            mqttDoc["in_progress"] = false;
-            char topic[MQTT_TOPIC_UPDATE_STATE_PATTERN_LENGTH+1];
-            snprintf(topic, sizeof(topic), MQTT_TOPIC_UPDATE_STATE_PATTERN, deviceIdentity.data.uuid);
-            mqttClient.beginPublish(topic, measureJson(mqttDoc), true);
-            BufferingPrint bufferedClient(mqttClient, 32);
-            serializeJson(mqttDoc, bufferedClient);
-            bufferedClient.flush();
-            mqttClient.endPublish();
-          }
-          eventLog.createEvent("OTA firmware checked");
-        }
+  if(!_otaManifestUrl.isEmpty()){
+    if(_otaNextCheckTime == 0){ //First check 60 seconds after booting, spread so controllers powered up together do not check together
+      _otaNextCheckTime = 60ULL * 1000000ULL + otaFirmware_jitter(FIRMWARE_CHECK_BOOT_JITTER_SECONDS);
+    } else if((uint64_t)esp_timer_get_time() >= _otaNextCheckTime){
+      if(!_otaUpdateInProcess && !_otaPendingRequest){
+        networkWorker.submit(NETWORK_JOB_OTA_CHECK);
       }
 
-      _otaLastCheckedTime = esp_timer_get_time();
-      #if CORE_DEBUG_LEVEL >= 4
-        reportMemoryUsage("Firmware check complete.");
-      #endif /* CORE_DEBUG_LEVEL >= 4 */
+      _otaNextCheckTime = esp_timer_get_time() + (uint64_t)FIRMWARE_CHECK_SECONDS * 1000000ULL + otaFirmware_jitter(FIRMWARE_CHECK_JITTER_SECONDS);
     }
   }
 
+  NetworkWorker::completion networkResult;
+  while(networkWorker.poll(networkResult)){
+    networkWorker_complete(networkResult);
+  }
+
+  cloudHttp.expireIdle();
+
   if(esp_timer_get_time() - lastTimeMemoryBroadcast >= (uint64_t)MEMORY_USAGE_REPORT_SECONDS * 1000000ULL){
     lastTimeMemoryBroadcast = esp_timer_get_time();
     uint32_t currentHeapFree         = (uint32_t)ESP.getFreeHeap();
@@ -985,8 +1023,10 @@ void loop() {
   temperatureSensors.loop();
   provisioningMode.loop();
 
-  #if CORE_DEBUG_LEVEL > 0
-    telnetLog.loop();
+  #if ETHERNET_MODEL == ENUM_ETHERNET_MODEL_W5500
+    if(ESP32_W5500_isConnected()){
+      syslogSink.loop();
+    }
   #endif
 
   #if ETHERNET_MODEL == ENUM_ETHERNET_MODEL_W5500
@@ -1009,6 +1049,268 @@ void loop() {
 
 }
 
+
+/**
+ * Runs one network worker job.  Called on the network worker task; records the outcome in result
+ * and leaves MQTT, events and the OLED to networkWorker_complete() on the loop.
+*/
+void networkWorker_run(const NetworkWorker::job &work, NetworkWorker::completion &result){
+
+  switch(work.type){
+
+    case NETWORK_JOB_CLOUD_BACKUP:
+    case NETWORK_JOB_CLOUD_RESTORE:
+    case NETWORK_JOB_CLOUD_DELETE: {
+      int httpCode = 0;
+      String errorMsg;
+      bool completed;
+
+      if(work.type == NETWORK_JOB_CLOUD_BACKUP){
+        completed = cloudBackup_performUpload(httpCode, errorMsg);
+      } else if(work.type == NETWORK_JOB_CLOUD_RESTORE){
+        completed = cloudBackup_performRestore(httpCode, errorMsg);
+      } else {
+        completed = cloudBackup_performDelete(httpCode, errorMsg);
+      }
+
+      result.code = httpCode;
+      result.ok = completed && (httpCode == 200 || httpCode == 204 || httpCode == 304);
+      if(!result.ok){
+        strlcpy(result.message, errorMsg.isEmpty() ? "Cloud returned unexpected status" : errorMsg.c_str(), sizeof(result.message));
+      }
+      break;
+    }
+
+    case NETWORK_JOB_OTA_CHECK: {
+      char etag[sizeof(_otaManifestCache.etag)] = "";
+      char lastModified[sizeof(_otaManifestCache.lastModified)] = "";
+
+      if(otaFirmware_manifestUnchanged(etag, lastModified)){
+        log_d("OTA manifest not modified; update available: %d", _otaManifestCache.updateAvailable);
+        result.ok = true;
+        result.code = _otaManifestCache.updateAvailable ? 1 : 0;
+        break;
+      }
+
+      _otaCheckFailed = false;
+      _otaCheckErrorCode = 0;
+      _otaCheckRunning = true;
+      bool updateAvailable = otaFirmware.checkForUpdate();
+      _otaCheckRunning = false;
+
+      result.ok = !_otaCheckFailed;
+      result.code = _otaCheckFailed ? _otaCheckErrorCode : (updateAvailable ? 1 : 0);
+
+      /* Validators from just before the check; if the manifest changed in between, the next check simply downloads it again */
+      _otaManifestCache.valid = result.ok && (etag[0] != '\0' || lastModified[0] != '\0');
+      _otaManifestCache.updateAvailable = updateAvailable;
+      strlcpy(_otaManifestCache.etag, etag, sizeof(_otaManifestCache.etag));
+      strlcpy(_otaManifestCache.lastModified, lastModified, sizeof(_otaManifestCache.lastModified));
+      break;
+    }
+
+    default:
+      result.ok = false;
+      strlcpy(result.message, "Unknown job", sizeof(result.message));
+      break;
+  }
+}
+
+
+/**
+ * Acts on a finished network worker job; called from the loop
+*/
+void networkWorker_complete(const NetworkWorker::completion &result){
+
+  switch(result.type){
+
+    case NETWORK_JOB_CLOUD_BACKUP:
+      cloudBackup_reportUpload(result);
+      break;
+
+    case NETWORK_JOB_CLOUD_RESTORE:
+      cloudBackup_reportRestore(result);
+      break;
+
+    case NETWORK_JOB_OTA_CHECK:
+      otaFirmware_reportCheck(result);
+      break;
+  }
+}
+
+
+/**
+ * Name of a network worker job type, as reported by /api/jobs
+*/
+const char* networkWorker_jobName(uint8_t type){
+
+  switch(type){
+    case NETWORK_JOB_CLOUD_BACKUP:
+      return "cloud-backup-upload";
+    case NETWORK_JOB_OTA_CHECK:
+      return "ota-check";
+    case NETWORK_JOB_CLOUD_RESTORE:
+      return "cloud-backup-restore";
+    case NETWORK_JOB_CLOUD_DELETE:
+      return "cloud-backup-delete";
+    default:
+      return "unknown";
+  }
+}
+
+
+/**
+ * Random delay of up to maxSeconds, in microseconds, for spreading scheduled checks
+*/
+uint64_t otaFirmware_jitter(uint32_t maxSeconds){
+  if(maxSeconds == 0){
+    return 0;
+  }
+  return (uint64_t)(esp_random() % maxSeconds) * 1000000ULL + esp_random() % 1000000UL;
+}
+
+
+/**
+ * Asks the manifest server, with a conditional HEAD request, whether the manifest has changed
+ * since the last successful check.  Runs on the network worker.
+ * Returns true only on 304 Not Modified, when the cached result still stands.  Otherwise etag
+ * and lastModified receive the manifest's current validators (empty if the server sends none)
+ * and the caller downloads the manifest as usual; a failed probe costs nothing but the probe.
+ * etag and lastModified must be the size of the matching _otaManifestCache fields.
+*/
+bool otaFirmware_manifestUnchanged(char* etag, char* lastModified){
+
+  /* Trusts the same certificates as the manifest GET: the controller bundle, or the built-in roots without one */
+  xSemaphoreTakeRecursive(_certBundleLock, portMAX_DELAY);
+  esp_http_client_handle_t client = cloudHttp.acquire(_otaManifestUrl.c_str(), HTTP_METHOD_HEAD, 15000, _certBundle);
+  xSemaphoreGiveRecursive(_certBundleLock);
+  if(client == nullptr){
+    return false;
+  }
+
+  bool prepared = cloudHttp.setHeader(client, "uuid", deviceIdentity.data.uuid);
+
+  if(_otaManifestCache.valid){
+    if(_otaManifestCache.etag[0] != '\0'){
+      prepared = prepared && cloudHttp.setHeader(client, "If-None-Match", _otaManifestCache.etag);
+    }
+    if(_otaManifestCache.lastModified[0] != '\0'){
+      prepared = prepared && cloudHttp.setHeader(client, "If-Modified-Since", _otaManifestCache.lastModified);
+    }
+  }
+
+  prepared = prepared
+          && cloudHttp.captureHeader(client, "ETag", etag, sizeof(_otaManifestCache.etag))
+          && cloudHttp.captureHeader(client, "Last-Modified", lastModified, sizeof(_otaManifestCache.lastModified));
+
+  if(!prepared){
+    cloudHttp.release(client, true);
+    etag[0] = '\0';
+    lastModified[0] = '\0';
+    return false;
+  }
+
+  esp_err_t err = cloudHttp.perform(client);
+  int status = err == ESP_OK ? esp_http_client_get_status_code(client) : 0;
+  cloudHttp.release(client, err == ESP_OK);
+
+  if(status == 304 && _otaManifestCache.valid){
+    return true;
+  }
+
+  if(status != 200){
+    log_d("OTA manifest probe: err=%d status=%d", (int)err, status);
+    etag[0] = '\0';
+    lastModified[0] = '\0';
+  }
+
+  return false;
+}
+
+
+/**
+ * Publishes the outcome of a scheduled OTA manifest check
+ * @param result code is the onError code when the check failed, otherwise 1 if an update is available and 0 if not
+*/
+void otaFirmware_reportCheck(const NetworkWorker::completion &result){
+
+  if(!result.ok){
+    eventLog.createEvent("OTA check failed");
+    /* Availability goes "offline", as onError does outside a check; "online" is not published over it */
+    if(deviceIdentity.enabled && mqttClient.connected()){
+      char availability_topic[MQTT_TOPIC_UPDATE_AVAILABILITY_LENGTH+1];
+      snprintf(availability_topic, sizeof(availability_topic), MQTT_TOPIC_UPDATE_AVAILABILITY_PATTERN, deviceIdentity.data.uuid);
+      mqttClient.publish(availability_topic, "offline");
+
+      const char* notifyMessage;
+      switch(result.code){
+        case -1:
+          notifyMessage = "Could not reach the OTA server. Please verify network connectivity.";
+          break;
+        case 404:
+          notifyMessage = "No firmware was found for this device. The OTA URL may be incorrect.";
+          break;
+        case 409:
+          notifyMessage = "This device is running a revoked firmware version and cannot update automatically. Manual intervention is required.";
+          break;
+        case 500:
+          notifyMessage = "The OTA server returned an error. This is likely transient; the device will retry.";
+          break;
+        case ESP_ERR_INVALID_ARG:
+          notifyMessage = "The firmware manifest could not be parsed. The server may have returned an unexpected response.";
+          break;
+        case ESP_ERR_INVALID_STATE:
+          notifyMessage = "OTA is not properly configured on this device.";
+          break;
+        case ESP_ERR_NOT_FOUND:
+          notifyMessage = "This device was not found in the firmware manifest. The OTA URL may be incorrect.";
+          break;
+        default:
+          notifyMessage = "The firmware update check failed. Please verify network connectivity and OTA configuration.";
+          break;
+      }
+      JsonDocument notifyDoc;
+      notifyDoc["title"] = "⚠️ FireFly Controller OTA Check Failed";
+      notifyDoc["message"] = notifyMessage;
+      char notificationId[64];
+      snprintf(notificationId, sizeof(notificationId), "firefly_ota_error_%s", deviceIdentity.data.uuid);
+      notifyDoc["notification_id"] = notificationId;
+      mqttClient.beginPublish("homeassistant/persistent_notification/create", measureJson(notifyDoc), false);
+      BufferingPrint bufferedNotify(mqttClient, 32);
+      serializeJson(notifyDoc, bufferedNotify);
+      bufferedNotify.flush();
+      mqttClient.endPublish();
+    }
+  } else if(result.code == 1){
+    otaFirmware_publishAvailable();
+  } else {
+    /* Service reachable, no update — publish online + current version */
+    if(deviceIdentity.enabled && mqttClient.connected()){
+      char availability_topic[MQTT_TOPIC_UPDATE_AVAILABILITY_LENGTH+1];
+      snprintf(availability_topic, sizeof(availability_topic), MQTT_TOPIC_UPDATE_AVAILABILITY_PATTERN, deviceIdentity.data.uuid);
+      mqttClient.publish(availability_topic, "online", true);
+
+      JsonDocument mqttDoc;
+      mqttDoc["installed_version"] = VERSION;
+      mqttDoc["latest_version"] = VERSION;
+      mqttDoc["in_progress"] = false;
+      char topic[MQTT_TOPIC_UPDATE_STATE_PATTERN_LENGTH+1];
+      snprintf(topic, sizeof(topic), MQTT_TOPIC_UPDATE_STATE_PATTERN, deviceIdentity.data.uuid);
+      mqttClient.beginPublish(topic, measureJson(mqttDoc), true);
+      BufferingPrint bufferedClient(mqttClient, 32);
+      serializeJson(mqttDoc, bufferedClient);
+      bufferedClient.flush();
+      mqttClient.endPublish();
+    }
+    eventLog.createEvent("OTA firmware checked");
+  }
+
+  #if CORE_DEBUG_LEVEL >= 4
+    reportMemoryUsage("Firmware check complete.");
+  #endif /* CORE_DEBUG_LEVEL >= 4 */
+}
+
+
 /** Handles changes in observed temperatures 
  * @param location the location where the change was observed
  * @param value the new temperature in degrees celsius
@@ -1250,6 +1552,8 @@ void eventHandler_visualAuthChanged(){
 */
 void eventHandler_eventLogInfoEvent(){
 
+  syslog_forwardLatestEvent(SyslogSink::SEVERITY_INFO);
+
   if(oled.isSleeping()){
     return;
   }
@@ -1264,6 +1568,7 @@ void eventHandler_eventLogInfoEvent(){
  * Handles events where the event log type was notification
 */
 void eventHandler_eventLogNotificationEvent(){
+  syslog_forwardLatestEvent(SyslogSink::SEVERITY_NOTICE);
   oled.setPage(managerOled::PAGE_EVENT_LOG);
 }
 
@@ -1272,6 +1577,7 @@ void eventHandler_eventLogNotificationEvent(){
  * Handles events where the event log type was error
 */
 void eventHandler_eventLogErrorEvent(){
+  syslog_forwardLatestEvent(SyslogSink::SEVERITY_ERROR);
   oled.setPage(managerOled::PAGE_ERROR);
   frontPanel.setStatus(managerFrontPanel::status::TROUBLE);
 
@@ -1371,22 +1677,13 @@ void failureHandler_outputs(uint8_t address, nsOutputs::failureReason failureRea
 
 
 /**
- * Updates the NTP time from the server with special handling
+ * Records the boot time once the SNTP service has set the clock.  Never waits on the network;
+ * force asks the service to resync in the background.
 */
 void updateNTPTime(bool force){
 
-  if((esp_timer_get_time() > ntpSleepUntil) || force){
-      /*
-        Workaround until https://github.com/arduino-libraries/NTPClient/pull/163 is merged
-        If time client update is unsuccessful, stop trying for 5 minutes
-      */
-
-      if(timeClient.update()){
-        ntpSleepUntil = 0;
-      }else{
-        ntpSleepUntil = esp_timer_get_time() + 300ULL * 1000000ULL; // 5 minutes in µs
-        return; // Stop early if update failed
-      }
+  if(force){
+    timeClient.requestSync();
   }
 
   if(timeClient.isTimeSet() && bootTime == 0){
@@ -1407,24 +1704,84 @@ void setControllerNameOnOLED(){
   }
 
 
-  String filename = CONFIGFS_PATH_CONTROLLERS + (String)"/" + deviceIdentity.data.uuid;
+  switch(runtimeConfig_load()){
 
-  if(configFS.exists(filename)){
-    JsonDocument filter;
-    filter["name"] = true;
+    case ControllerConfigCache::LOAD_OK:
+      oled.setName(runtimeConfig.string(runtimeConfig.header().name) ?: "");
+      break;
 
-    String plaintext;
-    if(secretEncryption.decryptFromFile(configFS, filename, plaintext)){
-      JsonDocument doc;
-      deserializeJson(doc, plaintext, DeserializationOption::Filter(filter));
-      oled.setName(doc["name"]);
-    } else {
-      eventLog.createEvent("Config decrypt fail", EventLog::LOG_LEVEL_ERROR);
-      log_e("Failed to decrypt %s", filename.c_str());
-    }
+    case ControllerConfigCache::LOAD_PARSE_FAIL:
+      oled.setName("");
+      break;
+
+    default:
+      break;
+  }
+
+}
+
+
+/**
+ * Loads the cached controller config, reporting a decrypt failure the way each consumer previously did
+ * @returns the load result; on LOAD_PARSE_FAIL the caller reports controllerConfig.error() with its own prefix
+ */
+ControllerConfigCache::loadResult controllerConfig_load(){
+
+  ControllerConfigCache::loadResult result = controllerConfig.load();
+
+  if(result == ControllerConfigCache::LOAD_DECRYPT_FAIL){
+    eventLog.createEvent("Config decrypt fail", EventLog::LOG_LEVEL_ERROR);
+    log_e("Failed to decrypt %s", controllerConfig.path().c_str());
+  }
+
+  return result;
+}
+
+
+/**
+ * Makes runtimeConfig match this controller's config file.  The stored image is used when it was compiled from the file now on disk;
+ * otherwise the JSON is parsed and compiled, and the image is stored for the next boot.
+ * @returns the load result; on LOAD_PARSE_FAIL the caller reports controllerConfig.error() with its own prefix
+ */
+ControllerConfigCache::loadResult runtimeConfig_load(){
+
+  static uint32_t loadedGeneration = 0;
+
+  uint32_t generation = controllerConfig.generation();
+
+  if(runtimeConfig.isValid() && loadedGeneration == generation){
+    return ControllerConfigCache::LOAD_OK;
+  }
+
+  runtimeConfig.clear();
+
+  uint8_t nonce[12];
+  if(!secretEncryption.readNonce(configFS, controllerConfig.path(), nonce)){
+    return controllerConfig_load();
+  }
 
+  if(runtimeConfig.loadFromFile(configFS, secretEncryption, RUNTIME_CONFIG_IMAGE_PATH, nonce)){
+    loadedGeneration = generation;
+    return ControllerConfigCache::LOAD_OK;
   }
 
+  ControllerConfigCache::loadResult result = controllerConfig_load();
+
+  if(result != ControllerConfigCache::LOAD_OK){
+    return result;
+  }
+
+  if(!runtimeConfig.compile(controllerConfig.root(), nonce)){
+    eventLog.createEvent("Config compile fail", EventLog::LOG_LEVEL_ERROR);
+    return ControllerConfigCache::LOAD_NO_MEMORY;
+  }
+
+  if(!runtimeConfig.writeToFile(configFS, secretEncryption, RUNTIME_CONFIG_IMAGE_PATH)){
+    log_w("Unable to store %s; it will be compiled again next boot", RUNTIME_CONFIG_IMAGE_PATH);
+  }
+
+  loadedGeneration = generation;
+  return ControllerConfigCache::LOAD_OK;
 }
 
 
@@ -1537,83 +1894,278 @@ void http_options(AsyncWebServerRequest *request) {
 
 
 /**
- * Generic handler to return HTTP/500 responses when the configFS file system has not been mounted
+ * Queues a network worker job for a request and sends a 202 response with its ID and a Location
+ * header for /api/jobs.  If a job of the same type is already pending, the caller is pointed at it.
 */
-void http_configFSNotMunted(AsyncWebServerRequest *request){
+void http_submitJob(AsyncWebServerRequest *request, uint8_t type){
 
-  if(!request->hasHeader("visual-token")){
-        http_unauthorized(request);
-        return;
+  uint32_t id = networkWorker.submit(type);
+  if(id == 0){
+    id = networkWorker.pendingJob(type);
   }
 
-  if(!authToken.authenticate(request->header("visual-token").c_str())){
-    http_unauthorized(request);
+  if(id == 0){
+    http_serviceUnavailable(request, "Network worker busy");
     return;
   }
 
-  http_error(request, "File system not mounted");
+  String location = "/api/jobs/" + String(id);
+
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonDocument doc;
+  doc["id"] = id;
+  doc["location"] = location;
 
+  serializeJson(doc, *response);
+  response->addHeader("Location", location);
+  response->setCode(202);
+  request->send(response);
 }
 
 
 /**
- * Handles the version endpoint requests
+ * Sends a JSON document produced incrementally by source as a chunked 200 response, so memory use
+ * does not grow with the document size.  source is deleted when the response is destroyed.
 */
-void http_handleVersion(AsyncWebServerRequest *request){
+void http_sendJsonStream(AsyncWebServerRequest *request, JsonStreamSource *source){
+  std::shared_ptr<JsonStreamSource> shared(source);
+  request->send(request->beginChunkedResponse("application/json", [shared](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+    return shared->read(buffer, maxLen);
+  }));
+}
 
-  if(request->method() == HTTP_OPTIONS){
-    http_options(request);
-    return;
-  }
 
-  if(request->method() != HTTP_GET){
-    http_methodNotAllowed(request);
-    return;
-  }
+/**
+ * Streams the event log as the JSON array returned by /events
+*/
+class EventLogJsonSource : public JsonStreamSource{
 
-  resetHTPServerUsage();
+  private:
+    uint16_t _index = 0;
+    uint16_t _count = 0;
+    bool _started = false;
 
-  if(deviceIdentity.enabled == false){
-    http_error(request, "Device identity unavailable");
-    return;
-  }
+  public:
+    EventLogJsonSource(){
+      _count = eventLog.getEventCount();
+    }
 
-  if(strcmp(deviceIdentity.data.uuid, "") == 0){
-    http_error(request, "Device identity invalid");
-    return;
-  }
+  protected:
+    bool fill() override{
 
-  char product_hex[16] = {0};
-  sprintf(product_hex, "0x%08X", PRODUCT_HEX);
- 
-  AsyncResponseStream *response = request->beginResponseStream("application/json");
-  JsonDocument doc;
-  doc["uuid"] = deviceIdentity.data.uuid;
-  doc["product_id"] = deviceIdentity.data.product_id;
-  doc["product_hex"] = product_hex;
-  doc["application"]["name"]    = APPLICATION;
-  doc["application"]["version"] = VERSION;
-  doc["application"]["commit"]  = COMMIT_HASH;
-  if(_uiApplication[0] != '\0'){
-    doc["ui"]["name"]    = _uiApplication;
-    doc["ui"]["version"] = _uiVersion;
-    doc["ui"]["commit"]  = _uiCommit;
-  } else {
-    doc["ui"] = (const char*)nullptr;
-  }
+      if(!_started){
+        _started = true;
+        writer.beginArray();
+        return true;
+      }
 
-  serializeJson(doc, *response);
-  request->send(response);
-}
+      if(_index >= _count){
+        writer.endArray();
+        return false;
+      }
 
+      EventLog::eventLogEntry event = eventLog.getEvent(_index++);
 
-/**
- * POST /api/reboot — reboots the device after a short delay.
-*/
-void http_handleReboot_POST(AsyncWebServerRequest *request){
+      writer.beginObject();
+      writer.key("time");
+      writer.value((uint64_t)event.timestamp);
+      writer.key("level");
 
-  if(request->method() == HTTP_OPTIONS){
-    http_options(request);
+      switch(event.level){
+        case EventLog::LOG_LEVEL_ERROR:
+          writer.value("error");
+          break;
+
+        case EventLog::LOG_LEVEL_NOTIFICATION:
+          writer.value("notify");
+          break;
+
+        case EventLog::LOG_LEVEL_INFO:
+          writer.value("info");
+          break;
+
+        default:
+          writer.value("unknown");
+          break;
+      }
+
+      writer.key("text");
+      writer.value(event.text);
+      writer.endObject();
+
+      return true;
+    }
+};
+
+
+/**
+ * Streams the names of the regular files in a directory as a JSON array of strings
+*/
+class DirectoryNamesJsonSource : public JsonStreamSource{
+
+  private:
+    File _root;
+    bool _started = false;
+
+  public:
+    DirectoryNamesJsonSource(fs::FS &fs, const char *path){
+      _root = fs.open(path);
+    }
+
+  protected:
+    bool fill() override{
+
+      if(!_started){
+        _started = true;
+        writer.beginArray();
+        return true;
+      }
+
+      while(_root){
+        File file = _root.openNextFile();
+
+        if(!file){
+          _root.close();
+          break;
+        }
+
+        if(!file.isDirectory()){
+          writer.value(file.name());
+          return true;
+        }
+      }
+
+      writer.endArray();
+      return false;
+    }
+};
+
+
+/**
+ * Streams the names in a DirectoryIndex as a JSON array of strings, one entry per fill so the index
+ * is never held while the response waits on the socket
+*/
+class DirectoryIndexJsonSource : public JsonStreamSource{
+
+  private:
+    DirectoryIndex &_index;
+    size_t _position = 0;
+    bool _started = false;
+
+  public:
+    DirectoryIndexJsonSource(DirectoryIndex &index) : _index(index){}
+
+  protected:
+    bool fill() override{
+
+      if(!_started){
+        _started = true;
+        writer.beginArray();
+        return true;
+      }
+
+      DirectoryIndex::entry item;
+      if(_index.get(_position++, item)){
+        writer.value(item.name);
+        return true;
+      }
+
+      writer.endArray();
+      return false;
+    }
+};
+
+
+/**
+ * Streams the file names of a configFS directory from its index, or from the file system if the index could not be built
+*/
+void http_sendDirectoryNames(AsyncWebServerRequest *request, DirectoryIndex &index){
+  if(index.isBuilt()){
+    http_sendJsonStream(request, new DirectoryIndexJsonSource(index));
+  }else{
+    http_sendJsonStream(request, new DirectoryNamesJsonSource(configFS, (index.directory() + "/").c_str()));
+  }
+}
+
+
+/**
+ * Generic handler to return HTTP/500 responses when the configFS file system has not been mounted
+*/
+void http_configFSNotMunted(AsyncWebServerRequest *request){
+
+  if(!request->hasHeader("visual-token")){
+        http_unauthorized(request);
+        return;
+  }
+
+  if(!authToken.authenticate(request->header("visual-token").c_str())){
+    http_unauthorized(request);
+    return;
+  }
+
+  http_error(request, "File system not mounted");
+
+}
+
+
+/**
+ * Handles the version endpoint requests
+*/
+void http_handleVersion(AsyncWebServerRequest *request){
+
+  if(request->method() == HTTP_OPTIONS){
+    http_options(request);
+    return;
+  }
+
+  if(request->method() != HTTP_GET){
+    http_methodNotAllowed(request);
+    return;
+  }
+
+  resetHTPServerUsage();
+
+  if(deviceIdentity.enabled == false){
+    http_error(request, "Device identity unavailable");
+    return;
+  }
+
+  if(strcmp(deviceIdentity.data.uuid, "") == 0){
+    http_error(request, "Device identity invalid");
+    return;
+  }
+
+  char product_hex[16] = {0};
+  sprintf(product_hex, "0x%08X", PRODUCT_HEX);
+ 
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonDocument doc;
+  doc["uuid"] = deviceIdentity.data.uuid;
+  doc["product_id"] = deviceIdentity.data.product_id;
+  doc["product_hex"] = product_hex;
+  doc["application"]["name"]    = APPLICATION;
+  doc["application"]["version"] = VERSION;
+  doc["application"]["commit"]  = COMMIT_HASH;
+  if(_uiApplication[0] != '\0'){
+    doc["ui"]["name"]    = _uiApplication;
+    doc["ui"]["version"] = _uiVersion;
+    doc["ui"]["commit"]  = _uiCommit;
+  } else {
+    doc["ui"] = (const char*)nullptr;
+  }
+
+  serializeJson(doc, *response);
+  request->send(response);
+}
+
+
+/**
+ * POST /api/reboot — reboots the device after a short delay.
+*/
+void http_handleReboot_POST(AsyncWebServerRequest *request){
+
+  if(request->method() == HTTP_OPTIONS){
+    http_options(request);
     return;
   }
 
@@ -1675,36 +2227,7 @@ void http_handleEventLog(AsyncWebServerRequest *request){
     return;
   }
 
-  AsyncResponseStream *response = request->beginResponseStream("application/json");
-  JsonDocument doc;
-
-  for(uint16_t i=0; i < eventLog.getEventCount(); i++){
-    JsonObject entry = doc.add<JsonObject>();
-    entry["time"] = eventLog.getEvent(i).timestamp;
-
-    switch(eventLog.getEvent(i).level){
-      case EventLog::LOG_LEVEL_ERROR:
-        entry["level"] = "error";
-        break;
-
-      case EventLog::LOG_LEVEL_NOTIFICATION:
-        entry["level"] = "notify";
-        break;
-
-      case EventLog::LOG_LEVEL_INFO:
-        entry["level"] = "info";
-        break;
-
-      default:
-        entry["level"] = "unknown";
-        break;
-    }
-
-    entry["text"] = eventLog.getEvent(i).text;
-  }
- 
-  serializeJson(doc, *response);
-  request->send(response);
+  http_sendJsonStream(request, new EventLogJsonSource());
 }
 
 
@@ -1754,6 +2277,54 @@ void http_handleErrorLog(AsyncWebServerRequest *request){
 }
 
 
+/**
+ * GET /api/jobs/{id} — state of a job queued by an endpoint that returned 202
+*/
+void http_handleJob(AsyncWebServerRequest *request){
+
+  if(request->method() == HTTP_OPTIONS){
+    http_options(request);
+    return;
+  }
+
+  if(request->method() != HTTP_GET){
+    http_methodNotAllowed(request);
+    return;
+  }
+
+  if(!request->hasHeader("visual-token") || !authToken.authenticate(request->header("visual-token").c_str())){
+    http_unauthorized(request);
+    return;
+  }
+
+  resetHTPServerUsage();
+
+  NetworkWorker::record job;
+  if(!networkWorker.lookup(strtoul(request->pathArg(0).c_str(), nullptr, 10), job)){
+    http_notFound(request);
+    return;
+  }
+
+  static const char* const stateNames[] = { "queued", "running", "succeeded", "failed" };
+
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  JsonDocument doc;
+  doc["id"] = job.result.id;
+  doc["type"] = networkWorker_jobName(job.result.type);
+  doc["state"] = stateNames[job.state];
+
+  if(job.state >= NetworkWorker::JOB_SUCCEEDED && job.result.code != 0){
+    doc["status"] = job.result.code;
+  }
+  if(job.state == NetworkWorker::JOB_FAILED){
+    doc["message"] = job.result.message;
+  }
+
+  serializeJson(doc, *response);
+  request->send(response);
+}
+
+
 /**
  * Creates a long-term authorization with the given visual token
 */
@@ -1879,7 +2450,19 @@ void http_handleControllers_DELETE(AsyncWebServerRequest *request){
     return;
   }
 
-  if(configFS.remove(filename)){
+  bool removed = configFS.remove(filename);
+
+  if(removed){
+    controllerMacIndex.remove(request->pathArg(0).c_str());
+    controllerDirectory.remove(request->pathArg(0).c_str());
+  }
+
+  if(request->pathArg(0) == deviceIdentity.data.uuid){
+    configFS.remove(RUNTIME_CONFIG_IMAGE_PATH);
+    controllerConfig.invalidate();
+  }
+
+  if(removed){
     request->send(204);
   }else{
     http_error(request, "Failed when trying to delete file");
@@ -1925,9 +2508,30 @@ void http_handleControllers_PUT(AsyncWebServerRequest *request, JsonVariant doc)
     return;
   }
 
-  String jsonStr;
-  serializeJson(doc, jsonStr);
-  if(!secretEncryption.encryptToFile(configFS, CONFIGFS_PATH_CONTROLLERS + (String)"/" + request->pathArg(0), jsonStr)){
+  EncryptWriter writer;
+  bool written = secretEncryption.openEncryptWriter(configFS, CONFIGFS_PATH_CONTROLLERS + (String)"/" + request->pathArg(0), writer);
+  if(written){
+    serializeJson(doc, writer);
+    written = writer.commit();
+  }
+
+  if(written){
+    controllerMacIndex.update(request->pathArg(0).c_str(), doc["mac_address"], writer.nonce());
+    controllerDirectory.put(request->pathArg(0).c_str());
+  }
+
+  if(request->pathArg(0) == deviceIdentity.data.uuid){
+
+    // Compiled now so the next boot can skip JSON entirely; a missing image is rebuilt at boot
+    RuntimeConfigImage image;
+    if(!written || !image.compile(doc.as<JsonObjectConst>(), writer.nonce()) || !image.writeToFile(configFS, secretEncryption, RUNTIME_CONFIG_IMAGE_PATH)){
+      configFS.remove(RUNTIME_CONFIG_IMAGE_PATH);
+    }
+
+    controllerConfig.invalidate();
+  }
+
+  if(!written){
     http_error(request, "Unable to open the file for writing");
     return;
   }
@@ -1969,23 +2573,7 @@ void http_handleListControllers(AsyncWebServerRequest *request){
 
   resetHTPServerUsage();
 
-  AsyncResponseStream *response = request->beginResponseStream("application/json");
-  JsonDocument doc(&spiRamAllocator);  //Supports 128 UUID's
-  JsonArray array = doc.to<JsonArray>();
-
-  File root = configFS.open(CONFIGFS_PATH_CONTROLLERS + (String)"/");
-
-  File file = root.openNextFile();
-
-  while(file){
-      if(!file.isDirectory()){
-        array.add((String)file.name());
-      }
-      file = root.openNextFile();
-  }
-
-  serializeJson(doc, *response);
-  request->send(response);
+  http_sendDirectoryNames(request, controllerDirectory);
 
 }
 
@@ -2083,6 +2671,8 @@ void http_handleClients_DELETE(AsyncWebServerRequest *request){
   }
 
   if(configFS.remove(filename)){
+    clientMacIndex.remove(request->pathArg(0).c_str());
+    clientDirectory.remove(request->pathArg(0).c_str());
     request->send(204);
   }else{
     http_error(request, "Failed when trying to delete file");
@@ -2128,13 +2718,21 @@ void http_handleClients_PUT(AsyncWebServerRequest *request, JsonVariant doc){
     return;
   }
 
-  String jsonStr;
-  serializeJson(doc, jsonStr);
-  if(!secretEncryption.encryptToFile(configFS, CONFIGFS_PATH_CLIENTS + (String)"/" + request->pathArg(0), jsonStr)){
+  EncryptWriter writer;
+  bool written = secretEncryption.openEncryptWriter(configFS, CONFIGFS_PATH_CLIENTS + (String)"/" + request->pathArg(0), writer);
+  if(written){
+    serializeJson(doc, writer);
+    written = writer.commit();
+  }
+
+  if(!written){
     http_error(request, "Unable to open the file for writing");
     return;
   }
 
+  clientMacIndex.update(request->pathArg(0).c_str(), doc["mac_address"], writer.nonce());
+  clientDirectory.put(request->pathArg(0).c_str());
+
   request->send(204);
 }
 
@@ -2170,23 +2768,7 @@ void http_handleListClients(AsyncWebServerRequest *request){
 
   resetHTPServerUsage();
 
-  AsyncResponseStream *response = request->beginResponseStream("application/json");
-  JsonDocument doc(&spiRamAllocator);  //Supports 128 UUID's
-  JsonArray array = doc.to<JsonArray>();
-
-  File root = configFS.open(CONFIGFS_PATH_CLIENTS + (String)"/");
-
-  File file = root.openNextFile();
-
-  while(file){
-      if(!file.isDirectory()){
-        array.add((String)file.name());
-      }
-      file = root.openNextFile();
-  }
-
-  serializeJson(doc, *response);
-  request->send(response);
+  http_sendDirectoryNames(request, clientDirectory);
 
 }
 
@@ -2263,37 +2845,10 @@ void http_handleProvisioning_PUT(AsyncWebServerRequest *request){
 
   request->send(202);
 
-  JsonDocument filter;
-  filter["mac_address"] = true;
-
-  File root = configFS.open(CONFIGFS_PATH_CLIENTS + (String)"/");
-  File file = root.openNextFile();
-
-  while(file){
-
-    if(!file.isDirectory()){
-      String clientPath = CONFIGFS_PATH_CLIENTS + (String)"/" + file.name();
-      file.close();
-
-      String plaintext;
-      if(secretEncryption.decryptFromFile(configFS, clientPath, plaintext)){
-        JsonDocument doc;
-        DeserializationError error = deserializeJson(doc, plaintext, DeserializationOption::Filter(filter));
-        if(!error){
-          provisioningMode.addAllowedMac(doc["mac_address"].as<std::string>());
-        }
-      } else {
-        eventLog.createEvent("Client decrypt fail", EventLog::LOG_LEVEL_ERROR);
-        log_e("Failed to decrypt %s", clientPath.c_str());
-      }
-    } else {
-      file.close();
-    }
-
-    file = root.openNextFile();
-  }
+  clientMacIndex.forEachMac([](const char* uuid, const char* mac){
+    provisioningMode.addAllowedMac(mac);
+  });
 
-  root.close();
   provisioningMode.setActive();
 }
 
@@ -2320,53 +2875,11 @@ void eventHandler_rogueClient(const char* macAddress){
 };
 
 
-/// @brief Scans client config files to find the UUID whose stored MAC matches the given MAC address
-/// @param mac MAC address in xx:xx:xx:xx:xx:xx format (lowercase)
+/// @brief Looks up the client whose stored MAC matches the given MAC address
+/// @param mac MAC address in xx:xx:xx:xx:xx:xx format (comparison is case-insensitive)
 /// @return The UUID string if found, empty string if not found
 String findClientUuidByMac(const char* mac){
-
-  JsonDocument filter;
-  filter["mac_address"] = true;
-
-  File root = configFS.open(CONFIGFS_PATH_CLIENTS + (String)"/");
-  File file = root.openNextFile();
-
-  while(file){
-
-    if(!file.isDirectory()){
-      String clientName = file.name();
-      String clientPath = CONFIGFS_PATH_CLIENTS + (String)"/" + clientName;
-      file.close();
-
-      String plaintext;
-      if(secretEncryption.decryptFromFile(configFS, clientPath, plaintext)){
-        JsonDocument doc;
-        DeserializationError error = deserializeJson(doc, plaintext, DeserializationOption::Filter(filter));
-
-        if(!error){
-          String storedMac = doc["mac_address"].as<String>();
-          storedMac.toLowerCase();
-          String incomingMac = String(mac);
-          incomingMac.toLowerCase();
-
-          if(storedMac == incomingMac){
-            root.close();
-            return clientName;
-          }
-        }
-      } else {
-        eventLog.createEvent("Client decrypt fail", EventLog::LOG_LEVEL_ERROR);
-        log_e("Failed to decrypt %s", clientPath.c_str());
-      }
-    } else {
-      file.close();
-    }
-
-    file = root.openNextFile();
-  }
-
-  root.close();
-  return String();
+  return clientMacIndex.findUuid(mac);
 }
 
 
@@ -2470,36 +2983,25 @@ void http_handleProvisioningToken(AsyncWebServerRequest *request, JsonVariant do
   String controllerPath = CONFIGFS_PATH_CONTROLLERS + (String)"/" + uuid;
   String clientPath = CONFIGFS_PATH_CLIENTS + (String)"/" + uuid;
 
-  String recordPath;
+  MacIndex* recordIndex;
   if(configFS.exists(controllerPath)){
-    recordPath = controllerPath;
+    recordIndex = &controllerMacIndex;
   } else if(configFS.exists(clientPath)){
-    recordPath = clientPath;
+    recordIndex = &clientMacIndex;
   } else {
     log_w("Provisioning token request: no controller or client file for uuid=%s from %s", uuid.c_str(), request->client()->remoteIP().toString().c_str());
     http_notFound(request);
     return;
   }
 
-  JsonDocument filter;
-  filter["mac_address"] = true;
-
-  String plaintext;
-  if(!secretEncryption.decryptFromFile(configFS, recordPath, plaintext)){
-    http_error(request, "Unable to decrypt record file");
-    return;
-  }
-
-  JsonDocument storedDoc;
-  DeserializationError storedErr = deserializeJson(storedDoc, plaintext, DeserializationOption::Filter(filter));
-  if(storedErr || storedDoc["mac_address"].isNull()){
+  char storedMacText[18];
+  if(!recordIndex->findMac(uuid.c_str(), storedMacText)){
     log_w("Provisioning token request: record %s has no mac_address field", uuid.c_str());
     http_notFound(request);
     return;
   }
 
-  String storedMac = storedDoc["mac_address"].as<String>();
-  storedMac.toLowerCase();
+  String storedMac = storedMacText;
   String incomingMac = doc["mac_address"].as<String>();
   incomingMac.toLowerCase();
 
@@ -2527,69 +3029,91 @@ void http_handleProvisioningToken(AsyncWebServerRequest *request, JsonVariant do
  * @param mac the MAC address to search for (comparison is case-insensitive)
  */
 String findControllerUuidByMac(const char* mac){
+  return controllerMacIndex.findUuid(mac);
+}
 
-  JsonDocument filter;
-  filter["mac_address"] = true;
 
-  File root = configFS.open(CONFIGFS_PATH_CONTROLLERS + (String)"/");
-  if(!root){
-    log_e("findControllerUuidByMac: failed to open controllers directory");
-    return String();
-  }
 
-  File file = root.openNextFile();
 
-  if(!file){
-    log_w("findControllerUuidByMac: no files found in controllers directory");
-  }
+#define BACKUP_ETAG_LENGTH 65                                           /* Hex digest and terminator */
+static char _backupEtag[BACKUP_ETAG_LENGTH] = "";                      /* RAM copy of /backup.etag; empty when there is no backup */
+static bool _backupEtagLoaded = false;                                 /* True once _backupEtag reflects /backup.etag */
+static portMUX_TYPE _backupEtagMux = portMUX_INITIALIZER_UNLOCKED;     /* Guards both; the web server, network worker and loop all use them */
 
-  while(file){
+/**
+ * Copies the ETag of /backup.json, as a lowercase hex string, into etag; empty if there is none.
+ * /backup.etag is read once and then served from RAM; every writer goes through setBackupEtag()
+ * or clearBackupEtag() so the copy stays current.
+ */
+void backupEtag(char* etag, size_t length){
 
-    if(!file.isDirectory()){
-      String controllerName = file.name();
-      String controllerPath = CONFIGFS_PATH_CONTROLLERS + (String)"/" + controllerName;
-      log_d("findControllerUuidByMac: checking file name=%s path=%s", controllerName.c_str(), controllerPath.c_str());
-      file.close();
+  portENTER_CRITICAL(&_backupEtagMux);
+  bool loaded = _backupEtagLoaded;
+  portEXIT_CRITICAL(&_backupEtagMux);
 
-      String plaintext;
-      if(secretEncryption.decryptFromFile(configFS, controllerPath, plaintext)){
-        JsonDocument doc;
-        DeserializationError error = deserializeJson(doc, plaintext, DeserializationOption::Filter(filter));
+  if(!loaded){
+    char fromFile[BACKUP_ETAG_LENGTH] = "";
 
-        if(!error){
-          if(doc["mac_address"].isNull()){
-            log_d("findControllerUuidByMac: %s has no mac_address field", controllerName.c_str());
-          } else {
-            String storedMac = doc["mac_address"].as<String>();
-            log_d("findControllerUuidByMac: stored mac='%s' incoming mac='%s'", storedMac.c_str(), mac);
-            storedMac.toLowerCase();
-            String incomingMac = String(mac);
-            incomingMac.toLowerCase();
-
-            if(storedMac == incomingMac){
-              root.close();
-              return controllerName;
-            }
-          }
-        } else {
-          log_e("findControllerUuidByMac: failed to parse JSON in %s: %s", controllerPath.c_str(), error.c_str());
-        }
-      } else {
-        eventLog.createEvent("Ctlr decrypt fail", EventLog::LOG_LEVEL_ERROR);
-        log_e("Failed to decrypt %s", controllerPath.c_str());
-      }
-    } else {
-      file.close();
+    File etagFile = configFS.open("/backup.etag", "r");
+    if(etagFile){
+      size_t n = etagFile.read((uint8_t*)fromFile, sizeof(fromFile) - 1);
+      fromFile[n] = '\0';
+      etagFile.close();
+    }
+
+    /* A writer may have got in while the file was read; its value wins */
+    portENTER_CRITICAL(&_backupEtagMux);
+    if(!_backupEtagLoaded){
+      memcpy(_backupEtag, fromFile, sizeof(_backupEtag));
+      _backupEtagLoaded = true;
     }
+    portEXIT_CRITICAL(&_backupEtagMux);
+  }
+
+  portENTER_CRITICAL(&_backupEtagMux);
+  strlcpy(etag, _backupEtag, length);
+  portEXIT_CRITICAL(&_backupEtagMux);
+}
+
 
-    file = root.openNextFile();
+/**
+ * Writes etagHex to /backup.etag, replacing any existing file, and updates the RAM copy
+ */
+void setBackupEtag(const char* etagHex){
+
+  if(configFS.exists("/backup.etag")){
+    configFS.remove("/backup.etag");
+  }
+
+  File etagFile = configFS.open("/backup.etag", "w");
+  bool written = false;
+  if(etagFile){
+    etagFile.print(etagHex);
+    etagFile.close();
+    written = true;
   }
 
-  root.close();
-  return String();
+  portENTER_CRITICAL(&_backupEtagMux);
+  strlcpy(_backupEtag, written ? etagHex : "", sizeof(_backupEtag));
+  _backupEtagLoaded = true;
+  portEXIT_CRITICAL(&_backupEtagMux);
 }
 
 
+/**
+ * Removes /backup.etag and clears the RAM copy
+ */
+void clearBackupEtag(){
+
+  if(configFS.exists("/backup.etag")){
+    configFS.remove("/backup.etag");
+  }
+
+  portENTER_CRITICAL(&_backupEtagMux);
+  _backupEtag[0] = '\0';
+  _backupEtagLoaded = true;
+  portEXIT_CRITICAL(&_backupEtagMux);
+}
 
 
 /**
@@ -2601,9 +3125,7 @@ String findControllerUuidByMac(const char* mac){
 void writeBackupEtag(){
   File f = configFS.open("/backup.json", "r");
   if(!f){
-    if(configFS.exists("/backup.etag")){
-      configFS.remove("/backup.etag");
-    }
+    clearBackupEtag();
     return;
   }
 
@@ -2626,14 +3148,7 @@ void writeBackupEtag(){
     sprintf(etagHex + i*2, "%02x", hash[i]);
   }
   etagHex[64] = '\0';
-  if(configFS.exists("/backup.etag")){
-    configFS.remove("/backup.etag");
-  }
-  File etagFile = configFS.open("/backup.etag", "w");
-  if(etagFile){
-    etagFile.print(etagHex);
-    etagFile.close();
-  }
+  setBackupEtag(etagHex);
 }
 
 
@@ -2681,7 +3196,10 @@ void http_handleBackup_HEAD(AsyncWebServerRequest *request){
     return;
   }
 
-  if(!configFS.exists("/backup.etag")){
+  char etag[BACKUP_ETAG_LENGTH];
+  backupEtag(etag, sizeof(etag));
+
+  if(etag[0] == '\0'){
     http_notFound(request);
     return;
   }
@@ -2689,16 +3207,7 @@ void http_handleBackup_HEAD(AsyncWebServerRequest *request){
   resetHTPServerUsage();
 
   AsyncWebServerResponse *response = request->beginResponse(200, "application/json", "");
-
-  if(configFS.exists("/backup.etag")){
-    File etagFile = configFS.open("/backup.etag", "r");
-    if(etagFile){
-      String etag = etagFile.readString();
-      etagFile.close();
-      response->addHeader("ETag", "\"" + etag + "\"");
-    }
-  }
-
+  response->addHeader("ETag", "\"" + String(etag) + "\"");
   request->send(response);
 }
 
@@ -2729,43 +3238,98 @@ void http_handleBackup_GET(AsyncWebServerRequest *request){
 
   resetHTPServerUsage();
 
-  File f = configFS.open("/backup.json", "r");
-  if(!f){
-    http_error(request, "Unable to open backup file");
+  char etag[BACKUP_ETAG_LENGTH];
+  backupEtag(etag, sizeof(etag));
+
+  if(http_etagMatches(request->header("If-None-Match").c_str(), etag)){
+    AsyncWebServerResponse *response = request->beginResponse(304);
+    response->addHeader("ETag", "\"" + String(etag) + "\"");
+    request->send(response);
     return;
   }
-  String plaintext = f.readString();
-  f.close();
 
-  AsyncWebServerResponse *response = request->beginResponse(200, "application/json", plaintext);
+  /* Served straight from LittleFS in chunks; the file is never held in RAM */
+  AsyncWebServerResponse *response = request->beginResponse(configFS, "/backup.json", "application/json");
+  if(response == nullptr || response->code() != 200){
+    delete response;
+    http_error(request, "Unable to open backup file");
+    return;
+  }
 
-  if(configFS.exists("/backup.etag")){
-    File etagFile = configFS.open("/backup.etag", "r");
-    if(etagFile){
-      String etag = etagFile.readString();
-      etagFile.close();
-      response->addHeader("ETag", "\"" + etag + "\"");
-    }
+  if(etag[0] != '\0'){
+    response->addHeader("ETag", "\"" + String(etag) + "\"");
   }
 
   request->send(response);
 }
 
 
+#ifndef BACKUP_UPLOAD_WRITE_CHUNK_SIZE
+  #define BACKUP_UPLOAD_WRITE_CHUNK_SIZE 4096 /* Upload bytes staged before each LittleFS write; one flash block so each write commits whole blocks */
+#endif
+
 static File _backupUploadFile;
 static bool _backupUploadAuthorized = false;
 static size_t _backupUploadBytesExpected = 0;
 static size_t _backupUploadBytesWritten = 0;
+static uint8_t* _backupUploadChunk = nullptr;    /* Staging buffer of BACKUP_UPLOAD_WRITE_CHUNK_SIZE bytes */
+static size_t _backupUploadChunkLength = 0;
+static bool _backupUploadWriteFailed = false;
+static mbedtls_sha256_context _backupUploadSha; /* Running SHA-256 of the upload, finalized as the ETag */
+static bool _backupUploadShaActive = false;
+
+
+/**
+ * Writes any staged upload bytes to the in-progress file
+*/
+void backupUpload_flushChunk(){
+
+  if(_backupUploadChunkLength == 0){
+    return;
+  }
+
+  if(_backupUploadFile.write(_backupUploadChunk, _backupUploadChunkLength) != _backupUploadChunkLength){
+    _backupUploadWriteFailed = true;
+  }
+
+  _backupUploadChunkLength = 0;
+}
+
+
+/**
+ * Releases the staging buffer and hash context of the current upload
+*/
+void backupUpload_release(){
+
+  if(_backupUploadChunk != nullptr){
+    free(_backupUploadChunk);
+    _backupUploadChunk = nullptr;
+  }
+  _backupUploadChunkLength = 0;
+
+  if(_backupUploadShaActive){
+    mbedtls_sha256_free(&_backupUploadSha);
+    _backupUploadShaActive = false;
+  }
+}
+
 
 /**
- * Body handler for streaming Backup PUTs directly to LittleFS
+ * Body handler for streaming Backup PUTs directly to LittleFS.  The SHA-256 used as the ETag is
+ * updated as each chunk arrives so the file does not have to be read back after the upload.
 */
 void http_handleBackup_PUT_body(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total){
 
   if(index == 0){
+    backupUpload_release();
+    if(_backupUploadFile){
+      _backupUploadFile.close();
+    }
+
     _backupUploadAuthorized = false;
     _backupUploadBytesExpected = total;
     _backupUploadBytesWritten = 0;
+    _backupUploadWriteFailed = false;
 
     if(!request->hasHeader("visual-token") || !authToken.authenticate(request->header("visual-token").c_str())){
       return;
@@ -2784,12 +3348,44 @@ void http_handleBackup_PUT_body(AsyncWebServerRequest *request, uint8_t *data, s
       return;
     }
 
+    _backupUploadChunk = (uint8_t*)ps_malloc(BACKUP_UPLOAD_WRITE_CHUNK_SIZE);
+    if(_backupUploadChunk == nullptr){
+      _backupUploadChunk = (uint8_t*)malloc(BACKUP_UPLOAD_WRITE_CHUNK_SIZE);
+    }
+
+    mbedtls_sha256_init(&_backupUploadSha);
+    mbedtls_sha256_starts(&_backupUploadSha, 0);
+    _backupUploadShaActive = true;
+
     _backupUploadAuthorized = true;
   }
 
   if(_backupUploadAuthorized && _backupUploadFile){
-    _backupUploadFile.write(data, len);
+    mbedtls_sha256_update(&_backupUploadSha, data, len);
     _backupUploadBytesWritten += len;
+
+    if(_backupUploadChunk == nullptr){
+      if(_backupUploadFile.write(data, len) != len){
+        _backupUploadWriteFailed = true;
+      }
+      return;
+    }
+
+    while(len > 0){
+      size_t n = BACKUP_UPLOAD_WRITE_CHUNK_SIZE - _backupUploadChunkLength;
+      if(n > len){
+        n = len;
+      }
+
+      memcpy(_backupUploadChunk + _backupUploadChunkLength, data, n);
+      _backupUploadChunkLength += n;
+      data += n;
+      len -= n;
+
+      if(_backupUploadChunkLength == BACKUP_UPLOAD_WRITE_CHUNK_SIZE){
+        backupUpload_flushChunk();
+      }
+    }
   }
 }
 
@@ -2799,6 +3395,7 @@ void http_handleBackup_PUT_body(AsyncWebServerRequest *request, uint8_t *data, s
 void http_handleBackup_PUT(AsyncWebServerRequest *request){
 
   if(!_backupUploadAuthorized){
+    backupUpload_release();
     if(_backupUploadFile){
       _backupUploadFile.close();
       configFS.remove("/backup.json.upload_in_progress");
@@ -2811,8 +3408,19 @@ void http_handleBackup_PUT(AsyncWebServerRequest *request){
     return;
   }
 
+  backupUpload_flushChunk();
   _backupUploadFile.close();
 
+  uint8_t hash[32];
+  mbedtls_sha256_finish(&_backupUploadSha, hash);
+  backupUpload_release();
+
+  if(_backupUploadWriteFailed){
+    configFS.remove("/backup.json.upload_in_progress");
+    http_error(request, "Unable to write the file");
+    return;
+  }
+
   if(_backupUploadBytesExpected > 0 && _backupUploadBytesWritten != _backupUploadBytesExpected){
     configFS.remove("/backup.json.upload_in_progress");
     http_error(request, "Incomplete transfer");
@@ -2823,11 +3431,17 @@ void http_handleBackup_PUT(AsyncWebServerRequest *request){
     configFS.remove("/backup.json");
   }
   if(!configFS.rename("/backup.json.upload_in_progress", "/backup.json")){
+    clearBackupEtag();
     http_error(request, "Unable to finalize the file");
     return;
   }
 
-  writeBackupEtag();
+  char etagHex[65];
+  for(int i = 0; i < 32; i++){
+    sprintf(etagHex + i*2, "%02x", hash[i]);
+  }
+  etagHex[64] = '\0';
+  setBackupEtag(etagHex);
 
   resetHTPServerUsage();
   request->send(204);
@@ -2857,7 +3471,7 @@ void http_handleBackup_DELETE(AsyncWebServerRequest *request){
   }
 
   if(configFS.remove("/backup.json")){
-    configFS.remove("/backup.etag");
+    clearBackupEtag();
     request->send(204);
   }else{
     http_error(request, "Failed when trying to delete file");
@@ -2866,30 +3480,114 @@ void http_handleBackup_DELETE(AsyncWebServerRequest *request){
 
 
 /**
- * Lists a given filesystem + path to an ArduinoJSON JsonArray
+ * Streams the /files document: for each file system its total and used bytes and every file,
+ * recursively, with its path and size.  Directories are walked depth first with a stack of open
+ * handles, matching the order of the previous recursive listing.
  */
-void listDirToJsonArray(fs::FS &fs, const char *dirname, JsonArray &array) {
+class FileListJsonSource : public JsonStreamSource{
 
-  File root = fs.open(dirname);
-  if(!root) {
-    return;
-  }
-  if(!root.isDirectory()) {
-    return;
-  }
+  private:
 
-  File file = root.openNextFile();
-  while (file) {
-    if(file.isDirectory()) {
-      listDirToJsonArray(fs, file.path(), array);
-    } else {
-      JsonObject entry = array.add<JsonObject>();
-      entry["path"] = (String)file.path();
-      entry["size"] = file.size();
+    static const uint8_t MAX_DEPTH = 8;
+
+    struct volume{
+      const char *name;
+      fs::LittleFSFS *fs;
+      bool mounted;
+    };
+
+    volume _volumes[2];
+    uint8_t _volume = 0;
+    bool _started = false;
+    bool _listing = false;
+
+    File _stack[MAX_DEPTH];
+    uint8_t _depth = 0;
+
+    void _push(fs::FS &fs, const char *path){
+      File dir = fs.open(path);
+      if(!dir || !dir.isDirectory() || _depth >= MAX_DEPTH){
+        return;
+      }
+      _stack[_depth++] = dir;
     }
-    file = root.openNextFile();
-  }
-}
+
+  public:
+
+    FileListJsonSource(){
+      _volumes[0] = {"config", &configFS, configFS_isMounted};
+      _volumes[1] = {"ui", &uiFS, uiFS_isMounted};
+    }
+
+  protected:
+
+    bool fill() override{
+
+      if(!_started){
+        _started = true;
+        writer.beginObject();
+        return true;
+      }
+
+      if(_listing){
+
+        while(_depth > 0){
+          File file = _stack[_depth - 1].openNextFile();
+
+          if(!file){
+            _stack[--_depth].close();
+            continue;
+          }
+
+          if(file.isDirectory()){
+            _push(*_volumes[_volume].fs, file.path());
+            continue;
+          }
+
+          writer.beginObject();
+          writer.key("path");
+          writer.value(file.path());
+          writer.key("size");
+          writer.value((uint64_t)file.size());
+          writer.endObject();
+          return true;
+        }
+
+        writer.endArray();
+        writer.endObject();
+        _listing = false;
+        _volume++;
+        return true;
+      }
+
+      if(_volume >= sizeof(_volumes) / sizeof(_volumes[0])){
+        writer.endObject();
+        return false;
+      }
+
+      volume &current = _volumes[_volume];
+      writer.key(current.name);
+      writer.beginObject();
+
+      if(current.mounted){
+        writer.key("total");
+        writer.value((uint64_t)current.fs->totalBytes());
+        writer.key("used");
+        writer.value((uint64_t)current.fs->usedBytes());
+        writer.key("files");
+        writer.beginArray();
+        _push(*current.fs, "/");
+        _listing = true;
+      }else{
+        writer.key("error");
+        writer.value("File system not mounted");
+        writer.endObject();
+        _volume++;
+      }
+
+      return true;
+    }
+};
 
 
 /**
@@ -2919,32 +3617,7 @@ void http_handleFileList_GET(AsyncWebServerRequest *request){
 
   resetHTPServerUsage();
 
-  AsyncResponseStream *response = request->beginResponseStream("application/json");
-  JsonDocument doc(&spiRamAllocator);  //Supports approx 128 controllers, 128 clients, and 64 files in www
-  JsonObject root = doc.to<JsonObject>();
-  JsonObject configObject = root["config"].to<JsonObject>();
-  JsonObject uiObject = root["ui"].to<JsonObject>();
-
-  if(configFS_isMounted){
-    configObject["total"] = configFS.totalBytes();
-    configObject["used"] = configFS.usedBytes();
-    JsonArray fileList = configObject["files"].to<JsonArray>();
-    listDirToJsonArray(configFS, "/", fileList);
-  }else{
-    configObject["error"] = "File system not mounted";
-  }
-
-  if(uiFS_isMounted){
-    uiObject["total"] = uiFS.totalBytes();
-    uiObject["used"] = uiFS.usedBytes();
-    JsonArray fileList = uiObject["files"].to<JsonArray>();
-    listDirToJsonArray(uiFS, "/", fileList);
-  }else{
-    uiObject["error"] = "File system not mounted";
-  }
-
-  serializeJson(doc, *response);
-  request->send(response);
+  http_sendJsonStream(request, new FileListJsonSource());
 }
 
 
@@ -2976,17 +3649,45 @@ void writeCertTypes(JsonDocument& doc){
   if(!f) return;
   serializeJson(doc, f);
   f.close();
+  certDirectory.put(".cert_types");
+}
+
+
+/**
+ * Reads /certs/{name} into pem with bulk reads
+ * @returns false if the file could not be opened or pem could not be sized for it
+ */
+bool readCertPem(const String& name, String& pem){
+  pem = "";
+  File f = configFS.open(CONFIGFS_PATH_CERTS + (String)"/" + name, "r");
+  if(!f) return false;
+  if(!pem.reserve(f.size())){
+    f.close();
+    return false;
+  }
+  char chunk[256];
+  size_t length;
+  while((length = f.read((uint8_t*)chunk, sizeof(chunk))) > 0){
+    pem.concat(chunk, length);
+  }
+  f.close();
+  return true;
 }
 
 
 /**
- * Returns the SHA-256 fingerprint of a PEM certificate formatted as
- * colon-separated uppercase hex ("AA:BB:CC:…"), or an empty String on error.
+ * Fills meta with the size of a PEM file and the SHA-256 fingerprint (colon-separated uppercase hex,
+ * "AA:BB:CC:…") of its first certificate.  Subject and expiry (ISO 8601, UTC) are added when the
+ * certificate parses.  Computed once at upload and kept in .cert_types so readers never decode PEMs.
+ * @returns false if the PEM has no decodable certificate block
  */
-String computeCertFingerprint(const String& pem){
+bool computeCertMetadata(const String& pem, JsonObject meta){
+
+  meta["size"] = pem.length();
+
   int start = pem.indexOf("-----BEGIN CERTIFICATE-----");
   int end   = pem.indexOf("-----END CERTIFICATE-----");
-  if(start == -1 || end == -1) return "";
+  if(start == -1 || end == -1) return false;
   start += strlen("-----BEGIN CERTIFICATE-----");
 
   String b64 = pem.substring(start, end);
@@ -2996,13 +3697,13 @@ String computeCertFingerprint(const String& pem){
 
   size_t maxDerLen = (b64.length() / 4 + 1) * 3;
   uint8_t* der = (uint8_t*)malloc(maxDerLen);
-  if(!der) return "";
+  if(!der) return false;
 
   size_t outLen = 0;
   if(mbedtls_base64_decode(der, maxDerLen, &outLen,
       (const unsigned char*)b64.c_str(), b64.length()) != 0){
     free(der);
-    return "";
+    return false;
   }
 
   uint8_t hash[32];
@@ -3012,16 +3713,54 @@ String computeCertFingerprint(const String& pem){
   mbedtls_sha256_update(&sha_ctx, der, outLen);
   mbedtls_sha256_finish(&sha_ctx, hash);
   mbedtls_sha256_free(&sha_ctx);
-  free(der);
 
-  String fp = "";
-  char hex[3];
+  char fingerprint[32 * 3];
   for(int i = 0; i < 32; i++){
-    if(i > 0) fp += ":";
-    snprintf(hex, sizeof(hex), "%02X", hash[i]);
-    fp += hex;
+    snprintf(fingerprint + i * 3, 4, i < 31 ? "%02X:" : "%02X", hash[i]);
+  }
+  meta["fingerprint"] = fingerprint;
+
+  mbedtls_x509_crt crt;
+  mbedtls_x509_crt_init(&crt);
+  if(mbedtls_x509_crt_parse_der(&crt, der, outLen) == 0){
+    char subject[128];
+    if(mbedtls_x509_dn_gets(subject, sizeof(subject), &crt.subject) > 0){
+      meta["subject"] = subject;
+    }
+    char expires[21];
+    snprintf(expires, sizeof(expires), "%04d-%02d-%02dT%02d:%02d:%02dZ",
+      crt.valid_to.year, crt.valid_to.mon, crt.valid_to.day,
+      crt.valid_to.hour, crt.valid_to.min, crt.valid_to.sec);
+    meta["expires"] = expires;
+  }
+  mbedtls_x509_crt_free(&crt);
+  free(der);
+
+  return true;
+}
+
+
+/**
+ * Adds metadata to .cert_types entries written before it was recorded at upload.  Call once after configFS mount.
+ */
+void certTypes_backfillMetadata(){
+
+  JsonDocument certTypes = readCertTypes();
+  bool changed = false;
+
+  for(JsonPair kv : certTypes.as<JsonObject>()){
+    if(kv.value()["size"].is<size_t>()) continue;
+
+    String pem;
+    if(!readCertPem(kv.key().c_str(), pem)) continue;
+
+    computeCertMetadata(pem, kv.value().as<JsonObject>());
+    changed = true;
+  }
+
+  if(changed){
+    writeCertTypes(certTypes);
   }
-  return fp;
 }
 
 
@@ -3045,24 +3784,21 @@ static void http_sendProvisioningCert(AsyncWebServerRequest *request, const char
     return;
   }
 
-  String certPath = CONFIGFS_PATH_CERTS + (String)"/" + filename;
-  if(!configFS.exists(certPath)){
+  DirectoryIndex::entry file;
+  if(!certDirectory.find(filename.c_str(), file)){
     request->send(404);
     return;
   }
 
-  File f = configFS.open(certPath, "r");
-  if(!f){
-    http_error(request, "Unable to read certificate");
+  const char* fingerprint = certTypes[filename]["fingerprint"];
+  if(fingerprint == nullptr){
+    http_error(request, "Unable to compute fingerprint");
     return;
   }
-  String pem = "";
-  while(f.available()) pem += (char)f.read();
-  f.close();
 
-  String fingerprint = computeCertFingerprint(pem);
-  if(fingerprint.isEmpty()){
-    http_error(request, "Unable to compute fingerprint");
+  String pem;
+  if(!readCertPem(filename, pem)){
+    http_error(request, "Unable to read certificate");
     return;
   }
 
@@ -3120,10 +3856,17 @@ void http_handleCerts(AsyncWebServerRequest *request){
           bool wantsClient     = (certTypeHeader == "client"     || certTypeHeader == "both");
 
           request->_tempFile.close();
+          certDirectory.put(uploadedFilename.c_str());
 
           JsonDocument certTypes = readCertTypes();
-          certTypes[uploadedFilename]["controller"] = wantsController;
-          certTypes[uploadedFilename]["client"]     = wantsClient;
+          JsonObject meta = certTypes[uploadedFilename].to<JsonObject>();
+          meta["controller"] = wantsController;
+          meta["client"]     = wantsClient;
+
+          String pem;
+          if(!readCertPem(uploadedFilename, pem) || !computeCertMetadata(pem, meta)){
+            log_w("%s has no decodable certificate; stored without a fingerprint", uploadedFilename.c_str());
+          }
           writeCertTypes(certTypes);
 
           refreshCertBundle();
@@ -3174,22 +3917,24 @@ void http_handleCerts_GET(AsyncWebServerRequest *request){
 
   JsonDocument certTypes = readCertTypes();
 
-  File root = configFS.open(CONFIGFS_PATH_CERTS + (String)"/");
-
-  File file = root.openNextFile();
-  while(file){
-      if(!file.isDirectory()){
-          String name = (String)file.name();
-          if(name != ".cert_types"){
-            JsonObject fileInstance = array.add<JsonObject>();
-            fileInstance["file"] = name;
-            fileInstance["size"] = file.size();
-            fileInstance["controller"] = certTypes[name]["controller"].as<bool>();
-            fileInstance["client"]     = certTypes[name]["client"].as<bool>();
-          }
+  certDirectory.forEach([&](const DirectoryIndex::entry &file){
+    if(strcmp(file.name, ".cert_types") != 0){
+      JsonObject fileInstance = array.add<JsonObject>();
+      fileInstance["file"] = file.name;
+      fileInstance["size"] = file.size;
+      fileInstance["controller"] = certTypes[file.name]["controller"].as<bool>();
+      fileInstance["client"]     = certTypes[file.name]["client"].as<bool>();
+      if(certTypes[file.name]["fingerprint"].is<const char*>()){
+        fileInstance["fingerprint"] = certTypes[file.name]["fingerprint"];
+      }
+      if(certTypes[file.name]["subject"].is<const char*>()){
+        fileInstance["subject"] = certTypes[file.name]["subject"];
+      }
+      if(certTypes[file.name]["expires"].is<const char*>()){
+        fileInstance["expires"] = certTypes[file.name]["expires"];
       }
-      file = root.openNextFile();
     }
+  });
 
   serializeJson(doc, *response);
   request->send(response);
@@ -3382,6 +4127,7 @@ void http_handleCert_DELETE(AsyncWebServerRequest *request){
   bool wasController = certTypes[filename]["controller"].as<bool>();
 
   configFS.remove(CONFIGFS_PATH_CERTS + (String)"/" + filename);
+  certDirectory.remove(filename.c_str());
 
   certTypes.as<JsonObject>().remove(filename.c_str());
   writeCertTypes(certTypes);
@@ -3441,6 +4187,17 @@ void http_handleOTA_POST(AsyncWebServerRequest *request, JsonVariant doc){
 */
 void refreshCertBundle(){
 
+  xSemaphoreTakeRecursive(_certBundleLock, portMAX_DELAY);
+  _refreshCertBundle();
+  xSemaphoreGiveRecursive(_certBundleLock);
+}
+
+
+/**
+ * Body of refreshCertBundle(); the caller holds _certBundleLock
+*/
+void _refreshCertBundle(){
+
   if(_certBundle != nullptr){
     free(_certBundle);
     _certBundle = nullptr;
@@ -3448,49 +4205,58 @@ void refreshCertBundle(){
 
   _certBundleSize = 0;
 
-  /* Concatenate certs marked controller: true in .cert_types */
-  String bundle = "";
+  /* Concatenate certs marked controller: true in .cert_types.  Sized from the directory index so the
+     bundle is one allocation and each cert one read; a newline is allowed after each cert in case the
+     file does not end with one. */
+  size_t capacity = 0;
+  JsonDocument certTypes;
   if(configFS_isMounted){
-    JsonDocument certTypes = readCertTypes();
-    File certsDir = configFS.open(CONFIGFS_PATH_CERTS);
-    if(certsDir && certsDir.isDirectory()){
-      File certFile = certsDir.openNextFile();
-      while(certFile){
-        if(!certFile.isDirectory()){
-          String name = (String)certFile.name();
-          if(name != ".cert_types" && certTypes[name]["controller"].as<bool>()){
-            while(certFile.available()){
-              bundle += (char)certFile.read();
-            }
-          }
-        }
-        certFile = certsDir.openNextFile();
+    certTypes = readCertTypes();
+    certDirectory.forEach([&](const DirectoryIndex::entry &cert){
+      if(strcmp(cert.name, ".cert_types") != 0 && certTypes[cert.name]["controller"].as<bool>()){
+        capacity += cert.size + 1;
       }
-    }
+    });
   }
 
-  _certBundleSize = bundle.length();
-
-  if(_certBundleSize == 0){
+  if(capacity == 0){
     log_i("No user certs found; will use bundled Mozilla root CAs");
+    mqttTransport.setCACert(nullptr);
     return;
   }
 
-  _certBundle = (char*)ps_malloc(_certBundleSize + 1);
+  _certBundle = (char*)ps_malloc(capacity + 1);
   if(_certBundle == nullptr){
-    _certBundle = (char*)malloc(_certBundleSize + 1);
+    _certBundle = (char*)malloc(capacity + 1);
   }
 
   if(_certBundle == nullptr){
-    log_e("Failed to allocate cert bundle (%u bytes)", (unsigned int)(_certBundleSize + 1));
-    _certBundleSize = 0;
+    log_e("Failed to allocate cert bundle (%u bytes)", (unsigned int)(capacity + 1));
+    mqttTransport.setCACert(nullptr);
     return;
   }
 
-  memcpy(_certBundle, bundle.c_str(), _certBundleSize + 1);
+  certDirectory.forEach([&](const DirectoryIndex::entry &cert){
+    if(strcmp(cert.name, ".cert_types") == 0 || !certTypes[cert.name]["controller"].as<bool>()) return;
+
+    File certFile = configFS.open(CONFIGFS_PATH_CERTS + (String)"/" + cert.name, "r");
+    if(!certFile) return;
+
+    size_t length = certFile.read((uint8_t*)_certBundle + _certBundleSize, min((size_t)cert.size, capacity - _certBundleSize));
+    certFile.close();
+
+    _certBundleSize += length;
+    if(length > 0 && _certBundle[_certBundleSize - 1] != '\n' && _certBundleSize < capacity){
+      _certBundle[_certBundleSize++] = '\n';
+    }
+  });
+
+  _certBundle[_certBundleSize] = '\0';
 
   log_i("Cert bundle built: %u bytes", (unsigned int)_certBundleSize);
 
+  mqttTransport.setCACert(_certBundle);
+
   if(!_otaManifestUrl.isEmpty() && _otaManifestUrl.startsWith("https:")){
     if(_certBundle != nullptr){
       _otaHttpsClient.setCACert(_certBundle);
@@ -3515,42 +4281,31 @@ void setup_OtaFirmware(){
     return;
   }
 
-  String filename = CONFIGFS_PATH_CONTROLLERS + (String)"/" + deviceIdentity.data.uuid;
+  ControllerConfigCache::loadResult result = runtimeConfig_load();
 
-  if(!configFS.exists(filename)){
+  if(result == ControllerConfigCache::LOAD_PARSE_FAIL) {
+    char text[OLED_CHARACTERS_PER_LINE+1];
+    snprintf(text, sizeof(text), "OTA parse err %s", controllerConfig.error().c_str());
+    eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
     return;
   }
 
-  JsonDocument filter;
-  filter["ota"] = true;
-
-  String plaintext;
-  if(!secretEncryption.decryptFromFile(configFS, filename, plaintext)){
-    eventLog.createEvent("Config decrypt fail", EventLog::LOG_LEVEL_ERROR);
-    log_e("Failed to decrypt %s", filename.c_str());
+  if(result != ControllerConfigCache::LOAD_OK){
     return;
   }
 
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, plaintext, DeserializationOption::Filter(filter));
-
-  if(error) {
-    char text[OLED_CHARACTERS_PER_LINE+1];
-    snprintf(text, sizeof(text), "OTA parse err %s", error.c_str());
-    eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
-    return;
-  }
+  const RuntimeConfigImage::imageHeader& config = runtimeConfig.header();
 
-  if(doc["ota"].isNull()){
+  if(!(config.flags & RuntimeConfigImage::HAS_OTA)){
     return;
   }
 
-  if(doc["ota"]["url"].isNull()){
+  if(config.otaUrl == RuntimeConfigImage::NO_STRING){
     eventLog.createEvent("OTA cfg no url");
     return;
   }
 
-  String url = doc["ota"]["url"];
+  String url = runtimeConfig.string(config.otaUrl);
 
   uint8_t otaEthMac[6];
   esp_read_mac(otaEthMac, ESP_MAC_ETH);
@@ -3605,48 +4360,278 @@ void setup_OtaFirmware(){
     strlcpy(_otaLatestVersion, version, sizeof(_otaLatestVersion));
     strlcpy(_otaReleaseUrl, releaseUrl ? releaseUrl : "", sizeof(_otaReleaseUrl));
     _otaLastPublishedPercentage = -1;
+    if(_otaCheckRunning){ return; } /* On the network worker; otaFirmware_reportCheck() publishes */
+    otaFirmware_publishAvailable();
+  });
+
+  otaFirmware.onError([](const char* partition, int err){
+    _otaCheckFailed = true;
+    _otaCheckErrorCode = err;
+    log_e("OTA error on %s: %d", partition, err);
+    if(_otaCheckRunning){ return; } /* On the network worker; otaFirmware_reportCheck() publishes */
     if(deviceIdentity.enabled == false){ return; }
     if(!mqttClient.connected()){ return; }
-    eventLog.createEvent("OTA update available");
-
     char availability_topic[MQTT_TOPIC_UPDATE_AVAILABILITY_LENGTH+1];
     snprintf(availability_topic, sizeof(availability_topic), MQTT_TOPIC_UPDATE_AVAILABILITY_PATTERN, deviceIdentity.data.uuid);
-    mqttClient.publish(availability_topic, "online", true);
+    mqttClient.publish(availability_topic, "offline");
+  });
+
+  _otaManifestUrl = url;
+  _otaManifestCache.valid = false;
+  eventLog.createEvent("OTA update enabled");
+}
+
+
+/**
+ * Announces the update recorded by onAvailable in _otaLatestVersion and _otaReleaseUrl
+*/
+void otaFirmware_publishAvailable(){
+
+  if(deviceIdentity.enabled == false){ return; }
+  if(!mqttClient.connected()){ return; }
+  eventLog.createEvent("OTA update available");
+
+  char availability_topic[MQTT_TOPIC_UPDATE_AVAILABILITY_LENGTH+1];
+  snprintf(availability_topic, sizeof(availability_topic), MQTT_TOPIC_UPDATE_AVAILABILITY_PATTERN, deviceIdentity.data.uuid);
+  mqttClient.publish(availability_topic, "online", true);
+
+  char title[64];
+  snprintf(title, sizeof(title), "Release %s is available", _otaLatestVersion);
+  JsonDocument mqttDoc;
+  mqttDoc["title"] = title;
+  mqttDoc["installed_version"] = VERSION;
+  mqttDoc["latest_version"] = _otaLatestVersion;
+  if(strlen(_otaReleaseUrl) > 0){
+    mqttDoc["release_url"] = _otaReleaseUrl;
+  }
+  mqttDoc["release_summary"] = "After updating, all outputs will be turned off.";
+  mqttDoc["in_progress"] = false;
+
+  char topic[MQTT_TOPIC_UPDATE_STATE_PATTERN_LENGTH+1];
+  snprintf(topic, sizeof(topic), MQTT_TOPIC_UPDATE_STATE_PATTERN, deviceIdentity.data.uuid);
+  mqttClient.beginPublish(topic, measureJson(mqttDoc), true);
+  BufferingPrint bufferedClient(mqttClient, 32);
+  serializeJson(mqttDoc, bufferedClient);
+  bufferedClient.flush();
+  mqttClient.endPublish();
+}
 
-    char title[64];
-    snprintf(title, sizeof(title), "Release %s is available", version);
+
+/**
+ * Shows and publishes OTA progress for partition
+*/
+void otaFirmware_reportProgress(const char* partition, size_t written, size_t total){
+  _otaUpdateInProcess = true;
+  if(strcmp(partition, _otaCurrentPartition) != 0){
+    strlcpy(_otaCurrentPartition, partition, sizeof(_otaCurrentPartition));
+    _otaLastPublishedPercentage = -1;
+    oled.setOTAPartition(partition);
+    oled.setPage(managerOled::PAGE_OTA_IN_PROGRESS);
+    char msg[OLED_CHARACTERS_PER_LINE+1];
+    snprintf(msg, sizeof(msg), "OTA %s update start", partition);
+    eventLog.createEvent(msg, EventLog::LOG_LEVEL_INFO);
+  }
+  oled.setProgressBar((float)written / (float)total);
+  int pct = (int)((float)written / (float)total * 100);
+  if(pct != _otaLastPublishedPercentage && deviceIdentity.enabled && mqttClient.connected()){
+    _otaLastPublishedPercentage = pct;
     JsonDocument mqttDoc;
-    mqttDoc["title"] = title;
     mqttDoc["installed_version"] = VERSION;
-    mqttDoc["latest_version"] = version;
-    if(releaseUrl && strlen(releaseUrl) > 0){
-      mqttDoc["release_url"] = releaseUrl;
+    mqttDoc["latest_version"] = _otaLatestVersion;
+    if(strlen(_otaReleaseUrl) > 0){ mqttDoc["release_url"] = _otaReleaseUrl; }
+    mqttDoc["in_progress"] = true;
+    mqttDoc["update_percentage"] = pct;
+    char title[32];
+    snprintf(title, sizeof(title), "Updating %s", _otaCurrentPartition);
+    mqttDoc["title"] = title;
+    char topic[MQTT_TOPIC_UPDATE_STATE_PATTERN_LENGTH+1];
+    snprintf(topic, sizeof(topic), MQTT_TOPIC_UPDATE_STATE_PATTERN, deviceIdentity.data.uuid);
+    mqttClient.beginPublish(topic, measureJson(mqttDoc), false);
+    BufferingPrint bufferedClient(mqttClient, 32);
+    serializeJson(mqttDoc, bufferedClient);
+    bufferedClient.flush();
+    mqttClient.endPublish();
+  }
+  mqttClient.loop();
+}
+
+
+/**
+ * Publishes the end of an OTA update and, on success, boots the new firmware.  An app partition
+ * rebuilt from a delta patch is only selected for boot here, once every other partition has been written.
+*/
+void otaFirmware_reportComplete(bool success){
+
+  if(success && _otaDeltaPartition != nullptr){
+    esp_err_t err = esp_ota_set_boot_partition(_otaDeltaPartition);
+    if(err != ESP_OK){
+      log_e("esp_ota_set_boot_partition: %s", esp_err_to_name(err));
+      success = false;
     }
-    mqttDoc["release_summary"] = "After updating, all outputs will be turned off.";
-    mqttDoc["in_progress"] = false;
+  }
+  _otaDeltaPartition = nullptr;
+
+  _otaUpdateInProcess = false;
+  _otaPendingRequest = false;
 
+  if(mqttClient.connected()){
     char topic[MQTT_TOPIC_UPDATE_STATE_PATTERN_LENGTH+1];
     snprintf(topic, sizeof(topic), MQTT_TOPIC_UPDATE_STATE_PATTERN, deviceIdentity.data.uuid);
+    JsonDocument mqttDoc;
+    mqttDoc["in_progress"] = false;
     mqttClient.beginPublish(topic, measureJson(mqttDoc), true);
     BufferingPrint bufferedClient(mqttClient, 32);
     serializeJson(mqttDoc, bufferedClient);
     bufferedClient.flush();
     mqttClient.endPublish();
-  });
+  }
 
-  otaFirmware.onError([](const char* partition, int err){
-    _otaCheckFailed = true;
-    _otaCheckErrorCode = err;
-    log_e("OTA error on %s: %d", partition, err);
-    if(deviceIdentity.enabled == false){ return; }
-    if(!mqttClient.connected()){ return; }
-    char availability_topic[MQTT_TOPIC_UPDATE_AVAILABILITY_LENGTH+1];
-    snprintf(availability_topic, sizeof(availability_topic), MQTT_TOPIC_UPDATE_AVAILABILITY_PATTERN, deviceIdentity.data.uuid);
-    mqttClient.publish(availability_topic, "offline");
-  });
+  if(success){
+    if(mqttClient.connected()){
+      char availability_topic[MQTT_TOPIC_UPDATE_AVAILABILITY_LENGTH+1];
+      snprintf(availability_topic, sizeof(availability_topic), MQTT_TOPIC_UPDATE_AVAILABILITY_PATTERN, deviceIdentity.data.uuid);
+      mqttClient.publish(availability_topic, "offline", true);
+    }
+    eventLog.createEvent("Rebooting...", EventLog::LOG_LEVEL_NOTIFICATION);
+    delay(5000);
+    ESP.restart();
+  }
+}
 
-  _otaManifestUrl = url;
-  eventLog.createEvent("OTA update enabled");
+
+/**
+ * Downloads the delta patch listed for the running version under an app binary and rebuilds the new
+ * image from it into the next OTA partition (see common/deltaOta.h), leaving it to otaFirmware_reportComplete()
+ * to boot.  The patch is checked against its sha256 and the rebuilt image against the binary's sha256.
+ * Returns false, having written nothing that will boot, if there is no patch for this version or it
+ * cannot be used; the caller then downloads the full image.
+*/
+bool otaFirmware_applyDelta(JsonVariant binary){
+
+  const char* url = nullptr;
+  const char* patchHash = "";
+
+  for(JsonVariant delta : binary["delta"].as<JsonArray>()){
+    if(strcmp(delta["base_version"] | "", VERSION) == 0){
+      url = delta["url"] | "";
+      patchHash = delta["sha256"] | "";
+      break;
+    }
+  }
+
+  if(url == nullptr || url[0] == '\0'){
+    return false;
+  }
+
+  /* Without the image's sha256 nothing proves the patch rebuilt the intended firmware; use the full image */
+  const char* targetHash = binary["sha256"] | "";
+  if(strlen(targetHash) != 64){
+    log_w("Delta skipped: manifest has no sha256 for the app image");
+    return false;
+  }
+
+  log_i("Applying delta from %s: %s", VERSION, url);
+
+  /* Verified against the same certificates as the full image download */
+  xSemaphoreTakeRecursive(_certBundleLock, portMAX_DELAY);
+  esp_http_client_handle_t client = cloudHttp.acquire(url, HTTP_METHOD_GET, 30000, _certBundle);
+  xSemaphoreGiveRecursive(_certBundleLock);
+  if(client == nullptr){
+    return false;
+  }
+
+  if(cloudHttp.open(client, 0) != ESP_OK){
+    cloudHttp.release(client, false);
+    eventLog.createEvent("OTA delta failed", EventLog::LOG_LEVEL_NOTIFICATION);
+    return false;
+  }
+
+  if(cloudHttp.fetchHeaders(client) < 0){
+    cloudHttp.release(client, false);
+    eventLog.createEvent("OTA delta failed", EventLog::LOG_LEVEL_NOTIFICATION);
+    return false;
+  }
+
+  int httpCode = esp_http_client_get_status_code(client);
+  if(httpCode != 200){
+    log_e("Delta download returned %d", httpCode);
+    cloudHttp.release(client, true);
+    eventLog.createEvent("OTA delta failed", EventLog::LOG_LEVEL_NOTIFICATION);
+    return false;
+  }
+
+  DeltaOta* delta = new DeltaOta();
+  BackupInflater inflater;
+  uint8_t* chunk = (uint8_t*)malloc(CLOUD_BACKUP_CHUNK_SIZE);
+
+  bool ok = chunk != nullptr && inflater.begin();
+
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+
+  while(ok){
+    int bytesRead = esp_http_client_read(client, (char*)chunk, CLOUD_BACKUP_CHUNK_SIZE);
+    if(bytesRead == 0 && esp_http_client_is_complete_data_received(client)){
+      break;
+    }
+    if(bytesRead <= 0){
+      log_e("Delta download incomplete");
+      ok = false;
+      break;
+    }
+
+    mbedtls_sha256_update(&sha, chunk, bytesRead);
+    ok = inflater.update(chunk, (size_t)bytesRead, [&](const uint8_t* data, size_t length){
+      return delta->update(data, length);
+    });
+
+    if(delta->targetLength() > 0){
+      otaFirmware_reportProgress("app", delta->written(), delta->targetLength());
+    }
+  }
+
+  cloudHttp.release(client, ok);
+  free(chunk);
+
+  uint8_t hash[32];
+  mbedtls_sha256_finish(&sha, hash);
+  mbedtls_sha256_free(&sha);
+
+  char hex[65];
+  for(int i = 0; i < 32; i++){
+    sprintf(hex + i*2, "%02x", hash[i]);
+  }
+
+  if(ok && (!inflater.isComplete() || (patchHash[0] != '\0' && strcasecmp(hex, patchHash) != 0))){
+    log_e("Delta patch is truncated or does not match its sha256");
+    ok = false;
+  }
+
+  if(ok){
+    for(int i = 0; i < 32; i++){
+      sprintf(hex + i*2, "%02x", delta->targetHash()[i]);
+    }
+    if(strcasecmp(hex, targetHash) != 0){
+      log_e("Delta patch does not build the requested image");
+      ok = false;
+    }
+  }
+
+  ok = ok && delta->finish();
+
+  if(ok){
+    _otaDeltaPartition = delta->partition();
+  } else {
+    _otaDeltaPartition = nullptr;
+    log_e("Delta OTA failed: %s", delta->error() ? delta->error() : "download failed");
+    delta->abort();
+  }
+
+  delete delta;
+
+  eventLog.createEvent(ok ? "OTA app finished" : "OTA delta failed", ok ? EventLog::LOG_LEVEL_INFO : EventLog::LOG_LEVEL_NOTIFICATION);
+  return ok;
 }
 
 
@@ -3661,8 +4646,14 @@ void otaFirmware_checkPending(){
     return;
   }
 
+  /* otaFirmware is not shared between tasks; wait for a manifest check on the network worker to finish */
+  if(networkWorker.isPending(NETWORK_JOB_OTA_CHECK)){
+    return;
+  }
+
   _otaUpdateInProcess = true;
   _otaCurrentPartition[0] = '\0';
+  _otaDeltaPartition = nullptr;
 
   bool isForced = (_otaPendingDoc.size() > 0);
 
@@ -3709,38 +4700,7 @@ void otaFirmware_checkPending(){
   }
 
   otaFirmware.onProgress([](const char* partition, size_t written, size_t total){
-    _otaUpdateInProcess = true;
-    if(strcmp(partition, _otaCurrentPartition) != 0){
-      strlcpy(_otaCurrentPartition, partition, sizeof(_otaCurrentPartition));
-      _otaLastPublishedPercentage = -1;
-      oled.setOTAPartition(partition);
-      oled.setPage(managerOled::PAGE_OTA_IN_PROGRESS);
-      char msg[OLED_CHARACTERS_PER_LINE+1];
-      snprintf(msg, sizeof(msg), "OTA %s update start", partition);
-      eventLog.createEvent(msg, EventLog::LOG_LEVEL_INFO);
-    }
-    oled.setProgressBar((float)written / (float)total);
-    int pct = (int)((float)written / (float)total * 100);
-    if(pct != _otaLastPublishedPercentage && deviceIdentity.enabled && mqttClient.connected()){
-      _otaLastPublishedPercentage = pct;
-      JsonDocument mqttDoc;
-      mqttDoc["installed_version"] = VERSION;
-      mqttDoc["latest_version"] = _otaLatestVersion;
-      if(strlen(_otaReleaseUrl) > 0){ mqttDoc["release_url"] = _otaReleaseUrl; }
-      mqttDoc["in_progress"] = true;
-      mqttDoc["update_percentage"] = pct;
-      char title[32];
-      snprintf(title, sizeof(title), "Updating %s", _otaCurrentPartition);
-      mqttDoc["title"] = title;
-      char topic[MQTT_TOPIC_UPDATE_STATE_PATTERN_LENGTH+1];
-      snprintf(topic, sizeof(topic), MQTT_TOPIC_UPDATE_STATE_PATTERN, deviceIdentity.data.uuid);
-      mqttClient.beginPublish(topic, measureJson(mqttDoc), false);
-      BufferingPrint bufferedClient(mqttClient, 32);
-      serializeJson(mqttDoc, bufferedClient);
-      bufferedClient.flush();
-      mqttClient.endPublish();
-    }
-    mqttClient.loop();
+    otaFirmware_reportProgress(partition, written, total);
   });
 
   otaFirmware.onPartitionComplete([](const char* partition, bool success){
@@ -3750,41 +4710,34 @@ void otaFirmware_checkPending(){
   });
 
   otaFirmware.onComplete([](bool success){
-    _otaUpdateInProcess = false;
-    _otaPendingRequest = false;
+    otaFirmware_reportComplete(success);
+  });
 
-    if(mqttClient.connected()){
-      char topic[MQTT_TOPIC_UPDATE_STATE_PATTERN_LENGTH+1];
-      snprintf(topic, sizeof(topic), MQTT_TOPIC_UPDATE_STATE_PATTERN, deviceIdentity.data.uuid);
-      JsonDocument mqttDoc;
-      mqttDoc["in_progress"] = false;
-      mqttClient.beginPublish(topic, measureJson(mqttDoc), true);
-      BufferingPrint bufferedClient(mqttClient, 32);
-      serializeJson(mqttDoc, bufferedClient);
-      bufferedClient.flush();
-      mqttClient.endPublish();
+  if(isForced){
+    /* A delta patch for the running version replaces the app download; the full image is still used if it fails */
+    JsonArray binaries = _otaPendingDoc["binaries"].as<JsonArray>();
+    for(size_t i = 0; i < binaries.size(); i++){
+      if(strcmp(binaries[i]["partition"] | "", "app") == 0 && otaFirmware_applyDelta(binaries[i])){
+        binaries.remove(i);
+        break;
+      }
     }
 
-    if(success){
-      if(mqttClient.connected()){
-        char availability_topic[MQTT_TOPIC_UPDATE_AVAILABILITY_LENGTH+1];
-        snprintf(availability_topic, sizeof(availability_topic), MQTT_TOPIC_UPDATE_AVAILABILITY_PATTERN, deviceIdentity.data.uuid);
-        mqttClient.publish(availability_topic, "offline", true);
-      }
-      eventLog.createEvent("Rebooting...", EventLog::LOG_LEVEL_NOTIFICATION);
-      delay(5000);
-      ESP.restart();
+    if(binaries.size() == 0){
+      _otaPendingDoc.clear();
+      otaFirmware_reportComplete(true);
+      return;
     }
-  });
 
-  if(isForced){
     otaFirmware.execOTA(_otaPendingDoc);
     _otaPendingDoc.clear();
   } else {
     otaFirmware.execOTA();
   }
 
-  /* Only reached on failure — onComplete handles restart on success */
+  /* Only reached on failure — onComplete handles restart on success.  A rebuilt app partition is
+     never booted once the rest of the update has failed. */
+  _otaDeltaPartition = nullptr;
   _otaUpdateInProcess = false;
   _otaPendingRequest = false;
 }
@@ -3807,20 +4760,33 @@ void setupIO(){
     return;
   }
 
-  String filename = CONFIGFS_PATH_CONTROLLERS + (String)"/" + deviceIdentity.data.uuid;
+  ControllerConfigCache::loadResult result = runtimeConfig_load();
 
-  if(!configFS.exists(filename)){
+  if(result == ControllerConfigCache::LOAD_NOT_FOUND){
     eventLog.createEvent("No I/O file to read");
     return;
   }
 
-  if(!setup_outputs(filename)){
-    isOK = false;
+  if(result == ControllerConfigCache::LOAD_PARSE_FAIL){
+    char text[OLED_CHARACTERS_PER_LINE+1];
+    snprintf(text, sizeof(text), "I/O parse err %s", controllerConfig.error().c_str());
+    eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
   }
 
-  if(!setup_inputs(filename)){
+  if(result != ControllerConfigCache::LOAD_OK){
     isOK = false;
-  };
+  }
+
+  if(result == ControllerConfigCache::LOAD_OK){
+
+    if(!setup_outputs(runtimeConfig)){
+      isOK = false;
+    }
+
+    if(!setup_inputs(runtimeConfig)){
+      isOK = false;
+    };
+  }
 
   if(isOK){
       eventLog.createEvent("I/O setup read OK");
@@ -3831,81 +4797,55 @@ void setupIO(){
 
 
 /***
- * Sets up the outputs from the JSON document stored on ConfigFS.
+ * Sets up the outputs from the controller config.
  * 
- * @param filename the filename of the config file to use, which should already have been checked to exist
- * @note if the JSON document describes ports which are greater in number to the maximum number of ports for this hardware, they are ignored.  The JSON document is filtered before being read
+ * @param config the compiled controller config
+ * @note if the config describes ports which are greater in number to the maximum number of ports for this hardware, they are ignored
  */
-bool setup_outputs(String filename){
+bool setup_outputs(const RuntimeConfigImage& config){
 
   boolean isOK = true;
-  JsonDocument filter;
-
-  JsonObject filter_outputs__ = filter["outputs"]["*"].to<JsonObject>();
-  filter_outputs__["id"] = true;
-  filter_outputs__["type"] = true;
-  filter_outputs__["enabled"] = true;
-  filter_outputs__["start_brightness"] = true;
-
-  String plaintext;
-  if(!secretEncryption.decryptFromFile(configFS, filename, plaintext)){
-    eventLog.createEvent("Config decrypt fail", EventLog::LOG_LEVEL_ERROR);
-    log_e("Failed to decrypt %s", filename.c_str());
-    return false;
-  }
-
-  JsonDocument doc; //Supports up to 32 ports
-  DeserializationError error = deserializeJson(doc, plaintext, DeserializationOption::Filter(filter));
 
-  if(error) {
-    char text[OLED_CHARACTERS_PER_LINE+1];
-    snprintf(text, sizeof(text), "Out parse err %s", error.c_str());
-    eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
-    return false;
-  }
+  for (uint16_t i = 0; i < config.header().outputCount; i++) {
 
-  for (JsonPair output : doc["outputs"].as<JsonObject>()) {
+    const RuntimeConfigImage::outputRecord& output = config.output(i);
 
-    int8_t outputPortNumber = atoi(output.key().c_str());
-
-    if(outputPortNumber > (OUTPUT_CONTROLLER_COUNT * OUTPUT_CONTROLLER_COUNT_PINS)){
+    if(output.port > (OUTPUT_CONTROLLER_COUNT * OUTPUT_CONTROLLER_COUNT_PINS)){
       char text[OLED_CHARACTERS_PER_LINE+1];
-      snprintf(text, sizeof(text), "Out prt %s > max", output.key().c_str());
+      snprintf(text, sizeof(text), "Out prt %d > max", output.port);
       eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
       isOK = false;
       continue;
     }
 
-    if(outputPortNumber < 1){
+    if(output.port < 1){
       char text[OLED_CHARACTERS_PER_LINE+1];
-      snprintf(text, sizeof(text), "Out prt %s < 1", output.key().c_str());
+      snprintf(text, sizeof(text), "Out prt %d < 1", output.port);
       eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
       isOK = false;
       continue;
     }
 
-    if(output.value()["id"].isNull()){
+    if(output.id == RuntimeConfigImage::NO_STRING){
       char text[OLED_CHARACTERS_PER_LINE+1];
-      snprintf(text, sizeof(text), "Out prt %s no id", output.key().c_str());
+      snprintf(text, sizeof(text), "Out prt %d no id", output.port);
       eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
       isOK = false;
       continue;
     }
 
-    outputs.setPortId(outputPortNumber, output.value()["id"]);
+    outputs.setPortId(output.port, config.string(output.id));
 
-    if(!output.value()["type"].isNull()){
-      if(strcmp(output.value()["type"], "VARIABLE") == 0){
-        outputs.setPortType(outputPortNumber, nsOutputs::outputPin::VARIABLE);
-      }
+    if(output.type == RuntimeConfigImage::OUTPUT_TYPE_VARIABLE){
+      outputs.setPortType(output.port, nsOutputs::outputPin::VARIABLE);
     }
 
-    if(!output.value()["enabled"].isNull()){
-      outputs.enablePort(outputPortNumber, output.value()["enabled"].as<boolean>());
+    if(output.flags & RuntimeConfigImage::OUTPUT_HAS_ENABLED){
+      outputs.enablePort(output.port, output.flags & RuntimeConfigImage::OUTPUT_ENABLED);
     }
 
-    if(!output.value()["start_brightness"].isNull()){
-      outputs.setPortStartBrightness(outputPortNumber, output.value()["start_brightness"].as<uint8_t>());
+    if(output.flags & RuntimeConfigImage::OUTPUT_HAS_START_BRIGHTNESS){
+      outputs.setPortStartBrightness(output.port, output.startBrightness);
     }
 
   }
@@ -3915,73 +4855,50 @@ bool setup_outputs(String filename){
 
 
 /***
- * Sets up the inputs and actions from the JSON document stored on ConfigFS.
+ * Sets up the inputs and actions from the controller config.
  * 
- * @param filename the filename of the config file to use, which should already have been checked to exist
+ * @param config the compiled controller config
  * @returns true on success, false on failure
- * @note if the JSON document describes ports which are greater in number to the maximum number of ports for this hardware, they are ignored.  The JSON document is filtered before being read
+ * @note if the config describes ports which are greater in number to the maximum number of ports for this hardware, they are ignored
  */
-bool setup_inputs(String filename){
+bool setup_inputs(const RuntimeConfigImage& config){
 
   boolean isOK = true;
-  JsonDocument filter;
-
-  JsonObject filter_ports = filter["ports"]["*"].to<JsonObject>();
-  filter_ports["id"] = true;
-  filter_ports["clientUUID"] = true;
-
-  JsonObject filter_ports_channels = filter_ports["channels"]["*"].to<JsonObject>();
-  filter_ports_channels["type"] = true;
-  filter_ports_channels["enabled"] = true;
-  filter_ports_channels["offset"] = true;
-  filter_ports_channels["actions"] = true;
-
-  String plaintext;
-  if(!secretEncryption.decryptFromFile(configFS, filename, plaintext)){
-    eventLog.createEvent("Config decrypt fail", EventLog::LOG_LEVEL_ERROR);
-    log_e("Failed to decrypt %s", filename.c_str());
-    return false;
-  }
-
-  JsonDocument doc(&spiRamAllocator); //Supports up to 32 ports
-  DeserializationError error = deserializeJson(doc, plaintext, DeserializationOption::Filter(filter));
 
-  if(error) {
-    char text[OLED_CHARACTERS_PER_LINE+1];
-    snprintf(text, sizeof(text), "In parse err %s", error.c_str());
-    eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
-    return false;
-  }
+  for (uint16_t p = 0; p < config.header().portCount; p++) {
 
-  for (JsonPair port : doc["ports"].as<JsonObject>()) {
+    const RuntimeConfigImage::portRecord& port = config.port(p);
 
-    if(atoi(port.key().c_str()) > (IO_EXTENDER_COUNT_PINS / IO_EXTENDER_COUNT_CHANNELS_PER_PORT) * IO_EXTENDER_COUNT){
+    if(port.port > (IO_EXTENDER_COUNT_PINS / IO_EXTENDER_COUNT_CHANNELS_PER_PORT) * IO_EXTENDER_COUNT){
       char text[OLED_CHARACTERS_PER_LINE+1];
-      snprintf(text, sizeof(text), "In prt %s > max", port.key().c_str());
+      snprintf(text, sizeof(text), "In prt %d > max", port.port);
       eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
       isOK = false;
       continue;
     }
 
-    if(atoi(port.key().c_str()) < 1){
+    if(port.port < 1){
       char text[OLED_CHARACTERS_PER_LINE+1];
-      snprintf(text, sizeof(text), "In prt %s < 1", port.key().c_str());
+      snprintf(text, sizeof(text), "In prt %d < 1", port.port);
       eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
       isOK = false;
       continue;
     }
 
-    strlcpy(inputPorts[atoi(port.key().c_str())-1].id, port.value()["id"], sizeof(inputPorts[atoi(port.key().c_str())-1].id));
-    strlcpy(inputPorts[atoi(port.key().c_str())-1].clientUUID, port.value()["clientUUID"] | "", sizeof(inputPorts[atoi(port.key().c_str())-1].clientUUID));
+    inputPort& configuredPort = inputPorts[port.port-1];
+
+    strlcpy(configuredPort.id, config.string(port.id) ?: "", sizeof(configuredPort.id));
+    strlcpy(configuredPort.clientUUID, config.string(port.clientUUID) ?: "", sizeof(configuredPort.clientUUID));
 
     uint8_t i = 0;
 
-    JsonObject channels = port.value()["channels"].as<JsonObject>();
-    for (JsonPair port_value_channel : channels){
+    for (uint16_t c = port.firstChannel; c < port.firstChannel + port.channelCount; c++){
+
+      const RuntimeConfigImage::channelRecord& channel = config.channel(c);
 
-      if(i > IO_EXTENDER_COUNT_CHANNELS_PER_PORT){
+      if(i >= IO_EXTENDER_COUNT_CHANNELS_PER_PORT){
         char text[OLED_CHARACTERS_PER_LINE+1];
-        snprintf(text, sizeof(text), "In prt %s ch > max", port.key().c_str());
+        snprintf(text, sizeof(text), "In prt %d ch > max", port.port);
         eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
         isOK = false;
         continue;
@@ -3989,78 +4906,44 @@ bool setup_inputs(String filename){
 
       managerInputs::portChannel portChannel;
 
-      portChannel.port = atoi(port.key().c_str());
-      portChannel.channel = atoi(port_value_channel.key().c_str());
-      inputPorts[atoi(port.key().c_str())-1].channels[i].channel = portChannel.channel;
+      portChannel.port = port.port;
+      portChannel.channel = channel.channel;
+      configuredPort.channels[i].channel = portChannel.channel;
 
-      if(port_value_channel.value()["type"]){
-        if(port_value_channel.value()["type"] != "NORMALLY_OPEN"){
-          inputs.setPortChannelInputType(portChannel, managerInputs::NORMALLY_CLOSED);
-        }
+      if(channel.flags & RuntimeConfigImage::CHANNEL_NORMALLY_CLOSED){
+        inputs.setPortChannelInputType(portChannel, managerInputs::NORMALLY_CLOSED);
       }
 
-      if(port_value_channel.value()["enabled"]){
-        inputs.enablePortChannel(portChannel, port_value_channel.value()["enabled"].as<boolean>());
+      if(channel.flags & RuntimeConfigImage::CHANNEL_ENABLE){
+        inputs.enablePortChannel(portChannel, true);
       }
 
-      if(port_value_channel.value()["offset"]){
-        inputs.setOffset(portChannel, port_value_channel.value()["offset"].as<uint8_t>());
+      if(channel.flags & RuntimeConfigImage::CHANNEL_HAS_OFFSET){
+        inputs.setOffset(portChannel, channel.offset);
       }
 
-      JsonArray actions = port_value_channel.value()["actions"].as<JsonArray>();
-      for (JsonObject port_value_channel_value_action : actions) {
+      for (uint16_t a = channel.firstAction; a < channel.firstAction + channel.actionCount; a++) {
 
-        bool actionIsOK = false;
+        const RuntimeConfigImage::actionRecord& action = config.action(a);
 
         inputAction newInputAction;
 
-        if(!port_value_channel_value_action["action"].isNull()){
-        
-          if(strcmp(port_value_channel_value_action["action"], "INCREASE") == 0){
-            newInputAction.action = INCREASE;
-            actionIsOK = true;
-          }
-
-          if(strcmp(port_value_channel_value_action["action"], "INCREASE_MAXIMUM") == 0){
-            newInputAction.action = INCREASE_MAXIMUM;
-            actionIsOK = true;
-          }
-
-          if(strcmp(port_value_channel_value_action["action"], "DECREASE") == 0){
-            newInputAction.action = DECREASE;
-            actionIsOK = true;
-          }
-
-          if(strcmp(port_value_channel_value_action["action"], "DECREASE_MAXIMUM") == 0){
-            newInputAction.action = DECREASE_MAXIMUM;
-            actionIsOK = true;
-          }
+        bool actionIsOK = action.action != RuntimeConfigImage::ACTION_INVALID && action.output != 0;
 
-          if(strcmp(port_value_channel_value_action["action"], "TOGGLE") == 0){
-            newInputAction.action = TOGGLE;
-            actionIsOK = true;
-          }
-        }
+        newInputAction.action = (outputAction)action.action;
+        newInputAction.output = action.output;
 
-        if(port_value_channel_value_action["change_state"].isNull()){
-          newInputAction.changeState = managerInputs::changeState::CHANGE_STATE_SHORT_DURATION;
+        if(action.changeState == RuntimeConfigImage::CHANGE_STATE_LONG){
+          newInputAction.changeState = managerInputs::changeState::CHANGE_STATE_LONG_DURATION;
         }else{
-          if(strcmp(port_value_channel_value_action["change_state"], "LONG") == 0){
-            newInputAction.changeState = managerInputs::changeState::CHANGE_STATE_LONG_DURATION;
-          }
-        }
-
-        newInputAction.output = port_value_channel_value_action["output"].as<uint8_t>();
-
-        if(newInputAction.output == 0){
-          actionIsOK = false;
+          newInputAction.changeState = managerInputs::changeState::CHANGE_STATE_SHORT_DURATION;
         }
 
         if(actionIsOK){
-          inputPorts[atoi(port.key().c_str())-1].channels[i].actions.add(newInputAction);
+          configuredPort.channels[i].actions.add(newInputAction);
         }else{
           char text[OLED_CHARACTERS_PER_LINE+1];
-          snprintf(text, sizeof(text), "In prt %s ch %s inv act", port.key().c_str(), port_value_channel.key().c_str());
+          snprintf(text, sizeof(text), "In prt %d ch %u inv act", port.port, channel.channel);
           eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
           isOK = false;
         }
@@ -4096,6 +4979,7 @@ void mqtt_onDisconnect(){
   eventLog.createEvent(text);
   eventLog.createEvent("MQTT disconnected", EventLog::LOG_LEVEL_ERROR);
   _mqttWasConnected = false;
+  mqttConnector.lost();
 }
 
 
@@ -4109,54 +4993,71 @@ void mqtt_reconnect(){
     return;
   }
 
-  if((esp_timer_get_time() - mqttClient.lastReconnectAttemptTime >= (uint64_t)MQTT_RECONNECT_WAIT_MILLISECONDS * 1000ULL) || mqttClient.lastReconnectAttemptTime == 0){
-
-    if(mqttClient.connect(deviceIdentity.data.uuid, mqttClient.username, mqttClient.password, mqttClient.topic_availability, 2, true, "offline")) {
-        mqttClient.lastReconnectAttemptTime = 0;
-        _mqttWasConnected = true;
-        log_d("MQTT connected at uptime=%llu s; httpServerIsActive=%d lastTimeHttpServerUsed=%lu", esp_timer_get_time() / 1000000ULL, httpServerIsActive, lastTimeHttpServerUsed);
-        eventLog.createEvent("MQTT connected");
-        eventLog.resolveError("MQTT disconnected");
-        mqttClient.publish(mqttClient.topic_availability, "online", true);
-        char _httpServerCommandTopic[MQTT_TOPIC_HTTP_SERVER_SET_PATTERN_LENGTH+1];
-        snprintf(_httpServerCommandTopic, sizeof(_httpServerCommandTopic), MQTT_TOPIC_HTTP_SERVER_SET_PATTERN, deviceIdentity.data.uuid);
-        mqttClient.publish(_httpServerCommandTopic, httpServerIsActive ? "ON" : "OFF", true);
-        mqttClient.resubscribe();
-        if(!mqttClient.autoDiscovery.sent){
-          mqtt_autoDiscovery_update();
-          mqtt_autoDiscovery_temperature();
-          mqtt_autoDiscovery_outputs();
-          mqtt_autoDiscovery_inputs();
-          mqtt_autoDiscovery_inputControllers();
-          mqtt_autoDiscovery_outputControllers();
-          mqtt_autoDiscovery_start_time();
-          mqtt_autoDiscovery_ip_address();
-          mqtt_autoDiscovery_mac_address();
-          mqtt_autoDiscovery_count_errors();
-          mqtt_autoDiscovery_http_server();
-          mqtt_autoDiscovery_heapFree();
-          mqtt_autoDiscovery_heapLargestFreeBlock();
-          mqttClient.autoDiscovery.sent = true;
-          if(deviceIdentity.enabled && !_otaManifestUrl.isEmpty()){
-            char update_avail_topic[MQTT_TOPIC_UPDATE_AVAILABILITY_LENGTH+1];
-            snprintf(update_avail_topic, sizeof(update_avail_topic), MQTT_TOPIC_UPDATE_AVAILABILITY_PATTERN, deviceIdentity.data.uuid);
-            mqttClient.publish(update_avail_topic, "offline", true);
-          }
-        }
-        mqtt_publishAllAvailability();
-        mqtt_publishTemperatures();
-        mqtt_publishStartTime();
-        mqtt_publishIPAddress();
-        mqtt_publishMACAddress();
-        mqtt_publishCountErrors();
-        mqtt_publishHttpServerStateChanged(httpServerIsActive);
-        mqtt_publishClientCertState();
-        mqtt_publishControllerCertState();
-        return;
-    }
+  /* The lookup, TCP connect and TLS handshake run in the background; nothing to do until they are done */
+  if(!mqttConnector.poll()){
+    return;
+  }
 
-    mqttClient.lastReconnectAttemptTime = esp_timer_get_time();
+  /* With the connection already open, connect() only sends CONNECT and waits for CONNACK; bound that wait */
+  mqttClient.setSocketTimeout(MQTT_CONNACK_TIMEOUT_SECONDS);
+  bool connected = mqttClient.connect(deviceIdentity.data.uuid, mqttClient.username, mqttClient.password, mqttClient.topic_availability, 2, true, "offline", !mqttClient.persistentSession);
+  mqttClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+
+  if(!connected){
+    log_w("MQTT broker rejected the connection; state=%d", mqttClient.state());
+    mqttTransport.stop();
+    mqttConnector.failed();
+    return;
+  }
+
+  mqttConnector.succeeded();
+
+  _mqttWasConnected = true;
+  log_d("MQTT connected at uptime=%llu s; httpServerIsActive=%d lastTimeHttpServerUsed=%lu", esp_timer_get_time() / 1000000ULL, httpServerIsActive, lastTimeHttpServerUsed);
+  eventLog.createEvent("MQTT connected");
+  eventLog.resolveError("MQTT disconnected");
+  mqttClient.publish(mqttClient.topic_availability, "online", true);
+  char _httpServerCommandTopic[MQTT_TOPIC_HTTP_SERVER_SET_PATTERN_LENGTH+1];
+  snprintf(_httpServerCommandTopic, sizeof(_httpServerCommandTopic), MQTT_TOPIC_HTTP_SERVER_SET_PATTERN, deviceIdentity.data.uuid);
+  mqttClient.publish(_httpServerCommandTopic, httpServerIsActive ? "ON" : "OFF", true);
+
+  /* A broker that kept the session still has every subscription */
+  if(mqttClient.persistentSession && mqttTransport.sessionPresent() && !mqttClient.resubscribeNeeded){
+    log_d("MQTT session resumed; skipping resubscribe");
+  } else {
+    mqttClient.resubscribe();
+  }
+
+  if(!mqttClient.autoDiscovery.sent){
+    mqtt_autoDiscovery_update();
+    mqtt_autoDiscovery_temperature();
+    mqtt_autoDiscovery_outputs();
+    mqtt_autoDiscovery_inputs();
+    mqtt_autoDiscovery_inputControllers();
+    mqtt_autoDiscovery_outputControllers();
+    mqtt_autoDiscovery_start_time();
+    mqtt_autoDiscovery_ip_address();
+    mqtt_autoDiscovery_mac_address();
+    mqtt_autoDiscovery_count_errors();
+    mqtt_autoDiscovery_http_server();
+    mqtt_autoDiscovery_heapFree();
+    mqtt_autoDiscovery_heapLargestFreeBlock();
+    mqttClient.autoDiscovery.sent = true;
+    if(deviceIdentity.enabled && !_otaManifestUrl.isEmpty()){
+      char update_avail_topic[MQTT_TOPIC_UPDATE_AVAILABILITY_LENGTH+1];
+      snprintf(update_avail_topic, sizeof(update_avail_topic), MQTT_TOPIC_UPDATE_AVAILABILITY_PATTERN, deviceIdentity.data.uuid);
+      mqttClient.publish(update_avail_topic, "offline", true);
+    }
   }
+  mqtt_publishAllAvailability();
+  mqtt_publishTemperatures();
+  mqtt_publishStartTime();
+  mqtt_publishIPAddress();
+  mqtt_publishMACAddress();
+  mqtt_publishCountErrors();
+  mqtt_publishHttpServerStateChanged(httpServerIsActive);
+  mqtt_publishClientCertState();
+  mqtt_publishControllerCertState();
 }
 
 
@@ -4174,75 +5075,62 @@ void setupMQTT(){
   strcpy(mqttClient.topic_availability, topic_availability);
   mqttClient.setCallback(eventHandler_mqttMessageReceived);
 
-  String filename = CONFIGFS_PATH_CONTROLLERS + (String)"/" + deviceIdentity.data.uuid;
+  ControllerConfigCache::loadResult result = runtimeConfig_load();
 
-  if(!configFS.exists(filename)){
+  if(result == ControllerConfigCache::LOAD_PARSE_FAIL) {
+    char text[OLED_CHARACTERS_PER_LINE+1];
+    snprintf(text, sizeof(text), "MQTT parse err %s", controllerConfig.error().c_str());
+    eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
     return;
   }
 
-  JsonDocument filter;
-  filter["name"] = true;
-  filter["area"] = true;
-  filter["mqtt"] = true;
-
-  String plaintext;
-  if(!secretEncryption.decryptFromFile(configFS, filename, plaintext)){
-    eventLog.createEvent("Config decrypt fail", EventLog::LOG_LEVEL_ERROR);
-    log_e("Failed to decrypt %s", filename.c_str());
+  if(result != ControllerConfigCache::LOAD_OK){
     return;
   }
 
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, plaintext, DeserializationOption::Filter(filter));
-
-  if(error) {
-    char text[OLED_CHARACTERS_PER_LINE+1];
-    snprintf(text, sizeof(text), "MQTT parse err %s", error.c_str());
-    eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
-    return;
-  }
+  const RuntimeConfigImage::imageHeader& config = runtimeConfig.header();
 
-  if(!doc["name"].isNull()){
-    mqttClient.autoDiscovery.setDeviceName(doc["name"].as<String>().c_str());
+  if(config.name != RuntimeConfigImage::NO_STRING){
+    mqttClient.autoDiscovery.setDeviceName(runtimeConfig.string(config.name));
   }
 
-  if(!doc["area"].isNull()){
-    mqttClient.autoDiscovery.setSuggestedArea(doc["area"].as<String>().c_str());
+  if(config.area != RuntimeConfigImage::NO_STRING){
+    mqttClient.autoDiscovery.setSuggestedArea(runtimeConfig.string(config.area));
   }
 
-  if(doc["mqtt"].isNull()){
+  if(!(config.flags & RuntimeConfigImage::HAS_MQTT)){
     char text[OLED_CHARACTERS_PER_LINE+1];
     snprintf(text, sizeof(text), "MQTT obj missing");
     eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
     return;
   }
 
-  JsonObject mqtt = doc["mqtt"];
-  uint16_t port = 1883;
+  bool tls = config.flags & RuntimeConfigImage::MQTT_TLS;
+  uint16_t port = tls ? 8883 : 1883;
 
-  if(mqtt["host"].isNull()){
+  if(config.mqttHost == RuntimeConfigImage::NO_STRING){
     char text[OLED_CHARACTERS_PER_LINE+1];
     snprintf(text, sizeof(text), "MQTT host missing");
     eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
     return;
   }
 
-  if(mqtt["username"].isNull()){
+  if(config.mqttUsername == RuntimeConfigImage::NO_STRING){
     char text[OLED_CHARACTERS_PER_LINE+1];
     snprintf(text, sizeof(text), "MQTT user missing");
     eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
     return;
   }
 
-  if(mqtt["password"].isNull()){
+  if(config.mqttPassword == RuntimeConfigImage::NO_STRING){
     char text[OLED_CHARACTERS_PER_LINE+1];
     snprintf(text, sizeof(text), "MQTT pass missing");
     eventLog.createEvent(text, EventLog::LOG_LEVEL_ERROR);
     return;
   }
 
-  if(!mqtt["port"].isNull()){
-    port = mqtt["port"];
+  if(config.flags & RuntimeConfigImage::HAS_MQTT_PORT){
+    port = config.mqttPort;
   }
 
   uint8_t ethMac[6];
@@ -4264,7 +5152,7 @@ void setupMQTT(){
   mqttApplication.toLowerCase();
   mqttApplication.replace(" ", "-");
 
-  String host = mqtt["host"].as<String>();
+  String host = runtimeConfig.string(config.mqttHost);
   host.replace("$$mac$$", macOnly);
   host.replace("$$mac_dashes$$", macDashes);
   host.replace("$$mac_colons$$", macColons);
@@ -4276,8 +5164,13 @@ void setupMQTT(){
   host.replace("$$product_hex$$", mqttProductHex);
   host.replace("$$current_version$$", VERSION);
   mqttClient.setServer(host.c_str(), port);
+  mqttTransport.setTls(tls);
+  xSemaphoreTakeRecursive(_certBundleLock, portMAX_DELAY);
+  mqttTransport.setCACert(_certBundle);
+  xSemaphoreGiveRecursive(_certBundleLock);
+  mqttConnector.begin(host.c_str(), port, mqttTransport);
 
-  String username = mqtt["username"].as<String>();
+  String username = runtimeConfig.string(config.mqttUsername);
   username.replace("$$mac$$", macOnly);
   username.replace("$$mac_dashes$$", macDashes);
   username.replace("$$mac_colons$$", macColons);
@@ -4290,7 +5183,7 @@ void setupMQTT(){
   username.replace("$$current_version$$", VERSION);
   mqttClient.setUsername(username.c_str());
 
-  String password = mqtt["password"].as<String>();
+  String password = runtimeConfig.string(config.mqttPassword);
   password.replace("$$mac$$", macOnly);
   password.replace("$$mac_dashes$$", macDashes);
   password.replace("$$mac_colons$$", macColons);
@@ -4301,10 +5194,79 @@ void setupMQTT(){
   password.replace("$$current_version$$", VERSION);
   mqttClient.setPassword(password.c_str());
 
+  mqttClient.persistentSession = config.flags & RuntimeConfigImage::MQTT_PERSISTENT_SESSION;
   mqttClient.enabled = true;
 }
 
 
+/***
+ * Sets up the remote log sink from the optional syslog object in the controller config
+ */
+void setupSyslog(){
+
+  if(deviceIdentity.enabled == false){
+    return;
+  }
+
+  if(runtimeConfig_load() != ControllerConfigCache::LOAD_OK){
+    return;
+  }
+
+  const RuntimeConfigImage::imageHeader& config = runtimeConfig.header();
+
+  if(!(config.flags & RuntimeConfigImage::HAS_SYSLOG)){
+    return;
+  }
+
+
+  if(config.syslogHost == RuntimeConfigImage::NO_STRING){
+    eventLog.createEvent("Syslog host missing", EventLog::LOG_LEVEL_ERROR);
+    return;
+  }
+
+  uint16_t port = (config.flags & RuntimeConfigImage::HAS_SYSLOG_PORT) ? config.syslogPort : SYSLOG_DEFAULT_PORT;
+  uint16_t rateLimit = (config.flags & RuntimeConfigImage::HAS_SYSLOG_RATE_LIMIT) ? config.syslogRateLimit : SYSLOG_DEFAULT_RATE_LIMIT;
+
+  SyslogSink::format format = SyslogSink::FORMAT_RFC5424;
+  if(config.syslogFormat == RuntimeConfigImage::SYSLOG_NDJSON){
+    format = SyslogSink::FORMAT_NDJSON;
+  }
+
+  uint8_t ethMac[6];
+  esp_read_mac(ethMac, ESP_MAC_ETH);
+  char hostname[18] = {0};
+  sprintf(hostname, "FireFly-%02X%02X%02X", ethMac[3], ethMac[4], ethMac[5]);
+
+  syslogSink.begin(runtimeConfig.string(config.syslogHost), port, format, rateLimit, hostname, APPLICATION, &timeClient);
+
+  #if CORE_DEBUG_LEVEL > 0 && !TELNET_LOG_DEFERRED
+    TelnetLog::setTap(&syslog_tapLogLine);
+  #endif
+}
+
+
+/***
+ * Receives every formatted log_* line from TelnetLog and queues it for the remote log sink
+ */
+void syslog_tapLogLine(const char* text, size_t length){
+  syslogSink.logArduino(text, length);
+}
+
+
+/***
+ * Queues the newest event log entry for the remote log sink
+ */
+void syslog_forwardLatestEvent(SyslogSink::severity level){
+
+  if(!syslogSink.isEnabled() || eventLog.getEventCount() == 0){
+    return;
+  }
+
+  EventLog::eventLogEntry entry = eventLog.getEvent(eventLog.getEventCount() - 1);
+  syslogSink.log(level, entry.text, strlen(entry.text), true);
+}
+
+
 /***
  * Handles MQTT message received events for subscribed topics
  */
@@ -4558,23 +5520,9 @@ void mqtt_publishClientCertState(){
     return;
   }
 
-  String certPath = CONFIGFS_PATH_CERTS + (String)"/" + clientFilename;
-  if(!configFS.exists(certPath)){
-    mqttClient.publish("FireFly/clients/cert/state", "", true);
-    return;
-  }
-
-  File f = configFS.open(certPath, "r");
-  if(!f){
-    mqttClient.publish("FireFly/clients/cert/state", "", true);
-    return;
-  }
-  String pem = "";
-  while(f.available()) pem += (char)f.read();
-  f.close();
-
-  String fingerprint = computeCertFingerprint(pem);
-  if(fingerprint.isEmpty()){
+  const char* fingerprint = certTypes[clientFilename]["fingerprint"];
+  String pem;
+  if(fingerprint == nullptr || !readCertPem(clientFilename, pem)){
     mqttClient.publish("FireFly/clients/cert/state", "", true);
     return;
   }
@@ -4606,21 +5554,12 @@ void mqtt_publishControllerCertState(){
 
   for(JsonPair kv : certTypes.as<JsonObject>()){
     if(!kv.value()["controller"].as<bool>()) continue;
-    String name = kv.key().c_str();
-    String certPath = CONFIGFS_PATH_CERTS + (String)"/" + name;
-    if(!configFS.exists(certPath)) continue;
-
-    File f = configFS.open(certPath, "r");
-    if(!f) continue;
-    String pem = "";
-    while(f.available()) pem += (char)f.read();
-    f.close();
-
-    String fingerprint = computeCertFingerprint(pem);
-    if(fingerprint.isEmpty()) continue;
+    const char* fingerprint = kv.value()["fingerprint"];
+    DirectoryIndex::entry file;
+    if(fingerprint == nullptr || !certDirectory.find(kv.key().c_str(), file)) continue;
 
     JsonObject entry = array.add<JsonObject>();
-    entry["filename"]    = name;
+    entry["filename"]    = kv.key().c_str();
     entry["fingerprint"] = fingerprint;
   }
 
@@ -4667,38 +5606,18 @@ void mqtt_autoDiscovery_outputs(){
     return;
   }
 
-  if(!configFS.exists(CONFIGFS_PATH_CONTROLLERS + (String)"/" + deviceIdentity.data.uuid)){
-    log_v("Controller config file does not exist");
-    return;
-  };
-
-  JsonDocument controllerFilterDoc;
-
-  JsonObject filter_outputs__ = controllerFilterDoc["outputs"]["*"].to<JsonObject>();
-  filter_outputs__["id"] = true;
-  filter_outputs__["name"] = true;
-  filter_outputs__["area"] = true;
-  filter_outputs__["icon"] = true;
-  filter_outputs__["type"] = true;
-  filter_outputs__["relay_manufacturer"] = true;
-  filter_outputs__["relay_model"] = true;
+  ControllerConfigCache::loadResult result = controllerConfig_load();
 
-  String plaintext;
-  if(!secretEncryption.decryptFromFile(configFS, CONFIGFS_PATH_CONTROLLERS + (String)"/" + deviceIdentity.data.uuid, plaintext)){
-    eventLog.createEvent("Config decrypt fail", EventLog::LOG_LEVEL_ERROR);
-    log_e("Failed to decrypt controller config in mqtt_autoDiscovery_outputs");
+  if(result == ControllerConfigCache::LOAD_NOT_FOUND){
+    log_v("Controller config file does not exist");
     return;
   }
 
-  JsonDocument controllerDoc(&spiRamAllocator); //Supports up to 32 ports
-  DeserializationError errorControllerFileDeserialization = deserializeJson(controllerDoc, plaintext, DeserializationOption::Filter(controllerFilterDoc));
-
-  if(errorControllerFileDeserialization) {
+  if(result != ControllerConfigCache::LOAD_OK) {
     return;
   }
 
-  
-  for (JsonPair output : controllerDoc["outputs"].as<JsonObject>()) {
+  for (JsonPairConst output : controllerConfig.root()["outputs"].as<JsonObjectConst>()) {
 
     int8_t outputPortNumber = atoi(output.key().c_str());
 
@@ -5858,18 +6777,43 @@ void resetHTPServerUsage(){
 
 static bool _cloudAuth_setHeaders(esp_http_client_handle_t client) {
   if (!deviceIdentity.enabled) return false;
-  return cloudDeviceAuth_setHeaders(client, deviceIdentity.data.uuid, (time_t)timeClient.getEpochTime());
+  return cloudDeviceAuth_setHeaders(cloudHttp, client, deviceIdentity.data.uuid, (time_t)timeClient.getEpochTime());
 }
 
 
+#ifndef CLOUD_BACKUP_MAX_SIZE
+  #define CLOUD_BACKUP_MAX_SIZE (512UL * 1024UL) /* Largest /backup.json uploaded or restored; upload memory no longer depends on it */
+#endif
+
+#ifndef CLOUD_BACKUP_CHUNK_SIZE
+  #define CLOUD_BACKUP_CHUNK_SIZE 2048 /* Plaintext bytes read, encrypted and sent per step of a cloud backup upload */
+#endif
+
+#ifndef CLOUD_BACKUP_COMPRESSION
+  #define CLOUD_BACKUP_COMPRESSION 1 /* Deflate backups before encryption when that makes them smaller; 0 always uploads plain JSON */
+#endif
+
+
 /**
- * Reads /backup.json from configFS, encrypts with key_backup, and uploads to the
- * cloud.  Called automatically by the OTA check loop if /backup.json exists.
- * Silently returns on any error.
+ * Writes all of buffer to an open esp_http_client request body
  */
+static bool _cloudBackup_writeAll(esp_http_client_handle_t client, const uint8_t* buffer, size_t length) {
+  while (length > 0) {
+    int written = esp_http_client_write(client, (const char*)buffer, length);
+    if (written <= 0) return false;
+    buffer += written;
+    length -= written;
+  }
+  return true;
+}
+
+
 /**
- * Reads /backup.json, encrypts it with key_backup, and POSTs it to the
- * cloud backup endpoint with the local ETag header (if one exists).
+ * Streams /backup.json, encrypted with key_backup, to the cloud backup endpoint
+ * with the local ETag header (if one exists).  The body is sent in the trailing-tag
+ * FFCE format one CLOUD_BACKUP_CHUNK_SIZE chunk at a time, so memory use does not
+ * grow with the backup.  With CLOUD_BACKUP_COMPRESSION the file is deflated once to
+ * size the body and again as it is sent.
  * Returns true when the HTTP request completed; httpCode is set to the
  * server's response code.  Returns false on any local failure and sets
  * errorMsg to a description of the problem.
@@ -5884,34 +6828,31 @@ bool cloudBackup_performUpload(int &httpCode, String &errorMsg) {
   }
 
   size_t fileSize = f.size();
-  if (fileSize > 512UL * 1024UL) {
+  if (fileSize > CLOUD_BACKUP_MAX_SIZE) {
     f.close();
-    errorMsg = "Backup file exceeds 512KB limit";
+    errorMsg = "Backup file exceeds size limit";
     return false;
   }
 
-  uint8_t* plainBuf = (uint8_t*)(psramFound() ? ps_malloc(fileSize) : malloc(fileSize));
-  if (!plainBuf) {
+  uint8_t* chunk = (uint8_t*)malloc(CLOUD_BACKUP_CHUNK_SIZE);
+  if (!chunk) {
     f.close();
     errorMsg = "Out of memory";
     return false;
   }
 
-  if (f.read(plainBuf, fileSize) != fileSize) {
-    memset(plainBuf, 0, fileSize);
-    free(plainBuf);
-    f.close();
-    errorMsg = "Failed to read backup.json";
-    return false;
-  }
-  f.close();
+  size_t payloadLen = fileSize;
+  bool deflated = false;
+  BackupDeflater deflater;
 
-  size_t blobLen = 0;
-  uint8_t* blob = secretEncryption.encryptBackup(plainBuf, fileSize, blobLen);
-  memset(plainBuf, 0, fileSize);
-  free(plainBuf);
+  #if CLOUD_BACKUP_COMPRESSION
+    deflated = deflater.sizeFile(f, chunk, CLOUD_BACKUP_CHUNK_SIZE, payloadLen);
+  #endif
 
-  if (!blob) {
+  BackupEncryptor encryptor;
+  if (!secretEncryption.openBackupEncryptor(payloadLen, encryptor, deflated)) {
+    free(chunk);
+    f.close();
     errorMsg = "Encryption failed";
     return false;
   }
@@ -5921,44 +6862,71 @@ bool cloudBackup_performUpload(int &httpCode, String &errorMsg) {
   url += deviceIdentity.data.uuid;
   url += "/backup";
 
-  esp_http_client_config_t cfg = {};
-  cfg.url               = url.c_str();
-  cfg.crt_bundle_attach = esp_crt_bundle_attach;
-  cfg.timeout_ms        = 30000;
-  cfg.method            = HTTP_METHOD_POST;
-  cfg.buffer_size_tx    = 2048;
-
-  esp_http_client_handle_t client = esp_http_client_init(&cfg);
+  esp_http_client_handle_t client = cloudHttp.acquire(url.c_str(), HTTP_METHOD_POST, 30000);
+  if (client == nullptr) {
+    free(chunk);
+    f.close();
+    errorMsg = "Cloud client unavailable";
+    return false;
+  }
 
   if (!_cloudAuth_setHeaders(client)) {
-    esp_http_client_cleanup(client);
-    memset(blob, 0, blobLen);
-    free(blob);
+    cloudHttp.release(client, false);
+    free(chunk);
+    f.close();
     errorMsg = "Auth header build failed";
     return false;
   }
 
-  esp_http_client_set_header(client, "Content-Type", "application/octet-stream");
+  bool sent = cloudHttp.setHeader(client, "Content-Type", "application/octet-stream");
 
-  if (configFS.exists("/backup.etag")) {
-    File etagFile = configFS.open("/backup.etag", "r");
-    if (etagFile) {
-      String etag = etagFile.readString();
-      etagFile.close();
-      esp_http_client_set_header(client, "ETag", ("\"" + etag + "\"").c_str());
+  char etag[BACKUP_ETAG_LENGTH];
+  backupEtag(etag, sizeof(etag));
+  if (etag[0] != '\0') {
+    sent = sent && cloudHttp.setHeader(client, "ETag", ("\"" + String(etag) + "\"").c_str());
+  }
+
+  sent = sent
+      && cloudHttp.open(client, SecretEncryption::backupBlobLength(payloadLen)) == ESP_OK
+           && _cloudBackup_writeAll(client, encryptor.header(), 37);
+
+  if (deflated) {
+    uint8_t inflatedLen[sizeof(uint32_t)];
+    uint32_t len32 = (uint32_t)fileSize;
+    memcpy(inflatedLen, &len32, sizeof(inflatedLen));
+
+    sent = sent
+        && encryptor.update(inflatedLen, sizeof(inflatedLen))
+        && _cloudBackup_writeAll(client, inflatedLen, sizeof(inflatedLen))
+        && deflater.deflateFile(f, chunk, CLOUD_BACKUP_CHUNK_SIZE, [&](uint8_t* data, size_t length){
+             return encryptor.update(data, length) && _cloudBackup_writeAll(client, data, length);
+           });
+    deflater.end();
+  } else {
+    size_t remaining = fileSize;
+    while (sent && remaining > 0) {
+      size_t n = f.read(chunk, remaining < CLOUD_BACKUP_CHUNK_SIZE ? remaining : CLOUD_BACKUP_CHUNK_SIZE);
+      sent = n > 0
+          && encryptor.update(chunk, n)
+          && _cloudBackup_writeAll(client, chunk, n);
+      remaining -= n;
     }
   }
 
-  esp_http_client_set_post_field(client, (const char*)blob, blobLen);
+  uint8_t tag[16];
+  sent = sent
+      && encryptor.finish(tag)
+      && _cloudBackup_writeAll(client, tag, sizeof(tag))
+      && cloudHttp.fetchHeaders(client) >= 0;
 
-  esp_err_t err = esp_http_client_perform(client);
-  httpCode      = esp_http_client_get_status_code(client);
-  esp_http_client_cleanup(client);
+  httpCode = sent ? esp_http_client_get_status_code(client) : 0;
+  cloudHttp.release(client, sent);
 
-  memset(blob, 0, blobLen);
-  free(blob);
+  memset(chunk, 0, CLOUD_BACKUP_CHUNK_SIZE);
+  free(chunk);
+  f.close();
 
-  if (err != ESP_OK) {
+  if (!sent) {
     errorMsg = "Cloud request failed";
     return false;
   }
@@ -5967,23 +6935,33 @@ bool cloudBackup_performUpload(int &httpCode, String &errorMsg) {
 }
 
 
+/**
+ * Queues a scheduled cloud backup upload on the network worker; cloudBackup_reportUpload() logs the outcome
+ */
 void cloudBackup_scheduleHandler() {
 
   if (!deviceIdentity.enabled) return;
   if (!secretEncryption.isReady()) return;
   if (!timeClient.isTimeSet()) return;
 
-  eventLog.createEvent("Backup upload start");
+  if (networkWorker.submit(NETWORK_JOB_CLOUD_BACKUP)) {
+    eventLog.createEvent("Backup upload start");
+  }
+}
 
-  int    httpCode = 0;
-  String errorMsg;
 
-  if (!cloudBackup_performUpload(httpCode, errorMsg)) {
-    log_e("cloudBackup_scheduleHandler: %s", errorMsg.c_str());
+/**
+ * Logs the outcome of a scheduled cloud backup upload
+ */
+void cloudBackup_reportUpload(const NetworkWorker::completion &result) {
+
+  if (!result.ok) {
+    log_e("cloudBackup_scheduleHandler: %s", result.message);
     eventLog.createEvent("Backup upload fail", EventLog::LOG_LEVEL_ERROR);
     return;
   }
 
+  int httpCode = result.code;
   log_i("cloudBackup_scheduleHandler: status=%d", httpCode);
 
   if (httpCode == 200 || httpCode == 204 || httpCode == 304) {
@@ -5997,6 +6975,190 @@ void cloudBackup_scheduleHandler() {
 }
 
 
+/**
+ * Downloads the encrypted backup from the cloud and decrypts it, one CLOUD_BACKUP_CHUNK_SIZE
+ * chunk at a time, to /backup.json.restore_in_progress.  That file becomes /backup.cloud.json
+ * once the whole payload has authenticated; /backup.json is left alone until the user confirms
+ * the restore with POST /api/cloud-backup/staged.  Runs on the network worker.
+ * Returns true when /backup.cloud.json was written; httpCode is set to the server's response
+ * code.  Returns false on any failure and sets errorMsg to a description of the problem.
+ */
+bool cloudBackup_performRestore(int &httpCode, String &errorMsg) {
+  httpCode = 0;
+
+  String url = FIREFLY_CLOUD_API_ROOT;
+  url += "/devices/";
+  url += deviceIdentity.data.uuid;
+  url += "/backup";
+
+  esp_http_client_handle_t client = cloudHttp.acquire(url.c_str(), HTTP_METHOD_GET, 30000);
+  if (client == nullptr) {
+    errorMsg = "Cloud client unavailable";
+    return false;
+  }
+
+  if (!_cloudAuth_setHeaders(client)) {
+    cloudHttp.release(client, false);
+    errorMsg = "Auth header build failed";
+    return false;
+  }
+
+  if (cloudHttp.open(client, 0) != ESP_OK) {
+    cloudHttp.release(client, false);
+    errorMsg = "Cloud connection failed";
+    return false;
+  }
+
+  int64_t contentLength = cloudHttp.fetchHeaders(client);
+  if (contentLength < 0) {
+    cloudHttp.release(client, false);
+    errorMsg = "Cloud request failed";
+    return false;
+  }
+
+  httpCode = esp_http_client_get_status_code(client);
+
+  if (httpCode != 200 || contentLength <= 0 || contentLength > (int64_t)SecretEncryption::backupBlobLength(CLOUD_BACKUP_MAX_SIZE)) {
+    cloudHttp.release(client, httpCode != 200);
+    errorMsg = httpCode == 404 ? "No cloud backup" : "Cloud returned unexpected response";
+    return false;
+  }
+
+  uint8_t* chunk = (uint8_t*)malloc(CLOUD_BACKUP_CHUNK_SIZE);
+  if (!chunk) {
+    cloudHttp.release(client, false);
+    errorMsg = "Out of memory";
+    return false;
+  }
+
+  File outFile = configFS.open("/backup.json.restore_in_progress", "w");
+  if (!outFile) {
+    free(chunk);
+    cloudHttp.release(client, false);
+    errorMsg = "Failed to write backup.json";
+    return false;
+  }
+
+  BackupDecryptor decryptor;
+  bool ok = secretEncryption.openBackupDecryptor(decryptor, CLOUD_BACKUP_MAX_SIZE);
+  if (!ok) {
+    errorMsg = "Decryption failed";
+  }
+
+  bool writeFailed = false;
+  int64_t remaining = contentLength;
+
+  while (ok && remaining > 0) {
+    int bytesRead = esp_http_client_read(client, (char*)chunk, remaining < CLOUD_BACKUP_CHUNK_SIZE ? (int)remaining : CLOUD_BACKUP_CHUNK_SIZE);
+    if (bytesRead <= 0) {
+      errorMsg = "Incomplete read from cloud";
+      ok = false;
+      break;
+    }
+    remaining -= bytesRead;
+
+    ok = decryptor.update(chunk, (size_t)bytesRead, [&](const uint8_t* data, size_t length){
+      writeFailed = outFile.write(data, length) != length;
+      return !writeFailed;
+    });
+    if (!ok) {
+      errorMsg = writeFailed ? "Failed to write backup.json" : "Decryption failed";
+    }
+  }
+
+  cloudHttp.release(client, remaining == 0);
+
+  // Always called, so the backup key is released even when the download stopped early
+  if (!decryptor.finish() && ok) {
+    errorMsg = "Decryption failed";
+    ok = false;
+  }
+
+  outFile.close();
+  memset(chunk, 0, CLOUD_BACKUP_CHUNK_SIZE);
+  free(chunk);
+
+  if (!ok) {
+    configFS.remove("/backup.json.restore_in_progress");
+    return false;
+  }
+
+  if (configFS.exists("/backup.cloud.json")) {
+    configFS.remove("/backup.cloud.json");
+  }
+  if (!configFS.rename("/backup.json.restore_in_progress", "/backup.cloud.json")) {
+    configFS.remove("/backup.json.restore_in_progress");
+    errorMsg = "Failed to write backup.cloud.json";
+    return false;
+  }
+
+  return true;
+}
+
+
+/**
+ * Deletes the cloud backup and, when that succeeds, the local /backup.json.  Runs on the
+ * network worker.  Returns true when the HTTP request completed; httpCode is set to the
+ * server's response code.  Returns false on any local failure and sets errorMsg.
+ */
+bool cloudBackup_performDelete(int &httpCode, String &errorMsg) {
+  httpCode = 0;
+
+  String url = FIREFLY_CLOUD_API_ROOT;
+  url += "/devices/";
+  url += deviceIdentity.data.uuid;
+  url += "/backup";
+
+  esp_http_client_handle_t client = cloudHttp.acquire(url.c_str(), HTTP_METHOD_DELETE, 15000);
+  if (client == nullptr) {
+    errorMsg = "Cloud client unavailable";
+    return false;
+  }
+
+  if (!_cloudAuth_setHeaders(client)) {
+    cloudHttp.release(client, false);
+    errorMsg = "Auth header build failed";
+    return false;
+  }
+
+  esp_err_t err = cloudHttp.perform(client);
+  httpCode = esp_http_client_get_status_code(client);
+  cloudHttp.release(client, err == ESP_OK);
+
+  if (err != ESP_OK) {
+    errorMsg = "Cloud request failed";
+    return false;
+  }
+
+  if (httpCode == 200 || httpCode == 204) {
+    if (configFS.exists("/backup.json")) {
+      configFS.remove("/backup.json");
+    }
+    clearBackupEtag();
+  } else if (httpCode == 404) {
+    errorMsg = "No cloud backup";
+  }
+
+  return true;
+}
+
+
+/**
+ * Logs the outcome of a cloud backup restore
+ */
+void cloudBackup_reportRestore(const NetworkWorker::completion &result) {
+
+  if (!result.ok) {
+    log_e("cloudBackup_performRestore: %s (status=%d)", result.message, (int)result.code);
+    eventLog.createEvent("Backup restore fail", EventLog::LOG_LEVEL_ERROR);
+    return;
+  }
+
+  eventLog.resolveError("Backup restore fail");
+  eventLog.createEvent("Cloud backup staged");
+}
+
+
 /**
  * Generic dispatcher for /api/cloud-backup
  */
@@ -6028,8 +7190,8 @@ void http_handleCloudBackup(AsyncWebServerRequest *request) {
 
 /**
  * POST /api/cloud-backup
- * Reads backup.json from configFS, encrypts with key_backup, uploads to cloud.
- * Responds with the cloud HTTP status code.
+ * Queues an upload of backup.json, encrypted with key_backup, to the cloud.
+ * Responds 202 with the job ID; the job's status is the cloud HTTP status code.
  */
 void http_handleCloudBackup_POST(AsyncWebServerRequest *request) {
 
@@ -6061,29 +7223,16 @@ void http_handleCloudBackup_POST(AsyncWebServerRequest *request) {
 
   resetHTPServerUsage();
 
-  int    httpCode = 0;
-  String errorMsg;
-
-  if (!cloudBackup_performUpload(httpCode, errorMsg)) {
-    http_error(request, errorMsg.c_str());
-    return;
-  }
-
-  log_i("http_handleCloudBackup_POST: status=%d", httpCode);
-
-  AsyncResponseStream *resp = request->beginResponseStream("application/json");
-  JsonDocument doc;
-  doc["status"] = httpCode;
-  serializeJson(doc, *resp);
-  resp->setCode(httpCode == 200 || httpCode == 204 || httpCode == 304 ? 200 : 502);
-  request->send(resp);
+  http_submitJob(request, NETWORK_JOB_CLOUD_BACKUP);
 }
 
 
 /**
  * GET /api/cloud-backup
- * Downloads the encrypted backup from cloud, decrypts with key_backup,
- * writes to /backup.json on configFS, returns 200 with the plaintext JSON.
+ * Queues a download of the encrypted backup from the cloud, which the network worker
+ * decrypts to /backup.cloud.json on configFS.  Responds 202 with the job ID; once the
+ * job has succeeded the staged file is served by GET /api/cloud-backup/staged, and only
+ * replaces /backup.json when that is confirmed with POST /api/cloud-backup/staged.
  */
 void http_handleCloudBackup_GET(AsyncWebServerRequest *request) {
 
@@ -6110,188 +7259,140 @@ void http_handleCloudBackup_GET(AsyncWebServerRequest *request) {
 
   resetHTPServerUsage();
 
-  String url = FIREFLY_CLOUD_API_ROOT;
-  url += "/devices/";
-  url += deviceIdentity.data.uuid;
-  url += "/backup";
+  http_submitJob(request, NETWORK_JOB_CLOUD_RESTORE);
+}
 
-  esp_http_client_config_t cfg = {};
-  cfg.url               = url.c_str();
-  cfg.crt_bundle_attach = esp_crt_bundle_attach;
-  cfg.timeout_ms        = 30000;
-  cfg.method            = HTTP_METHOD_GET;
 
-  esp_http_client_handle_t client = esp_http_client_init(&cfg);
+/**
+ * DELETE /api/cloud-backup
+ * Queues a DELETE to the cloud; the job also removes the local /backup.json if it exists.
+ * Responds 202 with the job ID.
+ */
+void http_handleCloudBackup_DELETE(AsyncWebServerRequest *request) {
 
-  if (!_cloudAuth_setHeaders(client)) {
-    esp_http_client_cleanup(client);
-    http_error(request, "Auth header build failed");
+  if (!request->hasHeader("visual-token") ||
+      !authToken.authenticate(request->header("visual-token").c_str())) {
+    http_unauthorized(request);
     return;
   }
 
-  // Open connection and read the response into a buffer
-  esp_err_t err = esp_http_client_open(client, 0);
-  if (err != ESP_OK) {
-    esp_http_client_cleanup(client);
-    http_error(request, "Cloud connection failed");
+  if (!deviceIdentity.enabled) {
+    http_conflict(request, "Device not provisioned");
     return;
   }
 
-  int64_t contentLength = esp_http_client_fetch_headers(client);
-  int     code          = esp_http_client_get_status_code(client);
-
-  // Capture ETag from response headers before client is closed
-  String etagFromCloud;
-  {
-    char* etagValue = nullptr;
-    if(esp_http_client_get_header(client, "ETag", &etagValue) == ESP_OK && etagValue != nullptr){
-      etagFromCloud = String(etagValue);
-      etagFromCloud.replace("\"", "");
-    }
-  }
-
-  if (code == 404) {
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
-    http_notFound(request);
+  if (!timeClient.isTimeSet()) {
+    http_serviceUnavailable(request, "Clock not synchronized");
     return;
   }
 
-  if (code != 200 || contentLength <= 0 || contentLength > 512LL * 1024LL + 37LL) {
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
-    AsyncResponseStream *resp = request->beginResponseStream("application/json");
-    JsonDocument doc;
-    doc["message"] = "Cloud returned unexpected response";
-    doc["status"]  = code;
-    serializeJson(doc, *resp);
-    resp->setCode(502);
-    request->send(resp);
-    return;
-  }
+  resetHTPServerUsage();
 
-  uint8_t* blobBuf = (uint8_t*)(psramFound() ? ps_malloc((size_t)contentLength) : malloc((size_t)contentLength));
-  if (!blobBuf) {
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
-    http_error(request, "Out of memory");
-    return;
-  }
+  http_submitJob(request, NETWORK_JOB_CLOUD_DELETE);
+}
 
-  int bytesRead = esp_http_client_read(client, (char*)blobBuf, (int)contentLength);
-  esp_http_client_close(client);
-  esp_http_client_cleanup(client);
 
-  if (bytesRead != (int)contentLength) {
-    memset(blobBuf, 0, (size_t)contentLength);
-    free(blobBuf);
-    http_error(request, "Incomplete read from cloud");
+/**
+ * Generic dispatcher for /api/cloud-backup/staged
+ */
+void http_handleCloudBackupStaged(AsyncWebServerRequest *request) {
+
+  if(request->method() == HTTP_OPTIONS){
+    http_options(request);
     return;
   }
 
-  String plaintext;
-  if (!secretEncryption.decryptBackup(blobBuf, (size_t)contentLength, plaintext)) {
-    memset(blobBuf, 0, (size_t)contentLength);
-    free(blobBuf);
-    eventLog.createEvent("Backup decrypt fail", EventLog::LOG_LEVEL_ERROR);
-    http_error(request, "Decryption failed");
+  if (!request->hasHeader("visual-token") ||
+      !authToken.authenticate(request->header("visual-token").c_str())) {
+    http_unauthorized(request);
     return;
   }
 
-  memset(blobBuf, 0, (size_t)contentLength);
-  free(blobBuf);
+  switch(request->method()) {
 
-  // Write restored backup.json to configFS
-  File outFile = configFS.open("/backup.json", "w");
-  if (!outFile) {
-    http_error(request, "Failed to write backup.json");
-    return;
-  }
-  outFile.print(plaintext);
-  outFile.close();
+    case HTTP_GET:
+      http_handleCloudBackupStaged_GET(request);
+      break;
 
-  // Persist ETag sidecar if cloud provided one
-  if(etagFromCloud.length() == 64){
-    if(configFS.exists("/backup.etag")){
-      configFS.remove("/backup.etag");
-    }
-    File etagFile = configFS.open("/backup.etag", "w");
-    if(etagFile){
-      etagFile.print(etagFromCloud);
-      etagFile.close();
-    }
-  }
+    case HTTP_POST:
+      http_handleCloudBackupStaged_POST(request);
+      break;
 
-  request->send(200, "application/json", plaintext);
+    case HTTP_DELETE:
+      http_handleCloudBackupStaged_DELETE(request);
+      break;
+
+    default:
+      http_methodNotAllowed(request);
+      break;
+  }
 }
 
 
 /**
- * DELETE /api/cloud-backup
- * Sends DELETE to cloud and removes the local /backup.json if it exists.
+ * GET /api/cloud-backup/staged
+ * Serves the backup the last restore job downloaded, so the UI can show it before it is kept
  */
-void http_handleCloudBackup_DELETE(AsyncWebServerRequest *request) {
+void http_handleCloudBackupStaged_GET(AsyncWebServerRequest *request) {
 
-  if (!request->hasHeader("visual-token") ||
-      !authToken.authenticate(request->header("visual-token").c_str())) {
-    http_unauthorized(request);
+  if (!configFS.exists("/backup.cloud.json")) {
+    http_notFound(request);
     return;
   }
 
-  if (!deviceIdentity.enabled) {
-    http_conflict(request, "Device not provisioned");
-    return;
-  }
+  resetHTPServerUsage();
 
-  if (!timeClient.isTimeSet()) {
-    http_serviceUnavailable(request, "Clock not synchronized");
+  AsyncWebServerResponse *response = request->beginResponse(configFS, "/backup.cloud.json", "application/json");
+  if (response == nullptr || response->code() != 200) {
+    delete response;
+    http_error(request, "Unable to open backup file");
     return;
   }
 
-  resetHTPServerUsage();
-
-  String url = FIREFLY_CLOUD_API_ROOT;
-  url += "/devices/";
-  url += deviceIdentity.data.uuid;
-  url += "/backup";
+  request->send(response);
+}
 
-  esp_http_client_config_t cfg = {};
-  cfg.url               = url.c_str();
-  cfg.crt_bundle_attach = esp_crt_bundle_attach;
-  cfg.timeout_ms        = 15000;
-  cfg.method            = HTTP_METHOD_DELETE;
 
-  esp_http_client_handle_t client = esp_http_client_init(&cfg);
+/**
+ * POST /api/cloud-backup/staged
+ * Keeps the staged cloud backup: it replaces /backup.json and the ETag sidecar is recomputed
+ */
+void http_handleCloudBackupStaged_POST(AsyncWebServerRequest *request) {
 
-  if (!_cloudAuth_setHeaders(client)) {
-    esp_http_client_cleanup(client);
-    http_error(request, "Auth header build failed");
+  if (!configFS.exists("/backup.cloud.json")) {
+    http_notFound(request);
     return;
   }
 
-  esp_err_t err  = esp_http_client_perform(client);
-  int       code = esp_http_client_get_status_code(client);
-  esp_http_client_cleanup(client);
+  resetHTPServerUsage();
 
-  if (err != ESP_OK) {
-    http_error(request, "Cloud request failed");
+  if (configFS.exists("/backup.json")) {
+    configFS.remove("/backup.json");
+  }
+
+  if (!configFS.rename("/backup.cloud.json", "/backup.json")) {
+    clearBackupEtag();
+    eventLog.createEvent("Backup restore fail", EventLog::LOG_LEVEL_ERROR);
+    http_error(request, "Failed to write backup.json");
     return;
   }
 
-  if (code == 200 || code == 204) {
-    if (configFS.exists("/backup.json")) {
-      configFS.remove("/backup.json");
-    }
-    request->send(204);
-  } else if (code == 404) {
-    http_notFound(request);
-  } else {
-    AsyncResponseStream *resp = request->beginResponseStream("application/json");
-    JsonDocument doc;
-    doc["message"] = "Cloud returned unexpected status";
-    doc["status"]  = code;
-    serializeJson(doc, *resp);
-    resp->setCode(502);
-    request->send(resp);
+  writeBackupEtag();
+  eventLog.createEvent("Backup restored");
+
+  request->send(204);
+}
+
+
+/**
+ * DELETE /api/cloud-backup/staged
+ * Discards the staged cloud backup; /backup.json is untouched
+ */
+void http_handleCloudBackupStaged_DELETE(AsyncWebServerRequest *request) {
+
+  if (configFS.exists("/backup.cloud.json")) {
+    configFS.remove("/backup.cloud.json");
   }
+
+  request->send(204);
 }
\ No newline at end of file
@@ -31,3 +31,20 @@ export async function controllerFetch(ip, path, options = {}, token = '') {
     throw err
   }
 }
+
+const JOB_POLL_INTERVAL = 1000
+const JOB_TIMEOUT = 90000
+
+// Follows a job queued by a controller endpoint that answered 202, polling /api/jobs/{id} until it
+// succeeds or fails. Resolves to the final job ({ id, type, state, status, message }).
+export async function waitForControllerJob(ip, id, token = '') {
+  const deadline = Date.now() + JOB_TIMEOUT
+  while (Date.now() < deadline) {
+    const res = await controllerFetch(ip, `/jobs/${id}`, {}, token)
+    if (!res.ok) throw new Error(`Job ${id} status HTTP ${res.status}`)
+    const job = await res.json()
+    if (job.state === 'succeeded' || job.state === 'failed') return job
+    await new Promise(resolve => setTimeout(resolve, JOB_POLL_INTERVAL))
+  }
+  throw new Error(`Job ${id} did not finish in time`)
+}
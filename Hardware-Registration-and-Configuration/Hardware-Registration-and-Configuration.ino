@@ -38,8 +38,10 @@
 #include "common/cloudDeviceAuth.h"
 #include <ArduinoJson.h>
 #include "AsyncJson.h"
-#include <NTPClient.h>
-#include <WiFiUdp.h>
+#include "common/sntpClock.h"
+#include "common/cloudHttpPool.h"
+#include "common/httpClientStream.h"
+#include "common/httpEtag.h"
 #include <mbedtls/sha256.h>
 #include <mbedtls/hkdf.h>
 #include <mbedtls/md.h>
@@ -57,6 +59,7 @@ bool _otaPendingRequest = false;
 JsonDocument _otaPendingDoc;
 static char _otaCurrentPartition[8] = "";
 managerDeviceIdentity deviceIdentity; /* Device identity instance */
+CloudHttpPool cloudHttp; /* Kept-alive HTTPS clients for FireFly-Cloud */
 managerOled oled; /* OLED instance */
 managerFrontPanel frontPanel; /* Front panel instance */
 managerInputs inputs; /* Inputs collection */
@@ -64,13 +67,9 @@ nsOutputs::managerOutputs outputs; /* Outputs collection */
 managerTemperatureSensors temperatureSensors; /* Temperature sensors */
 authorizationToken authToken;
 
-#if ETHERNET_MODEL == ENUM_ETHERNET_MODEL_W5500 || WIFI_MODEL == ENUM_WIFI_MODEL_ESP32
-  WiFiUDP wifiNtpUdp;
-  NTPClient timeClient(wifiNtpUdp); /* WiFi NTP client for handling time requests */
-#endif
+SntpClock timeClient; /* Wall-clock time, kept in the background by the SNTP service */
 
 EventLog eventLog(&timeClient); /* Event Log instance */
-uint64_t ntpSleepUntil = 0;
 
 struct {
   bool   registered    = false;
@@ -79,8 +78,13 @@ struct {
   time_t checkedAt     = 0;
 } _registrationState;
 
+#ifndef FIRMWARE_LIST_SIZE
+  #define FIRMWARE_LIST_SIZE 5 /* Most recent releases kept from the cloud catalogue and served by GET /api/firmware */
+#endif
+
 struct {
-  String  json;
+  String  json;                 /* Serialized GET /api/firmware response */
+  char    etag[65]  = "";       /* SHA-256 hex of json */
   bool    ready     = false;
   bool    pending   = false;
   int64_t lastFetch = 0;
@@ -192,11 +196,6 @@ void setup() {
     if(ESP32_W5500_isConnected()){
 
       timeClient.begin();
-      updateNTPTime(true);
-
-      if(timeClient.isTimeSet()){
-        bootTime = timeClient.getEpochTime();
-      }
     }
 
     log_i("Ethernet IP: %s", ETH.localIP().toString().c_str());
@@ -354,6 +353,8 @@ void loop() {
     fetchFirmwareList();
   }
 
+  cloudHttp.expireIdle();
+
   otaFirmware_checkPending();
 
   oled.loop();
@@ -679,10 +680,53 @@ void http_handleMCU(AsyncWebServerRequest *request){
 }
 
 
+/**
+ * Replaces the cached firmware list with the serialized response in json and its ETag
+*/
+void firmwareList_setCache(String &json) {
+
+  uint8_t hash[32];
+  mbedtls_sha256((const uint8_t*)json.c_str(), json.length(), hash, 0);
+
+  for (int i = 0; i < 32; i++) {
+    sprintf(_firmwareState.etag + i*2, "%02x", hash[i]);
+  }
+  _firmwareState.etag[64] = '\0';
+
+  _firmwareState.json  = json;
+  _firmwareState.ready = true;
+}
+
+
+/**
+ * Skips whitespace in body and returns the next character without consuming it, or -1 at the end of the body
+*/
+int firmwareList_peekToken(Stream &body) {
+  int c = body.peek();
+  while (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+    body.read();
+    c = body.peek();
+  }
+  return c;
+}
+
+
+/**
+ * Consumes and returns the next character of body that is not whitespace, or -1 at the end of the body
+*/
+int firmwareList_nextToken(Stream &body) {
+  firmwareList_peekToken(body);
+  return body.read();
+}
+
+
 /**
  * Fetches the list of released Controller firmware from FireFly-Cloud for this device's product.
- * Called from loop() when _firmwareState.pending is set. Stores up to 5 most recent versions
- * (newest-first) in _firmwareState.json.
+ * Called from loop() when _firmwareState.pending is set.  The cloud returns every release,
+ * oldest-first; the body is parsed one release at a time as it arrives, keeping only the fields
+ * the UI and POST /api/ota use, and the last FIRMWARE_LIST_SIZE are held in a ring.  Memory use
+ * is therefore the same however long the catalogue grows.  The FIRMWARE_LIST_SIZE most recent
+ * versions (newest-first) are stored in _firmwareState.json.  A failed fetch keeps the previous list.
 */
 void fetchFirmwareList() {
 
@@ -692,74 +736,108 @@ void fetchFirmwareList() {
   snprintf(url, sizeof(url), "%s/ota/controller/0x%08" PRIx32 "/controller",
            FIREFLY_CLOUD_API_ROOT, deviceIdentity.data.product_hex);
 
-  esp_http_client_config_t cfg = {};
-  cfg.url                = url;
-  cfg.crt_bundle_attach  = esp_crt_bundle_attach;
-  cfg.timeout_ms         = 10000;
-
   log_i("fetchFirmwareList: %s", url);
 
-  esp_http_client_handle_t client = esp_http_client_init(&cfg);
-  esp_err_t err = esp_http_client_open(client, 0);
+  esp_http_client_handle_t client = cloudHttp.acquire(url, HTTP_METHOD_GET, 10000);
+  if (client == nullptr) {
+    eventLog.createEvent("Firmware list failed", EventLog::LOG_LEVEL_NOTIFICATION);
+    return;
+  }
+
+  esp_err_t err = cloudHttp.open(client, 0);
+  if (err == ESP_OK && cloudHttp.fetchHeaders(client) < 0) {
+    err = ESP_FAIL;
+  }
 
   if (err != ESP_OK) {
-    log_e("fetchFirmwareList: open failed (%d)", (int)err);
-    esp_http_client_cleanup(client);
+    log_e("fetchFirmwareList: request failed (%d)", (int)err);
+    cloudHttp.release(client, false);
     eventLog.createEvent("Firmware list failed", EventLog::LOG_LEVEL_NOTIFICATION);
     return;
   }
 
-  esp_http_client_fetch_headers(client);
   int status = esp_http_client_get_status_code(client);
   log_i("fetchFirmwareList: status=%d", status);
 
   if (status == 200) {
-    const int BUF_SIZE = 4096;
-    char* buf = new char[BUF_SIZE];
-    if (buf) {
-      int total = 0, read_len;
-      while ((read_len = esp_http_client_read(client, buf + total, BUF_SIZE - total - 1)) > 0) {
-        total += read_len;
-        if (total >= BUF_SIZE - 1) break;
-      }
-      buf[total] = '\0';
 
-      JsonDocument parsed;
-      DeserializationError parseErr = deserializeJson(parsed, buf);
-      delete[] buf;
+    JsonDocument filter;
+    filter["application_name"]          = true;
+    filter["version"]                   = true;
+    filter["release_url"]               = true;
+    filter["binaries"][0]["partition"]  = true;
+    filter["binaries"][0]["url"]        = true;
+    filter["binaries"][0]["sha256"]     = true;
+
+    JsonDocument releases[FIRMWARE_LIST_SIZE];
+    size_t count = 0;
+    bool complete = false;
+
+    HttpClientStream body(client);
 
-      if (!parseErr && parsed.is<JsonArray>()) {
-        JsonArray releases = parsed.as<JsonArray>();
-        int count = releases.size();
-        int start = (count > 5) ? count - 5 : 0;
+    if (firmwareList_nextToken(body) == '[') {
 
-        JsonDocument out;
-        JsonArray arr = out["versions"].to<JsonArray>();
-        for (int i = count - 1; i >= start; i--) {
-          arr.add(releases[i]);
+      if (firmwareList_peekToken(body) == ']') {
+        body.read();
+        complete = true;
+      }
+
+      while (!complete) {
+        DeserializationError parseErr = deserializeJson(releases[count % FIRMWARE_LIST_SIZE], body, DeserializationOption::Filter(filter));
+        if (parseErr) {
+          log_e("fetchFirmwareList: release %u: %s", (unsigned)count, parseErr.c_str());
+          break;
         }
+        count++;
 
-        _firmwareState.json = "";
-        serializeJson(out, _firmwareState.json);
-        _firmwareState.ready = true;
-        eventLog.createEvent("Firmware list fetched", EventLog::LOG_LEVEL_INFO);
+        int next = firmwareList_nextToken(body);
+        if (next == ']') {
+          complete = true;
+        } else if (next != ',') {
+          break;
+        }
       }
+    }
+
+    if (complete) {
+      JsonDocument out;
+      JsonArray arr = out["versions"].to<JsonArray>();
+      size_t kept = count < FIRMWARE_LIST_SIZE ? count : FIRMWARE_LIST_SIZE;
+      for (size_t i = 0; i < kept; i++) {
+        JsonDocument &release = releases[(count - 1 - i) % FIRMWARE_LIST_SIZE];
+        if (release["version"].is<const char*>()) {
+          arr.add(release);
+        }
+      }
+
+      String json;
+      serializeJson(out, json);
+      firmwareList_setCache(json);
+      log_i("fetchFirmwareList: %u releases, %u bytes", (unsigned)count, (unsigned)body.bytesRead());
+      eventLog.createEvent("Firmware list fetched", EventLog::LOG_LEVEL_INFO);
     } else {
-      delete[] buf;
+      log_e("fetchFirmwareList: malformed or incomplete response after %u bytes", (unsigned)body.bytesRead());
+      eventLog.createEvent("Firmware list failed", EventLog::LOG_LEVEL_NOTIFICATION);
     }
-  } else if (status == 404) {
+
+    cloudHttp.release(client, complete);
+    return;
+  }
+
+  if (status == 404) {
     /* No released firmware for this product — return an empty list */
-    _firmwareState.json = "{\"versions\":[]}";
-    _firmwareState.ready = true;
+    String json = "{\"versions\":[]}";
+    firmwareList_setCache(json);
   } else {
     log_e("fetchFirmwareList: unexpected status=%d", status);
     eventLog.createEvent("Firmware list failed", EventLog::LOG_LEVEL_NOTIFICATION);
-    _firmwareState.json = "{\"versions\":[]}";
-    _firmwareState.ready = true;
+    if (!_firmwareState.ready) {
+      String json = "{\"versions\":[]}";
+      firmwareList_setCache(json);
+    }
   }
 
-  esp_http_client_close(client);
-  esp_http_client_cleanup(client);
+  cloudHttp.release(client, true);
 }
 
 
@@ -767,7 +845,8 @@ void fetchFirmwareList() {
  * GET /api/firmware — returns the list of released Controller firmware for this device.
  * Cached for 30 seconds; triggers a background refresh when the cache expires while
  * continuing to serve stale data. Returns 202 only on the first call before any data
- * has been fetched.
+ * has been fetched.  The cached response carries an ETag; a matching If-None-Match
+ * gets 304 with no body.
 */
 void http_handleFirmware(AsyncWebServerRequest *request) {
 
@@ -797,7 +876,16 @@ void http_handleFirmware(AsyncWebServerRequest *request) {
     return;
   }
 
-  request->send(200, "application/json", _firmwareState.json);
+  if (http_etagMatches(request->header("If-None-Match").c_str(), _firmwareState.etag)) {
+    AsyncWebServerResponse *response = request->beginResponse(304);
+    response->addHeader("ETag", "\"" + String(_firmwareState.etag) + "\"");
+    request->send(response);
+    return;
+  }
+
+  AsyncWebServerResponse *response = request->beginResponse(200, "application/json", _firmwareState.json);
+  response->addHeader("ETag", "\"" + String(_firmwareState.etag) + "\"");
+  request->send(response);
 }
 
 
@@ -926,17 +1014,16 @@ void checkCloudRegistration() {
   url += deviceIdentity.data.uuid;
   url += "/registration";
 
-  esp_http_client_config_t cfg = {};
-  cfg.url                = url.c_str();
-  cfg.crt_bundle_attach  = esp_crt_bundle_attach;
-  cfg.timeout_ms         = 10000;
-
-  esp_http_client_handle_t client = esp_http_client_init(&cfg);
-
   _registrationState.checkedAt = timeClient.getEpochTime();
 
-  if (!cloudDeviceAuth_setHeaders(client, deviceIdentity.data.uuid, (time_t)timeClient.getEpochTime())) {
-    esp_http_client_cleanup(client);
+  esp_http_client_handle_t client = cloudHttp.acquire(url.c_str(), HTTP_METHOD_GET, 10000);
+  if (client == nullptr) {
+    eventLog.createEvent("Cloud reg fail", EventLog::LOG_LEVEL_NOTIFICATION);
+    return;
+  }
+
+  if (!cloudDeviceAuth_setHeaders(cloudHttp, client, deviceIdentity.data.uuid, (time_t)timeClient.getEpochTime())) {
+    cloudHttp.release(client, false);
     eventLog.createEvent("Cloud reg fail", EventLog::LOG_LEVEL_NOTIFICATION);
     return;
   }
@@ -944,17 +1031,18 @@ void checkCloudRegistration() {
   int  status  = 0;
   char bodyBuf[256] = {0};
 
-  esp_err_t err = esp_http_client_open(client, 0);
+  esp_err_t err = cloudHttp.open(client, 0);
+  if (err == ESP_OK && cloudHttp.fetchHeaders(client) < 0) {
+    err = ESP_FAIL;
+  }
   if (err == ESP_OK) {
-    esp_http_client_fetch_headers(client);
     status = esp_http_client_get_status_code(client);
     int bodyLen = esp_http_client_read(client, bodyBuf, sizeof(bodyBuf) - 1);
     if (bodyLen > 0) {
       log_i("checkCloudRegistration: response body: %s", bodyBuf);
     }
   }
-  esp_http_client_close(client);
-  esp_http_client_cleanup(client);
+  cloudHttp.release(client, err == ESP_OK);
 
   log_i("checkCloudRegistration: url=%s err=%d status=%d", url.c_str(), (int)err, status);
 
@@ -1184,20 +1272,23 @@ void http_handleRegistration_POST(AsyncWebServerRequest *request, JsonVariant &d
   /* POST to FireFly-Cloud */
   String postUrl = cloudUrl + "/devices/register";
 
-  esp_http_client_config_t cfg = {};
-  cfg.url               = postUrl.c_str();
-  cfg.method            = HTTP_METHOD_POST;
-  cfg.crt_bundle_attach = esp_crt_bundle_attach;
-  cfg.timeout_ms        = 10000;
+  esp_http_client_handle_t client = cloudHttp.acquire(postUrl.c_str(), HTTP_METHOD_POST, 10000);
+  if (client == nullptr) {
+    http_serviceUnavailable(request, "Cloud client busy");
+    return;
+  }
 
-  esp_http_client_handle_t client = esp_http_client_init(&cfg);
-  esp_http_client_set_header(client, "Content-Type",       "application/json");
-  esp_http_client_set_header(client, "X-Registration-Key", regKey.c_str());
+  if (!cloudHttp.setHeader(client, "Content-Type",       "application/json") ||
+      !cloudHttp.setHeader(client, "X-Registration-Key", regKey.c_str())) {
+    cloudHttp.release(client, true);
+    http_serviceUnavailable(request, "Cloud client busy");
+    return;
+  }
   esp_http_client_set_post_field(client, payload.c_str(), payload.length());
 
-  esp_err_t err    = esp_http_client_perform(client);
-  int       status = esp_http_client_get_status_code(client);
-  esp_http_client_cleanup(client);
+  esp_err_t err    = cloudHttp.perform(client);
+  int       status = err == ESP_OK ? esp_http_client_get_status_code(client) : 0;
+  cloudHttp.release(client, err == ESP_OK);
 
   if (err == ESP_OK && status == 204) {
     _registrationState.registered = true;
@@ -1734,24 +1825,18 @@ void eventHandler_eventLogResolvedErrorEvent(){
 
 
 /**
- * Updates the NTP time from the server with special handling
+ * Records the boot time once the SNTP service has set the clock.  Never waits on the network;
+ * force asks the service to resync in the background.
 */
 void updateNTPTime(bool force){
 
-  if((esp_timer_get_time() > ntpSleepUntil) || force == true){
-      /*
-        Workaround until https://github.com/arduino-libraries/NTPClient/pull/163 is merged
-
-        If time client update is unsuccessful, stop trying for 5 minutes
-      */
-
-      if(timeClient.update()){
-        ntpSleepUntil = 0;
-      }else{
-        ntpSleepUntil = esp_timer_get_time() + 300000000;
-      }
-    }
+  if(force == true){
+    timeClient.requestSync();
+  }
 
+  if(timeClient.isTimeSet() && bootTime == 0){
+    bootTime = timeClient.getEpochTime() - (unsigned long)(esp_timer_get_time() / 1000000ULL);
+  }
 }
 
 
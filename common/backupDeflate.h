@@ -0,0 +1,253 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include "rom/miniz.h"
+
+#ifndef BACKUP_DEFLATE_OUTPUT_CHUNK_SIZE
+    #define BACKUP_DEFLATE_OUTPUT_CHUNK_SIZE 1024 /* Compressed bytes staged before each call to the sink */
+#endif
+
+
+/**
+ * Raw deflate (RFC 1951) for cloud backup payloads, using the miniz copy in the ESP32 ROM so no
+ * compression library is linked.  The compressor state is large; it is allocated (in PSRAM when
+ * present) by begin() and freed by end() or destruction, so it only exists while a backup is
+ * being uploaded.
+ *
+ * Compression is deterministic: deflating the same input twice produces the same output, which
+ * lets an uploader size the payload in one pass and send it in a second.
+ */
+class BackupDeflater {
+
+public:
+
+    BackupDeflater() {}
+    BackupDeflater(const BackupDeflater&) = delete;
+    BackupDeflater& operator=(const BackupDeflater&) = delete;
+
+    ~BackupDeflater() {
+        end();
+    }
+
+    /**
+     * Allocates the compressor if needed and resets it for a new stream
+     */
+    bool begin() {
+
+        if (_compressor == nullptr) {
+            _compressor = (tdefl_compressor*)_alloc(sizeof(tdefl_compressor));
+            if (_compressor == nullptr) return false;
+        }
+
+        return tdefl_init(_compressor, nullptr, nullptr, TDEFL_DEFAULT_MAX_PROBES) == TDEFL_STATUS_OKAY;
+    }
+
+    /**
+     * Compresses file from its current position to the end as one stream.  Calls
+     * sink(uint8_t* data, size_t length) with each piece of output; the sink may modify data in
+     * place (to encrypt it) and returns false to stop.  Restarts the compressor first.
+     * @param scratch buffer for reads from the file
+     * @returns false if the compressor could not be allocated, the file could not be read to the end,
+     * compression failed or the sink stopped
+     */
+    template <typename F>
+    bool deflateFile(File& file, uint8_t* scratch, size_t scratchLength, F sink) {
+
+        if (!begin()) return false;
+
+        bool last = false;
+
+        while (!last) {
+
+            size_t remaining = file.read(scratch, scratchLength);
+            last = remaining < scratchLength || !file.available();
+
+            const uint8_t* input = scratch;
+
+            for (;;) {
+                size_t inputLength = remaining;
+                size_t outputLength = sizeof(_output);
+
+                tdefl_status status = tdefl_compress(_compressor, input, &inputLength, _output, &outputLength,
+                                                     last ? TDEFL_FINISH : TDEFL_NO_FLUSH);
+                if (status < 0) return false;
+
+                input += inputLength;
+                remaining -= inputLength;
+
+                if (outputLength > 0 && !sink(_output, outputLength)) return false;
+
+                if (last ? status == TDEFL_STATUS_DONE : remaining == 0) break;
+            }
+        }
+
+        // A short read ends the stream early; don't let it pass as the whole file
+        return file.position() == file.size();
+    }
+
+    /**
+     * Deflates file from its current position to the end without keeping the output, to size a
+     * payload before it is sent, then seeks back.  The payload is the inflated length (a uint32)
+     * followed by the deflate stream, so deflating only pays if that is shorter than the file.
+     * @param payloadLength set to the payload's length when deflating pays; otherwise unchanged
+     * @returns false, with the compressor freed, if the file is empty or could not be deflated to
+     * the end, or deflating would not make it smaller; the file is then sent as it is
+     */
+    bool sizeFile(File& file, uint8_t* scratch, size_t scratchLength, size_t& payloadLength) {
+
+        size_t start = file.position();
+        size_t fileLength = file.size() - start;
+        size_t deflatedLength = 0;
+
+        bool sized = fileLength > 0 && deflateFile(file, scratch, scratchLength, [&](uint8_t*, size_t length){
+            deflatedLength += length;
+            return true;
+        });
+
+        file.seek(start);
+
+        if (!sized || sizeof(uint32_t) + deflatedLength >= fileLength) {
+            end();
+            return false;
+        }
+
+        payloadLength = sizeof(uint32_t) + deflatedLength;
+        return true;
+    }
+
+    /**
+     * Frees the compressor
+     */
+    void end() {
+        free(_compressor);
+        _compressor = nullptr;
+        memset(_output, 0, sizeof(_output));
+    }
+
+private:
+
+    tdefl_compressor* _compressor = nullptr;
+    uint8_t _output[BACKUP_DEFLATE_OUTPUT_CHUNK_SIZE];
+
+    static void* _alloc(size_t size) {
+        return psramFound() ? ps_malloc(size) : malloc(size);
+    }
+};
+
+
+/**
+ * Streaming raw deflate decompressor for restoring cloud backups.  Input arrives in whatever pieces
+ * the caller has and output leaves through a sink as it is produced, so a restore never holds the
+ * whole backup.  The decompressor and its TINFL_LZ_DICT_SIZE window are allocated (in PSRAM when
+ * present) by begin() and freed by end() or destruction.
+ */
+class BackupInflater {
+
+public:
+
+    BackupInflater() {}
+    BackupInflater(const BackupInflater&) = delete;
+    BackupInflater& operator=(const BackupInflater&) = delete;
+
+    ~BackupInflater() {
+        end();
+    }
+
+    /**
+     * Allocates the decompressor if needed and resets it for a new stream
+     */
+    bool begin() {
+
+        if (_decompressor == nullptr) {
+            _decompressor = (tinfl_decompressor*)_alloc(sizeof(tinfl_decompressor));
+        }
+        if (_window == nullptr) {
+            _window = (uint8_t*)_alloc(TINFL_LZ_DICT_SIZE);
+        }
+        if (_decompressor == nullptr || _window == nullptr) {
+            end();
+            return false;
+        }
+
+        tinfl_init(_decompressor);
+        _windowPosition = 0;
+        _done = false;
+        _failed = false;
+        return true;
+    }
+
+    /**
+     * Decompresses the next length bytes of the stream.  Calls sink(const uint8_t* data, size_t length)
+     * with each piece of output; the data is the decompressor's window and must not be modified.
+     * The sink returns false to stop.
+     * @returns false if the stream is corrupt, continues past its end, or the sink stopped
+     */
+    template <typename F>
+    bool update(const uint8_t* input, size_t length, F sink) {
+
+        if (_decompressor == nullptr || _failed) return false;
+        if (_done) return length == 0 || _fail();
+
+        for (;;) {
+
+            size_t inputLength = length;
+            size_t outputLength = TINFL_LZ_DICT_SIZE - _windowPosition;
+
+            tinfl_status status = tinfl_decompress(_decompressor, input, &inputLength, _window, _window + _windowPosition,
+                                                   &outputLength, TINFL_FLAG_HAS_MORE_INPUT);
+            if (status < 0) return _fail();
+
+            input += inputLength;
+            length -= inputLength;
+
+            if (outputLength > 0 && !sink((const uint8_t*)(_window + _windowPosition), outputLength)) return _fail();
+            _windowPosition = (_windowPosition + outputLength) & (TINFL_LZ_DICT_SIZE - 1);
+
+            if (status == TINFL_STATUS_DONE) {
+                _done = true;
+                return length == 0 || _fail();
+            }
+
+            // A full window leaves output behind even when all the input has been taken
+            if (status != TINFL_STATUS_HAS_MORE_OUTPUT && length == 0) return true;
+        }
+    }
+
+    /**
+     * True once the end of the deflate stream has been decompressed without error
+     */
+    bool isComplete() const {
+        return _done && !_failed;
+    }
+
+    /**
+     * Frees the decompressor and clears its window
+     */
+    void end() {
+        free(_decompressor);
+        _decompressor = nullptr;
+
+        if (_window != nullptr) {
+            memset(_window, 0, TINFL_LZ_DICT_SIZE);
+            free(_window);
+            _window = nullptr;
+        }
+    }
+
+private:
+
+    tinfl_decompressor* _decompressor = nullptr;
+    uint8_t* _window = nullptr;
+    size_t _windowPosition = 0;
+    bool _done = false;
+    bool _failed = false;
+
+    bool _fail() {
+        _failed = true;
+        return false;
+    }
+
+    static void* _alloc(size_t size) {
+        return psramFound() ? ps_malloc(size) : malloc(size);
+    }
+};
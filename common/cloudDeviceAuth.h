@@ -9,30 +9,71 @@
 #include <mbedtls/ecdsa.h>
 #include <mbedtls/sha256.h>
 #include <mbedtls/base64.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include "common/deviceIdentity.h"
+#include "common/cloudHttpPool.h"
 #include <time.h>
 #include <string.h>
 
+#ifndef CLOUD_DEVICE_AUTH_YIELD_TICKS
+  #define CLOUD_DEVICE_AUTH_YIELD_TICKS 1 /* Ticks to give other tasks between key derivation and signing */
+#endif
+
 static int _cloudDeviceAuth_rng(void*, unsigned char* buf, size_t len) {
   esp_fill_random(buf, len);
   return 0;
 }
 
+/**
+ * Signs @p hash with @p ecdsa in one mbedtls call, after yielding CLOUD_DEVICE_AUTH_YIELD_TICKS
+ * so the signature starts on a fresh time slice.  The calling task stays preemptible throughout;
+ * FreeRTOS time-slices it against tasks of equal priority and higher-priority tasks preempt it.
+ *
+ * Restartable ECP (mbedtls_ecp_set_max_ops) is deliberately not used: the limit is process-wide,
+ * so while it is set every ECC operation on every task, including the TLS handshakes in
+ * CloudHttpPool, the OTA client and MqttTransport, returns "in progress" mid-handshake, which
+ * esp-tls treats as fatal.  The arduino-esp32 sdkconfig leaves MBEDTLS_ECP_RESTARTABLE off anyway.
+ *
+ * The duration of each signature is logged at debug level.
+ */
+static bool _cloudDeviceAuth_sign(mbedtls_ecdsa_context* ecdsa, const uint8_t* hash, uint8_t* sig, size_t sigSize, size_t* sigLen) {
+
+  vTaskDelay(CLOUD_DEVICE_AUTH_YIELD_TICKS);
+
+  int64_t started = esp_timer_get_time();
+  int ret = mbedtls_ecdsa_write_signature(ecdsa, MBEDTLS_MD_SHA256,
+                                          hash, 32, sig, sigSize, sigLen,
+                                          _cloudDeviceAuth_rng, nullptr);
+  int64_t elapsed = esp_timer_get_time() - started;
+
+  log_d("Signed in %lu us", (unsigned long)elapsed);
+
+  return ret == 0;
+}
+
 /**
  * Derives key_auth from the eFuse master key, generates a random nonce and
  * timestamp-based signature, and sets the four device-authentication headers
- * on @p client.
+ * on @p client through @p pool, so the next request on the pooled handle does
+ * not resend them.
  *
  * Reads the master key directly from eFuse each call so it is safe to use
  * even after deviceIdentity.data.key has been zeroed for security.  All
  * sensitive material (master key, key_auth) is zeroed before returning.
  *
- * @param client  Initialized esp_http_client handle
+ * Blocks the calling task until the signature is done, and yields before
+ * signing (see _cloudDeviceAuth_sign), so call it from a task that may be
+ * delayed, not from an ISR or with interrupts disabled.
+ *
+ * @param pool    Pool @p client was acquired from
+ * @param client  Handle returned by CloudHttpPool::acquire()
  * @param uuid    Device UUID string (deviceIdentity.data.uuid)
  * @param now     Current UTC time as time_t
- * @return true on success; false if key derivation or signing fails
+ * @return true on success; false if key derivation, signing or setting a header fails
  */
-static bool cloudDeviceAuth_setHeaders(esp_http_client_handle_t client, const char* uuid, time_t now) {
+static bool cloudDeviceAuth_setHeaders(CloudHttpPool& pool, esp_http_client_handle_t client, const char* uuid, time_t now) {
 
   uint8_t master_key[32] = {};
   esp_efuse_read_block(EFUSE_BLK3, master_key, EFUSE_KEY_OFFSET_BITS, EFUSE_KEY_SIZE_BITS);
@@ -77,9 +118,7 @@ static bool cloudDeviceAuth_setHeaders(esp_http_client_handle_t client, const ch
   memset(key_auth, 0, 32);
 
   uint8_t sig[72]; size_t sigLen = 0;
-  bool signOk = (mbedtls_ecdsa_write_signature(&ecdsa, MBEDTLS_MD_SHA256,
-                                               hash, 32, sig, sizeof(sig), &sigLen,
-                                               _cloudDeviceAuth_rng, nullptr) == 0);
+  bool signOk = _cloudDeviceAuth_sign(&ecdsa, hash, sig, sizeof(sig), &sigLen);
   mbedtls_ecdsa_free(&ecdsa);
 
   if (!signOk) return false;
@@ -89,10 +128,8 @@ static bool cloudDeviceAuth_setHeaders(esp_http_client_handle_t client, const ch
   mbedtls_base64_encode(nonceB64, sizeof(nonceB64), &nonceB64Len, nonce, 32);
   mbedtls_base64_encode(sigB64,   sizeof(sigB64),   &sigB64Len,   sig,   sigLen);
 
-  esp_http_client_set_header(client, "X-Device-UUID",      uuid);
-  esp_http_client_set_header(client, "X-Device-Nonce",     (char*)nonceB64);
-  esp_http_client_set_header(client, "X-Device-Timestamp", timestampBuf);
-  esp_http_client_set_header(client, "X-Device-Signature", (char*)sigB64);
-
-  return true;
+  return pool.setHeader(client, "X-Device-UUID",      uuid)
+      && pool.setHeader(client, "X-Device-Nonce",     (char*)nonceB64)
+      && pool.setHeader(client, "X-Device-Timestamp", timestampBuf)
+      && pool.setHeader(client, "X-Device-Signature", (char*)sigB64);
 }
@@ -0,0 +1,493 @@
+#pragma once
+#include <Arduino.h>
+#include <esp_http_client.h>
+#include <esp_crt_bundle.h>
+#include <esp_timer.h>
+#include <sdkconfig.h>
+#include <freertos/FreeRTOS.h>
+
+#ifndef CLOUD_HTTP_POOL_SLOTS
+    #define CLOUD_HTTP_POOL_SLOTS 2 /* Hosts with a pooled client; the least recently used idle one is replaced */
+#endif
+
+#ifndef CLOUD_HTTP_POOL_IDLE_SECONDS
+    #define CLOUD_HTTP_POOL_IDLE_SECONDS 4 /* An idle connection is closed after this long; below the 5-15 s most servers keep one open */
+#endif
+
+#ifndef CLOUD_HTTP_POOL_MAX_HEADERS
+    #define CLOUD_HTTP_POOL_MAX_HEADERS 8 /* Per-request headers set through setHeader(); device authentication uses four */
+#endif
+
+#ifndef CLOUD_HTTP_POOL_MAX_CAPTURES
+    #define CLOUD_HTTP_POOL_MAX_CAPTURES 2 /* Response headers recorded through captureHeader() */
+#endif
+
+#ifndef CLOUD_HTTP_POOL_TX_BUFFER_SIZE
+    #define CLOUD_HTTP_POOL_TX_BUFFER_SIZE 2048 /* esp_http_client transmit buffer */
+#endif
+
+
+/**
+ * Shared esp_http_client handles for cloud requests, one per host, so consecutive requests to the
+ * same service reuse a kept-alive connection instead of a new TCP and TLS handshake each time.  When
+ * a connection has to be made again, the TLS session ticket saved by the previous one (if the IDF
+ * build has CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS) lets the server resume the session with an
+ * abbreviated handshake.
+ *
+ * A request is: acquire() the client for a URL, set headers with setHeader() (headers set directly on
+ * the handle persist into the next request), open() and fetchHeaders() or perform() it, then release() it.  Response
+ * headers are only seen by the event handler, so any the caller needs are named with captureHeader()
+ * before the request is sent.  A handle is
+ * used by one task at a time; acquire() returns nullptr rather than waiting if the host's client is
+ * checked out.  Idle connections are closed by expireIdle(), so they do not hold TLS buffers between
+ * bursts of requests.
+ *
+ * Servers are verified against the built-in root CA bundle, or against the PEM passed to acquire().
+ * The pool keeps its own copy of that PEM for as long as the client uses it, so the caller's buffer
+ * only has to stay valid for the acquire() call.
+ *
+ * Every connection made is counted and timed (TCP connect and TLS handshake) for getStats().
+ */
+class CloudHttpPool {
+
+public:
+
+    struct stats {
+        uint32_t requests;              // open() and perform() calls
+        uint32_t reused;                // Requests sent on a kept-alive connection
+        uint32_t handshakes;            // Connections made
+        uint32_t resumable;             // Handshakes that could offer a saved session ticket
+        uint32_t handshakeMillisTotal;
+        uint32_t handshakeMillisMax;
+    };
+
+    CloudHttpPool() {}
+    CloudHttpPool(const CloudHttpPool&) = delete;
+    CloudHttpPool& operator=(const CloudHttpPool&) = delete;
+
+    /**
+     * Checks out the client for url's host, creating it on first use, and prepares it for a new request
+     * @param caPem PEM certificates to verify the server with, or nullptr for the built-in bundle; copied.
+     * A client made with other certificates is replaced, dropping its connection.
+     * @returns nullptr if the host's client is checked out, every slot is busy, or the client could not be created
+     */
+    esp_http_client_handle_t acquire(const char* url, esp_http_client_method_t method, int timeoutMs, const char* caPem = nullptr) {
+
+        char host[sizeof(_slot::host)];
+        if (!_hostOf(url, host, sizeof(host))) return nullptr;
+
+        _slot* slot = nullptr;
+
+        portENTER_CRITICAL(&_mux);
+        slot = _claim(host);
+        portEXIT_CRITICAL(&_mux);
+
+        if (slot == nullptr) {
+            log_w("No pooled HTTP client free for %s", host);
+            return nullptr;
+        }
+
+        if (slot->client != nullptr && (strcmp(slot->host, host) != 0 || !_sameCA(slot->caPem, caPem))) {
+            esp_http_client_cleanup(slot->client);
+            slot->client = nullptr;
+            slot->connected = false;
+            slot->handshakes = 0;
+        }
+
+        if (slot->client == nullptr) {
+            strlcpy(slot->host, host, sizeof(slot->host));
+            slot->client = _create(slot, url, caPem);
+            if (slot->client == nullptr) {
+                _release(slot);
+                return nullptr;
+            }
+        } else if (esp_http_client_set_url(slot->client, url) != ESP_OK) {
+            _release(slot);
+            return nullptr;
+        }
+
+        // Left over from the previous request on this handle, including any set on it directly
+        for (uint8_t i = 0; i < slot->headerCount; i++) {
+            esp_http_client_delete_header(slot->client, slot->headers[i]);
+        }
+        for (const char* name : _deviceAuthHeaders) {
+            esp_http_client_delete_header(slot->client, name);
+        }
+        slot->headerCount = 0;
+        slot->captureCount = 0;
+        esp_http_client_set_post_field(slot->client, nullptr, 0);
+
+        esp_http_client_set_method(slot->client, method);
+        slot->method = method;
+        slot->writeLength = 0;
+        slot->sentReused = false;
+        esp_http_client_set_timeout_ms(slot->client, timeoutMs);
+
+        return slot->client;
+    }
+
+    /**
+     * Sets a request header that acquire() removes again before the next request
+     * @param name must outlive the request; use a literal
+     */
+    bool setHeader(esp_http_client_handle_t client, const char* name, const char* value) {
+
+        _slot* slot = _find(client);
+        if (slot == nullptr) return false;
+
+        bool listed = false;
+        for (uint8_t i = 0; i < slot->headerCount; i++) {
+            if (strcmp(slot->headers[i], name) == 0) listed = true;
+        }
+        if (!listed) {
+            if (slot->headerCount == CLOUD_HTTP_POOL_MAX_HEADERS) return false;
+            slot->headers[slot->headerCount++] = name;
+        }
+
+        return esp_http_client_set_header(client, name, value) == ESP_OK;
+    }
+
+    /**
+     * Copies the value of response header name into value when the response arrives; value is left
+     * unchanged if the response does not have the header
+     * @param name and value must outlive the request
+     */
+    bool captureHeader(esp_http_client_handle_t client, const char* name, char* value, size_t length) {
+
+        _slot* slot = _find(client);
+        if (slot == nullptr || slot->captureCount == CLOUD_HTTP_POOL_MAX_CAPTURES || length == 0) return false;
+
+        slot->captures[slot->captureCount++] = {name, value, length};
+        return true;
+    }
+
+    /**
+     * esp_http_client_open(), on a fresh connection if the kept-alive one has been dropped by the server.
+     * open() only connects and writes the request headers, so a failure means the server never saw a
+     * whole request and it is safe to send again whatever the method.
+     */
+    esp_err_t open(esp_http_client_handle_t client, int writeLength) {
+        _slot* slot = _find(client);
+        if (slot != nullptr) slot->writeLength = writeLength;
+        return _send(client, true, [&](){ return esp_http_client_open(client, writeLength); });
+    }
+
+    /**
+     * esp_http_client_fetch_headers() after open().  A server that closed the kept-alive connection while
+     * it sat idle may only be noticed here, when the response never comes; a GET or HEAD without a body
+     * is then opened on a fresh connection and its headers fetched once more.
+     * @returns the content length, 0 if unknown, or negative on failure, as esp_http_client_fetch_headers()
+     */
+    int64_t fetchHeaders(esp_http_client_handle_t client) {
+
+        _slot* slot = _find(client);
+        if (slot == nullptr) return ESP_FAIL;
+
+        int64_t length = esp_http_client_fetch_headers(client);
+        if (length >= 0 || !slot->sentReused || slot->writeLength != 0 || !_idempotent(slot)) return length;
+
+        log_d("No response on kept-alive connection to %s, reconnecting", slot->host);
+        esp_http_client_close(client);
+        slot->connected = false;
+        slot->sentReused = false;
+        slot->connectStarted = esp_timer_get_time();
+
+        portENTER_CRITICAL(&_mux);
+        _stats.reused--;
+        portEXIT_CRITICAL(&_mux);
+
+        if (esp_http_client_open(client, 0) != ESP_OK) return ESP_FAIL;
+        return esp_http_client_fetch_headers(client);
+    }
+
+    /**
+     * esp_http_client_perform(), on a fresh connection if the kept-alive one has been dropped by the server.
+     * perform() can fail after the server has received and acted on the request, so only GET and HEAD,
+     * which change nothing, are sent again.
+     */
+    esp_err_t perform(esp_http_client_handle_t client) {
+        _slot* slot = _find(client);
+        bool safe = slot != nullptr && _idempotent(slot);
+        return _send(client, safe, [&](){ return esp_http_client_perform(client); });
+    }
+
+    /**
+     * Returns a client to the pool
+     * @param keepAlive true if the whole response was read, so the connection can carry the next request;
+     * otherwise it is closed, keeping the TLS session for the next handshake
+     */
+    void release(esp_http_client_handle_t client, bool keepAlive) {
+
+        _slot* slot = _find(client);
+        if (slot == nullptr) return;
+
+        // Reads off any body the caller did not want so the next request starts on a clean stream
+        if (keepAlive && esp_http_client_flush_response(client, nullptr) != ESP_OK) {
+            keepAlive = false;
+        }
+
+        if (!keepAlive || !esp_http_client_is_complete_data_received(client)) {
+            esp_http_client_close(client);
+            slot->connected = false;
+        }
+
+        slot->lastUsed = esp_timer_get_time();
+        _release(slot);
+    }
+
+    /**
+     * Closes connections idle for CLOUD_HTTP_POOL_IDLE_SECONDS; cheap enough to call every loop
+     */
+    void expireIdle() {
+
+        int64_t now = esp_timer_get_time();
+
+        for (size_t i = 0; i < CLOUD_HTTP_POOL_SLOTS; i++) {
+
+            _slot* slot = &_slots[i];
+
+            portENTER_CRITICAL(&_mux);
+            bool expired = !slot->inUse && slot->connected
+                        && now - slot->lastUsed >= (int64_t)CLOUD_HTTP_POOL_IDLE_SECONDS * 1000000LL;
+            if (expired) slot->inUse = true;
+            portEXIT_CRITICAL(&_mux);
+
+            if (!expired) continue;
+
+            esp_http_client_close(slot->client);
+            slot->connected = false;
+            _release(slot);
+        }
+    }
+
+    void getStats(stats& out) {
+        portENTER_CRITICAL(&_mux);
+        out = _stats;
+        portEXIT_CRITICAL(&_mux);
+    }
+
+private:
+
+    struct _slot {
+        CloudHttpPool* pool;
+        esp_http_client_handle_t client;
+        char host[72];                  // scheme://authority the client is connected to
+        char* caPem;                    // The client's copy of the PEM it verifies with; nullptr for the bundle
+        esp_http_client_method_t method;
+        int writeLength;                // Body length given to open()
+        bool sentReused;                // The request went out on a kept-alive connection
+        bool inUse;
+        bool connected;                 // A connection is open and may be reused
+        uint32_t handshakes;            // Connections this client has made; a ticket is saved after the first
+        int64_t connectStarted;
+        int64_t lastUsed;
+        const char* headers[CLOUD_HTTP_POOL_MAX_HEADERS];
+        uint8_t headerCount;
+        struct {
+            const char* name;
+            char* value;
+            size_t length;
+        } captures[CLOUD_HTTP_POOL_MAX_CAPTURES];
+        uint8_t captureCount;
+    };
+
+    #if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        static constexpr bool _sessionTickets = true;
+    #else
+        static constexpr bool _sessionTickets = false;
+    #endif
+
+    // Signed per request, so a stale set must never reach the next one
+    static constexpr const char* _deviceAuthHeaders[] = {"X-Device-UUID", "X-Device-Nonce", "X-Device-Timestamp", "X-Device-Signature"};
+
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+    _slot _slots[CLOUD_HTTP_POOL_SLOTS] = {};
+    stats _stats = {};
+
+    /**
+     * Marks the slot for host, or the least recently used idle slot, as in use.  Caller holds _mux.
+     */
+    _slot* _claim(const char* host) {
+
+        _slot* unused = nullptr;
+        _slot* oldest = nullptr;
+
+        for (size_t i = 0; i < CLOUD_HTTP_POOL_SLOTS; i++) {
+
+            _slot* slot = &_slots[i];
+
+            if (slot->client != nullptr && strcmp(slot->host, host) == 0) {
+                if (slot->inUse) return nullptr;
+                slot->inUse = true;
+                return slot;
+            }
+
+            if (slot->inUse) continue;
+
+            if (slot->client == nullptr) {
+                if (unused == nullptr) unused = slot;
+            } else if (oldest == nullptr || slot->lastUsed < oldest->lastUsed) {
+                oldest = slot;
+            }
+        }
+
+        _slot* choice = unused != nullptr ? unused : oldest;
+        if (choice != nullptr) choice->inUse = true;
+        return choice;
+    }
+
+    void _release(_slot* slot) {
+        portENTER_CRITICAL(&_mux);
+        slot->inUse = false;
+        portEXIT_CRITICAL(&_mux);
+    }
+
+    _slot* _find(esp_http_client_handle_t client) {
+        for (size_t i = 0; i < CLOUD_HTTP_POOL_SLOTS; i++) {
+            if (_slots[i].client == client && _slots[i].inUse) return &_slots[i];
+        }
+        return nullptr;
+    }
+
+    esp_http_client_handle_t _create(_slot* slot, const char* url, const char* caPem) {
+
+        slot->pool = this;
+        slot->connected = false;
+        slot->handshakes = 0;
+
+        // esp_http_client keeps a pointer to cert_pem, so it gets a copy the caller cannot free
+        free(slot->caPem);
+        slot->caPem = nullptr;
+        if (caPem != nullptr) {
+            size_t length = strlen(caPem) + 1;
+            slot->caPem = (char*)ps_malloc(length);
+            if (slot->caPem == nullptr) slot->caPem = (char*)malloc(length);
+            if (slot->caPem == nullptr) return nullptr;
+            memcpy(slot->caPem, caPem, length);
+        }
+
+        esp_http_client_config_t cfg = {};
+        cfg.url               = url;
+        if (slot->caPem != nullptr) {
+            cfg.cert_pem      = slot->caPem;
+        } else {
+            cfg.crt_bundle_attach = esp_crt_bundle_attach;
+        }
+        cfg.buffer_size_tx    = CLOUD_HTTP_POOL_TX_BUFFER_SIZE;
+        cfg.keep_alive_enable = true;
+        cfg.event_handler     = _onEvent;
+        cfg.user_data         = slot;
+        #if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+            cfg.save_client_session = true;
+        #endif
+
+        return esp_http_client_init(&cfg);
+    }
+
+    static bool _idempotent(const _slot* slot) {
+        return slot->method == HTTP_METHOD_GET || slot->method == HTTP_METHOD_HEAD;
+    }
+
+    static bool _sameCA(const char* a, const char* b) {
+        if (a == nullptr || b == nullptr) return a == b;
+        return strcmp(a, b) == 0;
+    }
+
+    /**
+     * @param retryable the request may be sent a second time if it fails on a reused connection
+     */
+    template <typename F>
+    esp_err_t _send(esp_http_client_handle_t client, bool retryable, F request) {
+
+        _slot* slot = _find(client);
+        if (slot == nullptr) return ESP_ERR_INVALID_ARG;
+
+        bool reused = slot->connected;
+        slot->connectStarted = esp_timer_get_time();
+
+        esp_err_t err = request();
+
+        if (err != ESP_OK && reused && retryable) {
+            // Most likely the server closed the kept-alive connection while it sat idle; try once on a new one
+            esp_http_client_close(client);
+            slot->connected = false;
+            reused = false;
+            slot->connectStarted = esp_timer_get_time();
+            err = request();
+        }
+
+        slot->sentReused = err == ESP_OK && reused;
+
+        portENTER_CRITICAL(&_mux);
+        _stats.requests++;
+        if (slot->sentReused) _stats.reused++;
+        portEXIT_CRITICAL(&_mux);
+
+        return err;
+    }
+
+    /**
+     * Counts a connection once esp_http_client has finished its TCP connect and TLS handshake
+     */
+    static esp_err_t _onEvent(esp_http_client_event_t* event) {
+
+        _slot* slot = (_slot*)event->user_data;
+        if (slot == nullptr) return ESP_OK;
+
+        switch (event->event_id) {
+
+            case HTTP_EVENT_ON_CONNECTED: {
+                uint32_t millis = (uint32_t)((esp_timer_get_time() - slot->connectStarted) / 1000LL);
+                bool resumable = _sessionTickets && slot->handshakes > 0;
+                slot->connected = true;
+                slot->handshakes++;
+
+                CloudHttpPool* pool = slot->pool;
+                portENTER_CRITICAL(&pool->_mux);
+                pool->_stats.handshakes++;
+                if (resumable) pool->_stats.resumable++;
+                pool->_stats.handshakeMillisTotal += millis;
+                if (millis > pool->_stats.handshakeMillisMax) pool->_stats.handshakeMillisMax = millis;
+                portEXIT_CRITICAL(&pool->_mux);
+
+                log_i("Connected to %s in %lu ms%s", slot->host, (unsigned long)millis, resumable ? " (session ticket offered)" : "");
+                break;
+            }
+
+            case HTTP_EVENT_ON_HEADER:
+                for (uint8_t i = 0; i < slot->captureCount; i++) {
+                    if (strcasecmp(event->header_key, slot->captures[i].name) == 0) {
+                        strlcpy(slot->captures[i].value, event->header_value, slot->captures[i].length);
+                    }
+                }
+                break;
+
+            case HTTP_EVENT_DISCONNECTED:
+                slot->connected = false;
+                break;
+
+            default:
+                break;
+        }
+
+        return ESP_OK;
+    }
+
+    /**
+     * Copies the scheme and authority of url ("https://api.example.com:8443") into host
+     */
+    static bool _hostOf(const char* url, char* host, size_t length) {
+
+        const char* authority = strstr(url, "://");
+        if (authority == nullptr) return false;
+        authority += 3;
+
+        size_t end = strcspn(authority, "/?#");
+        size_t total = (authority - url) + end;
+        if (end == 0 || total >= length) return false;
+
+        memcpy(host, url, total);
+        host[total] = '\0';
+        return true;
+    }
+};
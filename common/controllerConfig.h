@@ -0,0 +1,156 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <ArduinoJson.h>
+#include "secretEncryption.h"
+#include "psramAllocator.h"
+
+/**
+ * Shared, decrypted copy of this controller's own config file (/controllers/<uuid>).
+ *
+ * The file is stream-decrypted and parsed once into a PSRAM-backed JsonDocument holding only the
+ * members the firmware reads (name, area, mqtt, syslog, ota, outputs, ports).  Every consumer
+ * reads that document instead of decrypting and filtering the file itself; boot-time setup reads
+ * the RuntimeConfigImage compiled from it instead, and only falls back here to rebuild the image.
+ *
+ * Writers of the file call invalidate(), which only bumps a generation counter and is safe from
+ * the HTTP task; the next load() on the main task sees the stale generation and reloads.
+ */
+class ControllerConfigCache {
+
+public:
+
+    enum loadResult {
+        LOAD_OK = 0,            // root() holds the parsed config
+        LOAD_NOT_FOUND = 1,     // No config file exists for this controller
+        LOAD_DECRYPT_FAIL = 2,  // The file exists but could not be decrypted
+        LOAD_PARSE_FAIL = 3,    // The file decrypted but is not valid JSON; see error()
+        LOAD_NO_MEMORY = 4      // The config parsed but a derived form of it could not be allocated
+    };
+
+    ControllerConfigCache() : _doc(&spiRamAllocator) {}
+
+    /**
+     * Sets the file backing the cache.  Does not read it; the first load() does.
+     */
+    void begin(fs::FS& fs, SecretEncryption& encryption, const String& path) {
+        _fs = &fs;
+        _encryption = &encryption;
+        _path = path;
+        invalidate();
+    }
+
+    /**
+     * Marks the cached copy stale.  Call whenever the backing file is written or removed.
+     */
+    void invalidate() {
+        _generation++;
+    }
+
+    /**
+     * Incremented by every invalidate(); consumers may compare it to detect a changed config
+     */
+    uint32_t generation() {
+        return _generation;
+    }
+
+    /**
+     * Returns the cached config, decrypting and parsing the file first if the cache is stale.
+     * Must only be called from the main task.
+     */
+    loadResult load() {
+
+        uint32_t generation = _generation;
+
+        if (_loadedGeneration == generation) {
+            return _result;
+        }
+
+        _loadedGeneration = generation;
+        _doc.clear();
+        _error = DeserializationError::Ok;
+
+        if (_fs == nullptr || _encryption == nullptr || !_fs->exists(_path)) {
+            _result = LOAD_NOT_FOUND;
+            return _result;
+        }
+
+        DecryptStream plaintext;
+        if (!_encryption->openDecryptStream(*_fs, _path, plaintext)) {
+            _result = LOAD_DECRYPT_FAIL;
+            return _result;
+        }
+
+        JsonDocument filter;
+        _buildFilter(filter);
+
+        _error = deserializeJson(_doc, plaintext, DeserializationOption::Filter(filter));
+        plaintext.close();
+        _result = _error ? LOAD_PARSE_FAIL : LOAD_OK;
+
+        return _result;
+    }
+
+    /**
+     * The cached config; empty unless the last load() returned LOAD_OK
+     */
+    JsonObjectConst root() {
+        return _doc.as<JsonObjectConst>();
+    }
+
+    /**
+     * The deserialization error from the last load(), if it returned LOAD_PARSE_FAIL
+     */
+    DeserializationError error() {
+        return _error;
+    }
+
+    const String& path() {
+        return _path;
+    }
+
+private:
+
+    JsonDocument _doc;
+    fs::FS* _fs = nullptr;
+    SecretEncryption* _encryption = nullptr;
+    String _path;
+
+    volatile uint32_t _generation = 1;
+    uint32_t _loadedGeneration = 0;
+    loadResult _result = LOAD_NOT_FOUND;
+    DeserializationError _error;
+
+    /**
+     * Union of the members read by all consumers; anything else in the file is not kept in memory
+     */
+    static void _buildFilter(JsonDocument& filter) {
+
+        filter["name"] = true;
+        filter["area"] = true;
+        filter["mqtt"] = true;
+        filter["syslog"] = true;
+        filter["ota"] = true;
+
+        JsonObject outputs = filter["outputs"]["*"].to<JsonObject>();
+        outputs["id"] = true;
+        outputs["type"] = true;
+        outputs["enabled"] = true;
+        outputs["start_brightness"] = true;
+        outputs["name"] = true;
+        outputs["area"] = true;
+        outputs["icon"] = true;
+        outputs["relay_manufacturer"] = true;
+        outputs["relay_model"] = true;
+
+        JsonObject ports = filter["ports"]["*"].to<JsonObject>();
+        ports["id"] = true;
+        ports["clientUUID"] = true;
+
+        JsonObject channels = ports["channels"]["*"].to<JsonObject>();
+        channels["type"] = true;
+        channels["enabled"] = true;
+        channels["offset"] = true;
+        channels["actions"] = true;
+    }
+};
@@ -0,0 +1,303 @@
+#pragma once
+#include <Arduino.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+
+#ifndef DELTA_OTA_WRITE_BUFFER_SIZE
+    #define DELTA_OTA_WRITE_BUFFER_SIZE 4096 /* Rebuilt image bytes staged per esp_ota_write() */
+#endif
+
+
+/**
+ * Rebuilds a new application image into the next OTA partition from a delta patch against the running
+ * image, so an update downloads only what changed between the two releases.  Patches are made by
+ * scripts/delta-ota.py.  After the header, a patch is a bsdiff-style list of records:
+ *
+ *   header   "FFDP", version (1), 3 reserved, base length (u32), base SHA-256, target length (u32), target SHA-256
+ *   record   diff length (u32), extra length (u32), seek (i32), then diff-length bytes that are added byte by
+ *            byte to the base from the current base offset, then extra-length bytes copied as they are;
+ *            the base offset then moves by seek
+ *
+ * All integers are little-endian.  update() takes the decompressed patch (the file is raw deflate; see
+ * BackupInflater) in pieces of any size.  The base is read through a memory map of the running partition
+ * and checked against the base SHA-256 before anything is written; the rebuilt image is checked against
+ * the target SHA-256 in finish(), which then closes the partition with esp_ota_end() (image validation,
+ * and signature verification under secure boot).  Selecting the partition for boot is left to the caller.
+ */
+class DeltaOta {
+
+public:
+
+    static constexpr size_t HEADER_SIZE = 4 + 4 + 4 + 32 + 4 + 32;
+
+    DeltaOta() {}
+    DeltaOta(const DeltaOta&) = delete;
+    DeltaOta& operator=(const DeltaOta&) = delete;
+
+    ~DeltaOta() {
+        abort();
+    }
+
+    /**
+     * Feeds the next length bytes of the decompressed patch
+     * @returns false once the patch is invalid, does not apply to the running image, or cannot be written
+     */
+    bool update(const uint8_t* data, size_t length) {
+
+        if (_error != nullptr) return false;
+
+        while (length > 0) {
+
+            if (_headerLength < HEADER_SIZE) {
+                size_t take = min(length, HEADER_SIZE - _headerLength);
+                memcpy(_header + _headerLength, data, take);
+                _headerLength += take;
+                data += take;
+                length -= take;
+                if (_headerLength == HEADER_SIZE && !_begin()) return false;
+                continue;
+            }
+
+            if (_recordLength < sizeof(_record)) {
+                if (_recordLength == 0 && _written == _targetLength) return _fail("Patch continues past the target");
+                size_t take = min(length, sizeof(_record) - _recordLength);
+                memcpy(_record + _recordLength, data, take);
+                _recordLength += take;
+                data += take;
+                length -= take;
+                if (_recordLength == sizeof(_record) && !_startRecord()) return false;
+                continue;
+            }
+
+            if (_diffRemaining > 0) {
+                size_t take = min(length, (size_t)_diffRemaining);
+                for (size_t i = 0; i < take; i++) {
+                    if (!_emit(data[i] + _base[_baseOffset + i])) return false;
+                }
+                _baseOffset += take;
+                _diffRemaining -= take;
+                data += take;
+                length -= take;
+            } else if (_extraRemaining > 0) {
+                size_t take = min(length, (size_t)_extraRemaining);
+                for (size_t i = 0; i < take; i++) {
+                    if (!_emit(data[i])) return false;
+                }
+                _extraRemaining -= take;
+                data += take;
+                length -= take;
+            }
+
+            if (_diffRemaining == 0 && _extraRemaining == 0) {
+                _endRecord();
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Verifies the rebuilt image and closes the partition; call once the whole patch has been fed
+     * @returns true if partition() now holds the target image
+     */
+    bool finish() {
+
+        if (_error != nullptr) return false;
+        if (_headerLength < HEADER_SIZE || _written != _targetLength || _recordLength != 0) return _fail("Patch is incomplete");
+        if (!_flush()) return false;
+
+        uint8_t hash[32];
+        mbedtls_sha256_finish(&_targetHash, hash);
+        if (memcmp(hash, _header + 48, 32) != 0) return _fail("Rebuilt image does not match");
+
+        _unmap();
+
+        esp_err_t err = esp_ota_end(_ota);
+        _ota = 0;
+        if (err != ESP_OK) {
+            log_e("esp_ota_end: %s", esp_err_to_name(err));
+            return _fail("Rebuilt image is not valid");
+        }
+
+        _finished = true;
+        return true;
+    }
+
+    /**
+     * Abandons the update and releases the partition and the memory map
+     */
+    void abort() {
+        if (_ota != 0) {
+            esp_ota_abort(_ota);
+            _ota = 0;
+        }
+        _unmap();
+        if (_hashing) {
+            mbedtls_sha256_free(&_targetHash);
+            _hashing = false;
+        }
+    }
+
+    /**
+     * The partition being written; after a successful finish(), the one to boot
+     */
+    const esp_partition_t* partition() const {
+        return _finished ? _partition : nullptr;
+    }
+
+    /**
+     * SHA-256 of the target image, from the patch header; meaningless until the header has been read
+     */
+    const uint8_t* targetHash() const {
+        return _header + 48;
+    }
+
+    size_t written() const {
+        return _written;
+    }
+
+    /**
+     * Length of the target image; 0 until the header has been read
+     */
+    size_t targetLength() const {
+        return _targetLength;
+    }
+
+    /**
+     * Why the update stopped, or nullptr
+     */
+    const char* error() const {
+        return _error;
+    }
+
+private:
+
+    uint8_t _header[HEADER_SIZE];
+    size_t _headerLength = 0;
+    uint8_t _record[12];
+    size_t _recordLength = 0;
+
+    const uint8_t* _base = nullptr;
+    size_t _baseLength = 0;
+    int64_t _baseOffset = 0;
+    esp_partition_mmap_handle_t _baseMap = 0;
+    bool _mapped = false;
+
+    uint32_t _diffRemaining = 0;
+    uint32_t _extraRemaining = 0;
+
+    const esp_partition_t* _partition = nullptr;
+    esp_ota_handle_t _ota = 0;
+    size_t _targetLength = 0;
+    size_t _written = 0;
+    mbedtls_sha256_context _targetHash;
+    bool _hashing = false;
+    bool _finished = false;
+
+    uint8_t _buffer[DELTA_OTA_WRITE_BUFFER_SIZE];
+    size_t _buffered = 0;
+
+    const char* _error = nullptr;
+
+    static uint32_t _u32(const uint8_t* p) {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    bool _fail(const char* error) {
+        if (_error == nullptr) _error = error;
+        log_e("Delta OTA: %s", _error);
+        abort();
+        return false;
+    }
+
+    /**
+     * Checks the header against the running image and opens the next OTA partition
+     */
+    bool _begin() {
+
+        if (memcmp(_header, "FFDP", 4) != 0 || _header[4] != 1) return _fail("Not a version 1 patch");
+
+        _baseLength = _u32(_header + 8);
+        _targetLength = _u32(_header + 44);
+
+        const esp_partition_t* running = esp_ota_get_running_partition();
+        _partition = esp_ota_get_next_update_partition(nullptr);
+        if (running == nullptr || _partition == nullptr) return _fail("No OTA partition");
+        if (_baseLength == 0 || _baseLength > running->size) return _fail("Base is not the running image");
+        if (_targetLength == 0 || _targetLength > _partition->size) return _fail("Target does not fit");
+
+        const void* base = nullptr;
+        if (esp_partition_mmap(running, 0, _baseLength, ESP_PARTITION_MMAP_DATA, &base, &_baseMap) != ESP_OK) {
+            return _fail("Unable to map the running image");
+        }
+        _base = (const uint8_t*)base;
+        _mapped = true;
+
+        uint8_t hash[32];
+        mbedtls_sha256(_base, _baseLength, hash, 0);
+        if (memcmp(hash, _header + 12, 32) != 0) return _fail("Base is not the running image");
+
+        esp_err_t err = esp_ota_begin(_partition, _targetLength, &_ota);
+        if (err != ESP_OK) {
+            _ota = 0;
+            log_e("esp_ota_begin: %s", esp_err_to_name(err));
+            return _fail("Unable to open the OTA partition");
+        }
+
+        mbedtls_sha256_init(&_targetHash);
+        mbedtls_sha256_starts(&_targetHash, 0);
+        _hashing = true;
+        return true;
+    }
+
+    bool _startRecord() {
+
+        _diffRemaining = _u32(_record);
+        _extraRemaining = _u32(_record + 4);
+
+        if ((uint64_t)_written + _diffRemaining + _extraRemaining > _targetLength) return _fail("Patch overruns the target");
+        if (_diffRemaining > 0 && (_baseOffset < 0 || (uint64_t)_baseOffset + _diffRemaining > _baseLength)) {
+            return _fail("Patch reads outside the base");
+        }
+
+        if (_diffRemaining == 0 && _extraRemaining == 0) {
+            _endRecord();
+        }
+        return true;
+    }
+
+    void _endRecord() {
+        _baseOffset += (int32_t)_u32(_record + 8);
+        _recordLength = 0;
+    }
+
+    bool _emit(uint8_t value) {
+        _buffer[_buffered++] = value;
+        _written++;
+        return _buffered < sizeof(_buffer) || _flush();
+    }
+
+    bool _flush() {
+
+        if (_buffered == 0) return true;
+
+        mbedtls_sha256_update(&_targetHash, _buffer, _buffered);
+
+        esp_err_t err = esp_ota_write(_ota, _buffer, _buffered);
+        _buffered = 0;
+        if (err != ESP_OK) {
+            log_e("esp_ota_write: %s", esp_err_to_name(err));
+            return _fail("Unable to write the OTA partition");
+        }
+        return true;
+    }
+
+    void _unmap() {
+        if (_mapped) {
+            esp_partition_munmap(_baseMap);
+            _mapped = false;
+            _base = nullptr;
+        }
+    }
+};
@@ -0,0 +1,234 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#ifndef DIRECTORY_INDEX_INITIAL_CAPACITY
+    #define DIRECTORY_INDEX_INITIAL_CAPACITY 16 /* Entries allocated before the first growth */
+#endif
+
+/**
+ * In-memory listing of the regular files in one configFS directory (/controllers, /clients or /certs)
+ * so list endpoints never walk LittleFS with openNextFile().
+ *
+ * build() walks the directory once after mount; writers of the directory call put() after the file
+ * is closed and remove() after it is deleted.  Writers that touch many files at once (provisioning
+ * pulls) call build() again.  Entries live in a PSRAM array in the order they were added.  Lookups
+ * by name are linear, which is fine for the few dozen files these directories hold.
+ *
+ * All methods are safe from any task.  Readers that yield between entries (chunked responses) should
+ * walk by position with get(); an entry added or removed mid-walk may then be missed or repeated,
+ * as it could be with a directory walk.
+ */
+class DirectoryIndex {
+
+public:
+
+    struct entry {
+        char name[64];          // NUL-terminated; LittleFS names are at most 64 bytes here
+        uint32_t size;
+        time_t mtime;           // 0 when the file system does not record it
+    };
+
+    DirectoryIndex() {}
+    DirectoryIndex(const DirectoryIndex&) = delete;
+    DirectoryIndex& operator=(const DirectoryIndex&) = delete;
+
+    /**
+     * Sets the directory indexed.  Does not read it; call build().
+     */
+    void begin(fs::FS& fs, const char* directory) {
+        if (_lock == nullptr) {
+            _lock = xSemaphoreCreateRecursiveMutex();
+        }
+        _fs = &fs;
+        _directory = directory;
+    }
+
+    /**
+     * Replaces the index with a fresh walk of the directory
+     * @returns false if the directory could not be read or memory could not be allocated
+     */
+    bool build() {
+
+        if (_lock == nullptr) return false;
+        _guard guard(_lock);
+
+        _count = 0;
+        _built = false;
+
+        File root = _fs->open(_directory + "/");
+        if (!root) return false;
+
+        bool complete = true;
+
+        File file = root.openNextFile();
+        while (file) {
+            if (!file.isDirectory()) {
+                entry item = {};
+                strlcpy(item.name, file.name(), sizeof(item.name));
+                item.size = file.size();
+                item.mtime = file.getLastWrite();
+                if (!_append(item)) complete = false;
+            }
+            file.close();
+            file = root.openNextFile();
+        }
+        root.close();
+
+        _built = complete;
+        return complete;
+    }
+
+    /**
+     * Records a file that has just been written, reading its size and mtime from the file system
+     * @returns false if the file does not exist or memory could not be allocated
+     */
+    bool put(const char* name) {
+
+        if (_lock == nullptr) return false;
+
+        File file = _fs->open(_directory + "/" + name);
+        if (!file || file.isDirectory()) return false;
+
+        entry item = {};
+        strlcpy(item.name, name, sizeof(item.name));
+        item.size = file.size();
+        item.mtime = file.getLastWrite();
+        file.close();
+
+        _guard guard(_lock);
+
+        int32_t index = _find(name);
+        if (index >= 0) {
+            _entries[index] = item;
+            return true;
+        }
+
+        return _append(item);
+    }
+
+    /**
+     * Drops the entry for a file that has been deleted
+     */
+    void remove(const char* name) {
+
+        if (_lock == nullptr) return;
+        _guard guard(_lock);
+
+        int32_t index = _find(name);
+        if (index < 0) return;
+
+        // Shifted rather than swapped so listings keep their order
+        memmove(&_entries[index], &_entries[index + 1], (_count - index - 1) * sizeof(entry));
+        _count--;
+    }
+
+    /**
+     * Copies the entry at position into item
+     * @returns false once position is past the end
+     */
+    bool get(size_t position, entry& item) {
+
+        if (_lock == nullptr) return false;
+        _guard guard(_lock);
+
+        if (position >= _count) return false;
+
+        item = _entries[position];
+        return true;
+    }
+
+    /**
+     * Copies the entry for name into item
+     * @returns false if there is no such file
+     */
+    bool find(const char* name, entry& item) {
+
+        if (_lock == nullptr) return false;
+        _guard guard(_lock);
+
+        int32_t index = _find(name);
+        if (index < 0) return false;
+
+        item = _entries[index];
+        return true;
+    }
+
+    /**
+     * Calls fn(const entry&) for every file while holding the index; fn must not call back into it from another task
+     */
+    template <typename F>
+    void forEach(F fn) {
+
+        if (_lock == nullptr) return;
+        _guard guard(_lock);
+
+        for (size_t i = 0; i < _count; i++) {
+            fn(_entries[i]);
+        }
+    }
+
+    /**
+     * True once build() has read the whole directory; list endpoints fall back to the file system until then
+     */
+    bool isBuilt() {
+        return _built;
+    }
+
+    size_t count() {
+        return _count;
+    }
+
+    const String& directory() {
+        return _directory;
+    }
+
+private:
+
+    fs::FS* _fs = nullptr;
+    String _directory;
+    SemaphoreHandle_t _lock = nullptr;
+    bool _built = false;
+
+    entry* _entries = nullptr;
+    size_t _count = 0;
+    size_t _capacity = 0;
+
+
+    class _guard {
+        SemaphoreHandle_t _l;
+    public:
+        explicit _guard(SemaphoreHandle_t l) : _l(l) { xSemaphoreTakeRecursive(_l, portMAX_DELAY); }
+        ~_guard() { xSemaphoreGiveRecursive(_l); }
+    };
+
+    int32_t _find(const char* name) {
+        for (size_t i = 0; i < _count; i++) {
+            if (strcmp(_entries[i].name, name) == 0) return i;
+        }
+        return -1;
+    }
+
+    bool _append(const entry& item) {
+
+        if (_count == _capacity) {
+            size_t capacity = _capacity == 0 ? DIRECTORY_INDEX_INITIAL_CAPACITY : _capacity * 2;
+            entry* entries = (entry*)(psramFound() ? ps_malloc(capacity * sizeof(entry)) : malloc(capacity * sizeof(entry)));
+            if (entries == nullptr) {
+                log_e("Unable to grow the index of %s to %u entries", _directory.c_str(), (unsigned int)capacity);
+                return false;
+            }
+            if (_entries != nullptr) {
+                memcpy(entries, _entries, _count * sizeof(entry));
+                free(_entries);
+            }
+            _entries = entries;
+            _capacity = capacity;
+        }
+
+        _entries[_count++] = item;
+        return true;
+    }
+};
@@ -1,6 +1,6 @@
 #include "hardware.h"
 #include <LinkedList.h>
-#include <NTPClient.h>
+#include "sntpClock.h"
 
 #ifndef eventLog_h
     #define eventLog_h
@@ -33,7 +33,7 @@
             uint16_t _count = 0; /* Number of valid entries currently stored */
 
             LinkedList<String> _errors;
-            NTPClient* _timeClient;
+            EpochClock* _timeClient;
 
             void (*_ptrInfoCallback)(); //Function to call when there is an info logged
             void (*_ptrNotificationCallback)(); //Function to call when there is a notification logged
@@ -64,9 +64,9 @@
             /**
              * Creates a new event log handler
              *
-             * @param timeClient An NTP client that can be used when logging events
+             * @param timeClient Clock used to timestamp events once it is set
             */
-            EventLog(NTPClient *timeClient){
+            EventLog(EpochClock *timeClient){
                 _timeClient = timeClient;
                 _buffer = (eventLogEntry*)ps_malloc(EVENT_LOG_MAXIMUM_ENTRIES * sizeof(eventLogEntry));
                 if(_buffer == nullptr){
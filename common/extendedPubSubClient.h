@@ -308,11 +308,12 @@
             using PubSubClient::PubSubClient; /* Inherit the base PubSubClient */
             char serverFqdn[256]; /* Heap-safe copy of the broker FQDN, prevents dangling pointer when caller's String goes out of scope */
             char topic_availability[MQTT_TOPIC_CONTROLLER_AVAILABILITY_LENGTH + 1]; /* Topic name for availability, which will be used as the last will topic name as well */
-            int64_t lastReconnectAttemptTime = 0; /* The time (millis() or equivalent) when the last reconnection was be attempted */
             LinkedList<String> subscriptions; /* List of MQTT subscriptions */
             char username[MQTT_USERNAME_MAX_LENGTH + 1]; /* MQTT username to use when authenticating */
             char password[MQTT_PASSWORD_MAX_LENGTH + 1]; /* MQTT password to use when authenticating */
             bool enabled = false; /* Enabled only if credentials and configuration exists */
+            bool persistentSession = false; /* Connect with clean session off, so the broker keeps subscriptions across drops; they are QoS 0, so nothing is queued */
+            bool resubscribeNeeded = false; /* A subscription was added while disconnected, so the broker's session does not have it */
 
             
             struct autoDiscovery{
@@ -344,7 +345,9 @@
              */
             void addSubscription(const char* topic){
                 this->subscriptions.add(String(topic));
-                this->subscribe(topic);
+                if(!this->subscribe(topic)){
+                    resubscribeNeeded = true;
+                }
             }
 
 
@@ -352,9 +355,11 @@
              * Processes all subscriptions in the list and resubscribes to all of them
              */
             void resubscribe(){
+                resubscribeNeeded = false;
                 for(int i=0; i < this->subscriptions.size(); i++){
                     if(!this->subscribe(this->subscriptions.get(i).c_str())){
                         log_e("FAILED to subscribe to %s", this->subscriptions.get(i).c_str());
+                        resubscribeNeeded = true;
                     }
                 }
             }
@@ -229,7 +229,17 @@
 
 
     #ifndef MQTT_RECONNECT_WAIT_MILLISECONDS
-        #define MQTT_RECONNECT_WAIT_MILLISECONDS 5000 /* Number of milliseconds to wait between MQTT reconnect attempts */
+        #define MQTT_RECONNECT_WAIT_MILLISECONDS 5000 /* Number of milliseconds to wait before the second MQTT reconnect attempt; doubles, with jitter, after each failure */
+    #endif
+
+
+    #ifndef MQTT_RECONNECT_MAX_WAIT_MILLISECONDS
+        #define MQTT_RECONNECT_MAX_WAIT_MILLISECONDS 300000 /* Longest wait between MQTT reconnect attempts */
+    #endif
+
+
+    #ifndef MQTT_CONNACK_TIMEOUT_SECONDS
+        #define MQTT_CONNACK_TIMEOUT_SECONDS 5 /* Seconds to wait for the broker to answer CONNECT once the TCP connection is open */
     #endif
 
 
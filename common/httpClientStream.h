@@ -0,0 +1,82 @@
+#pragma once
+#include <Arduino.h>
+#include <esp_http_client.h>
+
+#ifndef HTTP_CLIENT_STREAM_BUFFER_SIZE
+    #define HTTP_CLIENT_STREAM_BUFFER_SIZE 512 /* Bytes read from the connection at a time */
+#endif
+
+
+/**
+ * Read-only Stream over the body of an esp_http_client response, so a parser such as ArduinoJson
+ * can consume the body as it arrives rather than from a buffer holding all of it.  Construct it
+ * after esp_http_client_fetch_headers(); once the body has been read, read() and peek() return -1
+ * immediately instead of waiting out the Stream timeout.
+ */
+class HttpClientStream : public Stream {
+
+public:
+
+    explicit HttpClientStream(esp_http_client_handle_t client) : _client(client) {
+        setTimeout(0); // esp_http_client_read() already waits for data; -1 only ever means the end
+    }
+
+    int available() override {
+        return _fill() ? _length - _position : 0;
+    }
+
+    int read() override {
+        return _fill() ? _buffer[_position++] : -1;
+    }
+
+    int peek() override {
+        return _fill() ? _buffer[_position] : -1;
+    }
+
+    size_t write(uint8_t) override {
+        return 0;
+    }
+
+    /**
+     * True if the body ended before the server had sent all of it
+     */
+    bool failed() const {
+        return _failed;
+    }
+
+    /**
+     * Body bytes received so far
+     */
+    size_t bytesRead() const {
+        return _total;
+    }
+
+private:
+
+    esp_http_client_handle_t _client;
+    uint8_t _buffer[HTTP_CLIENT_STREAM_BUFFER_SIZE];
+    int _length = 0;
+    int _position = 0;
+    size_t _total = 0;
+    bool _ended = false;
+    bool _failed = false;
+
+    bool _fill() {
+
+        if (_position < _length) return true;
+        if (_ended) return false;
+
+        int received = esp_http_client_read(_client, (char*)_buffer, sizeof(_buffer));
+
+        if (received <= 0) {
+            _ended = true;
+            _failed = received < 0 || !esp_http_client_is_complete_data_received(_client);
+            return false;
+        }
+
+        _length = received;
+        _position = 0;
+        _total += received;
+        return true;
+    }
+};
@@ -0,0 +1,46 @@
+#pragma once
+#include <string.h>
+
+
+/**
+ * Returns true if ifNoneMatch, the value of a request's If-None-Match header, matches etagHex.
+ * Accepts "*", a comma-separated list, and weak validators, per RFC 9110 weak comparison.  A
+ * missing header (nullptr or empty) and an empty etagHex never match.
+ */
+static bool http_etagMatches(const char* ifNoneMatch, const char* etagHex) {
+
+    if (ifNoneMatch == nullptr || etagHex[0] == '\0') {
+        return false;
+    }
+
+    const char* p = ifNoneMatch;
+    size_t etagLength = strlen(etagHex);
+
+    while (*p) {
+
+        while (*p == ' ' || *p == ',') {
+            p++;
+        }
+
+        if (*p == '*') {
+            return true;
+        }
+
+        if (p[0] == 'W' && p[1] == '/') {
+            p += 2;
+        }
+
+        if (*p == '"') {
+            p++;
+            if (strncmp(p, etagHex, etagLength) == 0 && p[etagLength] == '"') {
+                return true;
+            }
+        }
+
+        while (*p && *p != ',') {
+            p++;
+        }
+    }
+
+    return false;
+}
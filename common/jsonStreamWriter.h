@@ -0,0 +1,228 @@
+#ifndef jsonStreamWriter_h
+    #define jsonStreamWriter_h
+
+    #include <Arduino.h>
+
+    #ifndef JSON_STREAM_WRITER_BUFFER_SIZE
+        #define JSON_STREAM_WRITER_BUFFER_SIZE 512 /* Bytes staged between a source and the response; a larger element spills to the heap */
+    #endif
+
+    #ifndef JSON_STREAM_WRITER_MAX_DEPTH
+        #define JSON_STREAM_WRITER_MAX_DEPTH 8 /* Maximum nesting of arrays and objects */
+    #endif
+
+
+    /**
+     * Minimal forward-only JSON writer that stages output in a fixed buffer so large responses
+     * can be produced a few elements at a time.  Output is byte-identical to serializeJson() for
+     * the same sequence of values: no whitespace, and strings escaped the way ArduinoJson does.
+     * An element that does not fit in the buffer is never cut short: the rest of it is kept on
+     * the heap and handed out by drain() once the buffer has been emptied.
+     */
+    class JsonStreamWriter{
+
+        private:
+
+            char _buffer[JSON_STREAM_WRITER_BUFFER_SIZE];
+            size_t _length = 0;     /* Bytes staged */
+            size_t _position = 0;   /* Bytes already handed out by drain() */
+            String _overflow;       /* Bytes staged after the buffer filled; they follow it */
+
+            bool _hasMember[JSON_STREAM_WRITER_MAX_DEPTH] = {};
+            uint8_t _depth = 0;
+            bool _afterKey = false;
+
+            void _put(char c){
+                if(_length < sizeof(_buffer) && _overflow.length() == 0){
+                    _buffer[_length++] = c;
+                }else{
+                    _overflow += c;
+                }
+            }
+
+            void _put(const char* text){
+                while(*text){
+                    _put(*text++);
+                }
+            }
+
+            void _separator(){
+                if(_afterKey){
+                    _afterKey = false;
+                    return;
+                }
+                if(_depth > 0){
+                    if(_hasMember[_depth - 1]){
+                        _put(',');
+                    }
+                    _hasMember[_depth - 1] = true;
+                }
+            }
+
+            void _string(const char* text){
+                _put('"');
+                for(; *text; text++){
+                    char c = *text;
+                    switch(c){
+                        case '"':  _put("\\\""); break;
+                        case '\\': _put("\\\\"); break;
+                        case '\b': _put("\\b"); break;
+                        case '\f': _put("\\f"); break;
+                        case '\n': _put("\\n"); break;
+                        case '\r': _put("\\r"); break;
+                        case '\t': _put("\\t"); break;
+                        default:
+                            if((uint8_t)c < 0x20){
+                                char escaped[7];
+                                snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)(uint8_t)c);
+                                _put(escaped);
+                            }else{
+                                _put(c);
+                            }
+                            break;
+                    }
+                }
+                _put('"');
+            }
+
+            void _open(char c){
+                _separator();
+                _put(c);
+                if(_depth < JSON_STREAM_WRITER_MAX_DEPTH){
+                    _hasMember[_depth] = false;
+                }
+                _depth++;
+            }
+
+            void _close(char c){
+                if(_depth > 0){
+                    _depth--;
+                }
+                _put(c);
+            }
+
+        public:
+
+            void beginArray(){ _open('['); }
+            void endArray(){ _close(']'); }
+            void beginObject(){ _open('{'); }
+            void endObject(){ _close('}'); }
+
+            /**
+             * Writes an object member name; the next value written becomes its value
+             */
+            void key(const char* name){
+                _separator();
+                _string(name);
+                _put(':');
+                _afterKey = true;
+            }
+
+            void value(const char* text){
+                _separator();
+                _string(text);
+            }
+
+            void value(uint64_t number){
+                _separator();
+                char digits[21];
+                snprintf(digits, sizeof(digits), "%llu", (unsigned long long)number);
+                _put(digits);
+            }
+
+            /**
+             * Number of staged bytes not yet drained
+             */
+            size_t pending(){
+                return _length - _position + _overflow.length();
+            }
+
+            /**
+             * Free space in the buffer for the next element; anything larger spills to the heap
+             */
+            size_t available(){
+                return _overflow.length() > 0 ? 0 : sizeof(_buffer) - _length;
+            }
+
+            /**
+             * Moves up to maxLen staged bytes into out, resetting the buffer once it is empty and
+             * refilling it from any overflow
+             * @returns The number of bytes copied
+             */
+            size_t drain(uint8_t* out, size_t maxLen){
+
+                size_t count = 0;
+
+                while(count < maxLen && pending() > 0){
+
+                    size_t take = _length - _position;
+                    if(take > maxLen - count){
+                        take = maxLen - count;
+                    }
+                    memcpy(out + count, _buffer + _position, take);
+                    _position += take;
+                    count += take;
+
+                    if(_position == _length){
+                        _position = 0;
+                        _length = _overflow.length() < sizeof(_buffer) ? _overflow.length() : sizeof(_buffer);
+                        memcpy(_buffer, _overflow.c_str(), _length);
+                        _overflow.remove(0, _length);
+                    }
+                }
+
+                return count;
+            }
+    };
+
+
+    /**
+     * A JSON document produced incrementally into a JsonStreamWriter.  Subclasses implement
+     * fill() to write the next element or elements, returning false once the document is
+     * complete.  read() has the signature of an AsyncWebServer chunked-response filler.
+     */
+    class JsonStreamSource{
+
+        protected:
+
+            JsonStreamWriter writer;
+
+            /**
+             * Writes the next part of the document
+             * @returns false when nothing more remains to be written
+             */
+            virtual bool fill() = 0;
+
+        private:
+
+            bool _complete = false;
+
+        public:
+
+            virtual ~JsonStreamSource(){}
+
+            /**
+             * Copies up to maxLen bytes of the document into buffer
+             * @returns The number of bytes copied; 0 once the whole document has been read
+             */
+            size_t read(uint8_t* buffer, size_t maxLen){
+
+                size_t count = 0;
+
+                while(count < maxLen){
+                    count += writer.drain(buffer + count, maxLen - count);
+
+                    if(count == maxLen || _complete){
+                        break;
+                    }
+
+                    if(!fill()){
+                        _complete = true;
+                    }
+                }
+
+                return count;
+            }
+    };
+
+#endif
@@ -0,0 +1,486 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "secretEncryption.h"
+
+#ifndef MAC_INDEX_INITIAL_CAPACITY
+    #define MAC_INDEX_INITIAL_CAPACITY 32 /* Entries allocated before the first growth */
+#endif
+
+/**
+ * MAC address to UUID index over the encrypted records in one configFS directory
+ * (/clients or /controllers), so provisioning never has to decrypt every record to find one.
+ *
+ * Entries live in a PSRAM array with two open-addressed hash tables over it, one keyed by MAC
+ * and one by UUID, so lookups are O(1).  The array is persisted FFCE-encrypted at indexPath.
+ * Each entry carries the FFCE nonce of the record it was read from; reconcile() compares those
+ * with the headers of the files in the directory and decrypts only records that are new or
+ * were rewritten, so a missing or stale index repairs itself.
+ *
+ * Writers of the directory call update() or remove() after the file is written; writers that
+ * cannot (provisioning pulls) call reconcile().  All methods are safe from any task.
+ *
+ * Index file (version 1): "FFMI", uint16 version, uint16 reserved, uint32 count, entry[count].
+ */
+class MacIndex {
+
+public:
+
+    struct entry {
+        char uuid[40];          // NUL-terminated; 36 characters in practice
+        uint8_t nonce[12];      // FFCE nonce of the record file this entry was read from
+        uint8_t mac[6];
+        uint8_t hasMac;         // 0 when the record has no parsable mac_address
+        uint8_t reserved;
+    };
+
+    static_assert(sizeof(entry) == 60, "entry layout changed; bump the index file version");
+
+    MacIndex() {}
+    MacIndex(const MacIndex&) = delete;
+    MacIndex& operator=(const MacIndex&) = delete;
+
+    /**
+     * Sets the directory indexed and the index file.  Does not read either; call reconcile().
+     */
+    void begin(fs::FS& fs, SecretEncryption& encryption, const char* directory, const char* indexPath) {
+        if (_lock == nullptr) {
+            _lock = xSemaphoreCreateRecursiveMutex();
+        }
+        _fs = &fs;
+        _encryption = &encryption;
+        _directory = directory;
+        _indexPath = indexPath;
+    }
+
+    /**
+     * Loads the index file if it has not been loaded, then brings it in line with the directory:
+     * entries for removed files are dropped and records that are new or were rewritten since they
+     * were indexed are decrypted.  The index file is rewritten if anything changed.
+     * @returns false if the directory could not be read
+     */
+    bool reconcile() {
+
+        if (_lock == nullptr) return false;
+        _guard guard(_lock);
+
+        if (!_loaded) {
+            _loadFile();
+            _loaded = true;
+        }
+
+        File root = _fs->open(_directory + "/");
+        if (!root) return false;
+
+        bool changed = false;
+
+        // Entries still marked after the walk have no file
+        for (size_t i = 0; i < _count; i++) {
+            _entries[i].reserved = 1;
+        }
+
+        File file = root.openNextFile();
+        while (file) {
+
+            bool isDirectory = file.isDirectory();
+            String name = file.name();
+            file.close();
+
+            if (!isDirectory) {
+                String path = _directory + "/" + name;
+                uint8_t nonce[12];
+
+                if (!_encryption->readNonce(*_fs, path, nonce)) {
+                    log_w("%s is not an encrypted record; not indexed", path.c_str());
+                } else {
+                    int32_t index = _findUuid(name.c_str());
+
+                    if (index >= 0 && memcmp(_entries[index].nonce, nonce, sizeof(nonce)) == 0) {
+                        _entries[index].reserved = 0;
+                    } else {
+                        if (index >= 0) {
+                            _entries[index].reserved = 0;
+                        }
+                        if (_indexRecord(name.c_str(), path, nonce)) {
+                            changed = true;
+                        }
+                    }
+                }
+            }
+
+            file = root.openNextFile();
+        }
+        root.close();
+
+        size_t kept = 0;
+        for (size_t i = 0; i < _count; i++) {
+            if (_entries[i].reserved == 0) {
+                _entries[kept++] = _entries[i];
+            }
+        }
+        if (kept != _count) {
+            _count = kept;
+            changed = true;
+        }
+
+        _rebuildTables(_capacity);
+
+        if (changed) {
+            _saveFile();
+        }
+
+        return true;
+    }
+
+    /**
+     * Records the MAC address of a record that has just been written
+     * @param macAddress the record's mac_address member; null or unparsable records are indexed without a MAC
+     * @param nonce the FFCE nonce the record was written with
+     */
+    void update(const char* uuid, const char* macAddress, const uint8_t nonce[12]) {
+
+        if (_lock == nullptr) return;
+        _guard guard(_lock);
+
+        entry item = {};
+        strlcpy(item.uuid, uuid, sizeof(item.uuid));
+        memcpy(item.nonce, nonce, sizeof(item.nonce));
+        item.hasMac = parseMac(macAddress, item.mac) ? 1 : 0;
+
+        if (_put(item)) {
+            _saveFile();
+        }
+    }
+
+    /**
+     * Drops the entry for a record that has been deleted
+     */
+    void remove(const char* uuid) {
+
+        if (_lock == nullptr) return;
+        _guard guard(_lock);
+
+        int32_t index = _findUuid(uuid);
+        if (index < 0) return;
+
+        _entries[index] = _entries[_count - 1];
+        _count--;
+        _rebuildTables(_capacity);
+        _saveFile();
+    }
+
+    /**
+     * Finds the record whose MAC address matches
+     * @param mac MAC address as hex pairs, optionally separated by ':' or '-', any case
+     * @returns the UUID, or an empty String if no record has that MAC
+     */
+    String findUuid(const char* mac) {
+
+        uint8_t key[6];
+        if (_lock == nullptr || !parseMac(mac, key)) return String();
+
+        _guard guard(_lock);
+
+        int32_t index = _findMac(key);
+        return index >= 0 ? String(_entries[index].uuid) : String();
+    }
+
+    /**
+     * Finds the MAC address of a record
+     * @param out receives the MAC as xx:xx:xx:xx:xx:xx, lowercase
+     * @returns false if the record is not indexed or has no MAC address
+     */
+    bool findMac(const char* uuid, char out[18]) {
+
+        if (_lock == nullptr) return false;
+        _guard guard(_lock);
+
+        int32_t index = _findUuid(uuid);
+        if (index < 0 || !_entries[index].hasMac) return false;
+
+        formatMac(_entries[index].mac, out);
+        return true;
+    }
+
+    /**
+     * Calls fn(uuid, mac) for every record with a MAC address, MAC formatted as by findMac()
+     */
+    template <typename F>
+    void forEachMac(F fn) {
+
+        if (_lock == nullptr) return;
+        _guard guard(_lock);
+
+        char mac[18];
+        for (size_t i = 0; i < _count; i++) {
+            if (_entries[i].hasMac) {
+                formatMac(_entries[i].mac, mac);
+                fn(_entries[i].uuid, mac);
+            }
+        }
+    }
+
+    size_t count() {
+        return _count;
+    }
+
+    /**
+     * Parses six hex pairs, optionally separated by ':' or '-'
+     */
+    static bool parseMac(const char* text, uint8_t mac[6]) {
+
+        if (text == nullptr) return false;
+
+        for (int i = 0; i < 6; i++) {
+            if (i > 0 && (*text == ':' || *text == '-')) text++;
+
+            int high = _hexDigit(text[0]);
+            int low = high < 0 ? -1 : _hexDigit(text[1]);
+            if (low < 0) return false;
+
+            mac[i] = (high << 4) | low;
+            text += 2;
+        }
+
+        return *text == '\0';
+    }
+
+    static void formatMac(const uint8_t mac[6], char out[18]) {
+        snprintf(out, 18, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+
+private:
+
+    static const uint32_t EMPTY = 0xFFFFFFFF;
+
+    fs::FS* _fs = nullptr;
+    SecretEncryption* _encryption = nullptr;
+    String _directory;
+    String _indexPath;
+    SemaphoreHandle_t _lock = nullptr;
+    bool _loaded = false;
+
+    entry* _entries = nullptr;
+    size_t _count = 0;
+    size_t _capacity = 0;
+
+    uint32_t* _byMac = nullptr;     // Hash slot -> entry index, or EMPTY
+    uint32_t* _byUuid = nullptr;
+    size_t _slots = 0;              // Power of two, at least twice _capacity
+
+
+    class _guard {
+        SemaphoreHandle_t _l;
+    public:
+        explicit _guard(SemaphoreHandle_t l) : _l(l) { xSemaphoreTakeRecursive(_l, portMAX_DELAY); }
+        ~_guard() { xSemaphoreGiveRecursive(_l); }
+    };
+
+    static int _hexDigit(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    static uint32_t _hash(const uint8_t* data, size_t length) {
+        uint32_t h = 2166136261u;   // FNV-1a
+        for (size_t i = 0; i < length; i++) {
+            h = (h ^ data[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    static void* _alloc(size_t size) {
+        return psramFound() ? ps_malloc(size) : malloc(size);
+    }
+
+    int32_t _findMac(const uint8_t mac[6]) {
+        if (_slots == 0) return -1;
+        for (size_t s = _hash(mac, 6) & (_slots - 1); _byMac[s] != EMPTY; s = (s + 1) & (_slots - 1)) {
+            if (memcmp(_entries[_byMac[s]].mac, mac, 6) == 0) return _byMac[s];
+        }
+        return -1;
+    }
+
+    int32_t _findUuid(const char* uuid) {
+        if (_slots == 0) return -1;
+        for (size_t s = _hash((const uint8_t*)uuid, strlen(uuid)) & (_slots - 1); _byUuid[s] != EMPTY; s = (s + 1) & (_slots - 1)) {
+            if (strcmp(_entries[_byUuid[s]].uuid, uuid) == 0) return _byUuid[s];
+        }
+        return -1;
+    }
+
+    /**
+     * Sizes the entry array and both tables for capacity entries and re-inserts every entry.
+     * With duplicate MACs the first entry keeps the slot, as the directory scan used to.
+     */
+    bool _rebuildTables(size_t capacity) {
+
+        if (capacity < MAC_INDEX_INITIAL_CAPACITY) capacity = MAC_INDEX_INITIAL_CAPACITY;
+
+        if (capacity != _capacity || _entries == nullptr) {
+            entry* entries = (entry*)_alloc(capacity * sizeof(entry));
+            if (entries == nullptr) return false;
+            if (_entries != nullptr) {
+                memcpy(entries, _entries, _count * sizeof(entry));
+                free(_entries);
+            }
+            _entries = entries;
+            _capacity = capacity;
+        }
+
+        size_t slots = 1;
+        while (slots < _capacity * 2) slots <<= 1;
+
+        if (slots != _slots || _byMac == nullptr) {
+            uint32_t* byMac = (uint32_t*)_alloc(slots * sizeof(uint32_t));
+            uint32_t* byUuid = (uint32_t*)_alloc(slots * sizeof(uint32_t));
+            if (byMac == nullptr || byUuid == nullptr) {
+                free(byMac);
+                free(byUuid);
+                return false;
+            }
+            free(_byMac);
+            free(_byUuid);
+            _byMac = byMac;
+            _byUuid = byUuid;
+            _slots = slots;
+        }
+
+        memset(_byMac, 0xFF, _slots * sizeof(uint32_t));
+        memset(_byUuid, 0xFF, _slots * sizeof(uint32_t));
+
+        for (size_t i = 0; i < _count; i++) {
+            _insertSlots(i);
+        }
+
+        return true;
+    }
+
+    void _insertSlots(size_t index) {
+
+        const entry& item = _entries[index];
+
+        size_t s = _hash((const uint8_t*)item.uuid, strlen(item.uuid)) & (_slots - 1);
+        while (_byUuid[s] != EMPTY) s = (s + 1) & (_slots - 1);
+        _byUuid[s] = index;
+
+        if (item.hasMac && _findMac(item.mac) < 0) {
+            s = _hash(item.mac, 6) & (_slots - 1);
+            while (_byMac[s] != EMPTY) s = (s + 1) & (_slots - 1);
+            _byMac[s] = index;
+        }
+    }
+
+    /**
+     * Inserts or replaces the entry for item.uuid
+     * @returns false if memory could not be allocated
+     */
+    bool _put(const entry& item) {
+
+        int32_t index = _findUuid(item.uuid);
+
+        if (index >= 0) {
+            bool macChanged = _entries[index].hasMac != item.hasMac || memcmp(_entries[index].mac, item.mac, 6) != 0;
+            _entries[index] = item;
+            if (macChanged) _rebuildTables(_capacity);
+            return true;
+        }
+
+        if (_count == _capacity || _entries == nullptr) {
+            if (!_rebuildTables(_capacity * 2)) return false;
+        }
+
+        _entries[_count] = item;
+        _insertSlots(_count);
+        _count++;
+        return true;
+    }
+
+    /**
+     * Decrypts one record and indexes its mac_address
+     */
+    bool _indexRecord(const char* uuid, const String& path, const uint8_t nonce[12]) {
+
+        JsonDocument filter;
+        filter["mac_address"] = true;
+
+        DecryptStream plaintext;
+        if (!_encryption->openDecryptStream(*_fs, path, plaintext)) {
+            log_e("Failed to decrypt %s", path.c_str());
+            return false;
+        }
+
+        JsonDocument doc;
+        DeserializationError error = deserializeJson(doc, plaintext, DeserializationOption::Filter(filter));
+        plaintext.close();
+
+        entry item = {};
+        strlcpy(item.uuid, uuid, sizeof(item.uuid));
+        memcpy(item.nonce, nonce, sizeof(item.nonce));
+        item.hasMac = (!error && parseMac(doc["mac_address"].as<const char*>(), item.mac)) ? 1 : 0;
+
+        return _put(item);
+    }
+
+    void _loadFile() {
+
+        _count = 0;
+        _rebuildTables(_capacity);
+
+        if (!_fs->exists(_indexPath)) return;
+
+        DecryptStream stream;
+        if (!_encryption->openDecryptStream(*_fs, _indexPath, stream)) {
+            log_w("%s could not be decrypted; rebuilding", _indexPath.c_str());
+            return;
+        }
+
+        uint8_t header[12];
+        uint32_t count;
+
+        if (stream.readBytes((char*)header, sizeof(header)) != sizeof(header) ||
+            memcmp(header, "FFMI", 4) != 0 || header[4] != 1 || header[5] != 0) {
+            log_w("%s has an unknown format; rebuilding", _indexPath.c_str());
+            return;
+        }
+
+        memcpy(&count, header + 8, sizeof(count));
+        if (stream.size() != sizeof(header) + (size_t)count * sizeof(entry)) {
+            log_w("%s is truncated; rebuilding", _indexPath.c_str());
+            return;
+        }
+
+        entry item;
+        for (uint32_t i = 0; i < count; i++) {
+            if (stream.readBytes((char*)&item, sizeof(item)) != sizeof(item)) break;
+            item.uuid[sizeof(item.uuid) - 1] = '\0';
+            item.reserved = 0;
+            _put(item);
+        }
+    }
+
+    void _saveFile() {
+
+        EncryptWriter writer;
+        if (!_encryption->openEncryptWriter(*_fs, _indexPath, writer)) {
+            log_e("Unable to write %s", _indexPath.c_str());
+            return;
+        }
+
+        uint8_t header[12] = { 'F', 'F', 'M', 'I', 1, 0, 0, 0 };
+        uint32_t count = _count;
+        memcpy(header + 8, &count, sizeof(count));
+
+        writer.write(header, sizeof(header));
+        writer.write((const uint8_t*)_entries, _count * sizeof(entry));
+
+        if (!writer.commit()) {
+            log_e("Unable to write %s", _indexPath.c_str());
+        }
+    }
+};
@@ -0,0 +1,391 @@
+#pragma once
+#include <Arduino.h>
+#include <esp_netif.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <fcntl.h>
+#include <lwip/dns.h>
+#include <lwip/sockets.h>
+#include "mqttTransport.h"
+
+#ifndef MQTT_CONNECTOR_TIMEOUT_MILLISECONDS
+    #define MQTT_CONNECTOR_TIMEOUT_MILLISECONDS 10000 /* Longest a broker lookup and TCP connect may take together */
+#endif
+
+#ifndef MQTT_CONNECTOR_HANDSHAKE_TIMEOUT_MILLISECONDS
+    #define MQTT_CONNECTOR_HANDSHAKE_TIMEOUT_MILLISECONDS 15000 /* Longest a TLS handshake may take */
+#endif
+
+#ifndef MQTT_RECONNECT_WAIT_MILLISECONDS
+    #define MQTT_RECONNECT_WAIT_MILLISECONDS 5000 /* Wait before the second attempt; doubles with each failure */
+#endif
+
+#ifndef MQTT_RECONNECT_MAX_WAIT_MILLISECONDS
+    #define MQTT_RECONNECT_MAX_WAIT_MILLISECONDS 300000 /* Longest wait between attempts */
+#endif
+
+
+/**
+ * Opens the connection to the MQTT broker without blocking the caller, so a broker that is down or
+ * slow to answer does not stall loop().  Call poll() from loop() until it returns true; the transport
+ * then holds the open connection and the MQTT client only has CONNECT/CONNACK left to do.  The lookup
+ * runs in the lwIP task, and the connect and any TLS handshake run on a non-blocking socket, so poll()
+ * returns without waiting for the network.
+ *
+ * Attempts are spaced by exponential backoff with equal jitter: after n failures the wait is between
+ * half and all of min(max, min * 2^n), so a fleet that lost the broker together does not return together.
+ * Report the outcome of the MQTT handshake with succeeded() or failed(), and a dropped session with lost().
+ *
+ * The CONNECT/CONNACK exchange itself still blocks: PubSubClient::connect() has no asynchronous form,
+ * so a broker that accepts the TCP connection but never answers CONNECT (hung, or a proxy with nothing
+ * behind it) stalls loop() for up to MQTT_CONNACK_TIMEOUT_SECONDS on each attempt.  Backoff keeps those
+ * stalls apart.  A stopped broker refuses the connection and an unreachable one never completes it;
+ * both fail inside poll() without a stall.  To see the three cases, point the controller at a stopped
+ * broker, at an address with nothing on it, and at `nc -lk <port>`, and watch the OLED and inputs.
+ *
+ * One instance per sketch; lookups call back into it from the lwIP task.
+ */
+class MqttConnector {
+
+public:
+
+    MqttConnector() {}
+    MqttConnector(const MqttConnector&) = delete;
+    MqttConnector& operator=(const MqttConnector&) = delete;
+
+    /**
+     * Sets the broker and makes the next poll() start an attempt straight away
+     * @param host name or dotted IPv4 address; copied
+     * @param transport takes each connected socket, and does the TLS handshake if it has TLS on
+     */
+    void begin(const char* host, uint16_t port, MqttTransport& transport) {
+        _instance = this;
+        _close();
+        _transport = &transport;
+        strlcpy(_host, host, sizeof(_host));
+        _port = port;
+        _failures = 0;
+        _nextAttemptTime = 0;
+        _state = STATE_IDLE;
+    }
+
+    /**
+     * Advances the attempt in progress, or starts one once the backoff has elapsed
+     * @returns true once the transport holds a connection ready for CONNECT
+     */
+    bool poll() {
+
+        if (_host[0] == '\0' || _transport == nullptr) return false;
+
+        int64_t now = esp_timer_get_time();
+
+        switch (_state) {
+
+            case STATE_IDLE:
+                if (now < _nextAttemptTime) return false;
+                _attemptStarted = now;
+                return _resolve();
+
+            case STATE_RESOLVING:
+                return _pollResolve(now);
+
+            case STATE_CONNECTING:
+                return _pollConnect(now);
+
+            case STATE_HANDSHAKE:
+                return _pollHandshake(now);
+        }
+
+        return false;
+    }
+
+    /**
+     * The broker accepted the session; the next loss retries after a short jittered wait
+     */
+    void succeeded() {
+        _failures = 0;
+        _state = STATE_IDLE;
+        log_d("MQTT connected in %lld ms", (esp_timer_get_time() - _attemptStarted) / 1000LL);
+    }
+
+    /**
+     * The broker refused the session or did not answer CONNECT; backs off before the next attempt
+     */
+    void failed() {
+        _fail("MQTT broker refused the session");
+    }
+
+    /**
+     * An established session dropped; the first retry waits up to the minimum backoff
+     */
+    void lost() {
+        _close();
+        _failures = 0;
+        _state = STATE_IDLE;
+        _nextAttemptTime = esp_timer_get_time() + (int64_t)(esp_random() % MQTT_RECONNECT_WAIT_MILLISECONDS) * 1000LL;
+    }
+
+    /**
+     * Milliseconds until the next attempt starts; 0 while one is in progress or due
+     */
+    uint32_t retryInMillis() const {
+        int64_t remaining = _state == STATE_IDLE ? _nextAttemptTime - esp_timer_get_time() : 0;
+        return remaining > 0 ? (uint32_t)(remaining / 1000LL) : 0;
+    }
+
+    /**
+     * Consecutive attempts that have failed since the last success
+     */
+    uint16_t failures() const {
+        return _failures;
+    }
+
+private:
+
+    enum state : uint8_t {
+        STATE_IDLE,
+        STATE_RESOLVING,
+        STATE_CONNECTING,
+        STATE_HANDSHAKE
+    };
+
+    static MqttConnector* _instance;
+
+    char _host[256] = {0};
+    uint16_t _port = 0;
+    MqttTransport* _transport = nullptr;
+
+    state _state = STATE_IDLE;
+    int _socket = -1;
+    int64_t _attemptStarted = 0;
+    int64_t _handshakeStarted = 0;
+    int64_t _nextAttemptTime = 0;
+    uint16_t _failures = 0;
+
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t _lookup = 0;           // Incremented per lookup, so a late answer to an abandoned one is ignored
+    volatile bool _resolved = false;
+    bool _resolveFailed = false;
+    ip_addr_t _address;
+
+    /**
+     * Arguments for dns_gethostbyname_addrtype(), which has to be called in the lwIP task
+     */
+    struct lookupRequest {
+        const char* host;
+        ip_addr_t* address;
+        uint32_t lookup;
+        err_t result;
+    };
+
+    bool _resolve() {
+
+        portENTER_CRITICAL(&_mux);
+        uint32_t lookup = ++_lookup;
+        _resolved = false;
+        _resolveFailed = false;
+        portEXIT_CRITICAL(&_mux);
+
+        ip_addr_t address;
+        lookupRequest request = { _host, &address, lookup, ERR_OK };
+
+        if (esp_netif_tcpip_exec(_startLookup, &request) != ESP_OK) {
+            return _fail("MQTT lookup could not start");
+        }
+
+        if (request.result == ERR_OK) {
+            return _open(address);
+        }
+
+        if (request.result != ERR_INPROGRESS) {
+            return _fail("MQTT broker name not found");
+        }
+
+        _state = STATE_RESOLVING;
+        return false;
+    }
+
+    bool _pollResolve(int64_t now) {
+
+        if (!_resolved) {
+            if (now - _attemptStarted > (int64_t)MQTT_CONNECTOR_TIMEOUT_MILLISECONDS * 1000LL) {
+                return _fail("MQTT broker lookup timed out");
+            }
+            return false;
+        }
+
+        portENTER_CRITICAL(&_mux);
+        bool resolveFailed = _resolveFailed;
+        ip_addr_t address = _address;
+        portEXIT_CRITICAL(&_mux);
+
+        if (resolveFailed) {
+            return _fail("MQTT broker name not found");
+        }
+
+        return _open(address);
+    }
+
+    /**
+     * Starts a non-blocking connect to address
+     */
+    bool _open(const ip_addr_t& address) {
+
+        struct sockaddr_in destination = {};
+        destination.sin_family = AF_INET;
+        destination.sin_port = htons(_port);
+        destination.sin_addr.s_addr = ip_2_ip4(&address)->addr;
+
+        _socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (_socket < 0) {
+            return _fail("MQTT socket unavailable");
+        }
+
+        fcntl(_socket, F_SETFL, fcntl(_socket, F_GETFL, 0) | O_NONBLOCK);
+
+        if (connect(_socket, (struct sockaddr*)&destination, sizeof(destination)) == 0) {
+            return _handOver();
+        }
+
+        if (errno != EINPROGRESS) {
+            log_w("MQTT connect: errno %d", errno);
+            return _fail("MQTT broker unreachable");
+        }
+
+        _state = STATE_CONNECTING;
+        return false;
+    }
+
+    bool _pollConnect(int64_t now) {
+
+        fd_set writable;
+        FD_ZERO(&writable);
+        FD_SET(_socket, &writable);
+        struct timeval noWait = { 0, 0 };
+
+        int ready = select(_socket + 1, nullptr, &writable, nullptr, &noWait);
+
+        if (ready == 0) {
+            if (now - _attemptStarted > (int64_t)MQTT_CONNECTOR_TIMEOUT_MILLISECONDS * 1000LL) {
+                return _fail("MQTT connect timed out");
+            }
+            return false;
+        }
+
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (ready < 0 || getsockopt(_socket, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+            log_w("MQTT connect: errno %d", ready < 0 ? errno : error);
+            return _fail("MQTT broker unreachable");
+        }
+
+        return _handOver();
+    }
+
+    /**
+     * Gives the connected socket to the transport, which starts the TLS handshake if it has TLS on
+     */
+    bool _handOver() {
+
+        int enable = 1;
+        setsockopt(_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        setsockopt(_socket, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+
+        int socket = _socket;
+        _socket = -1;
+
+        if (!_transport->adopt(socket, _host)) {
+            return _fail("MQTT TLS setup failed");
+        }
+
+        _state = STATE_HANDSHAKE;
+        _handshakeStarted = esp_timer_get_time();
+        return _pollHandshake(_handshakeStarted);
+    }
+
+    bool _pollHandshake(int64_t now) {
+
+        int result = _transport->handshake();
+
+        if (result < 0) {
+            return _fail("MQTT TLS handshake failed");
+        }
+
+        if (result == 0) {
+            if (now - _handshakeStarted > (int64_t)MQTT_CONNECTOR_HANDSHAKE_TIMEOUT_MILLISECONDS * 1000LL) {
+                return _fail("MQTT TLS handshake timed out");
+            }
+            return false;
+        }
+
+        _state = STATE_IDLE;
+        _nextAttemptTime = INT64_MAX; // Until succeeded(), failed() or lost() says what happens next
+        return true;
+    }
+
+    bool _fail(const char* reason) {
+
+        _close();
+        _state = STATE_IDLE;
+
+        uint32_t cap = MQTT_RECONNECT_WAIT_MILLISECONDS;
+        for (uint16_t i = 0; i < _failures && cap < MQTT_RECONNECT_MAX_WAIT_MILLISECONDS; i++) {
+            cap *= 2;
+        }
+        cap = min(cap, (uint32_t)MQTT_RECONNECT_MAX_WAIT_MILLISECONDS);
+
+        uint32_t wait = cap / 2 + esp_random() % (cap / 2 + 1);
+        _nextAttemptTime = esp_timer_get_time() + (int64_t)wait * 1000LL;
+        if (_failures < UINT16_MAX) _failures++;
+
+        log_w("%s (attempt %u); retrying in %lu ms", reason, _failures, (unsigned long)wait);
+        return false;
+    }
+
+    void _close() {
+
+        if (_socket >= 0) {
+            close(_socket);
+            _socket = -1;
+        }
+
+        if (_state == STATE_HANDSHAKE) {
+            _transport->stop();
+        }
+
+        portENTER_CRITICAL(&_mux);
+        _lookup++;
+        portEXIT_CRITICAL(&_mux);
+    }
+
+    /**
+     * Runs in the lwIP task
+     */
+    static esp_err_t _startLookup(void* context) {
+        lookupRequest* request = (lookupRequest*)context;
+        request->result = dns_gethostbyname_addrtype(request->host, request->address, _onLookup,
+                                                     (void*)(uintptr_t)request->lookup, LWIP_DNS_ADDRTYPE_IPV4);
+        return ESP_OK;
+    }
+
+    /**
+     * Runs in the lwIP task when a lookup that did not finish in _startLookup() does; address is null on failure
+     */
+    static void _onLookup(const char* name, const ip_addr_t* address, void* argument) {
+
+        MqttConnector* self = _instance;
+        if (self == nullptr) return;
+
+        portENTER_CRITICAL(&self->_mux);
+        if ((uint32_t)(uintptr_t)argument == self->_lookup) {
+            if (address != nullptr) {
+                self->_address = *address;
+            }
+            self->_resolveFailed = address == nullptr;
+            self->_resolved = true;
+        }
+        portEXIT_CRITICAL(&self->_mux);
+    }
+};
+
+inline MqttConnector* MqttConnector::_instance = nullptr;
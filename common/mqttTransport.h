@@ -0,0 +1,387 @@
+#pragma once
+#include <Arduino.h>
+#include <Client.h>
+#include <esp_crt_bundle.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <lwip/sockets.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/error.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+#ifndef MQTT_TRANSPORT_BUFFER_SIZE
+    #define MQTT_TRANSPORT_BUFFER_SIZE 256 /* Bytes read from the connection at a time */
+#endif
+
+#ifndef MQTT_TRANSPORT_WRITE_TIMEOUT_MILLISECONDS
+    #define MQTT_TRANSPORT_WRITE_TIMEOUT_MILLISECONDS 5000 /* Longest write() waits for the connection to take a packet */
+#endif
+
+
+/**
+ * Arduino Client for PubSubClient over the non-blocking socket that MqttConnector opens, optionally
+ * wrapped in TLS.  PubSubClient never connects it itself: connect() always fails, and PubSubClient's
+ * connect() skips straight to CONNECT because connected() is already true.
+ *
+ * With TLS on, the broker is verified against the PEM set with setCACert() (the controller certs in
+ * /certs) or, without one, the built-in root CA bundle.  The transport keeps its own copy of the PEM,
+ * so another task may replace it, and free the original, while adopt() is parsing it.  The session from the last full handshake is
+ * kept across stop(), and offered on the next adopt() so the broker can resume it (session ticket or
+ * session ID) instead of repeating the certificate exchange and key agreement.
+ *
+ * The first bytes received after adopt() are kept, so sessionPresent() can read the CONNACK that
+ * PubSubClient does not expose.
+ */
+class MqttTransport : public Client {
+
+public:
+
+    MqttTransport() {
+        _caLock = xSemaphoreCreateMutex();
+    }
+    MqttTransport(const MqttTransport&) = delete;
+    MqttTransport& operator=(const MqttTransport&) = delete;
+
+    ~MqttTransport() {
+        stop();
+        forgetSession();
+        free(_caPem);
+        vSemaphoreDelete(_caLock);
+    }
+
+    /**
+     * Turns TLS on or off for the next adopt()
+     */
+    void setTls(bool enabled) {
+        if (enabled != _tls) forgetSession();
+        _tls = enabled;
+    }
+
+    bool tls() const {
+        return _tls;
+    }
+
+    /**
+     * PEM certificates to verify the broker with, or nullptr for the built-in bundle.  Copied, and parsed
+     * on each adopt(); safe to call from another task.
+     * @returns false if there was no memory for the copy; the built-in bundle is then used
+     */
+    bool setCACert(const char* pem) {
+
+        char* copy = nullptr;
+        if (pem != nullptr) {
+            size_t length = strlen(pem) + 1;
+            copy = (char*)ps_malloc(length);
+            if (copy == nullptr) copy = (char*)malloc(length);
+            if (copy != nullptr) memcpy(copy, pem, length);
+        }
+
+        xSemaphoreTake(_caLock, portMAX_DELAY);
+        char* previous = _caPem;
+        _caPem = copy;
+        xSemaphoreGive(_caLock);
+
+        free(previous);
+        return pem == nullptr || copy != nullptr;
+    }
+
+    /**
+     * Takes ownership of a connected, non-blocking socket to host and starts the TLS handshake if TLS is on
+     * @returns false if TLS could not be set up; the socket has then been closed
+     */
+    bool adopt(int socket, const char* host) {
+
+        stop();
+
+        _net.fd = socket;
+        _closed = false;
+        _rxLength = _rxPosition = 0;
+        _headLength = 0;
+        _handshakeStarted = esp_timer_get_time();
+
+        if (!_tls) return true;
+
+        mbedtls_ssl_init(&_ssl);
+        mbedtls_ssl_config_init(&_conf);
+        mbedtls_x509_crt_init(&_ca);
+        mbedtls_ctr_drbg_init(&_drbg);
+        mbedtls_entropy_init(&_entropy);
+        _tlsActive = true;
+
+        int ret = mbedtls_ctr_drbg_seed(&_drbg, mbedtls_entropy_func, &_entropy, nullptr, 0);
+        if (ret == 0) {
+            ret = mbedtls_ssl_config_defaults(&_conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+        }
+        if (ret != 0) return _tlsFailed("MQTT TLS setup", ret);
+
+        mbedtls_ssl_conf_authmode(&_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+        mbedtls_ssl_conf_rng(&_conf, mbedtls_ctr_drbg_random, &_drbg);
+
+        xSemaphoreTake(_caLock, portMAX_DELAY);
+        bool parsed = _caPem != nullptr && mbedtls_x509_crt_parse(&_ca, (const uint8_t*)_caPem, strlen(_caPem) + 1) >= 0 && _ca.version != 0;
+        xSemaphoreGive(_caLock);
+
+        if (parsed) {
+            mbedtls_ssl_conf_ca_chain(&_conf, &_ca, nullptr);
+        } else if (esp_crt_bundle_attach(&_conf) != ESP_OK) {
+            return _tlsFailed("MQTT TLS CA bundle", 0);
+        }
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+        mbedtls_ssl_conf_session_tickets(&_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+        ret = mbedtls_ssl_setup(&_ssl, &_conf);
+        if (ret == 0) ret = mbedtls_ssl_set_hostname(&_ssl, host);
+        if (ret != 0) return _tlsFailed("MQTT TLS setup", ret);
+
+        mbedtls_ssl_set_bio(&_ssl, &_net, mbedtls_net_send, mbedtls_net_recv, nullptr);
+
+        _resuming = _hasSession && mbedtls_ssl_set_session(&_ssl, &_session) == 0;
+
+        return true;
+    }
+
+    /**
+     * Advances the TLS handshake without waiting; does nothing without TLS
+     * @returns 1 once the connection is ready for MQTT, 0 while the handshake continues, -1 if it failed
+     */
+    int handshake() {
+
+        if (_net.fd < 0) return -1;
+        if (!_tlsActive || mbedtls_ssl_is_handshake_over(&_ssl)) return 1;
+
+        int ret = mbedtls_ssl_handshake(&_ssl);
+
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) return 0;
+#if defined(MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS)
+        if (ret == MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS) return 0;
+#endif
+
+        if (ret != 0) {
+            if (_resuming) forgetSession(); // The broker may have dropped it; the next attempt starts afresh
+            _tlsFailed("MQTT TLS handshake", ret);
+            return -1;
+        }
+
+        log_d("MQTT TLS handshake (%s) took %lld ms", _resuming ? "resumption offered" : "full",
+              (esp_timer_get_time() - _handshakeStarted) / 1000LL);
+
+        _keepSession();
+        return 1;
+    }
+
+    /**
+     * Drops the kept TLS session, so the next handshake is a full one
+     */
+    void forgetSession() {
+        if (_hasSession) {
+            mbedtls_ssl_session_free(&_session);
+            _hasSession = false;
+        }
+    }
+
+    /**
+     * True if the CONNACK for this connection said the broker still had the session for this client ID
+     */
+    bool sessionPresent() const {
+        return _headLength >= 4 && _head[0] == 0x20 && (_head[2] & 0x01);
+    }
+
+    int connect(IPAddress ip, uint16_t port) {
+        return 0;
+    }
+
+    int connect(const char* host, uint16_t port) {
+        return 0;
+    }
+
+    int connect(IPAddress ip, uint16_t port, int32_t timeout) {
+        return 0;
+    }
+
+    int connect(const char* host, uint16_t port, int32_t timeout) {
+        return 0;
+    }
+
+    size_t write(uint8_t value) override {
+        return write(&value, 1);
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+
+        size_t sent = 0;
+        int64_t deadline = esp_timer_get_time() + (int64_t)MQTT_TRANSPORT_WRITE_TIMEOUT_MILLISECONDS * 1000LL;
+
+        while (sent < size && _net.fd >= 0 && !_closed) {
+
+            int n = _tlsActive ? mbedtls_ssl_write(&_ssl, buffer + sent, size - sent)
+                               : send(_net.fd, buffer + sent, size - sent, MSG_DONTWAIT);
+
+            if (n > 0) {
+                sent += n;
+                continue;
+            }
+
+            if (!_wouldBlock(n) || esp_timer_get_time() > deadline) {
+                if (!_wouldBlock(n)) _closed = true;
+                break;
+            }
+
+            _wait();
+        }
+
+        return sent;
+    }
+
+    int available() override {
+        return _fill() ? _rxLength - _rxPosition : 0;
+    }
+
+    int read() override {
+        return _fill() ? _rx[_rxPosition++] : -1;
+    }
+
+    int read(uint8_t* buffer, size_t size) override {
+
+        if (!_fill()) return -1;
+
+        size_t take = min(size, (size_t)(_rxLength - _rxPosition));
+        memcpy(buffer, _rx + _rxPosition, take);
+        _rxPosition += take;
+        return take;
+    }
+
+    int peek() override {
+        return _fill() ? _rx[_rxPosition] : -1;
+    }
+
+    void flush() override {
+    }
+
+    void stop() override {
+
+        if (_tlsActive) {
+            if (_net.fd >= 0 && !_closed) mbedtls_ssl_close_notify(&_ssl);
+            mbedtls_ssl_free(&_ssl);
+            mbedtls_ssl_config_free(&_conf);
+            mbedtls_x509_crt_free(&_ca);
+            mbedtls_ctr_drbg_free(&_drbg);
+            mbedtls_entropy_free(&_entropy);
+            _tlsActive = false;
+        }
+
+        if (_net.fd >= 0) {
+            close(_net.fd);
+            _net.fd = -1;
+        }
+
+        _closed = true;
+        _rxLength = _rxPosition = 0;
+    }
+
+    uint8_t connected() override {
+        return _net.fd >= 0 && (!_closed || _rxPosition < _rxLength);
+    }
+
+    operator bool() override {
+        return connected();
+    }
+
+private:
+
+    bool _tls = false;
+    char* _caPem = nullptr;             // Our copy; replaced and read only with _caLock held
+    SemaphoreHandle_t _caLock = nullptr;
+
+    mbedtls_net_context _net = { -1 };
+    bool _closed = true;
+
+    bool _tlsActive = false;
+    mbedtls_ssl_context _ssl;
+    mbedtls_ssl_config _conf;
+    mbedtls_x509_crt _ca;
+    mbedtls_ctr_drbg_context _drbg;
+    mbedtls_entropy_context _entropy;
+
+    mbedtls_ssl_session _session;
+    bool _hasSession = false;
+    bool _resuming = false;
+    int64_t _handshakeStarted = 0;
+
+    uint8_t _rx[MQTT_TRANSPORT_BUFFER_SIZE];
+    int _rxLength = 0;
+    int _rxPosition = 0;
+
+    uint8_t _head[4];
+    size_t _headLength = 0;
+
+    bool _wouldBlock(int result) const {
+        if (_tlsActive) return result == MBEDTLS_ERR_SSL_WANT_READ || result == MBEDTLS_ERR_SSL_WANT_WRITE;
+        return result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+    /**
+     * Waits up to 10 ms for the socket to take more data
+     */
+    void _wait() {
+        fd_set writable;
+        FD_ZERO(&writable);
+        FD_SET(_net.fd, &writable);
+        struct timeval wait = { 0, 10000 };
+        select(_net.fd + 1, nullptr, &writable, nullptr, &wait);
+    }
+
+    bool _fill() {
+
+        if (_rxPosition < _rxLength) return true;
+        if (_net.fd < 0 || _closed) return false;
+        if (_tlsActive && !mbedtls_ssl_is_handshake_over(&_ssl)) return false;
+
+        int n = _tlsActive ? mbedtls_ssl_read(&_ssl, _rx, sizeof(_rx))
+                           : recv(_net.fd, _rx, sizeof(_rx), MSG_DONTWAIT);
+
+#if defined(MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+        if (_tlsActive && n == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+            _keepSession(); // TLS 1.3 sends its tickets after the handshake
+            return false;
+        }
+#endif
+
+        if (n > 0) {
+            _rxLength = n;
+            _rxPosition = 0;
+            for (int i = 0; i < n && _headLength < sizeof(_head); i++) {
+                _head[_headLength++] = _rx[i];
+            }
+            return true;
+        }
+
+        if (n == 0 || !_wouldBlock(n)) {
+            _closed = true;
+        }
+        return false;
+    }
+
+    void _keepSession() {
+        forgetSession();
+        mbedtls_ssl_session_init(&_session);
+        if (mbedtls_ssl_get_session(&_ssl, &_session) == 0) {
+            _hasSession = true;
+        } else {
+            mbedtls_ssl_session_free(&_session);
+        }
+    }
+
+    bool _tlsFailed(const char* step, int ret) {
+        char text[100] = {0};
+        mbedtls_strerror(ret, text, sizeof(text));
+        log_w("%s: -0x%04x %s", step, -ret, text);
+        stop();
+        return false;
+    }
+};
@@ -0,0 +1,287 @@
+#pragma once
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <esp_random.h>
+
+#ifndef NETWORK_WORKER_STACK_SIZE
+    #define NETWORK_WORKER_STACK_SIZE 8192 /* Bytes; TLS handshakes and the backup pipeline run on this stack */
+#endif
+
+#ifndef NETWORK_WORKER_PRIORITY
+    #define NETWORK_WORKER_PRIORITY 1 /* Lowest priority above idle */
+#endif
+
+#ifndef NETWORK_WORKER_CORE
+    #define NETWORK_WORKER_CORE 0 /* The Arduino loop runs on core 1, so slow requests never compete with it for CPU */
+#endif
+
+#ifndef NETWORK_WORKER_QUEUE_LENGTH
+    #define NETWORK_WORKER_QUEUE_LENGTH 8 /* Jobs waiting to run, and completions waiting to be collected */
+#endif
+
+#ifndef NETWORK_WORKER_JOB_HISTORY
+    #define NETWORK_WORKER_JOB_HISTORY 8 /* Jobs whose state lookup() can report; the oldest finished one is forgotten first */
+#endif
+
+
+/**
+ * A low-priority FreeRTOS task that runs slow network jobs (cloud requests, OTA manifest checks) so the
+ * control loop never waits on the network.
+ *
+ * The loop submit()s a job by type; the worker runs them one at a time through the handler given to
+ * begin() and posts a completion, which the loop collects with poll() and acts on.  The handler runs on
+ * the worker task, so it must not touch anything only the loop may use (MQTT, the OLED, outputs); it
+ * records what happened in the completion and the loop does the rest.
+ *
+ * At most one job of each type is queued or running; submitting another while one is pending is
+ * refused, so a job scheduled on a timer cannot pile up behind a slow endpoint.
+ *
+ * Every job gets an ID, and the state of the last NETWORK_WORKER_JOB_HISTORY jobs can be looked up
+ * from any task, so an HTTP handler can hand the ID back and let the caller poll for the outcome.
+ */
+class NetworkWorker {
+
+public:
+
+    static const uint8_t MAX_JOB_TYPES = 32;
+
+    enum jobState : uint8_t {
+        JOB_QUEUED,
+        JOB_RUNNING,
+        JOB_SUCCEEDED,
+        JOB_FAILED
+    };
+
+    struct job {
+        uint8_t type;
+        uint32_t id;
+    };
+
+    struct completion {
+        uint8_t type;
+        uint32_t id;
+        bool ok;                // The job did what it was for
+        int32_t code;           // Job specific, usually the HTTP status
+        char message[48];       // Why it failed, when ok is false
+    };
+
+    struct record {
+        jobState state;
+        completion result;      // type and id always; the rest once the job has finished
+    };
+
+    typedef void (*jobHandler)(const job& work, completion& result);
+
+    NetworkWorker() {}
+    NetworkWorker(const NetworkWorker&) = delete;
+    NetworkWorker& operator=(const NetworkWorker&) = delete;
+
+    /**
+     * Creates the queues and starts the worker task
+     * @param handler runs each job on the worker task
+     */
+    bool begin(jobHandler handler) {
+
+        if (_task != nullptr) return true;
+
+        _handler = handler;
+        _nextId = (esp_random() & 0x7FFFFFFF) | 1;   // So IDs from before a reboot are unlikely to be reused
+        _jobs = xQueueCreate(NETWORK_WORKER_QUEUE_LENGTH, sizeof(job));
+        _completions = xQueueCreate(NETWORK_WORKER_QUEUE_LENGTH, sizeof(completion));
+
+        if (_jobs == nullptr || _completions == nullptr) {
+            log_e("Unable to create the network worker queues");
+            return false;
+        }
+
+        if (xTaskCreatePinnedToCore(_run, "network", NETWORK_WORKER_STACK_SIZE, this, NETWORK_WORKER_PRIORITY, &_task, NETWORK_WORKER_CORE) != pdPASS) {
+            log_e("Unable to start the network worker task");
+            _task = nullptr;
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Queues a job without waiting
+     * @returns the job's ID, or 0 if the worker is not running, a job of this type is already pending,
+     * or the queue is full
+     */
+    uint32_t submit(uint8_t type) {
+
+        if (_task == nullptr || type >= MAX_JOB_TYPES) return 0;
+
+        uint32_t bit = 1UL << type;
+        job work = { type, 0 };
+
+        portENTER_CRITICAL(&_mux);
+        record* slot = (_pending & bit) ? nullptr : _freeRecord();
+        if (slot != nullptr) {
+            _pending |= bit;
+            work.id = _nextId++;
+            if (_nextId == 0) _nextId = 1;
+
+            memset(slot, 0, sizeof(*slot));
+            slot->state = JOB_QUEUED;
+            slot->result.type = type;
+            slot->result.id = work.id;
+        }
+        portEXIT_CRITICAL(&_mux);
+
+        if (slot == nullptr) return 0;
+
+        if (xQueueSend(_jobs, &work, 0) != pdTRUE) {
+            _finish(work, nullptr);
+            return 0;
+        }
+
+        return work.id;
+    }
+
+    /**
+     * True while a job of this type is queued or running
+     */
+    bool isPending(uint8_t type) {
+        if (type >= MAX_JOB_TYPES) return false;
+
+        portENTER_CRITICAL(&_mux);
+        bool pending = (_pending & (1UL << type)) != 0;
+        portEXIT_CRITICAL(&_mux);
+
+        return pending;
+    }
+
+    /**
+     * The ID of the queued or running job of this type, or 0 if there is none
+     */
+    uint32_t pendingJob(uint8_t type) {
+
+        uint32_t id = 0;
+
+        portENTER_CRITICAL(&_mux);
+        for (size_t i = 0; i < NETWORK_WORKER_JOB_HISTORY; i++) {
+            if (_records[i].result.id != 0 && _records[i].result.type == type && _records[i].state <= JOB_RUNNING) {
+                id = _records[i].result.id;
+            }
+        }
+        portEXIT_CRITICAL(&_mux);
+
+        return id;
+    }
+
+    /**
+     * Copies the state of a recent job into item; safe from any task
+     * @returns false if the ID is unknown or has been forgotten
+     */
+    bool lookup(uint32_t id, record& item) {
+
+        if (id == 0) return false;
+
+        bool found = false;
+
+        portENTER_CRITICAL(&_mux);
+        for (size_t i = 0; i < NETWORK_WORKER_JOB_HISTORY; i++) {
+            if (_records[i].result.id == id) {
+                item = _records[i];
+                found = true;
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&_mux);
+
+        return found;
+    }
+
+    /**
+     * Collects one completion without waiting; call from the loop until it returns false
+     */
+    bool poll(completion& result) {
+        return _completions != nullptr && xQueueReceive(_completions, &result, 0) == pdTRUE;
+    }
+
+private:
+
+    TaskHandle_t _task = nullptr;
+    QueueHandle_t _jobs = nullptr;
+    QueueHandle_t _completions = nullptr;
+    jobHandler _handler = nullptr;
+
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t _pending = 0;      // Bit per job type queued or running
+    uint32_t _nextId = 1;
+    record _records[NETWORK_WORKER_JOB_HISTORY] = {};
+
+    /**
+     * The unused or oldest finished record, or nullptr if every record is pending.  Caller holds _mux.
+     */
+    record* _freeRecord() {
+
+        record* oldest = nullptr;
+
+        for (size_t i = 0; i < NETWORK_WORKER_JOB_HISTORY; i++) {
+            record* item = &_records[i];
+            if (item->result.id == 0) return item;
+            if (item->state <= JOB_RUNNING) continue;
+            // IDs only wrap after four billion jobs, so the smallest distance back from _nextId is the newest
+            if (oldest == nullptr || _nextId - item->result.id > _nextId - oldest->result.id) oldest = item;
+        }
+
+        return oldest;
+    }
+
+    record* _findRecord(uint32_t id) {
+        for (size_t i = 0; i < NETWORK_WORKER_JOB_HISTORY; i++) {
+            if (_records[i].result.id == id) return &_records[i];
+        }
+        return nullptr;
+    }
+
+    void _setRunning(const job& work) {
+        portENTER_CRITICAL(&_mux);
+        record* item = _findRecord(work.id);
+        if (item != nullptr) item->state = JOB_RUNNING;
+        portEXIT_CRITICAL(&_mux);
+    }
+
+    /**
+     * Records the outcome, or forgets a job the queue refused when result is nullptr, and clears the
+     * type's pending bit
+     */
+    void _finish(const job& work, const completion* result) {
+        portENTER_CRITICAL(&_mux);
+        record* item = _findRecord(work.id);
+        if (item != nullptr && result == nullptr) {
+            memset(item, 0, sizeof(*item));
+        } else if (item != nullptr) {
+            item->result = *result;
+            item->state = result->ok ? JOB_SUCCEEDED : JOB_FAILED;
+        }
+        _pending &= ~(1UL << work.type);
+        portEXIT_CRITICAL(&_mux);
+    }
+
+    static void _run(void* parameter) {
+
+        NetworkWorker* self = (NetworkWorker*)parameter;
+        job work;
+
+        for (;;) {
+            if (xQueueReceive(self->_jobs, &work, portMAX_DELAY) != pdTRUE) continue;
+
+            self->_setRunning(work);
+
+            completion result = {};
+            result.type = work.type;
+            result.id = work.id;
+
+            self->_handler(work, result);
+
+            // The loop drains completions every pass, so this only waits if it has stalled
+            xQueueSend(self->_completions, &result, portMAX_DELAY);
+            self->_finish(work, &result);
+        }
+    }
+};
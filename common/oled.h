@@ -1,7 +1,6 @@
 #include "hardware.h"
 #include "Prototype9pt7b.h"         // used on all other OLED pages
 #include <Fonts/FreeMonoBold12pt7b.h>  // visual token page only
-#include <NTPClient.h>
 #include "eventLog.h"
 #include "authorizationToken.h"
 
@@ -7,6 +7,12 @@
     #ifndef FIRMWARE_CHECK_SECONDS
         #define FIRMWARE_CHECK_SECONDS 86400 /* Number of seconds between OTA firmware checks */
     #endif
+    #ifndef FIRMWARE_CHECK_JITTER_SECONDS
+        #define FIRMWARE_CHECK_JITTER_SECONDS 3600 /* Up to this many seconds are added at random to each check interval, so controllers do not check in lock-step */
+    #endif
+    #ifndef FIRMWARE_CHECK_BOOT_JITTER_SECONDS
+        #define FIRMWARE_CHECK_BOOT_JITTER_SECONDS 300 /* Up to this many seconds are added at random to the first check after boot */
+    #endif
     #ifndef CLOUD_BACKUP_INTERVAL_SECONDS
         #define CLOUD_BACKUP_INTERVAL_SECONDS 86400 /* Number of seconds between automatic cloud backup uploads */
     #endif
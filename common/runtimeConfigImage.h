@@ -0,0 +1,576 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <ArduinoJson.h>
+#include "secretEncryption.h"
+
+#ifndef RUNTIME_CONFIG_IMAGE_PATH
+    #define RUNTIME_CONFIG_IMAGE_PATH "/runtime_config.bin" /* Encrypted compiled image of this controller's config */
+#endif
+
+/**
+ * Compact binary form of the parts of this controller's config that boot-time setup reads:
+ * output table, input ports/channels/actions, name, area, MQTT, OTA and syslog settings.
+ *
+ * The image is compiled from the JSON config when the config is written and stored encrypted
+ * at RUNTIME_CONFIG_IMAGE_PATH.  At boot it is decrypted into one buffer and read in place:
+ * every table sits at a fixed offset given by the header, records refer to each other and to
+ * strings by index or offset, and there are no pointers.  All values are little-endian.
+ *
+ * Layout (version 1):
+ *   imageHeader      68 bytes
+ *   outputRecord[]    8 bytes each
+ *   portRecord[]     12 bytes each; channels are the contiguous range firstChannel..+channelCount
+ *   channelRecord[]   8 bytes each; actions are the contiguous range firstAction..+actionCount
+ *   actionRecord[]    4 bytes each
+ *   strings          NUL-terminated, referenced by offset from the start of the string table
+ *
+ * The header carries the GCM nonce of the JSON file the image was compiled from.  A config
+ * written without compiling a new image (provisioning, for example) gets a new nonce, so the
+ * stale image is detected by reading the 37-byte FFCE header alone.
+ *
+ * scripts/runtime-config-image.py mirrors this layout and can compile and dump images on a host.
+ */
+class RuntimeConfigImage {
+
+public:
+
+    static const uint16_t VERSION = 1;
+    static const uint16_t NO_STRING = 0xFFFF;   // String offset of a member absent from the JSON
+    static const size_t MAX_SIZE = 0xFFFF;      // Offsets are 16-bit
+
+    enum headerFlags : uint8_t {
+        HAS_MQTT = 0x01,
+        HAS_MQTT_PORT = 0x02,
+        HAS_OTA = 0x04,
+        HAS_SYSLOG = 0x08,
+        HAS_SYSLOG_PORT = 0x10,
+        HAS_SYSLOG_RATE_LIMIT = 0x20,
+        MQTT_TLS = 0x40,
+        MQTT_PERSISTENT_SESSION = 0x80
+    };
+
+    enum syslogFormat : uint8_t {
+        SYSLOG_RFC5424 = 0,
+        SYSLOG_NDJSON = 1
+    };
+
+    enum outputType : uint8_t {
+        OUTPUT_TYPE_DEFAULT = 0,
+        OUTPUT_TYPE_VARIABLE = 1
+    };
+
+    enum outputFlags : uint8_t {
+        OUTPUT_HAS_ENABLED = 0x01,
+        OUTPUT_ENABLED = 0x02,
+        OUTPUT_HAS_START_BRIGHTNESS = 0x04
+    };
+
+    enum channelFlags : uint8_t {
+        CHANNEL_NORMALLY_CLOSED = 0x01,
+        CHANNEL_ENABLE = 0x02,          // The JSON had a truthy "enabled"
+        CHANNEL_HAS_OFFSET = 0x04
+    };
+
+    /* Action codes share their values with the sketch's outputAction enum */
+    enum actionCode : uint8_t {
+        ACTION_TOGGLE = 0,
+        ACTION_INCREASE = 1,
+        ACTION_DECREASE = 2,
+        ACTION_INCREASE_MAXIMUM = 3,
+        ACTION_DECREASE_MAXIMUM = 4,
+        ACTION_INVALID = 0xFF
+    };
+
+    enum changeStateCode : uint8_t {
+        CHANGE_STATE_SHORT = 0,
+        CHANGE_STATE_LONG = 1
+    };
+
+    struct imageHeader {
+        char magic[4];              // "FFRC"
+        uint16_t version;
+        uint16_t headerSize;        // sizeof(imageHeader)
+        uint32_t imageSize;
+        uint8_t sourceNonce[12];    // FFCE nonce of the JSON file this image was compiled from
+        uint16_t outputCount;
+        uint16_t outputsOffset;
+        uint16_t portCount;
+        uint16_t portsOffset;
+        uint16_t channelCount;
+        uint16_t channelsOffset;
+        uint16_t actionCount;
+        uint16_t actionsOffset;
+        uint16_t stringsOffset;
+        uint16_t stringsSize;
+        uint16_t name;
+        uint16_t area;
+        uint16_t mqttHost;
+        uint16_t mqttUsername;
+        uint16_t mqttPassword;
+        uint16_t mqttPort;
+        uint16_t otaUrl;
+        uint16_t syslogHost;
+        uint16_t syslogPort;
+        uint16_t syslogRateLimit;
+        uint8_t syslogFormat;
+        uint8_t flags;
+        uint16_t reserved;
+    };
+
+    struct outputRecord {
+        int16_t port;               // Key in the outputs object
+        uint16_t id;
+        uint8_t type;
+        uint8_t flags;
+        uint8_t startBrightness;
+        uint8_t reserved;
+    };
+
+    struct portRecord {
+        int16_t port;               // Key in the ports object
+        uint16_t id;
+        uint16_t clientUUID;
+        uint16_t firstChannel;
+        uint16_t channelCount;
+        uint16_t reserved;
+    };
+
+    struct channelRecord {
+        uint16_t firstAction;
+        uint16_t actionCount;
+        uint8_t channel;            // Key in the channels object
+        uint8_t flags;
+        uint8_t offset;
+        uint8_t reserved;
+    };
+
+    struct actionRecord {
+        uint8_t action;
+        uint8_t changeState;
+        uint8_t output;
+        uint8_t reserved;
+    };
+
+    static_assert(sizeof(imageHeader) == 68, "imageHeader layout changed; bump VERSION");
+    static_assert(sizeof(outputRecord) == 8, "outputRecord layout changed; bump VERSION");
+    static_assert(sizeof(portRecord) == 12, "portRecord layout changed; bump VERSION");
+    static_assert(sizeof(channelRecord) == 8, "channelRecord layout changed; bump VERSION");
+    static_assert(sizeof(actionRecord) == 4, "actionRecord layout changed; bump VERSION");
+
+
+    RuntimeConfigImage() {}
+    RuntimeConfigImage(const RuntimeConfigImage&) = delete;
+    RuntimeConfigImage& operator=(const RuntimeConfigImage&) = delete;
+
+    ~RuntimeConfigImage() {
+        clear();
+    }
+
+    /**
+     * Frees the image
+     */
+    void clear() {
+        if (_buf != nullptr) {
+            memset(_buf, 0, _size);
+            free(_buf);
+        }
+        _buf = nullptr;
+        _size = 0;
+    }
+
+    bool isValid() const {
+        return _buf != nullptr;
+    }
+
+    /**
+     * Builds the image from a controller config document
+     * @param sourceNonce the FFCE nonce of the file doc was read from or written to
+     * @returns false if the image would exceed MAX_SIZE or cannot be allocated
+     */
+    bool compile(JsonObjectConst doc, const uint8_t sourceNonce[12]) {
+
+        clear();
+
+        // Sizing pass: nothing is written while _buf is null
+        _emit(doc);
+
+        size_t outputsOffset = sizeof(imageHeader);
+        size_t portsOffset = outputsOffset + _counts.outputs * sizeof(outputRecord);
+        size_t channelsOffset = portsOffset + _counts.ports * sizeof(portRecord);
+        size_t actionsOffset = channelsOffset + _counts.channels * sizeof(channelRecord);
+        size_t stringsOffset = actionsOffset + _counts.actions * sizeof(actionRecord);
+        size_t imageSize = stringsOffset + _counts.strings;
+
+        if (imageSize > MAX_SIZE) return false;
+
+        _buf = (uint8_t*)(psramFound() ? ps_malloc(imageSize) : malloc(imageSize));
+        if (_buf == nullptr) return false;
+        memset(_buf, 0, imageSize);
+        _size = imageSize;
+
+        imageHeader* h = (imageHeader*)_buf;
+        memcpy(h->magic, "FFRC", 4);
+        h->version = VERSION;
+        h->headerSize = sizeof(imageHeader);
+        h->imageSize = imageSize;
+        memcpy(h->sourceNonce, sourceNonce, sizeof(h->sourceNonce));
+        h->outputCount = _counts.outputs;
+        h->outputsOffset = outputsOffset;
+        h->portCount = _counts.ports;
+        h->portsOffset = portsOffset;
+        h->channelCount = _counts.channels;
+        h->channelsOffset = channelsOffset;
+        h->actionCount = _counts.actions;
+        h->actionsOffset = actionsOffset;
+        h->stringsOffset = stringsOffset;
+        h->stringsSize = _counts.strings;
+
+        // Write pass
+        _emit(doc);
+
+        return true;
+    }
+
+    /**
+     * Decrypts the image at path and adopts it if it is well formed, of this VERSION, and was
+     * compiled from the config file whose FFCE nonce is expectedNonce
+     * @returns false, leaving the image empty, otherwise
+     */
+    bool loadFromFile(fs::FS& fs, SecretEncryption& encryption, const char* path, const uint8_t expectedNonce[12]) {
+
+        clear();
+
+        if (!fs.exists(path)) return false;
+
+        DecryptStream stream;
+        if (!encryption.openDecryptStream(fs, path, stream)) return false;
+
+        size_t size = stream.size();
+        if (size < sizeof(imageHeader) || size > MAX_SIZE) return false;
+
+        uint8_t* buf = (uint8_t*)(psramFound() ? ps_malloc(size) : malloc(size));
+        if (buf == nullptr) return false;
+
+        bool ok = stream.readBytes((char*)buf, size) == size;
+        stream.close();
+
+        ok = ok
+          && validate(buf, size)
+          && memcmp(((imageHeader*)buf)->sourceNonce, expectedNonce, 12) == 0;
+
+        if (!ok) {
+            memset(buf, 0, size);
+            free(buf);
+            return false;
+        }
+
+        _buf = buf;
+        _size = size;
+        return true;
+    }
+
+    /**
+     * Encrypts the image to path, replacing any previous image
+     */
+    bool writeToFile(fs::FS& fs, SecretEncryption& encryption, const char* path) {
+        if (_buf == nullptr) return false;
+        return encryption.encryptToFile(fs, path, _buf, _size);
+    }
+
+    /**
+     * Checks that every table, range and string offset in the image lies within it
+     */
+    static bool validate(const uint8_t* buf, size_t size) {
+
+        if (size < sizeof(imageHeader)) return false;
+
+        const imageHeader* h = (const imageHeader*)buf;
+
+        if (memcmp(h->magic, "FFRC", 4) != 0 ||
+            h->version != VERSION ||
+            h->headerSize != sizeof(imageHeader) ||
+            h->imageSize != size) {
+            return false;
+        }
+
+        if (h->outputsOffset != sizeof(imageHeader) ||
+            h->portsOffset != h->outputsOffset + h->outputCount * sizeof(outputRecord) ||
+            h->channelsOffset != h->portsOffset + h->portCount * sizeof(portRecord) ||
+            h->actionsOffset != h->channelsOffset + h->channelCount * sizeof(channelRecord) ||
+            h->stringsOffset != h->actionsOffset + h->actionCount * sizeof(actionRecord) ||
+            (size_t)h->stringsOffset + h->stringsSize != size) {
+            return false;
+        }
+
+        // A terminated last string means every in-range offset yields a terminated string
+        if (h->stringsSize > 0 && buf[size - 1] != '\0') return false;
+
+        uint16_t stringsSize = h->stringsSize;
+        auto stringOk = [stringsSize](uint16_t offset) {
+            return offset == NO_STRING || offset < stringsSize;
+        };
+
+        if (!stringOk(h->name) || !stringOk(h->area) || !stringOk(h->mqttHost) ||
+            !stringOk(h->mqttUsername) || !stringOk(h->mqttPassword) ||
+            !stringOk(h->otaUrl) || !stringOk(h->syslogHost)) {
+            return false;
+        }
+
+        const outputRecord* outputs = (const outputRecord*)(buf + h->outputsOffset);
+        for (uint16_t i = 0; i < h->outputCount; i++) {
+            if (!stringOk(outputs[i].id)) return false;
+        }
+
+        const portRecord* ports = (const portRecord*)(buf + h->portsOffset);
+        for (uint16_t i = 0; i < h->portCount; i++) {
+            if (!stringOk(ports[i].id) || !stringOk(ports[i].clientUUID) ||
+                (uint32_t)ports[i].firstChannel + ports[i].channelCount > h->channelCount) {
+                return false;
+            }
+        }
+
+        const channelRecord* channels = (const channelRecord*)(buf + h->channelsOffset);
+        for (uint16_t i = 0; i < h->channelCount; i++) {
+            if ((uint32_t)channels[i].firstAction + channels[i].actionCount > h->actionCount) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /* Accessors; only valid while isValid() */
+
+    const imageHeader& header() const {
+        return *(const imageHeader*)_buf;
+    }
+
+    const outputRecord& output(uint16_t index) const {
+        return ((const outputRecord*)(_buf + header().outputsOffset))[index];
+    }
+
+    const portRecord& port(uint16_t index) const {
+        return ((const portRecord*)(_buf + header().portsOffset))[index];
+    }
+
+    const channelRecord& channel(uint16_t index) const {
+        return ((const channelRecord*)(_buf + header().channelsOffset))[index];
+    }
+
+    const actionRecord& action(uint16_t index) const {
+        return ((const actionRecord*)(_buf + header().actionsOffset))[index];
+    }
+
+    /**
+     * The string at offset in the string table, or nullptr for NO_STRING
+     */
+    const char* string(uint16_t offset) const {
+        if (offset == NO_STRING) return nullptr;
+        return (const char*)(_buf + header().stringsOffset + offset);
+    }
+
+private:
+
+    uint8_t* _buf = nullptr;
+    size_t _size = 0;
+
+    struct {
+        uint16_t outputs;
+        uint16_t ports;
+        uint16_t channels;
+        uint16_t actions;
+        size_t strings;
+    } _counts = {};
+
+
+    template <typename T>
+    void _put(uint16_t tableOffset, uint16_t index, const T& record) {
+        if (_buf != nullptr) {
+            memcpy(_buf + tableOffset + index * sizeof(T), &record, sizeof(T));
+        }
+    }
+
+    uint16_t _string(const char* text) {
+
+        if (text == nullptr) return NO_STRING;
+
+        size_t length = strlen(text) + 1;
+        size_t offset = _counts.strings;
+
+        // Past the 16-bit limit the sizing pass fails compile() before anything is written
+        if (_buf != nullptr) {
+            memcpy(_buf + header().stringsOffset + offset, text, length);
+        }
+
+        _counts.strings += length;
+        return offset < NO_STRING ? offset : NO_STRING;
+    }
+
+    static int16_t _key(const char* key) {
+        int value = atoi(key);
+        return value > INT16_MAX ? INT16_MAX : (value < INT16_MIN ? INT16_MIN : value);
+    }
+
+    static uint8_t _actionCode(const char* action) {
+
+        static const char* const kNames[] = { "TOGGLE", "INCREASE", "DECREASE", "INCREASE_MAXIMUM", "DECREASE_MAXIMUM" };
+
+        if (action == nullptr) return ACTION_INVALID;
+
+        for (uint8_t i = 0; i < sizeof(kNames) / sizeof(kNames[0]); i++) {
+            if (strcmp(action, kNames[i]) == 0) return i;
+        }
+
+        return ACTION_INVALID;
+    }
+
+    /**
+     * Walks the document in a fixed order, counting records and strings, and writing them when
+     * _buf is allocated.  Called once to size the image and once to fill it.
+     */
+    void _emit(JsonObjectConst doc) {
+
+        _counts = {};
+
+        uint16_t name = _string(doc["name"].as<const char*>());
+        uint16_t area = _string(doc["area"].as<const char*>());
+
+        uint8_t flags = 0;
+        uint16_t mqttHost = NO_STRING, mqttUsername = NO_STRING, mqttPassword = NO_STRING, mqttPort = 0;
+        uint16_t otaUrl = NO_STRING;
+        uint16_t syslogHost = NO_STRING, syslogPort = 0, syslogRateLimit = 0;
+        uint8_t syslogFormat = SYSLOG_RFC5424;
+
+        JsonObjectConst mqtt = doc["mqtt"];
+        if (!mqtt.isNull()) {
+            flags |= HAS_MQTT;
+            mqttHost = _string(mqtt["host"].as<const char*>());
+            mqttUsername = _string(mqtt["username"].as<const char*>());
+            mqttPassword = _string(mqtt["password"].as<const char*>());
+            if (!mqtt["port"].isNull()) {
+                flags |= HAS_MQTT_PORT;
+                mqttPort = mqtt["port"].as<uint16_t>();
+            }
+            if (mqtt["tls"].as<bool>()) {
+                flags |= MQTT_TLS;
+            }
+            if (mqtt["persistent_session"].as<bool>()) {
+                flags |= MQTT_PERSISTENT_SESSION;
+            }
+        }
+
+        JsonObjectConst ota = doc["ota"];
+        if (!ota.isNull()) {
+            flags |= HAS_OTA;
+            otaUrl = _string(ota["url"].as<const char*>());
+        }
+
+        JsonObjectConst syslog = doc["syslog"];
+        if (!syslog.isNull()) {
+            flags |= HAS_SYSLOG;
+            syslogHost = _string(syslog["host"].as<const char*>());
+            if (!syslog["port"].isNull()) {
+                flags |= HAS_SYSLOG_PORT;
+                syslogPort = syslog["port"].as<uint16_t>();
+            }
+            if (!syslog["rate_limit"].isNull()) {
+                flags |= HAS_SYSLOG_RATE_LIMIT;
+                syslogRateLimit = syslog["rate_limit"].as<uint16_t>();
+            }
+            if (strcmp(syslog["format"] | "rfc5424", "ndjson") == 0) {
+                syslogFormat = SYSLOG_NDJSON;
+            }
+        }
+
+        if (_buf != nullptr) {
+            imageHeader* h = (imageHeader*)_buf;
+            h->name = name;
+            h->area = area;
+            h->mqttHost = mqttHost;
+            h->mqttUsername = mqttUsername;
+            h->mqttPassword = mqttPassword;
+            h->mqttPort = mqttPort;
+            h->otaUrl = otaUrl;
+            h->syslogHost = syslogHost;
+            h->syslogPort = syslogPort;
+            h->syslogRateLimit = syslogRateLimit;
+            h->syslogFormat = syslogFormat;
+            h->flags = flags;
+        }
+
+        for (JsonPairConst output : doc["outputs"].as<JsonObjectConst>()) {
+
+            outputRecord record = {};
+            record.port = _key(output.key().c_str());
+            record.id = _string(output.value()["id"].as<const char*>());
+
+            const char* type = output.value()["type"];
+            if (type != nullptr && strcmp(type, "VARIABLE") == 0) {
+                record.type = OUTPUT_TYPE_VARIABLE;
+            }
+
+            if (!output.value()["enabled"].isNull()) {
+                record.flags |= OUTPUT_HAS_ENABLED;
+                if (output.value()["enabled"].as<bool>()) record.flags |= OUTPUT_ENABLED;
+            }
+
+            if (!output.value()["start_brightness"].isNull()) {
+                record.flags |= OUTPUT_HAS_START_BRIGHTNESS;
+                record.startBrightness = output.value()["start_brightness"].as<uint8_t>();
+            }
+
+            _put(_buf ? header().outputsOffset : 0, _counts.outputs++, record);
+        }
+
+        for (JsonPairConst port : doc["ports"].as<JsonObjectConst>()) {
+
+            portRecord record = {};
+            record.port = _key(port.key().c_str());
+            record.id = _string(port.value()["id"] | "");
+            record.clientUUID = _string(port.value()["clientUUID"] | "");
+            record.firstChannel = _counts.channels;
+
+            for (JsonPairConst channel : port.value()["channels"].as<JsonObjectConst>()) {
+
+                channelRecord channelRec = {};
+                channelRec.channel = (uint8_t)atoi(channel.key().c_str());
+                channelRec.firstAction = _counts.actions;
+
+                const char* type = channel.value()["type"];
+                if (type != nullptr && strcmp(type, "NORMALLY_OPEN") != 0) {
+                    channelRec.flags |= CHANNEL_NORMALLY_CLOSED;
+                }
+
+                if (channel.value()["enabled"]) {
+                    channelRec.flags |= CHANNEL_ENABLE;
+                }
+
+                if (channel.value()["offset"]) {
+                    channelRec.flags |= CHANNEL_HAS_OFFSET;
+                    channelRec.offset = channel.value()["offset"].as<uint8_t>();
+                }
+
+                for (JsonObjectConst action : channel.value()["actions"].as<JsonArrayConst>()) {
+
+                    actionRecord actionRec = {};
+                    actionRec.action = _actionCode(action["action"]);
+                    actionRec.output = action["output"].as<uint8_t>();
+
+                    const char* changeState = action["change_state"];
+                    if (changeState != nullptr && strcmp(changeState, "LONG") == 0) {
+                        actionRec.changeState = CHANGE_STATE_LONG;
+                    }
+
+                    _put(_buf ? header().actionsOffset : 0, _counts.actions++, actionRec);
+                    channelRec.actionCount++;
+                }
+
+                _put(_buf ? header().channelsOffset : 0, _counts.channels++, channelRec);
+                record.channelCount++;
+            }
+
+            _put(_buf ? header().portsOffset : 0, _counts.ports++, record);
+        }
+    }
+};
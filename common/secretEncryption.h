@@ -5,6 +5,581 @@
 #include <mbedtls/hkdf.h>
 #include <mbedtls/md.h>
 #include <esp_random.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "backupDeflate.h"
+
+#ifndef SECRET_ENCRYPTION_STREAM_CHUNK_SIZE
+    #define SECRET_ENCRYPTION_STREAM_CHUNK_SIZE 512 /* Ciphertext bytes read and decrypted per step by DecryptStream */
+#endif
+
+#ifndef SECRET_ENCRYPTION_WRITE_CHUNK_SIZE
+    #define SECRET_ENCRYPTION_WRITE_CHUNK_SIZE 512 /* Plaintext bytes staged and encrypted per file write by EncryptWriter */
+#endif
+
+#ifndef SECRET_ENCRYPTION_TEMP_PATH
+    #define SECRET_ENCRYPTION_TEMP_PATH "/.encrypt_in_progress" /* EncryptWriter's temporary file; writers are serialised so one path suffices */
+#endif
+
+
+/**
+ * Read-only Stream over the plaintext of an encrypted file, opened by
+ * SecretEncryption::openDecryptStream().  Only one chunk of plaintext is held in memory at a
+ * time, so the stream can be handed straight to deserializeJson().
+ *
+ * The GCM tag has already been verified when the stream is opened, so every byte it returns
+ * is authenticated.  The stream holds the SecretEncryption lock until close() or destruction;
+ * keep it short-lived and on a single task.  Opening another stream or an EncryptWriter on the
+ * same task while it is open fails rather than restarting the shared GCM context.
+ */
+class DecryptStream : public Stream {
+
+public:
+
+    DecryptStream() {}
+    DecryptStream(const DecryptStream&) = delete;
+    DecryptStream& operator=(const DecryptStream&) = delete;
+
+    ~DecryptStream() {
+        close();
+    }
+
+    int available() override {
+        return (int)((_length - _position) + _remaining);
+    }
+
+    int read() override {
+        if (_position == _length && !_fill()) return -1;
+        return _buf[_position++];
+    }
+
+    int peek() override {
+        if (_position == _length && !_fill()) return -1;
+        return _buf[_position];
+    }
+
+    size_t readBytes(char* buffer, size_t length) override {
+
+        size_t count = 0;
+
+        while (count < length) {
+            if (_position == _length && !_fill()) break;
+
+            size_t n = _length - _position;
+            if (n > length - count) n = length - count;
+
+            memcpy(buffer + count, _buf + _position, n);
+            _position += n;
+            count += n;
+        }
+
+        return count;
+    }
+
+    size_t write(uint8_t) override {
+        return 0;
+    }
+
+    /**
+     * Plaintext length recorded in the file header
+     */
+    size_t size() const {
+        return _size;
+    }
+
+    /**
+     * True if a read or decrypt error cut the stream short
+     */
+    bool failed() const {
+        return _failed;
+    }
+
+    /**
+     * Zeroes the plaintext buffer, closes the file and releases the encryption lock
+     */
+    void close() {
+        memset(_buf, 0, sizeof(_buf));
+        _position = 0;
+        _length = 0;
+        _remaining = 0;
+
+        if (_file) _file.close();
+
+        if (_lock != nullptr) {
+            xSemaphoreGive(_lock);
+            _lock = nullptr;
+        }
+        _ctx = nullptr;
+    }
+
+private:
+
+    friend class SecretEncryption;
+
+    File _file;
+    mbedtls_gcm_context* _ctx = nullptr;
+    SemaphoreHandle_t _lock = nullptr;
+
+    uint8_t _buf[SECRET_ENCRYPTION_STREAM_CHUNK_SIZE];
+    size_t _position = 0;
+    size_t _length = 0;
+    uint32_t _remaining = 0;
+    uint32_t _size = 0;
+    bool _failed = false;
+
+    bool _fill() {
+
+        if (_remaining == 0 || _ctx == nullptr) return false;
+
+        size_t n = _remaining < sizeof(_buf) ? _remaining : sizeof(_buf);
+        size_t olen = 0;
+
+        if (_file.read(_buf, n) != n ||
+            mbedtls_gcm_update(_ctx, _buf, n, _buf, sizeof(_buf), &olen) != 0 ||
+            olen != n) {
+            _failed = true;
+            close();
+            return false;
+        }
+
+        _remaining -= n;
+        _position = 0;
+        _length = n;
+        return true;
+    }
+};
+
+
+/**
+ * Print that encrypts everything written to it into a config-fs file, opened by
+ * SecretEncryption::openEncryptWriter().  Plaintext is staged one chunk at a time, encrypted in
+ * place and appended to SECRET_ENCRYPTION_TEMP_PATH, so memory use does not depend on the size
+ * of the document; serializeJson() can write to it directly.
+ *
+ * commit() patches the length and tag into the header and renames the file over the target, so
+ * readers see either the old file or the complete new one.  A writer destroyed without commit()
+ * discards the temporary file.  Like DecryptStream it holds the SecretEncryption lock while open.
+ */
+class EncryptWriter : public Print {
+
+public:
+
+    EncryptWriter() {}
+    EncryptWriter(const EncryptWriter&) = delete;
+    EncryptWriter& operator=(const EncryptWriter&) = delete;
+
+    ~EncryptWriter() {
+        abort();
+    }
+
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+
+        if (_ctx == nullptr) return 0;
+
+        size_t count = 0;
+
+        while (count < size) {
+            size_t n = sizeof(_buf) - _length;
+            if (n > size - count) n = size - count;
+
+            memcpy(_buf + _length, buffer + count, n);
+            _length += n;
+            count += n;
+
+            if (_length == sizeof(_buf) && !_flush()) {
+                return 0;
+            }
+        }
+
+        return count;
+    }
+
+    /**
+     * Encrypts any staged bytes, finalises the header and moves the file into place
+     * @returns false if any write failed; the target is left unchanged in that case
+     */
+    bool commit() {
+
+        if (_ctx == nullptr) return false;
+
+        uint8_t tag[16];
+        size_t olen = 0;
+
+        bool ok = !_failed
+               && _flush()
+               && mbedtls_gcm_finish(_ctx, nullptr, 0, &olen, tag, sizeof(tag)) == 0
+               && _file.seek(17)
+               && _file.write((uint8_t*)&_plaintextLen, 4) == 4
+               && _file.write(tag, sizeof(tag)) == sizeof(tag);
+
+        _file.close();
+
+        // LittleFS replaces an existing target atomically; fall back for filesystems that don't
+        if (ok && !_fs->rename(SECRET_ENCRYPTION_TEMP_PATH, _path.c_str())) {
+            _fs->remove(_path.c_str());
+            ok = _fs->rename(SECRET_ENCRYPTION_TEMP_PATH, _path.c_str());
+        }
+
+        if (!ok) {
+            _fs->remove(SECRET_ENCRYPTION_TEMP_PATH);
+        }
+
+        // Released only now: the next writer reuses the temporary path
+        _release();
+        _fs = nullptr;
+        return ok;
+    }
+
+    /**
+     * The nonce written to the file header; identifies this version of the file
+     */
+    const uint8_t* nonce() const {
+        return _nonce;
+    }
+
+    /**
+     * Discards everything written so far; the target file is not touched
+     */
+    void abort() {
+
+        if (_file) _file.close();
+
+        if (_ctx != nullptr) {
+            _release();
+            _fs->remove(SECRET_ENCRYPTION_TEMP_PATH);
+        }
+
+        _fs = nullptr;
+    }
+
+private:
+
+    friend class SecretEncryption;
+
+    fs::FS* _fs = nullptr;
+    String _path;
+    File _file;
+    mbedtls_gcm_context* _ctx = nullptr;
+    SemaphoreHandle_t _lock = nullptr;
+
+    uint8_t _buf[SECRET_ENCRYPTION_WRITE_CHUNK_SIZE];
+    uint8_t _nonce[12] = {};
+    size_t _length = 0;
+    uint32_t _plaintextLen = 0;
+    bool _failed = false;
+
+    bool _flush() {
+
+        if (_failed) return false;
+        if (_length == 0) return true;
+
+        size_t olen = 0;
+
+        if (mbedtls_gcm_update(_ctx, _buf, _length, _buf, sizeof(_buf), &olen) != 0 ||
+            olen != _length ||
+            _file.write(_buf, _length) != _length) {
+            _failed = true;
+            return false;
+        }
+
+        _plaintextLen += _length;
+        _length = 0;
+        return true;
+    }
+
+    void _release() {
+        memset(_buf, 0, sizeof(_buf));
+        _length = 0;
+        _ctx = nullptr;
+
+        if (_lock != nullptr) {
+            xSemaphoreGive(_lock);
+            _lock = nullptr;
+        }
+    }
+};
+
+
+/**
+ * Streaming encryptor for a cloud backup payload, opened by SecretEncryption::openBackupEncryptor().
+ * Produces the trailing-tag format (version 0x02): the caller sends header(), then every chunk after
+ * passing it through update(), then the tag from finish().  Only the caller's chunk is ever in memory,
+ * so the payload can be written straight to an HTTP connection opened with a Content-Length of
+ * SecretEncryption::backupBlobLength().
+ *
+ * Holds the SecretEncryption backup lock until finish() or destruction.
+ */
+class BackupEncryptor {
+
+public:
+
+    BackupEncryptor() {}
+    BackupEncryptor(const BackupEncryptor&) = delete;
+    BackupEncryptor& operator=(const BackupEncryptor&) = delete;
+
+    ~BackupEncryptor() {
+        _release();
+    }
+
+    /**
+     * The 37-byte header to send before the ciphertext; its tag field is zero
+     */
+    const uint8_t* header() const {
+        return _header;
+    }
+
+    /**
+     * Encrypts the next length bytes of plaintext in place
+     */
+    bool update(uint8_t* buffer, size_t length) {
+
+        if (_ctx == nullptr || length > _expected - _processed) return false;
+
+        size_t olen = 0;
+        if (mbedtls_gcm_update(_ctx, buffer, length, buffer, length, &olen) != 0 || olen != length) {
+            _release();
+            return false;
+        }
+
+        _processed += length;
+        return true;
+    }
+
+    /**
+     * Produces the tag to send after the ciphertext and releases the lock
+     * @returns false unless exactly the plaintext length given when opened was passed to update()
+     */
+    bool finish(uint8_t tag[16]) {
+
+        if (_ctx == nullptr) return false;
+
+        size_t olen = 0;
+        bool ok = _processed == _expected
+               && mbedtls_gcm_finish(_ctx, nullptr, 0, &olen, tag, 16) == 0;
+
+        _release();
+        return ok;
+    }
+
+private:
+
+    friend class SecretEncryption;
+
+    mbedtls_gcm_context* _ctx = nullptr;
+    SemaphoreHandle_t _lock = nullptr;
+
+    uint8_t _header[37] = {};
+    uint32_t _expected = 0;
+    uint32_t _processed = 0;
+
+    void _release() {
+        _ctx = nullptr;
+
+        if (_lock != nullptr) {
+            xSemaphoreGive(_lock);
+            _lock = nullptr;
+        }
+    }
+};
+
+
+/**
+ * Streaming decryptor for a cloud backup payload, opened by SecretEncryption::openBackupDecryptor().
+ * The caller passes the payload through update() in pieces as it arrives, header first; plaintext
+ * (inflated, for version 0x03) leaves through a sink, so only the caller's piece and the inflate
+ * window are ever in memory.  Versions 0x01, 0x02 and 0x03 are accepted.
+ *
+ * The tag can only be checked once the last byte has arrived, so the plaintext handed to the sink is
+ * unauthenticated until finish() returns true: write it somewhere temporary and only use it after.
+ *
+ * Holds the SecretEncryption backup lock until finish() or destruction.
+ */
+class BackupDecryptor {
+
+public:
+
+    BackupDecryptor() {}
+    BackupDecryptor(const BackupDecryptor&) = delete;
+    BackupDecryptor& operator=(const BackupDecryptor&) = delete;
+
+    ~BackupDecryptor() {
+        _release();
+    }
+
+    /**
+     * Consumes the next length bytes of the payload, decrypting ciphertext in place.  Calls
+     * sink(const uint8_t* data, size_t length) with each piece of plaintext; the sink returns false to stop.
+     * @returns false if the header is not a backup this key can open, the plaintext would exceed the
+     * limit given when opened, bytes follow the tag, or the sink stopped
+     */
+    template <typename F>
+    bool update(uint8_t* buffer, size_t length, F sink) {
+
+        while (length > 0) {
+
+            if (_ctx == nullptr) return false;
+
+            size_t n;
+
+            if (_headerRead < sizeof(_header)) {
+                n = _take(_header, sizeof(_header), _headerRead, buffer, length);
+                if (_headerRead == sizeof(_header) && !_start()) return false;
+            }
+            else if (_processed < _expected) {
+                n = length < _expected - _processed ? length : _expected - _processed;
+
+                size_t olen = 0;
+                if (mbedtls_gcm_update(_ctx, buffer, n, buffer, n, &olen) != 0 || olen != n) {
+                    _release();
+                    return false;
+                }
+                _processed += n;
+
+                if (!_plaintext(buffer, n, sink)) {
+                    _release();
+                    return false;
+                }
+            }
+            else if (_tagRead < _tagLength) {
+                n = _take(_tag, _tagLength, _tagRead, buffer, length);
+            }
+            else {
+                _release();
+                return false;
+            }
+
+            buffer += n;
+            length -= n;
+        }
+
+        return true;
+    }
+
+    /**
+     * Checks the tag and releases the lock
+     * @returns true only if the whole payload arrived, authenticated, and (for version 0x03) inflated
+     * to exactly the length it recorded
+     */
+    bool finish() {
+
+        if (_ctx == nullptr) return false;
+
+        bool ok = _headerRead == sizeof(_header) && _processed == _expected && _tagRead == _tagLength;
+
+        uint8_t computed[16];
+        size_t olen = 0;
+        ok = ok && mbedtls_gcm_finish(_ctx, nullptr, 0, &olen, computed, sizeof(computed)) == 0;
+
+        const uint8_t* tag = _tagLength == 0 ? _header + 21 : _tag;
+        uint8_t diff = 0;
+        for (size_t i = 0; i < sizeof(computed); i++) {
+            diff |= computed[i] ^ tag[i];
+        }
+        memset(computed, 0, sizeof(computed));
+
+        if (_header[4] == 0x03) {
+            ok = ok && _inflater.isComplete() && _inflated == _inflatedExpected;
+        }
+
+        _release();
+        return ok && diff == 0;
+    }
+
+    /**
+     * Plaintext bytes passed to the sink so far
+     */
+    size_t length() const {
+        return _header[4] == 0x03 ? _inflated : _processed;
+    }
+
+private:
+
+    friend class SecretEncryption;
+
+    mbedtls_gcm_context* _ctx = nullptr;
+    SemaphoreHandle_t _lock = nullptr;
+    size_t _maxPlaintextLen = SIZE_MAX;
+
+    uint8_t _header[37] = {};
+    size_t _headerRead = 0;
+    uint8_t _tag[16] = {};
+    size_t _tagLength = 0;      // 0 for version 0x01, whose tag is in the header
+    size_t _tagRead = 0;
+    uint32_t _expected = 0;
+    uint32_t _processed = 0;
+
+    BackupInflater _inflater;
+    uint8_t _inflatedLength[4] = {};
+    size_t _inflatedLengthRead = 0;
+    uint32_t _inflatedExpected = 0;
+    size_t _inflated = 0;
+
+    static size_t _take(uint8_t* field, size_t fieldLength, size_t& fieldRead, const uint8_t* buffer, size_t length) {
+        size_t n = length < fieldLength - fieldRead ? length : fieldLength - fieldRead;
+        memcpy(field + fieldRead, buffer, n);
+        fieldRead += n;
+        return n;
+    }
+
+    bool _start() {
+
+        static const uint8_t kMagic[4] = { 0x46, 0x46, 0x43, 0x45 };
+        uint8_t version = _header[4];
+
+        memcpy(&_expected, _header + 17, 4);
+        _tagLength = version == 0x01 ? 0 : 16;
+
+        bool ok = memcmp(_header, kMagic, 4) == 0
+               && (version == 0x01 || version == 0x02 || version == 0x03)
+               && (version == 0x03 || _expected <= _maxPlaintextLen)
+               && (version != 0x03 || _inflater.begin())
+               && mbedtls_gcm_starts(_ctx, MBEDTLS_GCM_DECRYPT, _header + 5, 12) == 0;
+
+        if (!ok) _release();
+        return ok;
+    }
+
+    template <typename F>
+    bool _plaintext(const uint8_t* data, size_t length, F sink) {
+
+        if (_header[4] != 0x03) {
+            return sink(data, length);
+        }
+
+        if (_inflatedLengthRead < sizeof(_inflatedLength)) {
+            size_t n = _take(_inflatedLength, sizeof(_inflatedLength), _inflatedLengthRead, data, length);
+            data += n;
+            length -= n;
+
+            if (_inflatedLengthRead < sizeof(_inflatedLength)) return true;
+
+            memcpy(&_inflatedExpected, _inflatedLength, sizeof(_inflatedExpected));
+            if (_inflatedExpected > _maxPlaintextLen) return false;
+        }
+
+        return _inflater.update(data, length, [&](const uint8_t* out, size_t outLength){
+            if (outLength > _inflatedExpected - _inflated) return false;
+            _inflated += outLength;
+            return sink(out, outLength);
+        });
+    }
+
+    void _release() {
+        _ctx = nullptr;
+        _inflater.end();
+
+        if (_lock != nullptr) {
+            xSemaphoreGive(_lock);
+            _lock = nullptr;
+        }
+    }
+};
+
 
 /**
  * AES-256-GCM file encryption using keys derived from the eFuse master secret.
@@ -21,7 +596,20 @@
  *   Offset 21 : 16 bytes  GCM authentication tag
  *   Offset 37 :  N bytes  ciphertext (N == plaintext_len)
  *
- * The same binary format is used for both config-fs files and cloud backup payloads.
+ * The same binary format is used for both config-fs files and cloud backup payloads.  Backups
+ * uploaded by a BackupEncryptor use version 0x02, which moves the tag after the ciphertext so the
+ * payload can be streamed without knowing the tag up front:
+ *   Offset  4 :  1 byte   version  = 0x02
+ *   Offset 21 : 16 bytes  zero
+ *   Offset 37 :  N bytes  ciphertext
+ *   Offset 37+N: 16 bytes GCM authentication tag
+ * Version 0x03 is laid out as 0x02, but its plaintext is a little-endian uint32 inflated length
+ * followed by a raw deflate stream (see BackupDeflater); plaintext_len is the length of both.
+ *
+ * Config-fs files are decrypted in two passes over the file: the first authenticates the whole
+ * ciphertext in SECRET_ENCRYPTION_STREAM_CHUNK_SIZE steps and discards the output, the second
+ * decrypts it again on demand through a DecryptStream.  Neither pass holds the whole plaintext.
+ * Writes go the other way through an EncryptWriter.
  */
 class SecretEncryption {
 
@@ -38,6 +626,16 @@ public:
         mbedtls_gcm_init(&_ctx);
         mbedtls_gcm_init(&_backupCtx);
 
+        if (_lock == nullptr) {
+            _lock = xSemaphoreCreateMutex();
+            if (_lock == nullptr) return false;
+        }
+
+        if (_backupLock == nullptr) {
+            _backupLock = xSemaphoreCreateMutex();
+            if (_backupLock == nullptr) return false;
+        }
+
         uint8_t derived[32];
 
         // Derive config-fs encryption key
@@ -99,274 +697,236 @@ public:
 
     /**
      * Encrypts a raw byte buffer and writes the encrypted binary to the given path.
-     * Returns false on failure; the partial file is removed.
+     * Returns false on failure; the existing file, if any, is left unchanged.
      */
     bool encryptToFile(fs::FS& fs, const String& path,
                        const uint8_t* plaintext, size_t plaintextLen) {
 
-        if (!_ready) return false;
+        EncryptWriter writer;
+        if (!openEncryptWriter(fs, path, writer)) return false;
 
-        uint8_t nonce[12];
-        esp_fill_random(nonce, sizeof(nonce));
+        if (plaintextLen > 0 && writer.write(plaintext, plaintextLen) != plaintextLen) {
+            return false;
+        }
 
-        uint8_t tag[16];
+        return writer.commit();
+    }
 
-        uint8_t* buf = nullptr;
-        if (plaintextLen > 0) {
-            buf = (uint8_t*)(psramFound() ? ps_malloc(plaintextLen) : malloc(plaintextLen));
-            if (!buf) return false;
-            memcpy(buf, plaintext, plaintextLen);
-        }
 
-        int ret = mbedtls_gcm_crypt_and_tag(
-            &_ctx, MBEDTLS_GCM_ENCRYPT,
-            plaintextLen,
-            nonce, sizeof(nonce),
-            nullptr, 0,
-            buf, buf,
-            sizeof(tag), tag
-        );
+    /**
+     * Opens an EncryptWriter that will replace the file at the given path on commit().
+     * Returns false if the temporary file cannot be created.
+     */
+    bool openEncryptWriter(fs::FS& fs, const String& path, EncryptWriter& out) {
 
-        if (ret != 0) {
-            if (buf) { memset(buf, 0, plaintextLen); free(buf); }
-            return false;
-        }
+        out.abort();
+        out._failed = false;
+        out._length = 0;
+        out._plaintextLen = 0;
 
-        File file = fs.open(path.c_str(), "w");
-        if (!file) {
-            if (buf) { memset(buf, 0, plaintextLen); free(buf); }
-            return false;
-        }
+        if (!_ready) return false;
+
+        uint8_t nonce[12];
+        esp_fill_random(nonce, sizeof(nonce));
 
+        if (!_take(_lock)) return false;
+
+        File file = fs.open(SECRET_ENCRYPTION_TEMP_PATH, "w");
+
+        // Length and tag are written as zeros here and patched by commit()
         const uint8_t magic[4] = { 0x46, 0x46, 0x43, 0x45 };
         const uint8_t version  = 0x01;
-        uint32_t len32 = (uint32_t)plaintextLen;
+        const uint8_t placeholder[4 + 16] = {};
 
-        bool ok = (file.write(magic, 4) == 4)
+        bool ok = file
+               && (file.write(magic, 4) == 4)
                && (file.write(&version, 1) == 1)
                && (file.write(nonce, sizeof(nonce)) == sizeof(nonce))
-               && (file.write((uint8_t*)&len32, 4) == 4)
-               && (file.write(tag, sizeof(tag)) == sizeof(tag))
-               && (plaintextLen == 0 || file.write(buf, plaintextLen) == plaintextLen);
-
-        file.close();
-
-        if (buf) { memset(buf, 0, plaintextLen); free(buf); }
+               && (file.write(placeholder, sizeof(placeholder)) == sizeof(placeholder))
+               && mbedtls_gcm_starts(&_ctx, MBEDTLS_GCM_ENCRYPT, nonce, sizeof(nonce)) == 0;
 
         if (!ok) {
-            fs.remove(path.c_str());
+            if (file) file.close();
+            fs.remove(SECRET_ENCRYPTION_TEMP_PATH);
+            xSemaphoreGive(_lock);
             return false;
         }
 
+        memcpy(out._nonce, nonce, sizeof(nonce));
+        out._fs = &fs;
+        out._path = path;
+        out._file = file;
+        out._ctx = &_ctx;
+        out._lock = _lock;
+
         return true;
     }
 
 
     /**
-     * Reads and AES-256-GCM decrypts the file at the given path into outPlaintext.
-     * Returns false on I/O error, bad magic/version, length mismatch, or tag failure.
+     * Authenticates the file at the given path and opens a DecryptStream over its plaintext.
+     * Returns false on I/O error, bad magic/version, length mismatch, or tag failure; out is
+     * left closed in that case.
      */
-    bool decryptFromFile(fs::FS& fs, const String& path, String& outPlaintext) {
+    bool openDecryptStream(fs::FS& fs, const String& path, DecryptStream& out) {
+
+        out.close();
+        out._failed = false;
+        out._size = 0;
 
         if (!_ready) return false;
 
         File file = fs.open(path.c_str(), "r");
         if (!file) return false;
 
-        uint8_t magic[4];
-        uint8_t version;
         uint8_t nonce[12];
         uint32_t plaintextLen;
         uint8_t tag[16];
 
-        static const uint8_t kMagic[4] = { 0x46, 0x46, 0x43, 0x45 };
-
-        bool headerOk =
-            (file.read(magic, 4) == 4)                  &&
-            (memcmp(magic, kMagic, 4) == 0)             &&
-            (file.read(&version, 1) == 1)               &&
-            (version == 0x01)                           &&
-            (file.read(nonce, sizeof(nonce)) == sizeof(nonce)) &&
-            (file.read((uint8_t*)&plaintextLen, 4) == 4)       &&
-            (file.read(tag, sizeof(tag)) == sizeof(tag));
-
-        if (!headerOk) {
+        if (!_readHeader(file, nonce, plaintextLen, tag)) {
             file.close();
             return false;
         }
 
-        if ((size_t)(file.size() - file.position()) != plaintextLen) {
+        if (!_take(_lock)) {
             file.close();
             return false;
         }
 
-        uint8_t* buf = nullptr;
-        if (plaintextLen > 0) {
-            buf = (uint8_t*)(psramFound() ? ps_malloc(plaintextLen + 1)
-                                          : malloc(plaintextLen + 1));
-            if (!buf) {
-                file.close();
-                return false;
-            }
-
-            if (file.read(buf, plaintextLen) != plaintextLen) {
-                memset(buf, 0, plaintextLen);
-                free(buf);
-                file.close();
-                return false;
-            }
-        }
-
-        file.close();
-
-        if (plaintextLen == 0) {
-            outPlaintext = String();
-            return true;
-        }
+        // Pass 1: authenticate, using the stream's buffer as scratch for the discarded plaintext
+        bool ok = _verifyTag(file, nonce, plaintextLen, tag, out._buf, sizeof(out._buf));
+        memset(out._buf, 0, sizeof(out._buf));
 
-        int ret = mbedtls_gcm_auth_decrypt(
-            &_ctx,
-            plaintextLen,
-            nonce, sizeof(nonce),
-            nullptr, 0,
-            tag, sizeof(tag),
-            buf, buf
-        );
+        // Pass 2 is driven by the stream's reads
+        ok = ok
+          && file.seek(kHeaderLen)
+          && mbedtls_gcm_starts(&_ctx, MBEDTLS_GCM_DECRYPT, nonce, sizeof(nonce)) == 0;
 
-        if (ret != 0) {
-            memset(buf, 0, plaintextLen);
-            free(buf);
+        if (!ok) {
+            xSemaphoreGive(_lock);
+            file.close();
             return false;
         }
 
-        buf[plaintextLen] = '\0';
-        outPlaintext = String((char*)buf);
-        memset(buf, 0, plaintextLen);
-        free(buf);
+        out._file = file;
+        out._ctx = &_ctx;
+        out._lock = _lock;
+        out._remaining = plaintextLen;
+        out._size = plaintextLen;
 
         return true;
     }
 
 
     /**
-     * Encrypts a raw byte buffer for cloud backup using key_backup.
-     * Returns an allocated buffer containing the full FFCE-format ciphertext blob.
-     * The caller must free() the returned pointer.  outLen receives the total byte count.
-     * Returns nullptr on failure.
+     * Reads the nonce from the header of the file at the given path without decrypting it.
+     * Every write uses a fresh nonce, so it identifies the version of the file.
      */
-    uint8_t* encryptBackup(const uint8_t* plaintext, size_t plaintextLen, size_t& outLen) {
+    bool readNonce(fs::FS& fs, const String& path, uint8_t nonce[12]) {
 
-        if (!_ready) return nullptr;
-
-        uint8_t nonce[12];
-        esp_fill_random(nonce, sizeof(nonce));
+        File file = fs.open(path.c_str(), "r");
+        if (!file) return false;
 
+        uint32_t plaintextLen;
         uint8_t tag[16];
-        uint8_t* cipherBuf = nullptr;
+        bool ok = _readHeader(file, nonce, plaintextLen, tag);
+        file.close();
 
-        if (plaintextLen > 0) {
-            cipherBuf = (uint8_t*)(psramFound() ? ps_malloc(plaintextLen) : malloc(plaintextLen));
-            if (!cipherBuf) return nullptr;
-            memcpy(cipherBuf, plaintext, plaintextLen);
-        }
+        return ok;
+    }
 
-        int ret = mbedtls_gcm_crypt_and_tag(
-            &_backupCtx, MBEDTLS_GCM_ENCRYPT,
-            plaintextLen,
-            nonce, sizeof(nonce),
-            nullptr, 0,
-            cipherBuf, cipherBuf,
-            sizeof(tag), tag
-        );
 
-        if (ret != 0) {
-            if (cipherBuf) { memset(cipherBuf, 0, plaintextLen); free(cipherBuf); }
-            return nullptr;
-        }
+    /**
+     * Reads and AES-256-GCM decrypts the file at the given path into outPlaintext.
+     * Returns false on I/O error, bad magic/version, length mismatch, or tag failure.
+     * Prefer openDecryptStream() when the plaintext is only going to be parsed.
+     */
+    bool decryptFromFile(fs::FS& fs, const String& path, String& outPlaintext) {
 
-        // Assemble the FFCE blob: 37-byte header + ciphertext
-        const size_t headerLen = 4 + 1 + 12 + 4 + 16; // = 37
-        outLen = headerLen + plaintextLen;
-        uint8_t* blob = (uint8_t*)(psramFound() ? ps_malloc(outLen) : malloc(outLen));
-        if (!blob) {
-            if (cipherBuf) { memset(cipherBuf, 0, plaintextLen); free(cipherBuf); }
-            return nullptr;
-        }
+        DecryptStream stream;
+        if (!openDecryptStream(fs, path, stream)) return false;
 
-        const uint8_t magic[4] = { 0x46, 0x46, 0x43, 0x45 };
-        const uint8_t version  = 0x01;
-        uint32_t len32 = (uint32_t)plaintextLen;
+        outPlaintext = String();
+        if (stream.size() > 0 && !outPlaintext.reserve(stream.size())) return false;
 
-        uint8_t* p = blob;
-        memcpy(p, magic, 4);    p += 4;
-        *p++ = version;
-        memcpy(p, nonce, 12);   p += 12;
-        memcpy(p, &len32, 4);   p += 4;
-        memcpy(p, tag, 16);     p += 16;
-        if (plaintextLen > 0) {
-            memcpy(p, cipherBuf, plaintextLen);
+        char chunk[64];
+        size_t n;
+        while ((n = stream.readBytes(chunk, sizeof(chunk))) > 0) {
+            outPlaintext.concat(chunk, n);
         }
+        memset(chunk, 0, sizeof(chunk));
 
-        if (cipherBuf) { memset(cipherBuf, 0, plaintextLen); free(cipherBuf); }
+        if (stream.failed() || outPlaintext.length() != stream.size()) {
+            outPlaintext = String();
+            return false;
+        }
 
-        return blob;
+        return true;
     }
 
 
     /**
-     * Decrypts a FFCE-format cloud backup blob using key_backup.
-     * outPlaintext receives the decrypted payload.
-     * Returns false on any error (bad magic, tag mismatch, etc.).
+     * Starts a streaming cloud backup encryption with key_backup; see BackupEncryptor
+     * @param plaintextLen the exact number of bytes that will be passed to update()
+     * @param deflated true if those bytes are an inflated length and deflate stream (version 0x03)
      */
-    bool decryptBackup(const uint8_t* blob, size_t blobLen, String& outPlaintext) {
+    bool openBackupEncryptor(size_t plaintextLen, BackupEncryptor& out, bool deflated = false) {
 
-        if (!_ready) return false;
+        if (!_ready || plaintextLen > UINT32_MAX) return false;
 
-        const size_t kHeaderLen = 4 + 1 + 12 + 4 + 16; // = 37
-        if (blobLen < kHeaderLen) return false;
+        if (!_take(_backupLock)) return false;
 
-        const uint8_t kMagic[4] = { 0x46, 0x46, 0x43, 0x45 };
-        if (memcmp(blob, kMagic, 4) != 0) return false;
-        if (blob[4] != 0x01) return false;
+        uint8_t nonce[12];
+        esp_fill_random(nonce, sizeof(nonce));
 
-        const uint8_t* nonce = blob + 5;
-        uint32_t plaintextLen;
-        memcpy(&plaintextLen, blob + 17, 4);
-        const uint8_t* tag = blob + 21;
-        const uint8_t* ciphertext = blob + kHeaderLen;
+        if (mbedtls_gcm_starts(&_backupCtx, MBEDTLS_GCM_ENCRYPT, nonce, sizeof(nonce)) != 0) {
+            xSemaphoreGive(_backupLock);
+            return false;
+        }
 
-        if ((size_t)(blobLen - kHeaderLen) != plaintextLen) return false;
+        static const uint8_t kMagic[4] = { 0x46, 0x46, 0x43, 0x45 };
+        uint32_t len32 = (uint32_t)plaintextLen;
 
-        if (plaintextLen == 0) {
-            outPlaintext = String();
-            return true;
-        }
+        memset(out._header, 0, sizeof(out._header));
+        memcpy(out._header, kMagic, 4);
+        out._header[4] = deflated ? kVersionDeflated : kVersionTrailingTag;
+        memcpy(out._header + 5, nonce, 12);
+        memcpy(out._header + 17, &len32, 4);
 
-        uint8_t* buf = (uint8_t*)(psramFound() ? ps_malloc(plaintextLen + 1)
-                                               : malloc(plaintextLen + 1));
-        if (!buf) return false;
-        memcpy(buf, ciphertext, plaintextLen);
+        out._ctx = &_backupCtx;
+        out._lock = _backupLock;
+        out._expected = len32;
+        out._processed = 0;
+        return true;
+    }
 
-        int ret = mbedtls_gcm_auth_decrypt(
-            &_backupCtx,
-            plaintextLen,
-            nonce, 12,
-            nullptr, 0,
-            tag, 16,
-            buf, buf
-        );
 
-        if (ret != 0) {
-            memset(buf, 0, plaintextLen);
-            free(buf);
-            return false;
-        }
+    /**
+     * Total size of a trailing-tag backup payload for plaintextLen bytes of plaintext
+     */
+    static size_t backupBlobLength(size_t plaintextLen) {
+        return kHeaderLen + plaintextLen + 16;
+    }
 
-        buf[plaintextLen] = '\0';
-        outPlaintext = String((char*)buf);
-        memset(buf, 0, plaintextLen);
-        free(buf);
 
+    /**
+     * Starts a streaming cloud backup decryption with key_backup; see BackupDecryptor
+     * @param maxPlaintextLen payloads whose plaintext (inflated, for version 0x03) would be longer are refused
+     */
+    bool openBackupDecryptor(BackupDecryptor& out, size_t maxPlaintextLen = SIZE_MAX) {
+
+        if (!_ready) return false;
+
+        if (!_take(_backupLock)) return false;
+
+        out._ctx = &_backupCtx;
+        out._lock = _backupLock;
+        out._maxPlaintextLen = maxPlaintextLen;
+        out._headerRead = 0;
+        out._tagRead = 0;
+        out._processed = 0;
+        out._inflatedLengthRead = 0;
+        out._inflated = 0;
         return true;
     }
 
@@ -376,8 +936,84 @@ public:
 
 private:
 
+    static const size_t kHeaderLen = 4 + 1 + 12 + 4 + 16; // = 37
+    static const uint8_t kVersionTrailingTag = 0x02;
+    static const uint8_t kVersionDeflated = 0x03;
+
     mbedtls_gcm_context _ctx;
     mbedtls_gcm_context _backupCtx;
+    SemaphoreHandle_t _lock = nullptr;   // Serialises use of _ctx between the main and HTTP tasks
+    SemaphoreHandle_t _backupLock = nullptr;   // Serialises use of _backupCtx; held for a whole upload
     bool _ready = false;
 
+
+    /**
+     * Takes lock for the calling task.  The locks are not recursive: a second open on the task that
+     * already holds one would restart the GCM context under the first stream, so it is refused.
+     */
+    static bool _take(SemaphoreHandle_t lock) {
+        if (xSemaphoreGetMutexHolder(lock) == xTaskGetCurrentTaskHandle()) {
+            log_e("Nested encryption open refused");
+            return false;
+        }
+        return xSemaphoreTake(lock, portMAX_DELAY) == pdTRUE;
+    }
+
+
+    /**
+     * Reads and validates the FFCE header, leaving file positioned at the ciphertext
+     */
+    static bool _readHeader(File& file, uint8_t nonce[12], uint32_t& plaintextLen, uint8_t tag[16]) {
+
+        uint8_t magic[4];
+        uint8_t version;
+
+        static const uint8_t kMagic[4] = { 0x46, 0x46, 0x43, 0x45 };
+
+        bool headerOk =
+            (file.read(magic, 4) == 4)                  &&
+            (memcmp(magic, kMagic, 4) == 0)             &&
+            (file.read(&version, 1) == 1)               &&
+            (version == 0x01)                           &&
+            (file.read(nonce, 12) == 12)                &&
+            (file.read((uint8_t*)&plaintextLen, 4) == 4) &&
+            (file.read(tag, 16) == 16);
+
+        return headerOk && (size_t)(file.size() - file.position()) == plaintextLen;
+    }
+
+
+    /**
+     * Runs GCM over the remaining ciphertext in chunks, discarding the output, and compares the
+     * computed tag with the stored one in constant time.  Caller holds _lock.
+     */
+    bool _verifyTag(File& file, const uint8_t nonce[12], uint32_t plaintextLen, const uint8_t tag[16],
+                    uint8_t* scratch, size_t scratchLen) {
+
+        if (mbedtls_gcm_starts(&_ctx, MBEDTLS_GCM_DECRYPT, nonce, 12) != 0) return false;
+
+        uint32_t remaining = plaintextLen;
+        while (remaining > 0) {
+            size_t n = remaining < scratchLen ? remaining : scratchLen;
+            size_t olen = 0;
+            if (file.read(scratch, n) != n ||
+                mbedtls_gcm_update(&_ctx, scratch, n, scratch, scratchLen, &olen) != 0) {
+                return false;
+            }
+            remaining -= n;
+        }
+
+        uint8_t computed[16];
+        size_t olen = 0;
+        if (mbedtls_gcm_finish(&_ctx, nullptr, 0, &olen, computed, sizeof(computed)) != 0) return false;
+
+        uint8_t diff = 0;
+        for (size_t i = 0; i < sizeof(computed); i++) {
+            diff |= computed[i] ^ tag[i];
+        }
+        memset(computed, 0, sizeof(computed));
+
+        return diff == 0;
+    }
+
 };
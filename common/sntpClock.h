@@ -0,0 +1,138 @@
+#pragma once
+#include <Arduino.h>
+#include <esp_netif_sntp.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+#ifndef SNTP_CLOCK_SERVER
+    #define SNTP_CLOCK_SERVER "pool.ntp.org" /* NTP server queried by SntpClock */
+#endif
+
+#ifndef SNTP_CLOCK_SYNC_INTERVAL_SECONDS
+    #define SNTP_CLOCK_SYNC_INTERVAL_SECONDS 3600 /* Seconds between background resyncs once time is set */
+#endif
+
+
+/**
+ * Wall-clock time source for the event log, syslog, MQTT and cloud request signing.  Readers only
+ * need isTimeSet() and getEpochTime(), so a fixed or scripted clock can stand in for SntpClock.
+ */
+class EpochClock {
+
+public:
+
+    virtual ~EpochClock() {}
+
+    /**
+     * True once the clock has been set from a time source
+     */
+    virtual bool isTimeSet() = 0;
+
+    /**
+     * Seconds since the Unix epoch; meaningless until isTimeSet()
+     */
+    virtual unsigned long getEpochTime() = 0;
+};
+
+
+/**
+ * EpochClock kept by the ESP-IDF SNTP service.  The service runs in the lwIP task and calls back
+ * when a response arrives, so nothing on the loop ever waits for the network.  The callback records
+ * the offset between the epoch and esp_timer, and reads add that offset to esp_timer: O(1), with no
+ * system call and no UDP.
+ *
+ * One instance per sketch; the SNTP service is a singleton.
+ */
+class SntpClock : public EpochClock {
+
+public:
+
+    SntpClock() {}
+    SntpClock(const SntpClock&) = delete;
+    SntpClock& operator=(const SntpClock&) = delete;
+
+    /**
+     * Starts the SNTP service.  Call once the network interface is up; returns without waiting for a response.
+     */
+    bool begin(const char* server = SNTP_CLOCK_SERVER) {
+
+        if (_started) return true;
+
+        _instance = this;
+        _server = server;
+
+        esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG(server);
+        config.sync_cb = _onSync;
+
+        sntp_set_sync_interval(SNTP_CLOCK_SYNC_INTERVAL_SECONDS * 1000UL);
+
+        if (esp_netif_sntp_init(&config) != ESP_OK) {
+            log_e("Unable to start SNTP");
+            return false;
+        }
+
+        _started = true;
+        return true;
+    }
+
+    /**
+     * Asks the SNTP service to query the server again (e.g. after the link comes back); does not wait.
+     * Starts the service first if begin() has not been called yet, as when the link came up after boot.
+     */
+    void requestSync() {
+        if (!_started) {
+            begin(_server);
+            return;
+        }
+        esp_netif_sntp_start();
+    }
+
+    bool isTimeSet() override {
+        return _set;
+    }
+
+    unsigned long getEpochTime() override {
+        return (unsigned long)(epochMicros() / 1000000LL);
+    }
+
+    /**
+     * Microseconds since the Unix epoch; meaningless until isTimeSet()
+     */
+    int64_t epochMicros() {
+        portENTER_CRITICAL(&_mux);
+        int64_t offset = _offsetMicros;
+        portEXIT_CRITICAL(&_mux);
+
+        return esp_timer_get_time() + offset;
+    }
+
+private:
+
+    static SntpClock* _instance;
+
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+    int64_t _offsetMicros = 0;      // Epoch microseconds minus esp_timer microseconds at the last sync
+    volatile bool _set = false;
+    bool _started = false;
+    const char* _server = SNTP_CLOCK_SERVER;
+
+    /**
+     * Runs in the lwIP task after the service has set the system time to tv
+     */
+    static void _onSync(struct timeval* tv) {
+
+        SntpClock* self = _instance;
+        if (self == nullptr || tv == nullptr) return;
+
+        int64_t offset = (int64_t)tv->tv_sec * 1000000LL + tv->tv_usec - esp_timer_get_time();
+
+        portENTER_CRITICAL(&self->_mux);
+        self->_offsetMicros = offset;
+        portEXIT_CRITICAL(&self->_mux);
+
+        self->_set = true;
+    }
+};
+
+inline SntpClock* SntpClock::_instance = nullptr;
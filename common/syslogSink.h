@@ -0,0 +1,522 @@
+#ifndef syslogSink_h
+    #define syslogSink_h
+
+    #include <Arduino.h>
+    #include <Network.h>
+    #include <WiFiUdp.h>
+    #include "sntpClock.h"
+    #include <esp_netif.h>
+    #include <freertos/FreeRTOS.h>
+    #include <freertos/portmacro.h>
+    #include <lwip/dns.h>
+    #include <time.h>
+
+    #ifndef SYSLOG_QUEUE_ENTRIES
+        #define SYSLOG_QUEUE_ENTRIES 32 /* Number of messages held between flushes; further messages are dropped and counted */
+    #endif
+    #ifndef SYSLOG_MESSAGE_MAX_LENGTH
+        #define SYSLOG_MESSAGE_MAX_LENGTH 200 /* Longest message text kept per entry; longer text is truncated */
+    #endif
+    static_assert(SYSLOG_MESSAGE_MAX_LENGTH <= UINT16_MAX, "SYSLOG_MESSAGE_MAX_LENGTH must fit the entry's uint16_t length");
+    #ifndef SYSLOG_DATAGRAM_SIZE
+        #define SYSLOG_DATAGRAM_SIZE 1400 /* Largest UDP payload sent; stays below a 1500 byte Ethernet MTU */
+    #endif
+    #ifndef SYSLOG_FLUSH_MILLISECONDS
+        #define SYSLOG_FLUSH_MILLISECONDS 1000 /* Milliseconds between flushes unless the queue is half full */
+    #endif
+    #ifndef SYSLOG_DEFAULT_PORT
+        #define SYSLOG_DEFAULT_PORT 514 /* UDP port used when the controller config does not specify one */
+    #endif
+    #ifndef SYSLOG_DEFAULT_RATE_LIMIT
+        #define SYSLOG_DEFAULT_RATE_LIMIT 20 /* Messages per second accepted when the controller config does not specify a rate limit */
+    #endif
+    #ifndef SYSLOG_RESOLVE_RETRY_SECONDS
+        #define SYSLOG_RESOLVE_RETRY_SECONDS 300 /* Seconds to wait before retrying a failed host name lookup */
+    #endif
+    #ifndef SYSLOG_FACILITY
+        #define SYSLOG_FACILITY 16 /* RFC 5424 facility; 16 is local0 */
+    #endif
+
+
+    /**
+     * Streams log messages to a remote collector over UDP, either as RFC 5424 syslog or as
+     * newline-delimited JSON.
+     *
+     * log() only copies the message into a fixed queue and never touches the network, so it
+     * is safe to call from any task.  loop() formats and sends the queued messages on a timer.
+     * NDJSON lines are packed into datagrams of up to SYSLOG_DATAGRAM_SIZE bytes; RFC 5424
+     * messages are sent one per datagram as RFC 5426 requires, but still only from loop().
+     * A collector given by name is looked up in the lwIP task; loop() keeps the messages queued
+     * until the answer arrives instead of waiting for it.
+     *
+     * One instance per sketch; lookups call back into it from the lwIP task.
+     */
+    class SyslogSink{
+
+        public:
+
+            enum format{
+                FORMAT_RFC5424 = 0,
+                FORMAT_NDJSON = 1
+            };
+
+            enum severity{
+                SEVERITY_ERROR = 3,
+                SEVERITY_WARNING = 4,
+                SEVERITY_NOTICE = 5,
+                SEVERITY_INFO = 6,
+                SEVERITY_DEBUG = 7
+            };
+
+        private:
+
+            struct entry{
+                uint32_t timestamp;     /* Milliseconds since boot when the message was queued */
+                uint8_t severity;
+                bool event;             /* True for event log entries, false for debug log lines */
+                uint16_t length;
+                char text[SYSLOG_MESSAGE_MAX_LENGTH];
+            };
+
+            entry* _queue = nullptr;    /* PSRAM-backed circular buffer of pending messages */
+            uint8_t _head = 0;
+            uint8_t _count = 0;
+            uint32_t _dropped = 0;      /* Messages rejected by the rate limit or a full queue since the last flush */
+
+            uint16_t _rateLimit = SYSLOG_DEFAULT_RATE_LIMIT;
+            uint16_t _tokens = 0;
+            uint32_t _lastRefill = 0;
+
+            portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+            bool _enabled = false;
+            format _format = FORMAT_RFC5424;
+            String _host;
+            uint16_t _port = SYSLOG_DEFAULT_PORT;
+            IPAddress _address;
+            bool _resolved = false;
+            bool _resolving = false;
+            uint64_t _resolveRetryAt = 0;
+
+            static SyslogSink* _instance;
+            uint32_t _lookup = 0;               /* Incremented per lookup, so a late answer to an abandoned one is ignored */
+            volatile bool _lookupDone = false;
+            bool _lookupFailed = false;
+            ip_addr_t _lookupAddress;
+            char _hostname[32] = "-";
+            char _appName[32] = "-";
+
+            EpochClock* _timeClient = nullptr;
+            WiFiUDP _udp;
+            uint32_t _lastFlush = 0;
+
+            char _datagram[SYSLOG_DATAGRAM_SIZE];
+            size_t _datagramLength = 0;
+
+            static const char* _severityName(uint8_t severity){
+                switch(severity){
+                    case SEVERITY_ERROR: return "error";
+                    case SEVERITY_WARNING: return "warning";
+                    case SEVERITY_NOTICE: return "notice";
+                    case SEVERITY_INFO: return "info";
+                    default: return "debug";
+                }
+            }
+
+            /**
+             * Writes the entry's time as an RFC 3339 UTC timestamp, or "-" if NTP has not synchronized
+             */
+            void _formatTimestamp(const entry& e, uint32_t nowMillis, char* out, size_t outSize){
+
+                if(_timeClient == nullptr || !_timeClient->isTimeSet()){
+                    snprintf(out, outSize, "-");
+                    return;
+                }
+
+                uint64_t epochMillis = (uint64_t)_timeClient->getEpochTime() * 1000ULL - (uint32_t)(nowMillis - e.timestamp);
+                time_t seconds = (time_t)(epochMillis / 1000ULL);
+                struct tm utc;
+                gmtime_r(&seconds, &utc);
+                snprintf(out, outSize, "%04d-%02d-%02dT%02d:%02d:%02d.%03uZ",
+                    utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec,
+                    (unsigned)(epochMillis % 1000ULL));
+            }
+
+            /**
+             * Appends text to out as the body of a JSON string
+             */
+            static size_t _jsonEscape(const char* text, size_t length, char* out, size_t outSize){
+
+                size_t pos = 0;
+
+                for(size_t i = 0; i < length && pos + 7 < outSize; i++){
+                    char c = text[i];
+                    if(c == '"' || c == '\\'){
+                        out[pos++] = '\\';
+                        out[pos++] = c;
+                    }else if((uint8_t)c < 0x20){
+                        pos += snprintf(out + pos, outSize - pos, "\\u%04x", (unsigned)(uint8_t)c);
+                    }else{
+                        out[pos++] = c;
+                    }
+                }
+
+                return pos;
+            }
+
+            /**
+             * Formats one entry into line, returning its length
+             */
+            size_t _formatEntry(const entry& e, uint32_t nowMillis, char* line, size_t lineSize){
+
+                char timestamp[32];
+                _formatTimestamp(e, nowMillis, timestamp, sizeof(timestamp));
+
+                if(_format == FORMAT_NDJSON){
+                    char escaped[SYSLOG_MESSAGE_MAX_LENGTH * 2];
+                    size_t escapedLength = _jsonEscape(e.text, e.length, escaped, sizeof(escaped));
+                    int n = snprintf(line, lineSize,
+                        "{\"time\":\"%s\",\"uptime_ms\":%lu,\"host\":\"%s\",\"app\":\"%s\",\"type\":\"%s\",\"severity\":\"%s\",\"message\":\"%.*s\"}\n",
+                        timestamp, (unsigned long)e.timestamp, _hostname, _appName, e.event ? "event" : "log",
+                        _severityName(e.severity), (int)escapedLength, escaped);
+                    return n < 0 ? 0 : ((size_t)n < lineSize ? (size_t)n : lineSize - 1);
+                }
+
+                int n = snprintf(line, lineSize, "<%u>1 %s %s %s - %s - %.*s",
+                    (unsigned)(SYSLOG_FACILITY * 8 + e.severity), timestamp, _hostname, _appName,
+                    e.event ? "event" : "log", (int)e.length, e.text);
+                return n < 0 ? 0 : ((size_t)n < lineSize ? (size_t)n : lineSize - 1);
+            }
+
+            void _sendDatagram(){
+
+                if(_datagramLength == 0){
+                    return;
+                }
+
+                if(_udp.beginPacket(_address, _port)){
+                    _udp.write((const uint8_t*)_datagram, _datagramLength);
+                    _udp.endPacket();
+                }
+
+                _datagramLength = 0;
+            }
+
+            void _append(const char* line, size_t length){
+
+                if(_format == FORMAT_RFC5424){
+                    memcpy(_datagram, line, length);
+                    _datagramLength = length;
+                    _sendDatagram();
+                    return;
+                }
+
+                if(_datagramLength + length > sizeof(_datagram)){
+                    _sendDatagram();
+                }
+
+                memcpy(_datagram + _datagramLength, line, length);
+                _datagramLength += length;
+            }
+
+            /**
+             * Arguments for dns_gethostbyname_addrtype(), which has to be called in the lwIP task
+             */
+            struct lookupRequest{
+                const char* host;
+                ip_addr_t* address;
+                uint32_t lookup;
+                err_t result;
+            };
+
+            /**
+             * Starts or advances the collector lookup without waiting for it
+             * @returns true once the collector's address is known
+             */
+            bool _resolve(){
+
+                if(_resolved){
+                    return true;
+                }
+
+                uint64_t now = esp_timer_get_time();
+
+                if(_resolving){
+
+                    if(!_lookupDone){
+                        return false;
+                    }
+
+                    portENTER_CRITICAL(&_mux);
+                    bool failed = _lookupFailed;
+                    ip_addr_t address = _lookupAddress;
+                    portEXIT_CRITICAL(&_mux);
+
+                    _resolving = false;
+
+                    if(!failed){
+                        _address = IPAddress(ip_2_ip4(&address)->addr);
+                        _resolved = true;
+                        return true;
+                    }
+
+                    _resolveRetryAt = now + (SYSLOG_RESOLVE_RETRY_SECONDS * 1000000ULL);
+                    return false;
+                }
+
+                if(now < _resolveRetryAt){
+                    return false;
+                }
+
+                if(_address.fromString(_host)){
+                    _resolved = true;
+                    return true;
+                }
+
+                portENTER_CRITICAL(&_mux);
+                uint32_t lookup = ++_lookup;
+                _lookupDone = false;
+                _lookupFailed = false;
+                portEXIT_CRITICAL(&_mux);
+
+                ip_addr_t address;
+                lookupRequest request = { _host.c_str(), &address, lookup, ERR_OK };
+
+                if(esp_netif_tcpip_exec(_startLookup, &request) == ESP_OK){
+                    if(request.result == ERR_OK){
+                        _address = IPAddress(ip_2_ip4(&address)->addr);
+                        _resolved = true;
+                        return true;
+                    }
+                    if(request.result == ERR_INPROGRESS){
+                        _resolving = true;
+                        return false;
+                    }
+                }
+
+                _resolveRetryAt = now + (SYSLOG_RESOLVE_RETRY_SECONDS * 1000000ULL);
+                return false;
+            }
+
+            /**
+             * Runs in the lwIP task
+             */
+            static esp_err_t _startLookup(void* context){
+                lookupRequest* request = (lookupRequest*)context;
+                request->result = dns_gethostbyname_addrtype(request->host, request->address, _onLookup,
+                                                             (void*)(uintptr_t)request->lookup, LWIP_DNS_ADDRTYPE_IPV4);
+                return ESP_OK;
+            }
+
+            /**
+             * Runs in the lwIP task when a lookup that did not finish in _startLookup() does; address is null on failure
+             */
+            static void _onLookup(const char* name, const ip_addr_t* address, void* argument){
+
+                SyslogSink* self = _instance;
+                if(self == nullptr){
+                    return;
+                }
+
+                portENTER_CRITICAL(&self->_mux);
+                if((uint32_t)(uintptr_t)argument == self->_lookup){
+                    if(address != nullptr){
+                        self->_lookupAddress = *address;
+                    }
+                    self->_lookupFailed = address == nullptr;
+                    self->_lookupDone = true;
+                }
+                portEXIT_CRITICAL(&self->_mux);
+            }
+
+        public:
+
+            SyslogSink(){
+                _queue = (entry*)ps_malloc(SYSLOG_QUEUE_ENTRIES * sizeof(entry));
+                if(_queue == nullptr){
+                    _queue = (entry*)malloc(SYSLOG_QUEUE_ENTRIES * sizeof(entry));
+                }
+            }
+
+            /**
+             * Enables the sink
+             * @param host Collector host name or IP address
+             * @param port Collector UDP port
+             * @param messageFormat FORMAT_RFC5424 or FORMAT_NDJSON
+             * @param rateLimit Maximum messages accepted per second; 0 disables the limit
+             * @param hostname Value sent as the syslog HOSTNAME / JSON host
+             * @param appName Value sent as the syslog APP-NAME / JSON app
+             * @param timeClient Clock used for timestamps; messages carry "-" until time is set
+             */
+            void begin(const char* host, uint16_t port, format messageFormat, uint16_t rateLimit, const char* hostname, const char* appName, EpochClock* timeClient){
+
+                if(_queue == nullptr){
+                    return;
+                }
+
+                _instance = this;
+
+                portENTER_CRITICAL(&_mux);
+                _lookup++;
+                portEXIT_CRITICAL(&_mux);
+
+                _host = host;
+                _port = port;
+                _format = messageFormat;
+                _rateLimit = rateLimit;
+                _tokens = rateLimit;
+                _lastRefill = (uint32_t)(esp_timer_get_time() / 1000ULL);
+                _timeClient = timeClient;
+                _resolved = false;
+                _resolving = false;
+                _resolveRetryAt = 0;
+                strlcpy(_hostname, hostname, sizeof(_hostname));
+                strlcpy(_appName, appName, sizeof(_appName));
+                _enabled = true;
+            }
+
+            bool isEnabled(){
+                return _enabled;
+            }
+
+            /**
+             * Queues a message.  Never blocks; the message is dropped and counted if the rate limit
+             * has been reached or the queue is full.
+             * @param level Message severity
+             * @param text Message text, truncated to SYSLOG_MESSAGE_MAX_LENGTH
+             * @param length Length of text
+             * @param event True if the message is an event log entry rather than a debug log line
+             */
+            void log(severity level, const char* text, size_t length, bool event = false){
+
+                if(!_enabled){
+                    return;
+                }
+
+                while(length > 0 && (text[length - 1] == '\n' || text[length - 1] == '\r')){
+                    length--;
+                }
+
+                if(length > SYSLOG_MESSAGE_MAX_LENGTH){
+                    length = SYSLOG_MESSAGE_MAX_LENGTH;
+                }
+
+                uint32_t now = (uint32_t)(esp_timer_get_time() / 1000ULL);
+
+                portENTER_CRITICAL(&_mux);
+
+                if(_rateLimit > 0){
+                    uint32_t refill = (uint32_t)((uint64_t)(now - _lastRefill) * _rateLimit / 1000ULL);
+                    if(refill > 0){
+                        if((uint32_t)_tokens + refill >= _rateLimit){
+                            _tokens = _rateLimit;
+                            _lastRefill = now;
+                        }else{
+                            /* Only the time the new tokens account for is used up; the rest counts towards the next one */
+                            _tokens += refill;
+                            _lastRefill += (uint32_t)((uint64_t)refill * 1000ULL / _rateLimit);
+                        }
+                    }
+                }
+
+                if((_rateLimit > 0 && _tokens == 0) || _count >= SYSLOG_QUEUE_ENTRIES){
+                    _dropped++;
+                    portEXIT_CRITICAL(&_mux);
+                    return;
+                }
+
+                if(_rateLimit > 0){
+                    _tokens--;
+                }
+
+                entry& e = _queue[(_head + _count) % SYSLOG_QUEUE_ENTRIES];
+                e.timestamp = now;
+                e.severity = level;
+                e.event = event;
+                e.length = (uint16_t)length;
+                memcpy(e.text, text, length);
+                _count++;
+
+                portEXIT_CRITICAL(&_mux);
+            }
+
+            /**
+             * Queues a line produced by the Arduino log_* macros, taking the severity from the
+             * "[   123][E]" prefix they emit
+             */
+            void logArduino(const char* text, size_t length){
+
+                severity level = SEVERITY_DEBUG;
+                const char* marker = (const char*)memchr(text, ']', length);
+
+                if(marker != nullptr && (size_t)(marker - text) + 3 < length && marker[1] == '['){
+                    switch(marker[2]){
+                        case 'E': level = SEVERITY_ERROR; break;
+                        case 'W': level = SEVERITY_WARNING; break;
+                        case 'I': level = SEVERITY_INFO; break;
+                        default: level = SEVERITY_DEBUG; break;
+                    }
+                }
+
+                log(level, text, length);
+            }
+
+            /**
+             * Sends queued messages.  Call from the main loop only while the network is connected.
+             */
+            void loop(){
+
+                if(!_enabled || _count == 0){
+                    return;
+                }
+
+                uint32_t now = (uint32_t)(esp_timer_get_time() / 1000ULL);
+
+                if(now - _lastFlush < SYSLOG_FLUSH_MILLISECONDS && _count < SYSLOG_QUEUE_ENTRIES / 2){
+                    return;
+                }
+
+                _lastFlush = now;
+
+                if(!_resolve()){
+                    return;
+                }
+
+                char line[SYSLOG_MESSAGE_MAX_LENGTH * 2 + 192];
+                entry e;
+
+                portENTER_CRITICAL(&_mux);
+                uint32_t dropped = _dropped;
+                _dropped = 0;
+                portEXIT_CRITICAL(&_mux);
+
+                if(dropped > 0){
+                    e.timestamp = now;
+                    e.severity = SEVERITY_WARNING;
+                    e.event = false;
+                    e.length = (uint16_t)snprintf(e.text, sizeof(e.text), "syslog dropped %lu messages", (unsigned long)dropped);
+                    _append(line, _formatEntry(e, now, line, sizeof(line)));
+                }
+
+                while(true){
+
+                    portENTER_CRITICAL(&_mux);
+                    if(_count == 0){
+                        portEXIT_CRITICAL(&_mux);
+                        break;
+                    }
+                    e = _queue[_head];
+                    _head = (_head + 1) % SYSLOG_QUEUE_ENTRIES;
+                    _count--;
+                    portEXIT_CRITICAL(&_mux);
+
+                    _append(line, _formatEntry(e, now, line, sizeof(line)));
+                }
+
+                _sendDatagram();
+            }
+    };
+
+    inline SyslogSink* SyslogSink::_instance = nullptr;
+
+#endif
@@ -6,7 +6,23 @@
         #include <WiFiServer.h>
         #include <WiFiClient.h>
         #include <HardwareSerial.h>
+        #include <freertos/FreeRTOS.h>
+        #include <freertos/task.h>
         #include <freertos/portmacro.h>
+        #include <esp_timer.h>
+        #include <esp_memory_utils.h>
+
+        #ifndef TELNET_LOG_DRAIN_TASK_PRIORITY
+            #define TELNET_LOG_DRAIN_TASK_PRIORITY 1 /* FreeRTOS priority of the drain task; kept just above idle so it never competes with the control loop */
+        #endif
+
+        #ifndef TELNET_LOG_DRAIN_INTERVAL_MILLISECONDS
+            #define TELNET_LOG_DRAIN_INTERVAL_MILLISECONDS 20 /* Milliseconds the drain task sleeps when every client is caught up */
+        #endif
+
+        #ifndef TELNET_LOG_DEFERRED
+            #define TELNET_LOG_DEFERRED 0 /* 1 = record log calls as binary records (format pointer, timestamp, raw arguments) instead of formatting them; decode with scripts/decode-deferred-log.py */
+        #endif
 
         class TelnetLog {
 
@@ -14,119 +30,368 @@
             static constexpr uint8_t  MAX_CLIENTS = 3;
             static constexpr size_t   BUF_SIZE    = 512;
             static constexpr size_t   RING_SIZE   = 16384;
+            static constexpr size_t   DRAIN_CHUNK = 1024;
+            static constexpr uint32_t DRAIN_TASK_STACK = 4096;
 
             WiFiServer      _server{PORT};
             WiFiClient      _clients[MAX_CLIENTS];
-            bool            _replaying[MAX_CLIENTS] = {};
+            uint32_t        _cursor[MAX_CLIENTS] = {};  /* Absolute ring position of the next byte each client will be sent */
 
             char                _ringBuf[RING_SIZE];
-            volatile uint32_t   _bytesWritten = 0;
+            volatile uint32_t   _bytesWritten = 0;      /* Absolute write position; wraps at 2^32, differences stay valid */
             portMUX_TYPE        _mux = portMUX_INITIALIZER_UNLOCKED;
 
+            TaskHandle_t        _drainTask = nullptr;
+            volatile bool       _running = false;
+            char                _drainBuf[DRAIN_CHUNK];
+
             static TelnetLog* _instance;
+            static void (*_tap)(const char* text, size_t length);  /* Optional extra consumer of formatted log lines */
 
         public:
             TelnetLog() { _instance = this; }
         private:
 
+            /**
+             * Copies a formatted message into the ring.  The copy is at most two memcpy calls
+             * (before and after the wrap point) so interrupts are only masked for the length
+             * of the copy, not for any network I/O.
+             */
             void _writeToRing(const char* buf, size_t len) {
+                if (len > RING_SIZE) {
+                    buf += len - RING_SIZE;
+                    len  = RING_SIZE;
+                }
                 portENTER_CRITICAL(&_mux);
-                for (size_t i = 0; i < len; i++) {
-                    _ringBuf[_bytesWritten % RING_SIZE] = buf[i];
-                    _bytesWritten++;
+                size_t idx   = _bytesWritten % RING_SIZE;
+                size_t first = len < RING_SIZE - idx ? len : RING_SIZE - idx;
+                memcpy(_ringBuf + idx, buf, first);
+                if (first < len) {
+                    memcpy(_ringBuf, buf + first, len - first);
+                }
+                _bytesWritten += (uint32_t)len;
+                portEXIT_CRITICAL(&_mux);
+            }
+
+            /**
+             * Copies up to DRAIN_CHUNK bytes for client i out of the ring into _drainBuf and
+             * advances its cursor.  If the writer has lapped the client, the cursor is moved to
+             * the oldest byte still in the ring and the number of skipped bytes is returned in
+             * dropped.  The copy is taken under the ring lock so the snapshot can never be torn
+             * by a concurrent log call.
+             */
+            size_t _readForClient(uint8_t i, uint32_t& dropped) {
+                dropped = 0;
+                portENTER_CRITICAL(&_mux);
+                uint32_t head = _bytesWritten;
+                if (head - _cursor[i] > (uint32_t)RING_SIZE) {
+                    dropped    = head - _cursor[i] - (uint32_t)RING_SIZE;
+                    _cursor[i] = head - (uint32_t)RING_SIZE;
+                }
+                size_t remain = (size_t)(head - _cursor[i]);
+                size_t chunk  = remain < DRAIN_CHUNK ? remain : DRAIN_CHUNK;
+                size_t idx    = _cursor[i] % RING_SIZE;
+                size_t first  = chunk < RING_SIZE - idx ? chunk : RING_SIZE - idx;
+                memcpy(_drainBuf, _ringBuf + idx, first);
+                if (first < chunk) {
+                    memcpy(_drainBuf + first, _ringBuf, chunk - first);
                 }
+                _cursor[i] += (uint32_t)chunk;
                 portEXIT_CRITICAL(&_mux);
+                return chunk;
+            }
+
+            void _acceptClients() {
+                WiFiClient newClient = _server.available();
+                if (!newClient) return;
+
+                for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+                    if (!_clients[i] || !_clients[i].connected()) {
+                        _clients[i] = newClient;
+                        _clients[i].setNoDelay(true);
+                        #if TELNET_LOG_DEFERRED
+                            _clients[i].print("\r\nFireFly Controller deferred log\r\n");
+                        #else
+                            _clients[i].print("\r\nFireFly Controller debug log\r\n");
+                        #endif
+
+                        /* Start the new client at the oldest byte still held so it receives the history */
+                        portENTER_CRITICAL(&_mux);
+                        uint32_t head = _bytesWritten;
+                        _cursor[i] = head > (uint32_t)RING_SIZE ? head - (uint32_t)RING_SIZE : 0;
+                        portEXIT_CRITICAL(&_mux);
+
+                        Serial.printf("[TelnetLog] client %u accepted bw=%u\r\n", i, (unsigned)head);
+                        return;
+                    }
+                }
+
+                newClient.stop();
+                Serial.printf("[TelnetLog] rejected (no slot)\r\n");
             }
 
-            void _replayHistory(uint8_t i) {
-                _replaying[i] = true;
-                uint32_t avail = _bytesWritten;
-                uint32_t pos   = avail > (uint32_t)RING_SIZE ? avail - (uint32_t)RING_SIZE : 0;
-                while (pos < avail) {
-                    size_t idx    = pos % RING_SIZE;
-                    size_t toEnd  = RING_SIZE - idx;
-                    size_t remain = (size_t)(avail - pos);
-                    size_t chunk  = remain < toEnd ? remain : toEnd;
-                    size_t sent   = _clients[i].write((const uint8_t*)(_ringBuf + idx), chunk);
-                    pos += (uint32_t)sent;
-                    if (sent < chunk) break;
+            /**
+             * Sends the next chunk of the ring to every connected client.
+             * @returns true if any bytes were sent, so the caller knows more may be pending
+             */
+            bool _drainClients() {
+                bool sentAny = false;
+
+                for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+                    if (!_clients[i]) continue;
+
+                    if (!_clients[i].connected()) {
+                        Serial.printf("[TelnetLog] stopping client %u\r\n", i);
+                        _clients[i].stop();
+                        continue;
+                    }
+
+                    uint32_t dropped = 0;
+                    size_t chunk = _readForClient(i, dropped);
+
+                    if (dropped > 0) {
+                        char marker[48];
+                        int n = snprintf(marker, sizeof(marker), "\r\n[TelnetLog] dropped %u bytes\r\n", (unsigned)dropped);
+                        _clients[i].write((const uint8_t*)marker, (size_t)n);
+                    }
+
+                    if (chunk == 0) continue;
+
+                    size_t sent = _clients[i].write((const uint8_t*)_drainBuf, chunk);
+                    if (sent < chunk) {
+                        /* Rewind by what the socket did not accept; if the client stays slow the
+                           writer laps it and the next pass reports the gap instead of stalling */
+                        portENTER_CRITICAL(&_mux);
+                        _cursor[i] -= (uint32_t)(chunk - sent);
+                        portEXIT_CRITICAL(&_mux);
+                    }
+                    if (sent > 0) sentAny = true;
                 }
-                _replaying[i] = false;
+
+                return sentAny;
             }
 
+            static void _drainTaskMain(void* arg) {
+                TelnetLog* self = static_cast<TelnetLog*>(arg);
+                while (self->_running) {
+                    self->_acceptClients();
+                    if (!self->_drainClients()) {
+                        vTaskDelay(pdMS_TO_TICKS(TELNET_LOG_DRAIN_INTERVAL_MILLISECONDS));
+                    }
+                }
+                for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
+                    if (self->_clients[i]) self->_clients[i].stop();
+                }
+                self->_server.end();
+                self->_drainTask = nullptr;
+                vTaskDelete(nullptr);
+            }
+
+            #if TELNET_LOG_DEFERRED
+
+                static constexpr uint8_t DEFERRED_SYNC       = 0xFE;  /* First byte of every deferred record */
+                static constexpr uint8_t DEFERRED_HEADER     = 10;    /* sync, payload length, format address, timestamp */
+                static constexpr uint8_t DEFERRED_MAX_STRING = 64;    /* Longest %s argument copied inline */
+                static constexpr uint8_t DEFERRED_STRING_REF = 0xFF;  /* %s length marker: a flash address follows instead of bytes */
+
+                static inline bool _put(uint8_t* rec, size_t& pos, const void* src, size_t len) {
+                    if (pos + len > DEFERRED_HEADER + 255) return false;
+                    memcpy(rec + pos, src, len);
+                    pos += len;
+                    return true;
+                }
+
+                /**
+                 * Encodes one log call as a binary record without formatting it.
+                 *
+                 * The record is [0xFE][payload length][format address LE32][esp_timer micros LE32]
+                 * followed by the raw arguments in format-string order: 4 bytes for integers,
+                 * pointers and * widths, 8 bytes for long long and double, and for %s a length
+                 * byte plus the bytes, or 0xFF plus a 4-byte address when the string lives in
+                 * flash.  Format strings are never copied; the host decoder looks them up in the
+                 * ELF.  Arguments that do not fit in 255 bytes are cut and decode as truncated.
+                 */
+                static size_t _encodeDeferred(uint8_t* rec, const char* fmt, va_list args) {
+                    size_t pos = DEFERRED_HEADER;
+                    const char* p = fmt;
+
+                    while (*p) {
+                        if (*p++ != '%') continue;
+                        if (*p == '%') { p++; continue; }
+
+                        while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') p++;
+
+                        if (*p == '*') {
+                            int32_t w = va_arg(args, int);
+                            if (!_put(rec, pos, &w, 4)) break;
+                            p++;
+                        } else {
+                            while (*p >= '0' && *p <= '9') p++;
+                        }
+
+                        if (*p == '.') {
+                            p++;
+                            if (*p == '*') {
+                                int32_t w = va_arg(args, int);
+                                if (!_put(rec, pos, &w, 4)) break;
+                                p++;
+                            } else {
+                                while (*p >= '0' && *p <= '9') p++;
+                            }
+                        }
+
+                        uint8_t longs = 0;
+                        while (*p == 'h' || *p == 'l' || *p == 'z' || *p == 'j' || *p == 't' || *p == 'L') {
+                            if (*p == 'l') longs++;
+                            if (*p == 'j') longs = 2;
+                            p++;
+                        }
+
+                        char conv = *p;
+                        if (conv == '\0') break;
+                        p++;
+
+                        bool fits = true;
+                        switch (conv) {
+                            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                                if (longs >= 2) {
+                                    uint64_t v = va_arg(args, unsigned long long);
+                                    fits = _put(rec, pos, &v, 8);
+                                } else {
+                                    uint32_t v = va_arg(args, unsigned int);
+                                    fits = _put(rec, pos, &v, 4);
+                                }
+                                break;
+
+                            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                                double v = va_arg(args, double);
+                                fits = _put(rec, pos, &v, 8);
+                                break;
+                            }
+
+                            case 'p': {
+                                uint32_t v = (uint32_t)(uintptr_t)va_arg(args, void*);
+                                fits = _put(rec, pos, &v, 4);
+                                break;
+                            }
+
+                            case 's': {
+                                const char* str = va_arg(args, const char*);
+                                if (str != nullptr && esp_ptr_in_drom(str)) {
+                                    uint32_t v = (uint32_t)(uintptr_t)str;
+                                    fits = _put(rec, pos, &DEFERRED_STRING_REF, 1) && _put(rec, pos, &v, 4);
+                                } else {
+                                    uint8_t len = 0;
+                                    if (str != nullptr) {
+                                        while (len < DEFERRED_MAX_STRING && str[len] != '\0') len++;
+                                    }
+                                    fits = _put(rec, pos, &len, 1) && (len == 0 || _put(rec, pos, str, len));
+                                }
+                                break;
+                            }
+
+                            default:
+                                /* Unknown conversion; the argument size cannot be known so stop here */
+                                fits = false;
+                                break;
+                        }
+                        if (!fits) break;
+                    }
+
+                    uint32_t fmtAddress = (uint32_t)(uintptr_t)fmt;
+                    uint32_t timestamp  = (uint32_t)esp_timer_get_time();
+                    rec[0] = DEFERRED_SYNC;
+                    rec[1] = (uint8_t)(pos - DEFERRED_HEADER);
+                    memcpy(rec + 2, &fmtAddress, 4);
+                    memcpy(rec + 6, &timestamp, 4);
+                    return pos;
+                }
+
+            #endif
+
         public:
 
             // Intercepts log_d/log_i/log_w/log_e/log_v via the log_printf macro below.
             // Serial here is the real HardwareSerial — this class body is compiled before
             // #define log_printf takes effect, and there is no #define Serial in this file,
             // so Serial.write() goes directly to the hardware UART.
+            // Network clients are never written from here; the drain task sends the ring to
+            // them so a slow telnet session cannot stall the task that logged.
+            // With TELNET_LOG_DEFERRED the message is not formatted at all and nothing is
+            // written to Serial; only the binary record is stored.
             static void interceptPrintf(const char* fmt, ...) {
-                char buf[BUF_SIZE];
-                va_list args;
-                va_start(args, fmt);
-                int len = vsnprintf(buf, sizeof(buf), fmt, args);
-                va_end(args);
-                if (len <= 0) return;
-                size_t n = (size_t)len < BUF_SIZE ? (size_t)len : BUF_SIZE - 1;
-                // HardwareSerial::operator bool() returns false until Serial.begin() has been
-                // called. Calling write() before begin() on ESP32 corrupts the UART driver
-                // state, so guard here — the ring buffer still captures pre-begin messages.
-                if (Serial)
-                    Serial.write((const uint8_t*)buf, n);
-                if (_instance) {
-                    _instance->_writeToRing(buf, n);
-                    for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
-                        if (_instance->_clients[i] && !_instance->_replaying[i]) {
-                            _instance->_clients[i].write((const uint8_t*)buf, n);
-                        }
+                #if TELNET_LOG_DEFERRED
+                    uint8_t rec[DEFERRED_HEADER + 255];
+                    va_list args;
+                    va_start(args, fmt);
+                    size_t n = _encodeDeferred(rec, fmt, args);
+                    va_end(args);
+                    if (_instance) {
+                        _instance->_writeToRing((const char*)rec, n);
                     }
-                }
+                #else
+                    char buf[BUF_SIZE];
+                    va_list args;
+                    va_start(args, fmt);
+                    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+                    va_end(args);
+                    if (len <= 0) return;
+                    size_t n = (size_t)len < BUF_SIZE ? (size_t)len : BUF_SIZE - 1;
+                    // HardwareSerial::operator bool() returns false until Serial.begin() has been
+                    // called. Calling write() before begin() on ESP32 corrupts the UART driver
+                    // state, so guard here — the ring buffer still captures pre-begin messages.
+                    if (Serial)
+                        Serial.write((const uint8_t*)buf, n);
+                    if (_instance) {
+                        _instance->_writeToRing(buf, n);
+                    }
+                    if (_tap) {
+                        _tap(buf, n);
+                    }
+                #endif
             }
 
-            void begin() {
-                _server.begin();
-                Serial.printf("[TelnetLog] begin\r\n");
+            /**
+             * Registers a function that receives every formatted log line, e.g. a remote log sink.
+             * It is called on the logging task and must not block or call log_* itself.  Not
+             * called in TELNET_LOG_DEFERRED mode, where lines are never formatted.
+             */
+            static void setTap(void (*tap)(const char* text, size_t length)) {
+                _tap = tap;
             }
 
-            void loop() {
-                WiFiClient newClient = _server.available();
-                if (newClient) {
-                    bool placed = false;
-                    for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
-                        if (!_clients[i] || !_clients[i].connected()) {
-                            _clients[i] = newClient;
-                            _clients[i].setNoDelay(true);
-                            _clients[i].print("\r\nFireFly Controller debug log\r\n");
-                            Serial.printf("[TelnetLog] client %u accepted bw=%u\r\n",
-                                         i, (unsigned)_bytesWritten);
-                            _replayHistory(i);
-                            placed = true;
-                            break;
-                        }
-                    }
-                    if (!placed) {
-                        newClient.stop();
-                        Serial.printf("[TelnetLog] rejected (no slot)\r\n");
-                    }
-                }
-                for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
-                    if (_clients[i] && !_clients[i].connected()) {
-                        Serial.printf("[TelnetLog] stopping client %u\r\n", i);
-                        _clients[i].stop();
-                    }
+            /**
+             * Starts the telnet server and the low-priority drain task that accepts clients and
+             * sends each of them the ring from its own cursor.
+             */
+            void begin() {
+                if (_drainTask != nullptr) return;
+                _server.begin();
+                _running = true;
+                if (xTaskCreate(_drainTaskMain, "telnetLog", DRAIN_TASK_STACK, this,
+                                TELNET_LOG_DRAIN_TASK_PRIORITY, &_drainTask) != pdPASS) {
+                    _running = false;
+                    _drainTask = nullptr;
+                    _server.end();
+                    Serial.printf("[TelnetLog] drain task create failed\r\n");
+                    return;
                 }
+                Serial.printf("[TelnetLog] begin\r\n");
             }
 
+            /**
+             * Signals the drain task to close all clients and stop the server; the task exits on its
+             * next pass.  Log lines are no longer written to the ring after this, but still go to
+             * Serial and the tap; with TELNET_LOG_DEFERRED they are dropped.
+             */
             void end() {
-                for (uint8_t i = 0; i < MAX_CLIENTS; i++) {
-                    if (_clients[i]) _clients[i].stop();
-                }
-                _server.end();
+                _running = false;
                 _instance = nullptr;
             }
         };
 
         inline TelnetLog* TelnetLog::_instance = nullptr;
+        inline void (*TelnetLog::_tap)(const char*, size_t) = nullptr;
 
         // Intercept Arduino log macros (log_d/log_i/log_w/log_e/log_v). All of them expand
         // through log_printf. Redefining it here guarantees interception in every translation
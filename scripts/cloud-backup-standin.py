@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+# Local stand-in for the cloud backup endpoint, for checking controller backup round-trips
+# without the real service.  Build the controller with
+#   -DFIREFLY_CLOUD_API_ROOT='"http://<this host>:<port>"'
+# and POST/GET/DELETE /api/cloud-backup on the device; this server keeps one blob per device
+# under --store.  Authentication headers are accepted without being checked.
+#
+# With --master-key every upload is decrypted (FFCE version 1, header tag, version 2, trailing
+# tag, or version 3, trailing tag over deflated JSON; see common/secretEncryption.h) and rejected with 400 if it does not authenticate, and GET
+# returns the SHA-256 of the plaintext as the ETag, matching what writeBackupEtag() computes on the
+# device.  Decrypting needs the 'cryptography' package.
+#
+# Usage:
+#   python3 scripts/cloud-backup-standin.py serve --port 8080 --master-key <64 hex chars>
+#   python3 scripts/cloud-backup-standin.py decrypt store/<uuid>.bin --master-key <64 hex chars>
+#   python3 scripts/cloud-backup-standin.py encrypt backup.json -o store/<uuid>.bin --master-key <64 hex chars>
+
+import argparse
+import hashlib
+import hmac
+import os
+import re
+import struct
+import sys
+import time
+import zlib
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+PATH = re.compile(r'^/devices/([0-9A-Za-z-]+)/backup$')
+
+
+def decrypt_backup(blob, master_key):
+    """Decrypts, and for version 3 inflates, a cloud backup blob with the key derived from the device master secret."""
+    try:
+        from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+    except ImportError:
+        sys.exit('decrypting needs the cryptography package: pip install cryptography')
+
+    if len(blob) < 37 or blob[:4] != b'FFCE' or blob[4] not in (1, 2, 3):
+        raise ValueError('not an FFCE version 1, 2 or 3 blob')
+    nonce, (length,) = blob[5:17], struct.unpack_from('<I', blob, 17)
+    trailer = 0 if blob[4] == 1 else 16
+    if len(blob) - 37 != length + trailer:
+        raise ValueError('FFCE length does not match the blob')
+    tag = blob[37 + length:] if trailer else blob[21:37]
+
+    # HKDF-SHA256, empty salt, info "firefly-backup-v1"; see SecretEncryption::begin()
+    prk = hmac.new(bytes(32), master_key, hashlib.sha256).digest()
+    key = hmac.new(prk, b'firefly-backup-v1\x01', hashlib.sha256).digest()
+
+    plaintext = AESGCM(key).decrypt(nonce, blob[37:37 + length] + tag, None)
+    if blob[4] != 3:
+        return plaintext
+
+    (inflated_length,) = struct.unpack_from('<I', plaintext)
+    inflated = zlib.decompress(plaintext[4:], wbits=-15)
+    if len(inflated) != inflated_length:
+        raise ValueError('inflated length does not match the payload')
+    return inflated
+
+
+def encrypt_backup(plaintext, master_key, version=3):
+    """Builds a cloud backup blob the way the controller does, for testing restores."""
+    from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+
+    prk = hmac.new(bytes(32), master_key, hashlib.sha256).digest()
+    key = hmac.new(prk, b'firefly-backup-v1\x01', hashlib.sha256).digest()
+
+    payload = plaintext
+    if version == 3:
+        deflate = zlib.compressobj(wbits=-15)
+        payload = struct.pack('<I', len(plaintext)) + deflate.compress(plaintext) + deflate.flush()
+
+    nonce = os.urandom(12)
+    sealed = AESGCM(key).encrypt(nonce, payload, None)
+    ciphertext, tag = sealed[:-16], sealed[-16:]
+    header = b'FFCE' + bytes([version]) + nonce + struct.pack('<I', len(payload))
+    if version == 1:
+        return header + tag + ciphertext
+    return header + bytes(16) + ciphertext + tag
+
+
+def make_handler(store, master_key, delay):
+
+    class Handler(BaseHTTPRequestHandler):
+
+        def _path(self):
+            match = PATH.match(self.path)
+            if not match:
+                self.send_error(404)
+                return None
+            if delay:
+                time.sleep(delay)
+            return os.path.join(store, match.group(1) + '.bin')
+
+        def do_POST(self):
+            path = self._path()
+            if path is None:
+                return
+            blob = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+            if master_key:
+                try:
+                    plaintext = decrypt_backup(blob, master_key)
+                except Exception as e:
+                    self.log_message('rejected upload of %d bytes: %s', len(blob), str(e) or 'tag mismatch')
+                    self.send_error(400)
+                    return
+                self.log_message('stored FFCE v%d, %d bytes for %d plaintext bytes', blob[4], len(blob), len(plaintext))
+            with open(path, 'wb') as f:
+                f.write(blob)
+            self.send_response(204)
+            self.end_headers()
+
+        def do_GET(self):
+            path = self._path()
+            if path is None:
+                return
+            if not os.path.exists(path):
+                self.send_error(404)
+                return
+            with open(path, 'rb') as f:
+                blob = f.read()
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/octet-stream')
+            self.send_header('Content-Length', str(len(blob)))
+            if master_key:
+                etag = hashlib.sha256(decrypt_backup(blob, master_key)).hexdigest()
+                self.send_header('ETag', f'"{etag}"')
+            self.end_headers()
+            self.wfile.write(blob)
+
+        def do_DELETE(self):
+            path = self._path()
+            if path is None:
+                return
+            if not os.path.exists(path):
+                self.send_error(404)
+                return
+            os.remove(path)
+            self.send_response(204)
+            self.end_headers()
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Local stand-in for the FireFly cloud backup endpoint')
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p = sub.add_parser('serve', help='serve /devices/<uuid>/backup')
+    p.add_argument('--port', type=int, default=8080)
+    p.add_argument('--store', default='cloud-backup-store', help='directory blobs are kept in')
+    p.add_argument('--master-key', help='device master secret, 64 hex chars, to verify uploads')
+    p.add_argument('--delay', type=float, default=0, help='seconds to stall before every response')
+
+    p = sub.add_parser('decrypt', help='decrypt a stored blob to stdout')
+    p.add_argument('blob')
+    p.add_argument('--master-key', required=True)
+
+    p = sub.add_parser('encrypt', help='encrypt a backup.json into a blob, to seed the store for restores')
+    p.add_argument('backup')
+    p.add_argument('-o', '--output', required=True)
+    p.add_argument('--master-key', required=True)
+    p.add_argument('--version', type=int, choices=(1, 2, 3), default=3)
+
+    args = parser.parse_args()
+    master_key = bytes.fromhex(args.master_key) if args.master_key else None
+
+    if args.command == 'decrypt':
+        with open(args.blob, 'rb') as f:
+            sys.stdout.buffer.write(decrypt_backup(f.read(), master_key))
+        return
+
+    if args.command == 'encrypt':
+        with open(args.backup, 'rb') as f:
+            blob = encrypt_backup(f.read(), master_key, args.version)
+        with open(args.output, 'wb') as f:
+            f.write(blob)
+        print(f'{args.output}: FFCE v{args.version}, {len(blob)} bytes')
+        return
+
+    os.makedirs(args.store, exist_ok=True)
+    server = ThreadingHTTPServer(('', args.port), make_handler(args.store, master_key, args.delay))
+    print(f'Serving cloud backup stand-in on port {args.port}, storing in {args.store}')
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
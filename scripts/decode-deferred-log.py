@@ -0,0 +1,208 @@
+#!/usr/bin/env python3
+# Decodes the binary log produced by a controller built with TELNET_LOG_DEFERRED=1.
+# Format strings are not sent by the device; they are read from the firmware ELF that
+# was flashed, so the ELF must come from exactly the same build.
+#
+# Record layout (little-endian), see _encodeDeferred() in common/telnetLog.h:
+#   0xFE, payload length (u8), format address (u32), esp_timer micros (u32), payload
+#   payload: arguments in format order; 4 bytes for int/pointer/* width, 8 bytes for
+#   long long and double, %s as length byte + bytes or 0xFF + flash address (u32).
+#
+# Usage:
+#   python3 scripts/decode-deferred-log.py build/Controller.ino.elf --host 192.168.1.50
+#   python3 scripts/decode-deferred-log.py build/Controller.ino.elf --file capture.bin
+
+import argparse
+import re
+import socket
+import struct
+import sys
+
+SYNC = 0xFE
+HEADER = 10
+STRING_REF = 0xFF
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+CONVERSION = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|z|j|t|L)?([diuxXocfFeEgGaAsp%])')
+
+
+class Elf:
+    """Minimal ELF32 reader that resolves addresses in allocated sections to C strings."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        if self.data[:4] != b'\x7fELF' or self.data[4] != 1:
+            raise ValueError(f'{path} is not a 32-bit ELF file')
+        shoff, = struct.unpack_from('<I', self.data, 0x20)
+        shentsize, shnum = struct.unpack_from('<HH', self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            _, sh_type, flags, addr, offset, size = struct.unpack_from('<IIIIII', self.data, shoff + i * shentsize)
+            if flags & SHF_ALLOC and sh_type != SHT_NOBITS and size > 0:
+                self.sections.append((addr, offset, size))
+        self.cache = {}
+
+    def string_at(self, address):
+        if address in self.cache:
+            return self.cache[address]
+        for addr, offset, size in self.sections:
+            if addr <= address < addr + size:
+                start = offset + (address - addr)
+                end = self.data.find(b'\0', start, offset + size)
+                if end < 0:
+                    end = offset + size
+                value = self.data[start:end].decode('utf-8', errors='replace')
+                self.cache[address] = value
+                return value
+        return None
+
+
+def render(elf, fmt, payload):
+    """Substitutes the raw argument bytes into the C format string."""
+    pos = 0
+    out = []
+    last = 0
+
+    def take(n):
+        nonlocal pos
+        if pos + n > len(payload):
+            raise IndexError
+        chunk = payload[pos:pos + n]
+        pos += n
+        return chunk
+
+    for m in CONVERSION.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, width, precision, length, conv = m.groups()
+        if conv == '%':
+            out.append('%')
+            continue
+        try:
+            if width == '*':
+                width = str(struct.unpack('<i', take(4))[0])
+            if precision == '*':
+                precision = str(struct.unpack('<i', take(4))[0])
+            spec = '%' + (flags or '') + (width or '') + ('.' + precision if precision is not None else '')
+
+            if conv in 'diuxXoc':
+                if length in ('ll', 'j'):
+                    value = struct.unpack('<q' if conv in 'di' else '<Q', take(8))[0]
+                else:
+                    value = struct.unpack('<i' if conv in 'di' else '<I', take(4))[0]
+                if conv == 'c':
+                    out.append((spec + 'c') % chr(value & 0xFF))
+                else:
+                    out.append((spec + ('d' if conv in 'iu' else conv)) % value)
+            elif conv in 'fFeEgGaA':
+                value = struct.unpack('<d', take(8))[0]
+                out.append((spec + ('f' if conv in 'aA' else conv)) % value)
+            elif conv == 'p':
+                out.append('0x%08x' % struct.unpack('<I', take(4))[0])
+            elif conv == 's':
+                n = take(1)[0]
+                if n == STRING_REF:
+                    value = elf.string_at(struct.unpack('<I', take(4))[0]) or '<?>'
+                else:
+                    value = take(n).decode('utf-8', errors='replace')
+                out.append((spec + 's') % value)
+        except IndexError:
+            out.append('<truncated>')
+            last = len(fmt)
+            break
+
+    out.append(fmt[last:])
+    return ''.join(out)
+
+
+def decode(elf, stream, write):
+    buf = bytearray()
+    skipped = 0
+    epoch = 0
+    previous = None
+
+    for chunk in stream:
+        buf.extend(chunk)
+        while True:
+            start = buf.find(bytes([SYNC]))
+            if start < 0:
+                skipped += len(buf)
+                buf.clear()
+                break
+            if start > 0:
+                skipped += start
+                del buf[:start]
+            if len(buf) < HEADER:
+                break
+            length = buf[1]
+            fmt_address, micros = struct.unpack_from('<II', buf, 2)
+            fmt = elf.string_at(fmt_address)
+            if fmt is None:
+                # Not a record boundary (banner text, a lapped client, or a stray 0xFE); resync
+                skipped += 1
+                del buf[:1]
+                continue
+            if len(buf) < HEADER + length:
+                break
+            payload = bytes(buf[HEADER:HEADER + length])
+            del buf[:HEADER + length]
+
+            if skipped:
+                write(f'[decoder] skipped {skipped} bytes\n')
+                skipped = 0
+
+            # esp_timer micros is truncated to 32 bits on the device; unwrap it here
+            if previous is not None and micros < previous:
+                epoch += 1 << 32
+            previous = micros
+            seconds = (epoch + micros) / 1_000_000
+
+            text = render(elf, fmt, payload).rstrip('\r\n')
+            write(f'{seconds:12.6f} {text}\n')
+
+
+def read_socket(host, port):
+    with socket.create_connection((host, port)) as s:
+        while True:
+            data = s.recv(4096)
+            if not data:
+                return
+            yield data
+
+
+def read_file(path):
+    with open(path, 'rb') as f:
+        while True:
+            data = f.read(65536)
+            if not data:
+                return
+            yield data
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode a TELNET_LOG_DEFERRED binary log')
+    parser.add_argument('elf', help='firmware ELF from the same build that is running on the device')
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument('--host', help='controller address; connects to the telnet log port')
+    source.add_argument('--file', help='previously captured raw log')
+    parser.add_argument('--port', type=int, default=23)
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+    stream = read_socket(args.host, args.port) if args.host else read_file(args.file)
+
+    def write(line):
+        sys.stdout.write(line)
+        sys.stdout.flush()
+
+    try:
+        decode(elf, stream, write)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
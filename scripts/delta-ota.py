@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+# Makes and applies the delta OTA patches that common/deltaOta.h rebuilds on the device, so a
+# controller running one release can update to the next by downloading only what changed.
+# The layout mirrors common/deltaOta.h; keep the two in step and bump VERSION in both when it changes.
+#
+# A patch is raw deflate of a header followed by bsdiff-style records:
+#   header  "FFDP", version, 3 reserved, base length (u32), base SHA-256, target length (u32), target SHA-256
+#   record  diff length (u32), extra length (u32), seek (i32), diff bytes, extra bytes
+# Diff bytes are added byte by byte to the base from the current base offset, extra bytes are copied
+# as they are, and the base offset then moves by seek.  Matches are found from an index of the base and
+# then extended while at least half the bytes still agree, so code that only moved (and so had its
+# addresses change) becomes diff bytes that are mostly zero, which deflate shrinks to almost nothing.
+#
+# 'apply' rebuilds the target exactly as the device does, for regression tests of both sides.  The
+# release manifest lists a patch under the app binary it produces:
+#   "delta": [{"base_version": "<running version>", "url": "<patch url>", "sha256": "<patch SHA-256>"}]
+#
+# Usage:
+#   python3 scripts/delta-ota.py diff Controller-2026.03.01.bin Controller-2026.04.01.bin -o 2026.03.01.ffdp
+#   python3 scripts/delta-ota.py apply Controller-2026.03.01.bin 2026.03.01.ffdp -o Controller.bin
+#   python3 scripts/delta-ota.py info 2026.03.01.ffdp
+
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+
+VERSION = 1
+MAGIC = b'FFDP'
+
+HEADER = struct.Struct('<4sB3sI32sI32s')
+RECORD = struct.Struct('<IIi')
+
+assert (HEADER.size, RECORD.size) == (80, 12)
+
+BLOCK = 16          # Bytes hashed to find a match
+STEP = 4            # Base positions indexed; any match of BLOCK + STEP bytes is found
+MIN_MATCH = 32      # Shorter matches are sent as extra bytes
+GIVE_UP = 64        # An extension stops once its score has fallen this far below the best
+
+
+def _extend_forward(base, b, target, t):
+    """Length from (b, t) that maximises matching bytes * 2 - length, as bsdiff scores it."""
+    limit = min(len(base) - b, len(target) - t)
+    score = best_score = best_length = 0
+    for k in range(limit):
+        score += 1 if base[b + k] == target[t + k] else -1
+        if score > best_score:
+            best_score, best_length = score, k + 1
+        elif score < best_score - GIVE_UP:
+            break
+    return best_length
+
+
+def _extend_backward(base, b, target, t, limit):
+    """As _extend_forward, backwards from just before (b, t), going back at most limit bytes."""
+    limit = min(limit, b, t)
+    score = best_score = best_length = 0
+    for k in range(1, limit + 1):
+        score += 1 if base[b - k] == target[t - k] else -1
+        if score > best_score:
+            best_score, best_length = score, k
+        elif score < best_score - GIVE_UP:
+            break
+    return best_length
+
+
+def find_matches(base, target):
+    """Returns (target offset, base offset, length) for the aligned regions, in target order, not overlapping."""
+    index = {}
+    for b in range(0, len(base) - BLOCK + 1, STEP):
+        index.setdefault(base[b:b + BLOCK], b)
+
+    matches = []
+    covered = 0         # Target bytes before this are in a match or already given up on
+    t = 0
+    while t <= len(target) - BLOCK:
+        b = index.get(target[t:t + BLOCK])
+        if b is None:
+            t += 1
+            continue
+
+        forward = _extend_forward(base, b, target, t)
+        backward = _extend_backward(base, b, target, t, t - covered)
+        if forward + backward < MIN_MATCH:
+            t += 1
+            continue
+
+        matches.append((t - backward, b - backward, forward + backward))
+        covered = t = t + forward
+
+    return matches
+
+
+def diff(base, target):
+    """Builds the uncompressed patch that turns base into target."""
+    out = bytearray(HEADER.pack(MAGIC, VERSION, bytes(3), len(base), hashlib.sha256(base).digest(),
+                                len(target), hashlib.sha256(target).digest()))
+
+    matches = find_matches(base, target)
+
+    # The first record only carries the bytes before the first match
+    t, b, length = 0, 0, 0
+    for next_t, next_b, next_length in matches + [(len(target), None, 0)]:
+        extra = target[t + length:next_t]
+        delta = bytes((target[t + k] - base[b + k]) & 0xFF for k in range(length))
+        out += RECORD.pack(length, len(extra), 0 if next_b is None else next_b - (b + length))
+        out += delta
+        out += extra
+        t, b, length = next_t, next_b, next_length
+
+    return bytes(out)
+
+
+def apply(base, patch):
+    """Rebuilds the target from base and the uncompressed patch, with the checks the device makes."""
+    if len(patch) < HEADER.size:
+        raise ValueError('patch is shorter than its header')
+
+    magic, version, _, base_length, base_hash, target_length, target_hash = HEADER.unpack_from(patch)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('not a version %d patch' % VERSION)
+    if base_length > len(base) or hashlib.sha256(base[:base_length]).digest() != base_hash:
+        raise ValueError('base is not the image this patch was made from')
+
+    target = bytearray()
+    offset = 0
+    position = HEADER.size
+    while len(target) < target_length:
+        if position + RECORD.size > len(patch):
+            raise ValueError('patch is incomplete')
+        diff_length, extra_length, seek = RECORD.unpack_from(patch, position)
+        position += RECORD.size
+
+        if len(target) + diff_length + extra_length > target_length:
+            raise ValueError('patch overruns the target')
+        if diff_length and (offset < 0 or offset + diff_length > base_length):
+            raise ValueError('patch reads outside the base')
+        if position + diff_length + extra_length > len(patch):
+            raise ValueError('patch is incomplete')
+
+        target += bytes((patch[position + k] + base[offset + k]) & 0xFF for k in range(diff_length))
+        position += diff_length
+        offset += diff_length
+
+        target += patch[position:position + extra_length]
+        position += extra_length
+
+        offset += seek
+
+    if position != len(patch):
+        raise ValueError('patch continues past the target')
+    if hashlib.sha256(target).digest() != target_hash:
+        raise ValueError('rebuilt image does not match')
+
+    return bytes(target)
+
+
+def compress(patch):
+    deflate = zlib.compressobj(9, zlib.DEFLATED, -15, 9)
+    return deflate.compress(patch) + deflate.flush()
+
+
+def decompress(data):
+    inflate = zlib.decompressobj(-15)
+    patch = inflate.decompress(data) + inflate.flush()
+    if not inflate.eof or inflate.unused_data:
+        raise ValueError('patch is not a single raw deflate stream')
+    return patch
+
+
+def _read(path):
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Make and apply delta OTA patches')
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p = sub.add_parser('diff', help='make a patch from base to target')
+    p.add_argument('base')
+    p.add_argument('target')
+    p.add_argument('-o', '--output', required=True)
+
+    p = sub.add_parser('apply', help='rebuild the target from base and a patch')
+    p.add_argument('base')
+    p.add_argument('patch')
+    p.add_argument('-o', '--output', required=True)
+
+    p = sub.add_parser('info', help='print a patch header')
+    p.add_argument('patch')
+
+    args = parser.parse_args()
+
+    try:
+        if args.command == 'diff':
+            base, target = _read(args.base), _read(args.target)
+            patch = compress(diff(base, target))
+            if apply(base, decompress(patch)) != target:
+                sys.exit('patch does not rebuild the target')
+            with open(args.output, 'wb') as f:
+                f.write(patch)
+            print('%s: %d bytes for a %d byte image (%.1fx smaller), sha256 %s'
+                  % (args.output, len(patch), len(target), len(target) / max(len(patch), 1),
+                     hashlib.sha256(patch).hexdigest()))
+
+        elif args.command == 'apply':
+            target = apply(_read(args.base), decompress(_read(args.patch)))
+            with open(args.output, 'wb') as f:
+                f.write(target)
+            print('%s: %d bytes, sha256 %s' % (args.output, len(target), hashlib.sha256(target).hexdigest()))
+
+        else:
+            patch = decompress(_read(args.patch))
+            magic, version, _, base_length, base_hash, target_length, target_hash = HEADER.unpack_from(patch)
+            print('version      %d' % version)
+            print('base         %d bytes, sha256 %s' % (base_length, base_hash.hex()))
+            print('target       %d bytes, sha256 %s' % (target_length, target_hash.hex()))
+
+    except (OSError, ValueError, zlib.error, struct.error) as e:
+        sys.exit(str(e))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,366 @@
+#!/usr/bin/env python3
+# Compiles, validates and dumps the controller's binary runtime config image.
+# The layout mirrors common/runtimeConfigImage.h; keep the two in step and bump VERSION in both
+# when it changes.
+#
+# On the device the image is stored FFCE-encrypted at /runtime_config.bin.  dump accepts either
+# a plaintext image (as written by compile) or the encrypted file together with the device's
+# 32-byte master secret, which needs the 'cryptography' package.
+#
+# Usage:
+#   python3 scripts/runtime-config-image.py compile controller.json -o image.bin
+#   python3 scripts/runtime-config-image.py dump image.bin
+#   python3 scripts/runtime-config-image.py dump runtime_config.bin --master-key <64 hex chars>
+
+import argparse
+import hashlib
+import hmac
+import json
+import struct
+import sys
+
+VERSION = 1
+NO_STRING = 0xFFFF
+MAX_SIZE = 0xFFFF
+
+HEADER = struct.Struct('<4sHHI12s' + 'H' * 20 + 'BBH')
+OUTPUT = struct.Struct('<hHBBBB')
+PORT = struct.Struct('<hHHHHH')
+CHANNEL = struct.Struct('<HHBBBB')
+ACTION = struct.Struct('<BBBB')
+
+assert (HEADER.size, OUTPUT.size, PORT.size, CHANNEL.size, ACTION.size) == (68, 8, 12, 8, 4)
+
+HEADER_FIELDS = (
+    'magic', 'version', 'headerSize', 'imageSize', 'sourceNonce',
+    'outputCount', 'outputsOffset', 'portCount', 'portsOffset',
+    'channelCount', 'channelsOffset', 'actionCount', 'actionsOffset',
+    'stringsOffset', 'stringsSize', 'name', 'area',
+    'mqttHost', 'mqttUsername', 'mqttPassword', 'mqttPort',
+    'otaUrl', 'syslogHost', 'syslogPort', 'syslogRateLimit',
+    'syslogFormat', 'flags', 'reserved',
+)
+
+HAS_MQTT, HAS_MQTT_PORT, HAS_OTA, HAS_SYSLOG, HAS_SYSLOG_PORT, HAS_SYSLOG_RATE_LIMIT = 0x01, 0x02, 0x04, 0x08, 0x10, 0x20
+MQTT_TLS, MQTT_PERSISTENT_SESSION = 0x40, 0x80
+OUTPUT_HAS_ENABLED, OUTPUT_ENABLED, OUTPUT_HAS_START_BRIGHTNESS = 0x01, 0x02, 0x04
+CHANNEL_NORMALLY_CLOSED, CHANNEL_ENABLE, CHANNEL_HAS_OFFSET = 0x01, 0x02, 0x04
+
+ACTIONS = ['TOGGLE', 'INCREASE', 'DECREASE', 'INCREASE_MAXIMUM', 'DECREASE_MAXIMUM']
+ACTION_INVALID = 0xFF
+
+
+# ArduinoJson conversions used by the firmware, so compile() produces byte-identical images
+
+def _as_bool(value):
+    if value is None:
+        return False
+    if isinstance(value, (bool, int, float)):
+        return value != 0
+    return True
+
+
+def _as_uint(value, bits):
+    if isinstance(value, bool):
+        return int(value)
+    if isinstance(value, float) and value.is_integer():
+        value = int(value)
+    if isinstance(value, int) and 0 <= value < (1 << bits):
+        return value
+    return 0
+
+
+def _atoi(text):
+    digits = ''
+    for i, c in enumerate(text.lstrip()):
+        if c.isdigit() or (i == 0 and c in '+-'):
+            digits += c
+        else:
+            break
+    try:
+        return int(digits)
+    except ValueError:
+        return 0
+
+
+def _key(text):
+    return max(-32768, min(32767, _atoi(text)))
+
+
+def _str(value):
+    return value if isinstance(value, str) else None
+
+
+def _obj(value):
+    return value if isinstance(value, dict) else {}
+
+
+def compile_image(doc, nonce=bytes(12)):
+    strings = bytearray()
+    outputs, ports, channels, actions = [], [], [], []
+
+    def string(text):
+        if text is None:
+            return NO_STRING
+        offset = len(strings)
+        strings.extend(text.encode('utf-8') + b'\0')
+        return offset if offset < NO_STRING else NO_STRING
+
+    h = dict.fromkeys(HEADER_FIELDS, 0)
+    h['name'] = string(_str(doc.get('name')))
+    h['area'] = string(_str(doc.get('area')))
+    for field in ('mqttHost', 'mqttUsername', 'mqttPassword', 'otaUrl', 'syslogHost'):
+        h[field] = NO_STRING
+
+    mqtt = doc.get('mqtt')
+    if isinstance(mqtt, dict):
+        h['flags'] |= HAS_MQTT
+        h['mqttHost'] = string(_str(mqtt.get('host')))
+        h['mqttUsername'] = string(_str(mqtt.get('username')))
+        h['mqttPassword'] = string(_str(mqtt.get('password')))
+        if mqtt.get('port') is not None:
+            h['flags'] |= HAS_MQTT_PORT
+            h['mqttPort'] = _as_uint(mqtt['port'], 16)
+        if _as_bool(mqtt.get('tls')):
+            h['flags'] |= MQTT_TLS
+        if _as_bool(mqtt.get('persistent_session')):
+            h['flags'] |= MQTT_PERSISTENT_SESSION
+
+    ota = doc.get('ota')
+    if isinstance(ota, dict):
+        h['flags'] |= HAS_OTA
+        h['otaUrl'] = string(_str(ota.get('url')))
+
+    syslog = doc.get('syslog')
+    if isinstance(syslog, dict):
+        h['flags'] |= HAS_SYSLOG
+        h['syslogHost'] = string(_str(syslog.get('host')))
+        if syslog.get('port') is not None:
+            h['flags'] |= HAS_SYSLOG_PORT
+            h['syslogPort'] = _as_uint(syslog['port'], 16)
+        if syslog.get('rate_limit') is not None:
+            h['flags'] |= HAS_SYSLOG_RATE_LIMIT
+            h['syslogRateLimit'] = _as_uint(syslog['rate_limit'], 16)
+        if syslog.get('format', 'rfc5424') == 'ndjson':
+            h['syslogFormat'] = 1
+
+    for key, output in _obj(doc.get('outputs')).items():
+        output = _obj(output)
+        flags = 0
+        if output.get('enabled') is not None:
+            flags |= OUTPUT_HAS_ENABLED | (OUTPUT_ENABLED if _as_bool(output['enabled']) else 0)
+        brightness = 0
+        if output.get('start_brightness') is not None:
+            flags |= OUTPUT_HAS_START_BRIGHTNESS
+            brightness = _as_uint(output['start_brightness'], 8)
+        outputs.append(OUTPUT.pack(_key(key), string(_str(output.get('id'))),
+                                   1 if output.get('type') == 'VARIABLE' else 0, flags, brightness, 0))
+
+    for key, port in _obj(doc.get('ports')).items():
+        port = _obj(port)
+        port_id = string(_str(port.get('id')) or '')
+        client_uuid = string(_str(port.get('clientUUID')) or '')
+        first_channel = len(channels)
+        for channel_key, channel in _obj(port.get('channels')).items():
+            channel = _obj(channel)
+            flags = 0
+            if isinstance(channel.get('type'), str) and channel['type'] != 'NORMALLY_OPEN':
+                flags |= CHANNEL_NORMALLY_CLOSED
+            if _as_bool(channel.get('enabled')):
+                flags |= CHANNEL_ENABLE
+            offset = 0
+            if _as_bool(channel.get('offset')):
+                flags |= CHANNEL_HAS_OFFSET
+                offset = _as_uint(channel['offset'], 8)
+            first_action = len(actions)
+            for action in channel.get('actions') or []:
+                action = _obj(action)
+                name = action.get('action')
+                code = ACTIONS.index(name) if name in ACTIONS else ACTION_INVALID
+                change_state = 1 if action.get('change_state') == 'LONG' else 0
+                actions.append(ACTION.pack(code, change_state, _as_uint(action.get('output'), 8), 0))
+            channels.append(CHANNEL.pack(first_action, len(actions) - first_action,
+                                         _atoi(channel_key) & 0xFF, flags, offset, 0))
+        ports.append(PORT.pack(_key(key), port_id, client_uuid, first_channel, len(channels) - first_channel, 0))
+
+    h['magic'] = b'FFRC'
+    h['version'] = VERSION
+    h['headerSize'] = HEADER.size
+    h['sourceNonce'] = nonce
+    h['outputCount'], h['portCount'], h['channelCount'], h['actionCount'] = len(outputs), len(ports), len(channels), len(actions)
+    h['outputsOffset'] = HEADER.size
+    h['portsOffset'] = h['outputsOffset'] + len(outputs) * OUTPUT.size
+    h['channelsOffset'] = h['portsOffset'] + len(ports) * PORT.size
+    h['actionsOffset'] = h['channelsOffset'] + len(channels) * CHANNEL.size
+    h['stringsOffset'] = h['actionsOffset'] + len(actions) * ACTION.size
+    h['stringsSize'] = len(strings)
+    h['imageSize'] = h['stringsOffset'] + len(strings)
+
+    if h['imageSize'] > MAX_SIZE:
+        raise ValueError(f'image would be {h["imageSize"]} bytes; the limit is {MAX_SIZE}')
+
+    return (HEADER.pack(*(h[f] for f in HEADER_FIELDS))
+            + b''.join(outputs) + b''.join(ports) + b''.join(channels) + b''.join(actions) + bytes(strings))
+
+
+def parse_image(image):
+    """Validates the image the way RuntimeConfigImage::validate() does; returns the decoded tables."""
+    if len(image) < HEADER.size:
+        raise ValueError('shorter than the header')
+    h = dict(zip(HEADER_FIELDS, HEADER.unpack_from(image)))
+
+    if h['magic'] != b'FFRC':
+        raise ValueError(f'bad magic {h["magic"]!r}')
+    if h['version'] != VERSION:
+        raise ValueError(f'version {h["version"]}; this tool reads version {VERSION}')
+    if h['headerSize'] != HEADER.size:
+        raise ValueError(f'header size {h["headerSize"]}, expected {HEADER.size}')
+    if h['imageSize'] != len(image):
+        raise ValueError(f'header says {h["imageSize"]} bytes, file has {len(image)}')
+
+    expected = HEADER.size
+    for count, offset, record in (('outputCount', 'outputsOffset', OUTPUT), ('portCount', 'portsOffset', PORT),
+                                  ('channelCount', 'channelsOffset', CHANNEL), ('actionCount', 'actionsOffset', ACTION)):
+        if h[offset] != expected:
+            raise ValueError(f'{offset} is {h[offset]}, expected {expected}')
+        expected += h[count] * record.size
+    if h['stringsOffset'] != expected or h['stringsOffset'] + h['stringsSize'] != len(image):
+        raise ValueError('string table does not end the image')
+    if h['stringsSize'] and image[-1] != 0:
+        raise ValueError('string table is not NUL-terminated')
+
+    strings = image[h['stringsOffset']:]
+
+    def string(offset):
+        if offset == NO_STRING:
+            return None
+        if offset >= len(strings):
+            raise ValueError(f'string offset {offset} outside the table')
+        return strings[offset:strings.index(b'\0', offset)].decode('utf-8', errors='replace')
+
+    def table(record, offset, count):
+        return [record.unpack_from(image, h[offset] + i * record.size) for i in range(h[count])]
+
+    tables = {
+        'header': h,
+        'outputs': table(OUTPUT, 'outputsOffset', 'outputCount'),
+        'ports': table(PORT, 'portsOffset', 'portCount'),
+        'channels': table(CHANNEL, 'channelsOffset', 'channelCount'),
+        'actions': table(ACTION, 'actionsOffset', 'actionCount'),
+        'string': string,
+    }
+
+    for field in ('name', 'area', 'mqttHost', 'mqttUsername', 'mqttPassword', 'otaUrl', 'syslogHost'):
+        string(h[field])
+    for output in tables['outputs']:
+        string(output[1])
+    for port in tables['ports']:
+        string(port[1])
+        string(port[2])
+        if port[3] + port[4] > h['channelCount']:
+            raise ValueError(f'port {port[0]} channel range outside the channel table')
+    for channel in tables['channels']:
+        if channel[0] + channel[1] > h['actionCount']:
+            raise ValueError(f'channel {channel[2]} action range outside the action table')
+
+    return tables
+
+
+def decrypt_ffce(blob, master_key):
+    """Decrypts a config-fs FFCE file with the key derived from the device master secret."""
+    try:
+        from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+    except ImportError:
+        sys.exit('decrypting needs the cryptography package: pip install cryptography')
+
+    if len(blob) < 37 or blob[:4] != b'FFCE' or blob[4] != 1:
+        raise ValueError('not an FFCE version 1 file')
+    nonce, (length,), tag = blob[5:17], struct.unpack_from('<I', blob, 17), blob[21:37]
+    if len(blob) - 37 != length:
+        raise ValueError('FFCE length does not match the file')
+
+    # HKDF-SHA256, empty salt, info "firefly-configfs-v1"; see SecretEncryption::begin()
+    prk = hmac.new(bytes(32), master_key, hashlib.sha256).digest()
+    key = hmac.new(prk, b'firefly-configfs-v1\x01', hashlib.sha256).digest()
+
+    return AESGCM(key).decrypt(nonce, blob[37:] + tag, None)
+
+
+def dump(tables, write):
+    h, string = tables['header'], tables['string']
+    write(f'FFRC version {h["version"]}, {h["imageSize"]} bytes, source nonce {h["sourceNonce"].hex()}\n')
+    write(f'name={string(h["name"])!r} area={string(h["area"])!r}\n')
+    if h['flags'] & HAS_MQTT:
+        port = h['mqttPort'] if h['flags'] & HAS_MQTT_PORT else 'default'
+        write(f'mqtt host={string(h["mqttHost"])!r} port={port} username={string(h["mqttUsername"])!r} '
+              f'password={"<set>" if h["mqttPassword"] != NO_STRING else None} '
+              f'tls={bool(h["flags"] & MQTT_TLS)} persistent_session={bool(h["flags"] & MQTT_PERSISTENT_SESSION)}\n')
+    if h['flags'] & HAS_OTA:
+        write(f'ota url={string(h["otaUrl"])!r}\n')
+    if h['flags'] & HAS_SYSLOG:
+        port = h['syslogPort'] if h['flags'] & HAS_SYSLOG_PORT else 'default'
+        rate = h['syslogRateLimit'] if h['flags'] & HAS_SYSLOG_RATE_LIMIT else 'default'
+        write(f'syslog host={string(h["syslogHost"])!r} port={port} rate_limit={rate} '
+              f'format={"ndjson" if h["syslogFormat"] else "rfc5424"}\n')
+
+    write(f'outputs ({h["outputCount"]}):\n')
+    for port, id_, type_, flags, brightness, _ in tables['outputs']:
+        enabled = bool(flags & OUTPUT_ENABLED) if flags & OUTPUT_HAS_ENABLED else '-'
+        brightness = brightness if flags & OUTPUT_HAS_START_BRIGHTNESS else '-'
+        write(f'  {port:3d} id={string(id_)!r} type={"VARIABLE" if type_ else "default"} '
+              f'enabled={enabled} start_brightness={brightness}\n')
+
+    write(f'ports ({h["portCount"]}):\n')
+    for port, id_, client, first_channel, channel_count, _ in tables['ports']:
+        write(f'  {port:3d} id={string(id_)!r} client={string(client)!r}\n')
+        for first_action, action_count, channel, flags, offset, _ in tables['channels'][first_channel:first_channel + channel_count]:
+            write(f'      ch {channel} {"NC" if flags & CHANNEL_NORMALLY_CLOSED else "NO"}'
+                  f'{" enabled" if flags & CHANNEL_ENABLE else ""}'
+                  f'{f" offset={offset}" if flags & CHANNEL_HAS_OFFSET else ""}\n')
+            for code, change_state, output, _ in tables['actions'][first_action:first_action + action_count]:
+                name = ACTIONS[code] if code < len(ACTIONS) else 'INVALID'
+                write(f'          {name} output={output} {"LONG" if change_state else "SHORT"}\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compile, validate and dump FireFly runtime config images')
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p = sub.add_parser('compile', help='compile a controller config JSON file to a plaintext image')
+    p.add_argument('config')
+    p.add_argument('-o', '--output', required=True)
+    p.add_argument('--nonce', default='00' * 12, help='source nonce to record, 24 hex chars')
+
+    p = sub.add_parser('dump', help='validate and print an image')
+    p.add_argument('image')
+    p.add_argument('--master-key', help='device master secret, 64 hex chars, to decrypt an FFCE file')
+
+    args = parser.parse_args()
+
+    if args.command == 'compile':
+        with open(args.config) as f:
+            doc = json.load(f)
+        image = compile_image(doc, bytes.fromhex(args.nonce))
+        parse_image(image)
+        with open(args.output, 'wb') as f:
+            f.write(image)
+        print(f'{args.output}: {len(image)} bytes')
+        return
+
+    with open(args.image, 'rb') as f:
+        blob = f.read()
+    if blob[:4] == b'FFCE':
+        if not args.master_key:
+            sys.exit(f'{args.image} is encrypted; pass --master-key')
+        blob = decrypt_ffce(blob, bytes.fromhex(args.master_key))
+
+    try:
+        tables = parse_image(blob)
+    except ValueError as e:
+        sys.exit(f'{args.image}: invalid image: {e}')
+
+    dump(tables, sys.stdout.write)
+
+
+if __name__ == '__main__':
+    main()
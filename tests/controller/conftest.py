@@ -19,3 +19,9 @@ def auth_headers(base_url):
     # POST /auth promotes the visual token to a long-term token (60-minute TTL).
     # The same token value is now valid for the entire test session.
     return {"visual-token": token}
+
+
+@pytest.fixture(scope="session")
+def device_provisioned():
+    """True when the device under test has a cloud identity (DEVICE_PROVISIONED=true)."""
+    return os.environ.get("DEVICE_PROVISIONED", "false").lower() == "true"
@@ -54,6 +54,24 @@ class TestBackup:
         r = requests.get(f"{base_url}/backup", headers=auth_headers)
         assert "application/json" in r.headers.get("Content-Type", "")
 
+    def test_get_backup_has_etag(self, base_url, auth_headers):
+        r = requests.get(f"{base_url}/backup", headers=auth_headers)
+        etag = r.headers.get("ETag", "")
+        assert etag.startswith('"') and etag.endswith('"')
+        assert len(etag) == 66
+
+    def test_get_backup_matching_if_none_match_returns_304(self, base_url, auth_headers):
+        etag = requests.head(f"{base_url}/backup", headers=auth_headers).headers["ETag"]
+        r = requests.get(f"{base_url}/backup", headers={**auth_headers, "If-None-Match": etag})
+        assert r.status_code == 304
+        assert r.content == b""
+        assert r.headers.get("ETag") == etag
+
+    def test_get_backup_stale_if_none_match_returns_200(self, base_url, auth_headers):
+        r = requests.get(f"{base_url}/backup", headers={**auth_headers, "If-None-Match": '"' + "0" * 64 + '"'})
+        assert r.status_code == 200
+        assert r.json() == SAMPLE_BACKUP
+
     def test_delete_backup_returns_204(self, base_url, auth_headers):
         r = requests.delete(f"{base_url}/backup", headers=auth_headers)
         assert r.status_code == 204
@@ -7,12 +7,42 @@ TEST_CERT_FILENAME = "test-cert.pem"
 # Minimal self-signed cert PEM content for testing upload/download.
 TEST_CERT_CONTENT = b"-----BEGIN CERTIFICATE-----\nMIIBIjANBgkqhkiG9w0BAQEFAAOCAQ8AMIIBCgKCAQEA0Z3VS5JJcds3xHn/ygWep4\n-----END CERTIFICATE-----\n"
 
+KNOWN_CERT_FILENAME = "known-cert.pem"
+# USERTrust ECC Certification Authority, cross-signed by AAA Certificate Services (the certificateContent example)
+KNOWN_CERT_CONTENT = b"""-----BEGIN CERTIFICATE-----
+MIID0zCCArugAwIBAgIQVmcdBOpPmUxvEIFHWdJ1lDANBgkqhkiG9w0BAQwFADB7
+MQswCQYDVQQGEwJHQjEbMBkGA1UECAwSR3JlYXRlciBNYW5jaGVzdGVyMRAwDgYD
+VQQHDAdTYWxmb3JkMRowGAYDVQQKDBFDb21vZG8gQ0EgTGltaXRlZDEhMB8GA1UE
+AwwYQUFBIENlcnRpZmljYXRlIFNlcnZpY2VzMB4XDTE5MDMxMjAwMDAwMFoXDTI4
+MTIzMTIzNTk1OVowgYgxCzAJBgNVBAYTAlVTMRMwEQYDVQQIEwpOZXcgSmVyc2V5
+MRQwEgYDVQQHEwtKZXJzZXkgQ2l0eTEeMBwGA1UEChMVVGhlIFVTRVJUUlVTVCBO
+ZXR3b3JrMS4wLAYDVQQDEyVVU0VSVHJ1c3QgRUNDIENlcnRpZmljYXRpb24gQXV0
+aG9yaXR5MHYwEAYHKoZIzj0CAQYFK4EEACIDYgAEGqxUWqn5aCPnetUkb1PGWthL
+q8bVttHmc3Gu3ZzWDGH926CJA7gFFOxXzu5dP+Ihs8731Ip54KODfi2X0GHE8Znc
+JZFjq38wo7Rw4sehM5zzvy5cU7Ffs30yf4o043l5o4HyMIHvMB8GA1UdIwQYMBaA
+FKARCiM+lvEH7OKvKe+CpX/QMKS0MB0GA1UdDgQWBBQ64QmG1M8ZwpZ2dEl23OA1
+xmNjmjAOBgNVHQ8BAf8EBAMCAYYwDwYDVR0TAQH/BAUwAwEB/zARBgNVHSAECjAI
+MAYGBFUdIAAwQwYDVR0fBDwwOjA4oDagNIYyaHR0cDovL2NybC5jb21vZG9jYS5j
+b20vQUFBQ2VydGlmaWNhdGVTZXJ2aWNlcy5jcmwwNAYIKwYBBQUHAQEEKDAmMCQG
+CCsGAQUFBzABhhhodHRwOi8vb2NzcC5jb21vZG9jYS5jb20wDQYJKoZIhvcNAQEM
+BQADggEBABns652JLCALBIAdGN5CmXKZFjK9Dpx1WywV4ilAbe7/ctvbq5AfjJXy
+ij0IckKJUAfiORVsAYfZFhr1wHUrxeZWEQff2Ji8fJ8ZOd+LygBkc7xGEJuTI42+
+FsMuCIKchjN0djsoTI0DQoWz4rIjQtUfenVqGtF8qmchxDM6OW1TyaLtYiKou+JV
+bJlsQ2uRl9EMC5MCHdK8aXdJ5htN978UeAOwproLtOGFfy/cQjutdAFI3tZs4RmY
+CV4Ks2dH/hzg1cEo70qLRDEmBDeNiXQ2Lu+lIg+DdEmSx/cQwgwp+7e9un/jX9Wf
+8qn0dNW44bOwgeThpWOjzOoEeJBuv/c=
+-----END CERTIFICATE-----
+"""
+KNOWN_CERT_FINGERPRINT = "A6:CF:64:DB:B4:C8:D5:FD:19:CE:48:89:60:68:DB:03:B5:33:A8:D1:33:6C:62:56:A8:7D:00:CB:B3:DE:F3:EA"
+KNOWN_CERT_EXPIRES = "2028-12-31T23:59:59Z"
+
 
 @pytest.fixture(scope="module", autouse=True)
 def cleanup(base_url, auth_headers):
-    """Delete the test certificate after all tests in this module complete."""
+    """Delete the test certificates after all tests in this module complete."""
     yield
     requests.delete(f"{base_url}/certs/{TEST_CERT_FILENAME}", headers=auth_headers)
+    requests.delete(f"{base_url}/certs/{KNOWN_CERT_FILENAME}", headers=auth_headers)
 
 
 class TestCerts:
@@ -75,3 +105,23 @@ class TestCerts:
             files={"file": (TEST_CERT_FILENAME, io.BytesIO(TEST_CERT_CONTENT), "application/x-pem-file")},
         )
         assert r.status_code == 401
+
+
+class TestCertMetadata:
+    def test_list_reports_fingerprint_subject_and_expiry(self, base_url, auth_headers):
+        r = requests.post(
+            f"{base_url}/certs",
+            files={"file": (KNOWN_CERT_FILENAME, io.BytesIO(KNOWN_CERT_CONTENT), "application/x-pem-file")},
+            headers=auth_headers,
+        )
+        assert r.status_code == 201
+
+        r = requests.get(f"{base_url}/certs", headers=auth_headers)
+        assert r.status_code == 200
+        item = next(c for c in r.json() if c["file"] == KNOWN_CERT_FILENAME)
+        assert item["size"] == len(KNOWN_CERT_CONTENT)
+        assert item["fingerprint"] == KNOWN_CERT_FINGERPRINT
+        assert item["expires"] == KNOWN_CERT_EXPIRES
+        assert "CN=USERTrust ECC Certification Authority" in item["subject"]
+        assert item["controller"] is False
+        assert item["client"] is False
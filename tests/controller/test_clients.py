@@ -4,6 +4,7 @@ import pytest
 
 
 TEST_UUID = str(uuid.uuid4())
+INDEX_UUID = str(uuid.uuid4())
 CLIENT_PAYLOAD = {"name": "Test Client"}
 CLIENT_PAYLOAD_UPDATED = {"name": "Updated Client", "area": "Test Area"}
 
@@ -13,6 +14,15 @@ def cleanup(base_url, auth_headers):
     """Delete the test client after all tests in this module complete."""
     yield
     requests.delete(f"{base_url}/api/clients/{TEST_UUID}", headers=auth_headers)
+    requests.delete(f"{base_url}/api/clients/{INDEX_UUID}", headers=auth_headers)
+
+
+def _config_file_size(base_url, auth_headers, path):
+    r = requests.get(f"{base_url}/files", headers=auth_headers)
+    for f in r.json()["config"]["files"]:
+        if f["path"] == path:
+            return f["size"]
+    return None
 
 
 class TestClients:
@@ -36,6 +46,10 @@ class TestClients:
         )
         assert r.status_code == 204
 
+    def test_list_clients_includes_created_client(self, base_url, auth_headers):
+        r = requests.get(f"{base_url}/api/clients", headers=auth_headers)
+        assert TEST_UUID in r.json()
+
     def test_get_client_returns_200(self, base_url, auth_headers):
         r = requests.get(f"{base_url}/api/clients/{TEST_UUID}", headers=auth_headers)
         assert r.status_code == 200
@@ -69,6 +83,10 @@ class TestClients:
         r = requests.get(f"{base_url}/api/clients/{TEST_UUID}", headers=auth_headers)
         assert r.status_code == 404
 
+    def test_list_clients_excludes_deleted_client(self, base_url, auth_headers):
+        r = requests.get(f"{base_url}/api/clients", headers=auth_headers)
+        assert TEST_UUID not in r.json()
+
     def test_get_nonexistent_client_returns_404(self, base_url, auth_headers):
         r = requests.get(
             f"{base_url}/api/clients/{uuid.uuid4()}", headers=auth_headers
@@ -94,3 +112,28 @@ class TestClients:
             headers=auth_headers,
         )
         assert r.status_code == 400
+
+
+class TestClientMacIndex:
+    """/clients.index holds one 60-byte entry per client; it is only kept on provisioned devices."""
+
+    def test_index_grows_and_shrinks_with_clients(self, base_url, auth_headers, device_provisioned):
+        if not device_provisioned:
+            pytest.skip("DEVICE_PROVISIONED is not true")
+
+        before = _config_file_size(base_url, auth_headers, "/clients.index")
+
+        r = requests.put(
+            f"{base_url}/api/clients/{INDEX_UUID}",
+            json={"name": "Index Client", "mac_address": "02:00:00:00:00:01"},
+            headers=auth_headers,
+        )
+        assert r.status_code == 204
+        added = _config_file_size(base_url, auth_headers, "/clients.index")
+        assert added is not None
+        if before is not None:
+            assert added == before + 60
+
+        r = requests.delete(f"{base_url}/api/clients/{INDEX_UUID}", headers=auth_headers)
+        assert r.status_code == 204
+        assert _config_file_size(base_url, auth_headers, "/clients.index") == added - 60
@@ -1,3 +1,4 @@
+import json
 import uuid
 import requests
 import pytest
@@ -9,6 +10,8 @@ CONTROLLER_PAYLOAD_UPDATED = {"name": "Updated Controller", "area": "Test Area"}
 
 OUTPUT_UUID = str(uuid.uuid4())
 INPUT_UUID = str(uuid.uuid4())
+SYSLOG_UUID = str(uuid.uuid4())
+LARGE_UUID = str(uuid.uuid4())
 
 
 @pytest.fixture(scope="module", autouse=True)
@@ -18,6 +21,8 @@ def cleanup(base_url, auth_headers):
     requests.delete(f"{base_url}/api/controllers/{TEST_UUID}", headers=auth_headers)
     requests.delete(f"{base_url}/api/controllers/{OUTPUT_UUID}", headers=auth_headers)
     requests.delete(f"{base_url}/api/controllers/{INPUT_UUID}", headers=auth_headers)
+    requests.delete(f"{base_url}/api/controllers/{SYSLOG_UUID}", headers=auth_headers)
+    requests.delete(f"{base_url}/api/controllers/{LARGE_UUID}", headers=auth_headers)
 
 
 class TestControllers:
@@ -231,3 +236,48 @@ class TestControllerInputPorts:
     def test_removed_input_ports_not_present(self, base_url, auth_headers):
         r = requests.get(f"{base_url}/api/controllers/{INPUT_UUID}", headers=auth_headers)
         assert "ports" not in r.json() or r.json().get("ports") in (None, {})
+
+
+class TestControllerSyslog:
+    """Verify the remote log sink configuration round-trips; it is applied on the next restart."""
+
+    def test_create_controller_with_syslog_returns_204(self, base_url, auth_headers):
+        r = requests.put(
+            f"{base_url}/api/controllers/{SYSLOG_UUID}",
+            json={
+                "name": "Syslog Test",
+                "syslog": {"host": "192.0.2.10", "port": 5514, "format": "ndjson", "rate_limit": 50},
+            },
+            headers=auth_headers,
+        )
+        assert r.status_code == 204
+
+    def test_get_controller_reflects_syslog(self, base_url, auth_headers):
+        r = requests.get(f"{base_url}/api/controllers/{SYSLOG_UUID}", headers=auth_headers)
+        syslog = r.json()["syslog"]
+        assert syslog["host"] == "192.0.2.10"
+        assert syslog["port"] == 5514
+        assert syslog["format"] == "ndjson"
+        assert syslog["rate_limit"] == 50
+
+
+class TestControllerLargeConfig:
+    """A config spanning several 512-byte decryption chunks reads back byte for byte."""
+
+    LARGE_PAYLOAD = {
+        "name": "Large Test",
+        "ports": {
+            str(port): {"id": f"SW{port:02d}", "channels": {str(channel): {} for channel in range(1, 9)}}
+            for port in range(1, 17)
+        },
+    }
+
+    def test_create_large_controller_returns_204(self, base_url, auth_headers):
+        assert len(json.dumps(self.LARGE_PAYLOAD, separators=(",", ":"))) > 2 * 512
+        r = requests.put(f"{base_url}/api/controllers/{LARGE_UUID}", json=self.LARGE_PAYLOAD, headers=auth_headers)
+        assert r.status_code == 204
+
+    def test_get_large_controller_matches(self, base_url, auth_headers):
+        r = requests.get(f"{base_url}/api/controllers/{LARGE_UUID}", headers=auth_headers)
+        assert r.status_code == 200
+        assert r.json() == self.LARGE_PAYLOAD
@@ -0,0 +1,63 @@
+import importlib.util
+import os
+import socket
+import time
+
+import requests
+import pytest
+
+
+# Runs against a controller built with TELNET_LOG_DEFERRED=1 and CORE_DEBUG_LEVEL of 3 or more;
+# FIRMWARE_ELF is the ELF from that same build, which the decoder reads the format strings from.
+FIRMWARE_ELF = os.environ.get("FIRMWARE_ELF", "")
+
+pytestmark = pytest.mark.skipif(not FIRMWARE_ELF, reason="FIRMWARE_ELF is not set")
+
+
+def _load_decoder():
+    path = os.path.join(os.path.dirname(__file__), "..", "..", "scripts", "decode-deferred-log.py")
+    spec = importlib.util.spec_from_file_location("decode_deferred_log", path)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module
+
+
+@pytest.fixture(scope="module", autouse=True)
+def restore_provisioning_state(base_url, auth_headers):
+    """Restore provisioning mode to its original state after tests complete."""
+    r = requests.get(f"{base_url}/api/provisioning", headers=auth_headers)
+    original_enabled = r.json().get("enabled", False) if r.status_code == 200 else False
+    yield
+    if original_enabled:
+        requests.put(f"{base_url}/api/provisioning", headers=auth_headers)
+    else:
+        requests.delete(f"{base_url}/api/provisioning", headers=auth_headers)
+
+
+class TestDeferredLog:
+    def test_event_log_line_decodes_from_elf(self, base_url, auth_headers):
+        decoder = _load_decoder()
+        elf = decoder.Elf(FIRMWARE_ELF)
+        host = base_url.split("://", 1)[1]
+
+        captured = bytearray()
+        with socket.create_connection((host, 23), timeout=5) as s:
+            s.settimeout(0.5)
+            time.sleep(0.5)  # The drain task picks up new clients on its next pass
+            requests.put(f"{base_url}/api/provisioning", headers=auth_headers)
+            deadline = time.time() + 3
+            while time.time() < deadline:
+                try:
+                    data = s.recv(4096)
+                except socket.timeout:
+                    continue
+                if not data:
+                    break
+                captured.extend(data)
+
+        lines = []
+        decoder.decode(elf, [bytes(captured)], lines.append)
+
+        # log_i("New event log entry: [%s]") exercises the format pointer and an inline RAM string
+        assert any("New event log entry: [Provisioning active]" in line for line in lines)
+        assert not any("<truncated>" in line for line in lines)
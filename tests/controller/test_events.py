@@ -1,3 +1,5 @@
+import time
+
 import requests
 
 
@@ -13,3 +15,10 @@ class TestEvents:
     def test_get_events_missing_auth_returns_401(self, base_url):
         r = requests.get(f"{base_url}/api/events")
         assert r.status_code == 401
+
+    def test_get_events_have_sntp_time(self, base_url, auth_headers):
+        # Events logged after the SNTP service sets the clock carry epoch time; earlier ones carry uptime
+        r = requests.get(f"{base_url}/api/events", headers=auth_headers)
+        epoch_times = [event["time"] for event in r.json() if event["time"] > 1_600_000_000]
+        assert epoch_times, "No event has an epoch timestamp; the clock was never set"
+        assert max(epoch_times) <= time.time() + 300
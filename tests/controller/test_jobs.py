@@ -0,0 +1,122 @@
+import time
+import requests
+import pytest
+
+
+@pytest.fixture(scope="module", autouse=True)
+def restore_backup(base_url, auth_headers):
+    """Restore the local backup and drop any staged cloud backup after tests complete."""
+    r = requests.get(f"{base_url}/backup", headers=auth_headers)
+    existing_backup = r.json() if r.status_code == 200 else None
+    yield
+    requests.delete(f"{base_url}/api/cloud-backup/staged", headers=auth_headers)
+    if existing_backup is not None:
+        requests.put(f"{base_url}/backup", json=existing_backup, headers=auth_headers)
+    else:
+        requests.delete(f"{base_url}/backup", headers=auth_headers)
+
+
+SAMPLE_BACKUP = {
+    "formatName": "dexie",
+    "formatVersion": 1,
+    "data": {
+        "databaseName": "firefly-test",
+        "databaseVersion": 1,
+        "tables": [],
+        "data": [],
+    },
+}
+
+
+def _wait_for_job(base_url, auth_headers, job_id, timeout=60):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        r = requests.get(f"{base_url}/api/jobs/{job_id}", headers=auth_headers)
+        assert r.status_code == 200
+        if r.json()["state"] in ("succeeded", "failed"):
+            return r.json()["state"]
+        time.sleep(1)
+    return "timeout"
+
+
+class TestJobs:
+    def test_get_unknown_job_returns_404(self, base_url, auth_headers):
+        r = requests.get(f"{base_url}/api/jobs/1", headers=auth_headers)
+        assert r.status_code == 404
+
+    def test_get_job_non_numeric_id_returns_404(self, base_url, auth_headers):
+        r = requests.get(f"{base_url}/api/jobs/abc", headers=auth_headers)
+        assert r.status_code == 404
+
+    def test_get_job_missing_auth_returns_401(self, base_url):
+        r = requests.get(f"{base_url}/api/jobs/1")
+        assert r.status_code == 401
+
+    def test_post_job_returns_405(self, base_url, auth_headers):
+        r = requests.post(f"{base_url}/api/jobs/1", headers=auth_headers)
+        assert r.status_code == 405
+
+
+class TestCloudBackupJobs:
+    def test_cloud_backup_missing_auth_returns_401(self, base_url):
+        r = requests.get(f"{base_url}/api/cloud-backup")
+        assert r.status_code == 401
+
+    def test_cloud_backup_restore_returns_job_or_precondition(self, base_url, auth_headers, device_provisioned):
+        r = requests.get(f"{base_url}/api/cloud-backup", headers=auth_headers)
+        if not device_provisioned:
+            assert r.status_code == 409
+            return
+
+        assert r.status_code == 202
+        job = r.json()
+        assert r.headers["Location"] == f"/api/jobs/{job['id']}"
+        assert job["location"] == r.headers["Location"]
+
+        status = requests.get(f"{base_url}{r.headers['Location']}", headers=auth_headers)
+        assert status.status_code == 200
+        assert status.json()["type"] == "cloud-backup-restore"
+
+    def test_cloud_backup_restore_leaves_local_backup(self, base_url, auth_headers, device_provisioned):
+        if not device_provisioned:
+            pytest.skip("DEVICE_PROVISIONED is not true")
+
+        requests.put(f"{base_url}/backup", json=SAMPLE_BACKUP, headers=auth_headers)
+        before = requests.get(f"{base_url}/backup", headers=auth_headers)
+        assert before.status_code == 200
+
+        r = requests.get(f"{base_url}/api/cloud-backup", headers=auth_headers)
+        assert r.status_code == 202
+        state = _wait_for_job(base_url, auth_headers, r.json()["id"])
+        assert state in ("succeeded", "failed")
+
+        after = requests.get(f"{base_url}/backup", headers=auth_headers)
+        assert after.status_code == 200
+        assert after.json() == SAMPLE_BACKUP
+        assert after.headers["ETag"] == before.headers["ETag"]
+
+        staged = requests.get(f"{base_url}/api/cloud-backup/staged", headers=auth_headers)
+        assert staged.status_code == (200 if state == "succeeded" else 404)
+
+
+class TestCloudBackupStaged:
+    def test_staged_missing_auth_returns_401(self, base_url):
+        r = requests.get(f"{base_url}/api/cloud-backup/staged")
+        assert r.status_code == 401
+
+    def test_delete_staged_returns_204(self, base_url, auth_headers):
+        r = requests.delete(f"{base_url}/api/cloud-backup/staged", headers=auth_headers)
+        assert r.status_code == 204
+
+    def test_get_staged_after_delete_returns_404(self, base_url, auth_headers):
+        r = requests.get(f"{base_url}/api/cloud-backup/staged", headers=auth_headers)
+        assert r.status_code == 404
+
+    def test_post_staged_without_download_returns_404(self, base_url, auth_headers):
+        requests.put(f"{base_url}/backup", json=SAMPLE_BACKUP, headers=auth_headers)
+        r = requests.post(f"{base_url}/api/cloud-backup/staged", headers=auth_headers)
+        assert r.status_code == 404
+
+        backup = requests.get(f"{base_url}/backup", headers=auth_headers)
+        assert backup.status_code == 200
+        assert backup.json() == SAMPLE_BACKUP
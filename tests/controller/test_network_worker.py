@@ -0,0 +1,102 @@
+import os
+import re
+import socket
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+import requests
+import pytest
+
+
+# Runs against a controller built with -DFIREFLY_CLOUD_API_ROOT='"http://<this host>:<CLOUD_STANDIN_PORT>"'.
+# The stand-in below takes that port and holds every backup request for STALL_SECONDS.
+CLOUD_STANDIN_PORT = int(os.environ.get("CLOUD_STANDIN_PORT", "0"))
+STALL_SECONDS = 30
+
+pytestmark = pytest.mark.skipif(CLOUD_STANDIN_PORT == 0, reason="CLOUD_STANDIN_PORT is not set")
+
+BACKUP_PATH = re.compile(r"^/devices/[0-9A-Za-z-]+/backup$")
+
+
+class _StallingStandIn(BaseHTTPRequestHandler):
+    """Stalls cloud backup requests, and answers anything else with 404 straight away."""
+
+    def do_GET(self):
+        if BACKUP_PATH.match(self.path):
+            time.sleep(STALL_SECONDS)
+        try:
+            self.send_response(404)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+        except OSError:
+            pass  # The device gave up waiting
+
+    do_HEAD = do_GET
+
+    def log_message(self, format, *args):
+        pass
+
+
+@pytest.fixture(scope="module")
+def standin():
+    server = ThreadingHTTPServer(("0.0.0.0", CLOUD_STANDIN_PORT), _StallingStandIn)
+    server.daemon_threads = True
+    thread = threading.Thread(target=server.serve_forever, daemon=True)
+    thread.start()
+    yield server
+    server.shutdown()
+    server.server_close()
+
+
+@pytest.fixture(scope="module", autouse=True)
+def drop_staged_backup(base_url, auth_headers):
+    yield
+    requests.delete(f"{base_url}/api/cloud-backup/staged", headers=auth_headers)
+
+
+def _local_address(base_url):
+    """This machine's address on the route to the device."""
+    host = base_url.split("://", 1)[1]
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+        s.connect((host, 80))
+        return s.getsockname()[0]
+
+
+def _wait_for_state(job_url, auth_headers, states, timeout):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        state = requests.get(job_url, headers=auth_headers).json()["state"]
+        if state in states:
+            return state
+        time.sleep(0.5)
+    return "timeout"
+
+
+class TestNetworkWorker:
+    def test_loop_runs_while_cloud_request_stalls(self, base_url, auth_headers, device_provisioned, standin):
+        if not device_provisioned:
+            pytest.skip("cloud jobs need a provisioned device")
+
+        r = requests.get(f"{base_url}/api/cloud-backup", headers=auth_headers)
+        assert r.status_code == 202
+        job_url = f"{base_url}{r.headers['Location']}"
+        assert _wait_for_state(job_url, auth_headers, ("running",), 10) == "running"
+
+        # A forced update is taken off the queue by otaFirmware_checkPending() on the loop; until then
+        # every POST is refused with 409.  The stand-in 404s the image, so the update fails at once.
+        image = f"http://{_local_address(base_url)}:{CLOUD_STANDIN_PORT}/firmware/Controller.ino.bin"
+        r = requests.post(f"{base_url}/api/ota", json={"binaries": [{"partition": "app", "url": image}]}, headers=auth_headers)
+        assert r.status_code == 202
+
+        started = time.time()
+        while True:
+            probe = requests.post(f"{base_url}/api/ota", json={}, headers=auth_headers)
+            if probe.status_code != 409 or time.time() - started > 10:
+                break
+            time.sleep(0.25)
+
+        assert probe.status_code == 400, "the loop did not run the queued update while the cloud request stalled"
+        assert requests.get(job_url, headers=auth_headers).json()["state"] == "running"
+
+        assert _wait_for_state(job_url, auth_headers, ("succeeded", "failed"), STALL_SECONDS + 30) == "failed"
@@ -0,0 +1,71 @@
+import os
+import socket
+import time
+
+import requests
+import pytest
+
+
+# The sink is configured at boot from the device's own controller config.  To run these tests, give
+# that config a syslog object pointing at this machine, on SYSLOG_LISTEN_PORT, with "rate_limit": 5,
+# and restart the device before the test run.
+SYSLOG_LISTEN_PORT = int(os.environ.get("SYSLOG_LISTEN_PORT", "0"))
+
+pytestmark = pytest.mark.skipif(SYSLOG_LISTEN_PORT == 0, reason="SYSLOG_LISTEN_PORT is not set")
+
+
+@pytest.fixture(scope="module")
+def collector():
+    """UDP socket standing in for the syslog collector."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("0.0.0.0", SYSLOG_LISTEN_PORT))
+    sock.settimeout(0.5)
+    yield sock
+    sock.close()
+
+
+@pytest.fixture(scope="module", autouse=True)
+def restore_provisioning_state(base_url, auth_headers):
+    """Restore provisioning mode to its original state after tests complete."""
+    r = requests.get(f"{base_url}/api/provisioning", headers=auth_headers)
+    original_enabled = r.json().get("enabled", False) if r.status_code == 200 else False
+    yield
+    if original_enabled:
+        requests.put(f"{base_url}/api/provisioning", headers=auth_headers)
+    else:
+        requests.delete(f"{base_url}/api/provisioning", headers=auth_headers)
+
+
+def _receive(collector, seconds):
+    """Every datagram that arrives within seconds, decoded."""
+    deadline = time.time() + seconds
+    received = []
+    while time.time() < deadline:
+        try:
+            data, _ = collector.recvfrom(2048)
+            received.append(data.decode("utf-8", "replace"))
+        except socket.timeout:
+            pass
+    return received
+
+
+class TestSyslog:
+    def test_event_is_sent_to_collector(self, base_url, auth_headers, collector):
+        _receive(collector, 2)  # Let the rate limit refill and drop anything already queued
+        r = requests.put(f"{base_url}/api/provisioning", headers=auth_headers)
+        assert r.status_code == 204
+        datagrams = _receive(collector, 3)
+        assert any("Provisioning active" in d for d in datagrams)
+
+    def test_burst_is_rate_limited(self, base_url, auth_headers, collector):
+        _receive(collector, 2)
+        started = time.time()
+        for _ in range(20):
+            requests.delete(f"{base_url}/api/provisioning", headers=auth_headers)
+            requests.put(f"{base_url}/api/provisioning", headers=auth_headers)
+        elapsed = time.time() - started
+        datagrams = _receive(collector, 3)
+        assert any("syslog dropped" in d for d in datagrams)
+        # Five tokens to start with, then five a second
+        forwarded = sum(d.count("Provisioning") for d in datagrams)
+        assert 1 <= forwarded <= 5 + 5 * (elapsed + 1)
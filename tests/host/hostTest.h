@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdio>
+#include <vector>
+
+/**
+ * Minimal test runner for the host tests: each test file includes this once, declares its cases with
+ * HOST_TEST() and checks with CHECK().  The program exits non-zero if any check failed.
+ */
+
+struct _hostTestCase {
+    const char* name;
+    void (*run)();
+};
+
+inline std::vector<_hostTestCase>& _hostTestCases() {
+    static std::vector<_hostTestCase> cases;
+    return cases;
+}
+
+inline int _hostTestFailures = 0;
+
+struct _hostTestRegistration {
+    _hostTestRegistration(const char* name, void (*run)()) {
+        _hostTestCases().push_back({name, run});
+    }
+};
+
+#define HOST_TEST(name) \
+    static void name(); \
+    static _hostTestRegistration name##_registration(#name, name); \
+    static void name()
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            _hostTestFailures++; \
+        } \
+    } while (0)
+
+int main() {
+
+    for (const _hostTestCase& test : _hostTestCases()) {
+        int before = _hostTestFailures;
+        test.run();
+        printf("%-4s %s\n", _hostTestFailures == before ? "ok" : "FAIL", test.name);
+    }
+
+    return _hostTestFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+/**
+ * Just enough of the Arduino core for the common/ headers built by the host tests
+ */
+
+#ifdef HOST_TEST_LOG
+    #define _HOST_LOG(level, format, ...) fprintf(stderr, "[" level "] " format "\n", ##__VA_ARGS__)
+#else
+    #define _HOST_LOG(level, format, ...) do {} while (0)
+#endif
+
+#define log_e(format, ...) _HOST_LOG("E", format, ##__VA_ARGS__)
+#define log_w(format, ...) _HOST_LOG("W", format, ##__VA_ARGS__)
+#define log_i(format, ...) _HOST_LOG("I", format, ##__VA_ARGS__)
+#define log_d(format, ...) _HOST_LOG("D", format, ##__VA_ARGS__)
+
+inline bool psramFound() {
+    return false;
+}
+
+inline void* ps_malloc(size_t size) {
+    return malloc(size);
+}
+
+
+class String {
+
+public:
+
+    String() {}
+    String(const char* value) : _value(value != nullptr ? value : "") {}
+    String(const std::string& value) : _value(value) {}
+
+    const char* c_str() const { return _value.c_str(); }
+    unsigned int length() const { return (unsigned int)_value.size(); }
+
+    bool reserve(unsigned int size) {
+        _value.reserve(size);
+        return true;
+    }
+
+    bool concat(const char* value, unsigned int length) {
+        _value.append(value, length);
+        return true;
+    }
+
+    String& operator+=(const String& other) {
+        _value += other._value;
+        return *this;
+    }
+
+    bool operator==(const String& other) const { return _value == other._value; }
+
+private:
+
+    std::string _value;
+};
+
+inline String operator+(const String& a, const String& b) {
+    String result = a;
+    result += b;
+    return result;
+}
+
+
+class Print {
+
+public:
+
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t count = 0;
+        while (count < size && write(buffer[count]) == 1) count++;
+        return count;
+    }
+};
+
+
+class Stream : public Print {
+
+public:
+
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    virtual size_t readBytes(char* buffer, size_t length) {
+        size_t count = 0;
+        int c;
+        while (count < length && (c = read()) >= 0) buffer[count++] = (char)c;
+        return count;
+    }
+};
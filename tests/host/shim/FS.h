@@ -0,0 +1,110 @@
+#pragma once
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+/**
+ * In-memory stand-in for the Arduino FS: files are byte vectors keyed by path.  Copies of a File
+ * share one handle, position included, as they do on the device.
+ */
+namespace fs {
+
+class File {
+
+public:
+
+    File() {}
+
+    File(std::shared_ptr<std::vector<uint8_t>> data) : _handle(std::make_shared<_state>()) {
+        _handle->data = data;
+    }
+
+    explicit operator bool() const {
+        return _handle && _handle->data;
+    }
+
+    size_t read(uint8_t* buffer, size_t length) {
+        if (!*this) return 0;
+        std::vector<uint8_t>& data = *_handle->data;
+        size_t n = _handle->position < data.size() ? data.size() - _handle->position : 0;
+        if (n > length) n = length;
+        memcpy(buffer, data.data() + _handle->position, n);
+        _handle->position += n;
+        return n;
+    }
+
+    size_t write(const uint8_t* buffer, size_t length) {
+        if (!*this) return 0;
+        std::vector<uint8_t>& data = *_handle->data;
+        if (data.size() < _handle->position + length) data.resize(_handle->position + length);
+        memcpy(data.data() + _handle->position, buffer, length);
+        _handle->position += length;
+        return length;
+    }
+
+    bool seek(size_t position) {
+        if (!*this || position > _handle->data->size()) return false;
+        _handle->position = position;
+        return true;
+    }
+
+    size_t position() const { return *this ? _handle->position : 0; }
+    size_t size() const { return *this ? _handle->data->size() : 0; }
+    int available() const { return (int)(size() - position()); }
+
+    void close() {
+        if (_handle) _handle->data.reset();
+    }
+
+private:
+
+    struct _state {
+        std::shared_ptr<std::vector<uint8_t>> data;
+        size_t position = 0;
+    };
+
+    std::shared_ptr<_state> _handle;
+};
+
+
+class FS {
+
+public:
+
+    File open(const char* path, const char* mode = "r") {
+        if (mode[0] == 'w') {
+            _files[path] = std::make_shared<std::vector<uint8_t>>();
+        } else if (!exists(path)) {
+            return File();
+        }
+        return File(_files[path]);
+    }
+
+    bool exists(const char* path) const { return _files.count(path) > 0; }
+    bool exists(const String& path) const { return exists(path.c_str()); }
+
+    bool remove(const char* path) { return _files.erase(path) > 0; }
+
+    bool rename(const char* from, const char* to) {
+        if (!exists(from)) return false;
+        _files[to] = _files[from];
+        _files.erase(from);
+        return true;
+    }
+
+    /**
+     * The bytes of a file, for a test to inspect or tamper with
+     */
+    std::vector<uint8_t>& contents(const char* path) {
+        return *_files.at(path);
+    }
+
+private:
+
+    std::map<std::string, std::shared_ptr<std::vector<uint8_t>>> _files;
+};
+
+}
+
+using fs::File;
@@ -0,0 +1,30 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_sntp.h"
+
+/**
+ * Records how the SNTP service was started, so a host test can check it and deliver a sync itself
+ * through hostSntpConfig.sync_cb
+ */
+
+typedef struct {
+    const char* server;
+    esp_sntp_time_cb_t sync_cb;
+} esp_sntp_config_t;
+
+#define ESP_NETIF_SNTP_DEFAULT_CONFIG(server_name) { server_name, nullptr }
+
+inline esp_sntp_config_t hostSntpConfig = {};
+inline int hostSntpInits = 0;
+inline int hostSntpStarts = 0;
+
+inline esp_err_t esp_netif_sntp_init(const esp_sntp_config_t* config) {
+    hostSntpConfig = *config;
+    hostSntpInits++;
+    return ESP_OK;
+}
+
+inline esp_err_t esp_netif_sntp_start() {
+    hostSntpStarts++;
+    return ESP_OK;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+inline void esp_fill_random(void* buffer, size_t length) {
+    uint8_t* bytes = (uint8_t*)buffer;
+    for (size_t i = 0; i < length; i++) bytes[i] = (uint8_t)rand();
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <cstdint>
+#include <sys/time.h>
+
+typedef void (*esp_sntp_time_cb_t)(struct timeval* tv);
+
+inline uint32_t hostSntpSyncIntervalMillis = 0;
+
+inline void sntp_set_sync_interval(uint32_t intervalMillis) {
+    hostSntpSyncIntervalMillis = intervalMillis;
+}
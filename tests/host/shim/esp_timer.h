@@ -0,0 +1,9 @@
+#pragma once
+#include <cstdint>
+
+// Microseconds since boot; a host test moves time by setting hostTimerMicros
+inline int64_t hostTimerMicros = 0;
+
+inline int64_t esp_timer_get_time() {
+    return hostTimerMicros;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "FreeRTOS.h"
+#include "task.h"
+
+/**
+ * Mutexes that record their holder.  With a single task, taking a held mutex could never succeed,
+ * so it fails at once instead of blocking.
+ */
+struct _hostMutex {
+    TaskHandle_t holder = nullptr;
+};
+
+typedef _hostMutex* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return new _hostMutex();
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t) {
+    if (mutex->holder != nullptr) return pdFALSE;
+    mutex->holder = xTaskGetCurrentTaskHandle();
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex) {
+    if (mutex->holder == nullptr) return pdFALSE;
+    mutex->holder = nullptr;
+    return pdTRUE;
+}
+
+inline TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t mutex) {
+    return mutex->holder;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "FreeRTOS.h"
+
+typedef void* TaskHandle_t;
+
+/**
+ * Everything on the host runs as one task
+ */
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+    static int task;
+    return &task;
+}
+
+inline void vTaskDelay(TickType_t) {}
@@ -0,0 +1,4 @@
+#pragma once
+
+// The ESP32 ROM carries miniz's tdefl and tinfl; the host tests link a miniz build instead
+#include <miniz.h>
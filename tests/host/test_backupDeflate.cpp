@@ -0,0 +1,274 @@
+#include "hostTest.h"
+#include "common/secretEncryption.h"
+
+/**
+ * BackupDeflater and BackupInflater against a real miniz, on their own and inside the version 0x03
+ * backup payload, including the fall back to an uncompressed version 0x02 payload when deflating
+ * does not make the backup smaller.
+ */
+
+static const uint8_t kMasterKey[32] = { 0x42 };
+
+static SecretEncryption& encryption() {
+    static SecretEncryption instance;
+    if (!instance.isReady()) instance.begin(kMasterKey, sizeof(kMasterKey));
+    return instance;
+}
+
+/**
+ * Backup-shaped JSON: repetitive, so it deflates well, and long enough to wrap the inflate window
+ */
+static std::vector<uint8_t> backupJson(size_t records) {
+
+    std::string json = "{\"controllers\":[";
+    for (size_t i = 0; i < records; i++) {
+        char record[128];
+        snprintf(record, sizeof(record), "%s{\"uuid\":\"%08zx-0000-4000-8000-%012zx\",\"name\":\"Relay %zu\",\"pin\":%zu}",
+                 i == 0 ? "" : ",", i * 2654435761u, i, i, i % 40);
+        json += record;
+    }
+    json += "]}";
+
+    return std::vector<uint8_t>(json.begin(), json.end());
+}
+
+static std::vector<uint8_t> noise(size_t length) {
+    std::vector<uint8_t> data(length);
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < length; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        data[i] = (uint8_t)x;
+    }
+    return data;
+}
+
+static File storedFile(fs::FS& fs, const std::vector<uint8_t>& data) {
+    File file = fs.open("/backup.json", "w");
+    file.write(data.data(), data.size());
+    file.seek(0);
+    return file;
+}
+
+static std::vector<uint8_t> deflate(fs::FS& fs, const std::vector<uint8_t>& data) {
+
+    File file = storedFile(fs, data);
+    BackupDeflater deflater;
+    uint8_t scratch[700];
+    std::vector<uint8_t> out;
+
+    bool ok = deflater.deflateFile(file, scratch, sizeof(scratch), [&](uint8_t* piece, size_t length){
+        out.insert(out.end(), piece, piece + length);
+        return true;
+    });
+
+    return ok ? out : std::vector<uint8_t>();
+}
+
+/**
+ * Inflates stream fed in pieces of the given size
+ * @returns true if the stream was complete and valid
+ */
+static bool inflate(const std::vector<uint8_t>& stream, size_t piece, std::vector<uint8_t>& out) {
+
+    BackupInflater inflater;
+    if (!inflater.begin()) return false;
+
+    out.clear();
+    for (size_t i = 0; i < stream.size(); i += piece) {
+        size_t n = stream.size() - i < piece ? stream.size() - i : piece;
+        bool ok = inflater.update(stream.data() + i, n, [&](const uint8_t* data, size_t length){
+            out.insert(out.end(), data, data + length);
+            return true;
+        });
+        if (!ok) return false;
+    }
+
+    return inflater.isComplete();
+}
+
+/**
+ * Builds a backup payload the way cloudBackup_performUpload() does: sized with sizeFile(), version
+ * 0x03 with the inflated length and deflate stream if that pays, otherwise version 0x02
+ */
+static std::vector<uint8_t> encryptBackup(fs::FS& fs, const std::vector<uint8_t>& data) {
+
+    File file = storedFile(fs, data);
+    uint8_t scratch[512];
+
+    size_t payloadLength = data.size();
+    BackupDeflater deflater;
+    bool deflated = deflater.sizeFile(file, scratch, sizeof(scratch), payloadLength);
+
+    BackupEncryptor encryptor;
+    if (!encryption().openBackupEncryptor(payloadLength, encryptor, deflated)) return {};
+
+    std::vector<uint8_t> blob(encryptor.header(), encryptor.header() + 37);
+    auto send = [&](uint8_t* piece, size_t length){
+        if (!encryptor.update(piece, length)) return false;
+        blob.insert(blob.end(), piece, piece + length);
+        return true;
+    };
+
+    bool ok;
+    if (deflated) {
+        uint8_t inflatedLength[4];
+        uint32_t length32 = (uint32_t)data.size();
+        memcpy(inflatedLength, &length32, sizeof(inflatedLength));
+        ok = send(inflatedLength, sizeof(inflatedLength))
+          && deflater.deflateFile(file, scratch, sizeof(scratch), send);
+    } else {
+        size_t n;
+        ok = true;
+        while (ok && (n = file.read(scratch, sizeof(scratch))) > 0) ok = send(scratch, n);
+    }
+
+    uint8_t tag[16];
+    if (!ok || !encryptor.finish(tag)) return {};
+    blob.insert(blob.end(), tag, tag + sizeof(tag));
+    return blob;
+}
+
+static bool decryptBackup(const std::vector<uint8_t>& blob, std::vector<uint8_t>& out, size_t maxPlaintextLength = SIZE_MAX) {
+
+    BackupDecryptor decryptor;
+    if (!encryption().openBackupDecryptor(decryptor, maxPlaintextLength)) return false;
+
+    std::vector<uint8_t> copy = blob;
+    out.clear();
+
+    for (size_t i = 0; i < copy.size(); i += 300) {
+        size_t n = copy.size() - i < 300 ? copy.size() - i : 300;
+        bool ok = decryptor.update(copy.data() + i, n, [&](const uint8_t* data, size_t length){
+            out.insert(out.end(), data, data + length);
+            return true;
+        });
+        if (!ok) return false;
+    }
+
+    return decryptor.finish();
+}
+
+
+HOST_TEST(deflate_round_trips_in_any_pieces) {
+
+    for (size_t records : { (size_t)1, (size_t)20, (size_t)2000 }) {
+        fs::FS fs;
+        std::vector<uint8_t> data = backupJson(records);
+        std::vector<uint8_t> stream = deflate(fs, data);
+        CHECK(!stream.empty());
+
+        for (size_t piece : { (size_t)1, (size_t)333, stream.size() }) {
+            std::vector<uint8_t> out;
+            CHECK(inflate(stream, piece, out));
+            CHECK(out == data);
+        }
+    }
+
+    // Larger than the inflate window, so the output wraps it
+    CHECK(backupJson(2000).size() > TINFL_LZ_DICT_SIZE);
+}
+
+HOST_TEST(deflate_is_deterministic) {
+    fs::FS fs;
+    std::vector<uint8_t> data = backupJson(500);
+    CHECK(deflate(fs, data) == deflate(fs, data));
+}
+
+HOST_TEST(size_file_reports_payload_and_rewinds) {
+
+    fs::FS fs;
+    std::vector<uint8_t> data = backupJson(500);
+    File file = storedFile(fs, data);
+    uint8_t scratch[512];
+
+    size_t payloadLength = data.size();
+    BackupDeflater deflater;
+    CHECK(deflater.sizeFile(file, scratch, sizeof(scratch), payloadLength));
+    CHECK(payloadLength == 4 + deflate(fs, data).size());
+    CHECK(payloadLength < data.size());
+    CHECK(file.position() == 0);
+}
+
+HOST_TEST(size_file_declines_what_does_not_shrink) {
+
+    uint8_t scratch[512];
+    BackupDeflater deflater;
+
+    for (size_t length : { (size_t)0, (size_t)3, (size_t)4000 }) {
+        fs::FS fs;
+        File file = storedFile(fs, noise(length));
+        size_t payloadLength = length;
+        CHECK(!deflater.sizeFile(file, scratch, sizeof(scratch), payloadLength));
+        CHECK(payloadLength == length);
+        CHECK(file.position() == 0);
+    }
+}
+
+HOST_TEST(compressible_backup_round_trips_as_version_3) {
+
+    fs::FS fs;
+    std::vector<uint8_t> data = backupJson(2000);
+    std::vector<uint8_t> blob = encryptBackup(fs, data);
+    CHECK(blob.size() > 37 && blob[4] == 0x03);
+    CHECK(blob.size() < SecretEncryption::backupBlobLength(data.size()));
+
+    std::vector<uint8_t> out;
+    CHECK(decryptBackup(blob, out));
+    CHECK(out == data);
+
+    // The limit applies to the inflated length, not the compressed payload
+    CHECK(!decryptBackup(blob, out, data.size() - 1));
+    CHECK(decryptBackup(blob, out, data.size()));
+}
+
+HOST_TEST(incompressible_backup_falls_back_to_version_2) {
+
+    fs::FS fs;
+    std::vector<uint8_t> data = noise(4000);
+    std::vector<uint8_t> blob = encryptBackup(fs, data);
+    CHECK(blob.size() == SecretEncryption::backupBlobLength(data.size()));
+    CHECK(blob[4] == 0x02);
+
+    std::vector<uint8_t> out;
+    CHECK(decryptBackup(blob, out));
+    CHECK(out == data);
+}
+
+HOST_TEST(truncated_deflate_stream_is_refused) {
+
+    fs::FS fs;
+    std::vector<uint8_t> data = backupJson(200);
+    std::vector<uint8_t> stream = deflate(fs, data);
+    std::vector<uint8_t> out;
+
+    std::vector<uint8_t> truncated(stream.begin(), stream.end() - 10);
+    CHECK(!inflate(truncated, 64, out));
+
+    // Authentic, but the deflate stream inside stops short of the inflated length it records
+    BackupEncryptor encryptor;
+    CHECK(encryption().openBackupEncryptor(4 + truncated.size(), encryptor, true));
+    std::vector<uint8_t> blob(encryptor.header(), encryptor.header() + 37);
+    uint32_t length32 = (uint32_t)data.size();
+    std::vector<uint8_t> payload((uint8_t*)&length32, (uint8_t*)&length32 + 4);
+    payload.insert(payload.end(), truncated.begin(), truncated.end());
+    CHECK(encryptor.update(payload.data(), payload.size()));
+    blob.insert(blob.end(), payload.begin(), payload.end());
+    uint8_t tag[16];
+    CHECK(encryptor.finish(tag));
+    blob.insert(blob.end(), tag, tag + sizeof(tag));
+
+    CHECK(!decryptBackup(blob, out));
+}
+
+HOST_TEST(corrupt_deflate_stream_is_refused) {
+
+    std::vector<uint8_t> garbage(64, 0xff);
+    std::vector<uint8_t> out;
+    CHECK(!inflate(garbage, 64, out));
+
+    // Bytes after the end of a complete stream
+    fs::FS fs;
+    std::vector<uint8_t> stream = deflate(fs, backupJson(10));
+    stream.push_back(0);
+    CHECK(!inflate(stream, stream.size(), out));
+}
@@ -0,0 +1,41 @@
+#include "hostTest.h"
+#include "common/httpEtag.h"
+
+/**
+ * If-None-Match matching shared by the /backup and /firmware handlers.
+ */
+
+static const char* ETAG = "a3f1c2d4";
+
+
+HOST_TEST(missing_header_or_etag_never_matches) {
+
+    CHECK(!http_etagMatches(nullptr, ETAG));
+    CHECK(!http_etagMatches("", ETAG));
+    CHECK(!http_etagMatches("*", ""));
+    CHECK(!http_etagMatches("\"\"", ""));
+}
+
+
+HOST_TEST(strong_weak_and_wildcard_match) {
+
+    CHECK(http_etagMatches("\"a3f1c2d4\"", ETAG));
+    CHECK(http_etagMatches("W/\"a3f1c2d4\"", ETAG));
+    CHECK(http_etagMatches("*", ETAG));
+}
+
+
+HOST_TEST(list_is_searched) {
+
+    CHECK(http_etagMatches("\"0000\", W/\"a3f1c2d4\"", ETAG));
+    CHECK(http_etagMatches("\"0000\",\"a3f1c2d4\"", ETAG));
+    CHECK(!http_etagMatches("\"0000\", \"1111\"", ETAG));
+}
+
+
+HOST_TEST(prefix_and_unquoted_values_do_not_match) {
+
+    CHECK(!http_etagMatches("\"a3f1c2d4ff\"", ETAG));
+    CHECK(!http_etagMatches("\"a3f1\"", ETAG));
+    CHECK(!http_etagMatches("a3f1c2d4", ETAG));
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include "hostTest.h"
+#include "common/secretEncryption.h"
+
+/**
+ * Round trips through SecretEncryption's streaming paths with real AES-GCM: config-fs files
+ * (version 0x01, EncryptWriter and DecryptStream) and cloud backup payloads (version 0x02,
+ * BackupEncryptor and BackupDecryptor), at sizes either side of the chunk boundaries.
+ */
+
+static const uint8_t kMasterKey[32] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+};
+
+static const size_t kChunk = SECRET_ENCRYPTION_STREAM_CHUNK_SIZE;
+static const size_t kSizes[] = { 0, 1, kChunk - 1, kChunk, kChunk + 1, 3 * kChunk, 3 * kChunk + 17 };
+
+static std::vector<uint8_t> pattern(size_t length) {
+    std::vector<uint8_t> data(length);
+    for (size_t i = 0; i < length; i++) data[i] = (uint8_t)(i * 31 + (i >> 8));
+    return data;
+}
+
+static SecretEncryption& encryption() {
+    static SecretEncryption instance;
+    if (!instance.isReady()) instance.begin(kMasterKey, sizeof(kMasterKey));
+    return instance;
+}
+
+/**
+ * Writes data through an EncryptWriter in 100-byte pieces, so staging crosses its chunk boundary
+ */
+static bool writeFile(fs::FS& fs, const char* path, const std::vector<uint8_t>& data) {
+
+    EncryptWriter writer;
+    if (!encryption().openEncryptWriter(fs, path, writer)) return false;
+
+    for (size_t i = 0; i < data.size(); i += 100) {
+        size_t n = data.size() - i < 100 ? data.size() - i : 100;
+        if (writer.write(data.data() + i, n) != n) return false;
+    }
+
+    return writer.commit();
+}
+
+/**
+ * Reads a whole DecryptStream, alternating read() and 7-byte readBytes() so reads straddle chunks
+ */
+static std::vector<uint8_t> readStream(DecryptStream& stream) {
+
+    std::vector<uint8_t> out;
+    char piece[7];
+
+    for (;;) {
+        int c = stream.read();
+        if (c < 0) break;
+        out.push_back((uint8_t)c);
+
+        size_t n = stream.readBytes(piece, sizeof(piece));
+        out.insert(out.end(), piece, piece + n);
+    }
+
+    return out;
+}
+
+/**
+ * Encrypts data as a version 0x02 backup payload: header, ciphertext, tag
+ */
+static std::vector<uint8_t> encryptBackup(const std::vector<uint8_t>& data) {
+
+    BackupEncryptor encryptor;
+    if (!encryption().openBackupEncryptor(data.size(), encryptor)) return {};
+
+    std::vector<uint8_t> blob(encryptor.header(), encryptor.header() + 37);
+    std::vector<uint8_t> body = data;
+
+    for (size_t i = 0; i < body.size(); i += kChunk) {
+        size_t n = body.size() - i < kChunk ? body.size() - i : kChunk;
+        if (!encryptor.update(body.data() + i, n)) return {};
+    }
+    blob.insert(blob.end(), body.begin(), body.end());
+
+    uint8_t tag[16];
+    if (!encryptor.finish(tag)) return {};
+    blob.insert(blob.end(), tag, tag + sizeof(tag));
+
+    return blob;
+}
+
+/**
+ * Feeds blob to a BackupDecryptor in pieces of the given size
+ * @returns true if finish() authenticated the payload
+ */
+static bool decryptBackup(std::vector<uint8_t> blob, size_t piece, std::vector<uint8_t>& out) {
+
+    BackupDecryptor decryptor;
+    if (!encryption().openBackupDecryptor(decryptor)) return false;
+
+    out.clear();
+    for (size_t i = 0; i < blob.size(); i += piece) {
+        size_t n = blob.size() - i < piece ? blob.size() - i : piece;
+        bool ok = decryptor.update(blob.data() + i, n, [&](const uint8_t* data, size_t length){
+            out.insert(out.end(), data, data + length);
+            return true;
+        });
+        if (!ok) return false;
+    }
+
+    return decryptor.finish();
+}
+
+
+HOST_TEST(file_round_trips_across_chunk_boundaries) {
+
+    for (size_t size : kSizes) {
+        fs::FS fs;
+        std::vector<uint8_t> data = pattern(size);
+        CHECK(writeFile(fs, "/secret", data));
+        CHECK(fs.contents("/secret").size() == 37 + size);
+        CHECK(!fs.exists(SECRET_ENCRYPTION_TEMP_PATH));
+
+        DecryptStream stream;
+        CHECK(encryption().openDecryptStream(fs, "/secret", stream));
+        CHECK(stream.size() == size);
+        CHECK(stream.available() == (int)size);
+        CHECK(readStream(stream) == data);
+        CHECK(!stream.failed());
+        CHECK(stream.available() == 0);
+    }
+}
+
+HOST_TEST(file_decrypts_to_string) {
+
+    fs::FS fs;
+    std::vector<uint8_t> data = pattern(2 * kChunk + 5);
+    CHECK(writeFile(fs, "/secret", data));
+
+    String plaintext;
+    CHECK(encryption().decryptFromFile(fs, "/secret", plaintext));
+    CHECK(plaintext.length() == data.size());
+    CHECK(memcmp(plaintext.c_str(), data.data(), data.size()) == 0);
+}
+
+HOST_TEST(file_with_altered_ciphertext_or_tag_is_refused) {
+
+    fs::FS fs;
+    std::vector<uint8_t> data = pattern(kChunk + 1);
+    CHECK(writeFile(fs, "/secret", data));
+    std::vector<uint8_t> original = fs.contents("/secret");
+
+    // Last ciphertext byte, in the second chunk
+    fs.contents("/secret").back() ^= 0x01;
+    DecryptStream stream;
+    CHECK(!encryption().openDecryptStream(fs, "/secret", stream));
+
+    // First tag byte
+    fs.contents("/secret") = original;
+    fs.contents("/secret")[21] ^= 0x80;
+    CHECK(!encryption().openDecryptStream(fs, "/secret", stream));
+
+    // Nonce
+    fs.contents("/secret") = original;
+    fs.contents("/secret")[5] ^= 0x01;
+    CHECK(!encryption().openDecryptStream(fs, "/secret", stream));
+
+    // A refused open leaves the lock free
+    fs.contents("/secret") = original;
+    CHECK(encryption().openDecryptStream(fs, "/secret", stream));
+    CHECK(readStream(stream) == data);
+}
+
+HOST_TEST(truncated_file_is_refused) {
+
+    fs::FS fs;
+    std::vector<uint8_t> data = pattern(kChunk + 1);
+    CHECK(writeFile(fs, "/secret", data));
+    std::vector<uint8_t> original = fs.contents("/secret");
+
+    DecryptStream stream;
+
+    fs.contents("/secret").pop_back();
+    CHECK(!encryption().openDecryptStream(fs, "/secret", stream));
+
+    fs.contents("/secret").resize(20);
+    CHECK(!encryption().openDecryptStream(fs, "/secret", stream));
+
+    fs.contents("/secret").clear();
+    CHECK(!encryption().openDecryptStream(fs, "/secret", stream));
+
+    String plaintext;
+    CHECK(!encryption().decryptFromFile(fs, "/secret", plaintext));
+    CHECK(plaintext.length() == 0);
+}
+
+HOST_TEST(nested_open_is_refused) {
+
+    fs::FS fs;
+    std::vector<uint8_t> first = pattern(kChunk + 3);
+    std::vector<uint8_t> second = pattern(10);
+    CHECK(writeFile(fs, "/first", first));
+    CHECK(writeFile(fs, "/second", second));
+
+    DecryptStream outer;
+    CHECK(encryption().openDecryptStream(fs, "/first", outer));
+    CHECK(outer.read() == first[0]);
+
+    DecryptStream inner;
+    CHECK(!encryption().openDecryptStream(fs, "/second", inner));
+
+    EncryptWriter writer;
+    CHECK(!encryption().openEncryptWriter(fs, "/second", writer));
+
+    // The outer stream's GCM state was not restarted
+    std::vector<uint8_t> rest = readStream(outer);
+    CHECK(rest.size() == first.size() - 1);
+    CHECK(std::equal(rest.begin(), rest.end(), first.begin() + 1));
+    CHECK(!outer.failed());
+    outer.close();
+
+    CHECK(encryption().openDecryptStream(fs, "/second", inner));
+    CHECK(readStream(inner) == second);
+}
+
+HOST_TEST(backup_round_trips_in_any_pieces) {
+
+    for (size_t size : kSizes) {
+        std::vector<uint8_t> data = pattern(size);
+        std::vector<uint8_t> blob = encryptBackup(data);
+        CHECK(blob.size() == SecretEncryption::backupBlobLength(size));
+        CHECK(blob[4] == 0x02);
+
+        for (size_t piece : { (size_t)1, (size_t)37, (size_t)100, kChunk + 1, blob.size() }) {
+            std::vector<uint8_t> out;
+            CHECK(decryptBackup(blob, piece, out));
+            CHECK(out == data);
+        }
+    }
+}
+
+HOST_TEST(backup_with_altered_tag_or_ciphertext_is_refused) {
+
+    std::vector<uint8_t> data = pattern(kChunk + 1);
+    std::vector<uint8_t> blob = encryptBackup(data);
+    std::vector<uint8_t> out;
+
+    std::vector<uint8_t> badTag = blob;
+    badTag.back() ^= 0x01;
+    CHECK(!decryptBackup(badTag, 64, out));
+
+    std::vector<uint8_t> badBody = blob;
+    badBody[37 + kChunk] ^= 0x01;
+    CHECK(!decryptBackup(badBody, 64, out));
+
+    CHECK(decryptBackup(blob, 64, out));
+}
+
+HOST_TEST(truncated_backup_is_refused) {
+
+    std::vector<uint8_t> data = pattern(kChunk + 1);
+    std::vector<uint8_t> blob = encryptBackup(data);
+    std::vector<uint8_t> out;
+
+    for (size_t length : { blob.size() - 1, blob.size() - 16, (size_t)37, (size_t)36 }) {
+        std::vector<uint8_t> truncated(blob.begin(), blob.begin() + length);
+        CHECK(!decryptBackup(truncated, 64, out));
+    }
+
+    // Bytes after the tag are refused too
+    std::vector<uint8_t> extended = blob;
+    extended.push_back(0);
+    CHECK(!decryptBackup(extended, 64, out));
+}
@@ -0,0 +1,113 @@
+#include "hostTest.h"
+#include "common/sntpClock.h"
+
+/**
+ * SntpClock read through the EpochClock interface, with esp_timer and the SNTP service replaced by
+ * the fakes in shim/: the sync callback is delivered by the test and time moves only when it says so.
+ */
+
+static void sync(int64_t epochSeconds, int64_t micros) {
+    struct timeval tv = { (time_t)epochSeconds, (suseconds_t)micros };
+    hostSntpConfig.sync_cb(&tv);
+}
+
+static void resetService() {
+    hostSntpConfig = {};
+    hostSntpInits = 0;
+    hostSntpStarts = 0;
+    hostTimerMicros = 0;
+}
+
+
+HOST_TEST(epoch_is_sync_time_plus_elapsed_timer) {
+
+    resetService();
+    SntpClock sntp;
+    EpochClock& clock = sntp;
+
+    hostTimerMicros = 5000000;
+    CHECK(sntp.begin("ntp.example"));
+    CHECK(hostSntpInits == 1);
+    CHECK(strcmp(hostSntpConfig.server, "ntp.example") == 0);
+    CHECK(hostSntpSyncIntervalMillis == SNTP_CLOCK_SYNC_INTERVAL_SECONDS * 1000UL);
+    CHECK(!clock.isTimeSet());
+
+    hostTimerMicros = 7250000;
+    sync(1700000000, 500000);
+    CHECK(clock.isTimeSet());
+    CHECK(clock.getEpochTime() == 1700000000UL);
+    CHECK(sntp.epochMicros() == 1700000000500000LL);
+
+    // Only esp_timer moves the clock between syncs
+    hostTimerMicros += 499999;
+    CHECK(clock.getEpochTime() == 1700000000UL);
+    hostTimerMicros += 1;
+    CHECK(clock.getEpochTime() == 1700000001UL);
+    hostTimerMicros += 3600LL * 1000000LL;
+    CHECK(clock.getEpochTime() == 1700003601UL);
+}
+
+HOST_TEST(reads_never_go_back_between_syncs) {
+
+    resetService();
+    SntpClock sntp;
+    EpochClock& clock = sntp;
+    CHECK(sntp.begin());
+
+    sync(1700000000, 0);
+
+    unsigned long previous = clock.getEpochTime();
+    for (int i = 0; i < 10000; i++) {
+        hostTimerMicros += 997;
+        unsigned long now = clock.getEpochTime();
+        CHECK(now >= previous);
+        previous = now;
+    }
+    CHECK(previous == 1700000000UL + (unsigned long)(10000 * 997 / 1000000));
+}
+
+HOST_TEST(resync_replaces_offset) {
+
+    resetService();
+    SntpClock sntp;
+    EpochClock& clock = sntp;
+    CHECK(sntp.begin());
+
+    hostTimerMicros = 1000000;
+    sync(1700000000, 0);
+    hostTimerMicros = 11000000;
+    CHECK(clock.getEpochTime() == 1700000010UL);
+
+    // The server says 2 s less than the drifted clock; the next read follows the server
+    sync(1700000008, 0);
+    CHECK(clock.getEpochTime() == 1700000008UL);
+    hostTimerMicros += 2000000;
+    CHECK(clock.getEpochTime() == 1700000010UL);
+
+    // A callback without a time changes nothing
+    hostSntpConfig.sync_cb(nullptr);
+    CHECK(clock.getEpochTime() == 1700000010UL);
+}
+
+HOST_TEST(request_sync_starts_service_when_begin_was_missed) {
+
+    resetService();
+    SntpClock sntp;
+    EpochClock& clock = sntp;
+
+    sntp.requestSync();
+    CHECK(hostSntpInits == 1);
+    CHECK(hostSntpStarts == 0);
+    CHECK(strcmp(hostSntpConfig.server, SNTP_CLOCK_SERVER) == 0);
+
+    sntp.requestSync();
+    CHECK(hostSntpInits == 1);
+    CHECK(hostSntpStarts == 1);
+
+    CHECK(sntp.begin());
+    CHECK(hostSntpInits == 1);
+
+    CHECK(!clock.isTimeSet());
+    sync(1700000000, 0);
+    CHECK(clock.isTimeSet());
+}
@@ -69,3 +69,32 @@ class TestFirmware:
             raise AssertionError("Never received a 200 to seed the cache")
         r2 = requests.get(f"{base_url}/api/firmware", headers=auth_headers)
         assert r2.status_code == 200
+
+    def test_get_firmware_lists_at_most_five(self, base_url, auth_headers):
+        deadline = time.time() + 15
+        body = None
+        while time.time() < deadline:
+            r = requests.get(f"{base_url}/api/firmware", headers=auth_headers)
+            if r.status_code == 200:
+                body = r.json()
+                break
+            time.sleep(1)
+        assert body is not None, "Never received a 200 response"
+        assert len(body["versions"]) <= 5
+
+    def test_get_firmware_etag_returns_304(self, base_url, auth_headers):
+        deadline = time.time() + 15
+        while time.time() < deadline:
+            r = requests.get(f"{base_url}/api/firmware", headers=auth_headers)
+            if r.status_code == 200:
+                break
+            time.sleep(1)
+        else:
+            raise AssertionError("Never received a 200 to seed the cache")
+        etag = r.headers.get("ETag")
+        assert etag is not None
+        r2 = requests.get(f"{base_url}/api/firmware", headers={**auth_headers, "If-None-Match": etag})
+        # The ETag is the SHA-256 of the list, so a background refresh of an unchanged catalogue keeps it
+        assert r2.status_code == 304
+        assert r2.headers["ETag"] == etag
+        assert r2.content == b""